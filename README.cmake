@@ -5,3 +5,37 @@ The CMake files included in the fswatch source distribution are provided as-is,
 in the hope that they will be useful, but **are not** guaranteed to work.  No
 bug report related to these files will be considered by the authors.
 
+
+Benchmarks
+----------
+
+The CMake build includes `fswatch_benchmark`, a set of microbenchmarks of the
+event pipeline: path filtering, event notification, marshalling of the events
+of the C API, record formatting and the scans of the poll monitor.  Build it
+with optimizations enabled and run it through the `benchmark` target:
+
+    $ cmake -DCMAKE_BUILD_TYPE=Release -S . -B build
+    $ cmake --build build --target benchmark
+
+Every benchmark prints a tab-separated line with its name, the number of items
+it processes, the number of repetitions, and the median and minimum time per
+item in nanoseconds.  Inputs are generated from a fixed seed, so that the
+output of two builds can be compared line by line.
+
+The poll monitor benchmarks create trees of 10,000 and 100,000 files in `/tmp`.
+Larger trees can be requested with `--poll-sizes`, for example
+`--poll-sizes=1000000,10000000`, provided there are enough free inodes.
+Run `fswatch_benchmark --help` for the other options.
+
+`fswatch_load` measures every available monitor end to end.  It performs
+creations, writes, renames, deletions and creations in a deep tree in a
+temporary directory at increasing rates, and prints, for each rate, the
+mutations which were lost and the 50th, 99th and 99.9th percentiles of the time
+elapsed between a mutation and its event.  The ladder of a monitor stops at the
+first rate at which mutations are lost or the monitor overflows:
+
+    $ build/test/benchmark/fswatch_load --monitor=inotify_monitor --latency=0.01
+
+Mutations reverted within the same scan, such as a file renamed back and forth,
+are lost by design by the poll monitor.  Run `fswatch_load --help` for the
+other options.
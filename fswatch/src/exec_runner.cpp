@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+#include "exec_runner.hpp"
+
+#ifdef HAVE_CXX_MUTEX
+
+#  include <cstring>
+#  include <iostream>
+#  include <spawn.h>
+#  include <sys/wait.h>
+#  include "gettext.h"
+#  include "libfswatch/c/libfswatch_log.h"
+
+#  define _(String) gettext(String)
+
+extern char **environ;
+
+using namespace fsw;
+using std::chrono::steady_clock;
+
+exec_runner::exec_runner(std::vector<std::string> command,
+                         bool per_path,
+                         unsigned int jobs,
+                         double debounce) :
+  command(std::move(command)),
+  per_path(per_path),
+  jobs(jobs),
+  debounce(std::chrono::duration_cast<steady_clock::duration>(
+    std::chrono::duration<double>(debounce)))
+{
+  runner_thread = std::thread(&exec_runner::run, this);
+}
+
+exec_runner::~exec_runner()
+{
+  {
+    std::lock_guard<std::mutex> lock(runner_mutex);
+    stopping = true;
+  }
+
+  runner_cond.notify_one();
+  runner_thread.join();
+}
+
+bool exec_runner::split_command(const std::string& command,
+                                std::vector<std::string>& args)
+{
+  std::string arg;
+  bool in_arg = false;
+  char quote = '\0';
+
+  args.clear();
+
+  for (size_t i = 0; i < command.size(); ++i)
+  {
+    const char c = command[i];
+
+    if (quote == '\'')
+    {
+      if (c == '\'') quote = '\0';
+      else arg += c;
+      continue;
+    }
+
+    if (c == '\\' && i + 1 < command.size())
+    {
+      arg += command[++i];
+      in_arg = true;
+      continue;
+    }
+
+    if (quote == '"')
+    {
+      if (c == '"') quote = '\0';
+      else arg += c;
+      continue;
+    }
+
+    if (c == '\'' || c == '"')
+    {
+      quote = c;
+      in_arg = true;
+    }
+    else if (c == ' ' || c == '\t' || c == '\n')
+    {
+      if (in_arg) args.push_back(arg);
+      arg.clear();
+      in_arg = false;
+    }
+    else
+    {
+      arg += c;
+      in_arg = true;
+    }
+  }
+
+  if (quote) return false;
+  if (in_arg) args.push_back(arg);
+
+  return !args.empty();
+}
+
+void exec_runner::submit(const std::vector<event>& events)
+{
+  {
+    std::lock_guard<std::mutex> lock(runner_mutex);
+    const time_point deadline = steady_clock::now() + debounce;
+
+    if (!per_path)
+    {
+      schedule("", deadline);
+    }
+    else
+    {
+      for (const event& evt : events)
+      {
+        if (!evt.get_path().empty()) schedule(evt.get_path(), deadline);
+      }
+    }
+  }
+
+  runner_cond.notify_one();
+}
+
+void exec_runner::schedule(const std::string& key, time_point deadline)
+{
+  if (running.find(key) != running.end())
+  {
+    rerun.insert(key);
+    return;
+  }
+
+  // Restart the debounce window of the queued run, if any.
+  auto it = deadlines.find(key);
+
+  if (it != deadlines.end())
+  {
+    queue.erase(std::make_pair(it->second, key));
+    it->second = deadline;
+  }
+  else
+  {
+    deadlines[key] = deadline;
+  }
+
+  queue.insert(std::make_pair(deadline, key));
+}
+
+void exec_runner::spawn(const std::string& key)
+{
+  std::vector<std::string> args(command);
+
+  if (per_path)
+  {
+    bool substituted = false;
+
+    for (std::string& arg : args)
+    {
+      for (size_t pos = arg.find("{}");
+           pos != std::string::npos;
+           pos = arg.find("{}", pos + key.size()))
+      {
+        arg.replace(pos, 2, key);
+        substituted = true;
+      }
+    }
+
+    if (!substituted) args.push_back(key);
+  }
+
+  std::vector<char *> argv;
+  for (std::string& arg : args) argv.push_back(&arg[0]);
+  argv.push_back(nullptr);
+
+  pid_t pid;
+  const int error = posix_spawnp(&pid,
+                                 argv[0],
+                                 nullptr,
+                                 nullptr,
+                                 argv.data(),
+                                 environ);
+
+  if (error)
+  {
+    std::cerr << _("Cannot execute ") << argv[0] << ": " << strerror(error)
+              << std::endl;
+    return;
+  }
+
+  children[pid] = key;
+  running.insert(key);
+}
+
+void exec_runner::reap_children()
+{
+  for (auto it = children.begin(); it != children.end();)
+  {
+    int status;
+    const pid_t pid = waitpid(it->first, &status, WNOHANG);
+
+    if (pid == 0)
+    {
+      ++it;
+      continue;
+    }
+
+    if (pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) != 0)
+    {
+      FSW_ELOGF(_("Command exited with status %d.\n"), WEXITSTATUS(status));
+    }
+
+    const std::string key = it->second;
+    it = children.erase(it);
+    running.erase(key);
+
+    if (rerun.erase(key)) schedule(key, steady_clock::now() + debounce);
+  }
+}
+
+void exec_runner::run()
+{
+  std::unique_lock<std::mutex> lock(runner_mutex);
+
+  for (;;)
+  {
+    reap_children();
+
+    const time_point now = steady_clock::now();
+
+    while (children.size() < jobs
+           && !queue.empty()
+           && (stopping || queue.begin()->first <= now))
+    {
+      const std::string key = queue.begin()->second;
+
+      queue.erase(queue.begin());
+      deadlines.erase(key);
+      spawn(key);
+    }
+
+    if (stopping && queue.empty() && children.empty()) return;
+
+    // Children are polled, since SIGCHLD cannot wake a condition variable.
+    time_point wake = time_point::max();
+
+    if (!queue.empty() && children.size() < jobs) wake = queue.begin()->first;
+    if (!children.empty())
+      wake = std::min(wake, now + std::chrono::milliseconds(10));
+
+    if (wake == time_point::max()) runner_cond.wait(lock);
+    else runner_cond.wait_until(lock, wake);
+  }
+}
+
+#endif  /* HAVE_CXX_MUTEX */
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_EXEC_RUNNER_H
+#  define FSW_EXEC_RUNNER_H
+
+#  ifdef HAVE_CXX_MUTEX
+
+#    include <chrono>
+#    include <condition_variable>
+#    include <map>
+#    include <mutex>
+#    include <set>
+#    include <string>
+#    include <thread>
+#    include <utility>
+#    include <vector>
+#    include <sys/types.h>
+#    include "libfswatch/c++/event.hpp"
+
+/*
+ * Runs a command when events are received, either once per batch or once per
+ * path.  Runs are delayed by the debounce window, which is restarted by every
+ * change of the same path: at most one run per path is queued, since a newer
+ * change makes the queued one obsolete.  A path changing while its command is
+ * running is run again once the command terminates.  At most jobs commands run
+ * concurrently.
+ */
+class exec_runner
+{
+public:
+  exec_runner(std::vector<std::string> command,
+              bool per_path,
+              unsigned int jobs,
+              double debounce);
+
+  /*
+   * Runs the queued commands without waiting for their debounce window, and
+   * waits for all the commands to terminate.
+   */
+  ~exec_runner();
+
+  exec_runner(const exec_runner&) = delete;
+  exec_runner& operator=(const exec_runner&) = delete;
+
+  void submit(const std::vector<fsw::event>& events);
+
+  /*
+   * Splits a command into arguments at unquoted whitespace.  Single quotes,
+   * double quotes and backslashes quote characters as in the shell.  Returns
+   * false if a quote is not terminated.
+   */
+  static bool split_command(const std::string& command,
+                            std::vector<std::string>& args);
+
+private:
+  typedef std::chrono::steady_clock::time_point time_point;
+
+  void run();
+  void schedule(const std::string& key, time_point deadline);
+  void spawn(const std::string& key);
+  void reap_children();
+
+  std::vector<std::string> command;
+  bool per_path;
+  unsigned int jobs;
+  std::chrono::steady_clock::duration debounce;
+
+  std::mutex runner_mutex;
+  std::condition_variable runner_cond;
+  // Queued runs, by key and by deadline.
+  std::map<std::string, time_point> deadlines;
+  std::set<std::pair<time_point, std::string>> queue;
+  // Running commands, by process identifier.
+  std::map<pid_t, std::string> children;
+  std::set<std::string> running;
+  std::set<std::string> rerun;
+  bool stopping = false;
+  std::thread runner_thread;
+};
+
+#  endif  /* HAVE_CXX_MUTEX */
+#endif  /* FSW_EXEC_RUNNER_H */
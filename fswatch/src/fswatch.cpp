@@ -18,6 +18,10 @@
 #endif
 #include "gettext.h"
 #include "fswatch.hpp"
+#include "exec_runner.hpp"
+#include "output_buffer.hpp"
+#include "output_formats.hpp"
+#include "printf_event.hpp"
 #include <iostream>
 #include <string>
 #include <exception>
@@ -28,6 +32,13 @@
 #include <cerrno>
 #include <vector>
 #include <map>
+#include <memory>
+#include <unistd.h>
+#ifdef HAVE_CXX_MUTEX
+#  include <mutex>
+#  include <condition_variable>
+#  include <thread>
+#endif
 #include "libfswatch/c++/path_utils.hpp"
 #include "libfswatch/c++/event.hpp"
 #include "libfswatch/c++/monitor.hpp"
@@ -36,6 +47,9 @@
 #include "libfswatch/c/libfswatch.h"
 #include "libfswatch/c/libfswatch_log.h"
 #include "libfswatch/c++/libfswatch_exception.hpp"
+#ifdef HAVE_UNIX_SEQPACKET
+#  include "libfswatch/c++/event_publisher.hpp"
+#endif
 
 #ifdef HAVE_GETOPT_LONG
 #  include <getopt.h>
@@ -51,17 +65,9 @@ using namespace fsw;
 static void print_event_flags(const event& evt);
 static void print_event_path(const event& evt);
 static void print_event_timestamp(const event& evt);
-static int printf_event_validate_format(const std::string& fmt);
 
 static FSW_EVENT_CALLBACK process_events;
 
-struct printf_event_callbacks
-{
-  void (*format_f)(const event& evt);
-  void (*format_p)(const event& evt);
-  void (*format_t)(const event& evt);
-};
-
 struct printf_event_callbacks event_format_callbacks
   {
     print_event_flags,
@@ -69,27 +75,33 @@ struct printf_event_callbacks event_format_callbacks
     print_event_timestamp
   };
 
-static int printf_event(const std::string& fmt,
-                        const event& evt,
-                        const struct printf_event_callbacks& callback,
-                        std::ostream& os = std::cout);
-
 static const unsigned int TIME_FORMAT_BUFF_SIZE = 128;
 
 static monitor *active_monitor = nullptr;
+#ifdef HAVE_CXX_MUTEX
+static exec_runner *active_runner = nullptr;
+#endif
+#ifdef HAVE_UNIX_SEQPACKET
+static event_publisher *active_publisher = nullptr;
+#endif
 static std::vector<monitor_filter> filters;
 static std::vector<fsw_event_type_filter> event_filters;
 static std::vector<std::string> filter_files;
+static std::vector<std::string> priority_paths;
 static bool _0flag = false;
 static bool _1flag = false;
 static bool aflag = false;
 static bool allow_overflow = false;
+static bool recover_overflow = false;
+static size_t verify_cache_size = 0;
+static size_t inventory_batch_size = 0;
 static int batch_marker_flag = false;
 static bool dflag = false;
 static bool Eflag = false;
 static bool fieFlag = false;
 static bool Iflag = false;
 static bool Lflag = false;
+static bool line_buffered = false;
 static bool mflag = false;
 static bool nflag = false;
 static bool oflag = false;
@@ -100,14 +112,40 @@ static bool vflag = false;
 static int version_flag = false;
 static bool xflag = false;
 static double lvalue = 1.0;
+static bool stats_flag = false;
+static double stats_interval = 10.0;
+static bool exec_flag = false;
+static std::vector<std::string> exec_command;
+static bool exec_per_path = false;
+static unsigned int exec_jobs = 1;
+static double exec_debounce = 0.0;
+static bool publish_flag = false;
+static std::string publish_socket;
 static std::string monitor_name;
 static std::string tformat = "%c";
 static std::string batch_marker = event::get_event_flag_name(fsw_event_flag::NoOp);
 static int format_flag = false;
 static std::string format;
+static printf_event_format compiled_format;
+
+enum output_format_type
+{
+  output_format_text,
+  output_format_ndjson,
+  output_format_binary
+};
+
+static output_format_type output_format = output_format_text;
 static std::string event_flag_separator = " ";
 static std::map<std::string, std::string> monitor_properties;
 
+/*
+ * Event records are written to a buffer which is flushed at the end of every
+ * batch, when it is full, or after every record if --line-buffered is used.
+ */
+static output_buffer output_buf(STDOUT_FILENO);
+static std::ostream output(&output_buf);
+
 /*
  * OPT_* variables are used as getopt_long values for long options that do not
  * have a short option equivalent.
@@ -120,6 +158,24 @@ static const int OPT_ALLOW_OVERFLOW = 132;
 static const int OPT_MONITOR_PROPERTY = 133;
 static const int OPT_FIRE_IDLE_EVENTS = 134;
 static const int OPT_FILTER_FROM = 135;
+static const int OPT_STATS = 136;
+static const int OPT_LINE_BUFFERED = 137;
+static const int OPT_OUTPUT_FORMAT = 138;
+static const int OPT_EXEC = 139;
+static const int OPT_EXEC_MODE = 140;
+static const int OPT_EXEC_JOBS = 141;
+static const int OPT_EXEC_DEBOUNCE = 142;
+static const int OPT_PUBLISH = 143;
+static const int OPT_RECOVER_OVERFLOW = 144;
+static const int OPT_VERIFY_CONTENT = 145;
+static const int OPT_PRIORITY = 146;
+static const int OPT_INVENTORY = 147;
+
+// Default number of files whose hash is cached by --verify-content.
+static const size_t DEFAULT_VERIFY_CACHE_SIZE = 65536;
+
+// Default number of events of a batch of the inventory listed by --inventory.
+static const size_t DEFAULT_INVENTORY_BATCH_SIZE = 1024;
 
 static void list_monitor_types(std::ostream& stream)
 {
@@ -157,6 +213,11 @@ static void usage(std::ostream& stream)
   stream << " -d, --directories     " << _("Watch directories only.\n");
   stream << " -e, --exclude=REGEX   " << _("Exclude paths matching REGEX.\n");
   stream << " -E, --extended        " << _("Use extended regular expressions.\n");
+  stream << "     --exec=COMMAND    " << _("Run COMMAND when events are received.") << "\n";
+  stream << "     --exec-debounce=SECONDS\n";
+  stream << "                       " << _("Delay a run until no change is received for SECONDS.") << "\n";
+  stream << "     --exec-jobs=N     " << _("Run at most N commands concurrently.") << "\n";
+  stream << "     --exec-mode=MODE  " << _("Run COMMAND once per batch or once per path.") << "\n";
   stream << "     --filter-from=FILE\n";
   stream << "                       " << _("Load filters from file.") << "\n";
   stream << "     --format=FORMAT   " << _("Use the specified record format.") << "\n";
@@ -165,15 +226,26 @@ static void usage(std::ostream& stream)
   stream << " -h, --help            " << _("Show this message.\n");
   stream << " -i, --include=REGEX   " << _("Include paths matching REGEX.\n");
   stream << " -I, --insensitive     " << _("Use case insensitive regular expressions.\n");
+  stream << "     --inventory[=EVENTS]\n";
+  stream << "                       " << _("List the watched objects before the changes.") << "\n";
   stream << " -l, --latency=DOUBLE  " << _("Set the latency.\n");
   stream << " -L, --follow-links    " << _("Follow symbolic links.\n");
+  stream << "     --line-buffered   " << _("Flush the output after every event record.\n");
   stream << " -M, --list-monitors   " << _("List the available monitors.\n");
   stream << " -m, --monitor=NAME    " << _("Use the specified monitor.\n");
   stream << "     --monitor-property name=value\n";
   stream << "                       " << _("Define the specified property.\n");
   stream << " -n, --numeric         " << _("Print a numeric event mask.\n");
   stream << " -o, --one-per-batch   " << _("Print a single message with the number of change events.\n");
+  stream << "     --output-format=FORMAT\n";
+  stream << "                       " << _("Use the specified output format: text, ndjson or binary.") << "\n";
+  stream << "     --priority=PATH   " << _("Notify the events of PATH without waiting.") << "\n";
+  stream << "     --publish=SOCKET  " << _("Publish the events to the subscribers of SOCKET.") << "\n";
+  stream << "     --recover-overflow\n";
+  stream << "                       " << _("Rescan the paths affected by an overflow.") << "\n";
   stream << " -r, --recursive       " << _("Recurse subdirectories.\n");
+  stream << "     --stats[=SECONDS]\n";
+  stream << "                       " << _("Print the monitor statistics periodically.") << "\n";
   stream << " -t, --timestamp       " << _("Print the event timestamp.\n");
   stream << " -u, --utc-time        " << _("Print the event time as UTC time.\n");
   stream << " -x, --event-flags     " << _("Print the event flags.\n");
@@ -181,6 +253,8 @@ static void usage(std::ostream& stream)
   stream << "     --event-flag-separator=STRING\n";
   stream << "                       " << _("Print event flags using the specified separator.") << "\n";
   stream << " -v, --verbose         " << _("Print verbose output.\n");
+  stream << "     --verify-content[=FILES]\n";
+  stream << "                       " << _("Drop the updates of files whose content did not change.") << "\n";
   stream << "     --version         " << _("Print the version of ") << PACKAGE_NAME << _(" and exit.\n");
   stream << "\n";
 #else
@@ -332,24 +406,43 @@ static void register_signal_handlers()
 
 static void print_event_path(const event& evt)
 {
-  std::cout << evt.get_path();
+  output << evt.get_path();
 }
 
+/*
+ * Events of the same batch usually share the same time: the date of the last
+ * time printed is cached, since the time format has a resolution of a second.
+ */
 static void print_event_timestamp(const event& evt)
 {
+  static bool cached = false;
+  static time_t cached_time;
+  static std::string cached_date;
+
   const time_t& evt_time = evt.get_time();
 
-  char time_format_buffer[TIME_FORMAT_BUFF_SIZE];
-  struct tm *tm_time = uflag ? gmtime(&evt_time) : localtime(&evt_time);
+  if (!cached || evt_time != cached_time)
+  {
+    char time_format_buffer[TIME_FORMAT_BUFF_SIZE];
+#ifdef HAVE_LOCALTIME_R
+    struct tm tm_buffer;
+    struct tm *tm_time = uflag ? gmtime_r(&evt_time, &tm_buffer)
+                               : localtime_r(&evt_time, &tm_buffer);
+#else
+    struct tm *tm_time = uflag ? gmtime(&evt_time) : localtime(&evt_time);
+#endif
 
-  std::string date =
-    strftime(time_format_buffer,
-             TIME_FORMAT_BUFF_SIZE,
-             tformat.c_str(),
-             tm_time) ? std::string(time_format_buffer) : std::string(
-      _("<date format error>"));
+    cached_date =
+      tm_time && strftime(time_format_buffer,
+                          TIME_FORMAT_BUFF_SIZE,
+                          tformat.c_str(),
+                          tm_time) ? std::string(time_format_buffer) : std::string(
+        _("<date format error>"));
+    cached_time = evt_time;
+    cached = true;
+  }
 
-  std::cout << date;
+  output << cached_date;
 }
 
 static void print_event_flags(const event& evt)
@@ -364,16 +457,16 @@ static void print_event_flags(const event& evt)
       mask += static_cast<int> (flag);
     }
 
-    std::cout << mask;
+    output << mask;
   }
   else
   {
     for (size_t i = 0; i < flags.size(); ++i)
     {
-      std::cout << flags[i];
+      output << flags[i];
 
       // Event flag separator is currently hard-coded.
-      if (i != flags.size() - 1) std::cout << event_flag_separator;
+      if (i != flags.size() - 1) output << event_flag_separator;
     }
   }
 }
@@ -382,41 +475,67 @@ static void print_end_of_event_record()
 {
   if (_0flag)
   {
-    std::cout << '\0';
-    std::cout.flush();
+    output << '\0';
   }
   else
   {
-    std::cout << std::endl;
+    output << '\n';
   }
+
+  if (line_buffered) output.flush();
 }
 
 static void write_batch_marker()
 {
   if (batch_marker_flag)
   {
-    std::cout << batch_marker;
+    output << batch_marker;
     print_end_of_event_record();
   }
 }
 
 static void write_one_batch_event(const std::vector<event>& events)
 {
-  std::cout << events.size();
+  output << events.size();
   print_end_of_event_record();
 
   write_batch_marker();
 }
 
+static void write_event(const event& evt)
+{
+  switch (output_format)
+  {
+  case output_format_text:
+    printf_event(compiled_format, evt, event_format_callbacks, output);
+    print_end_of_event_record();
+    return;
+  case output_format_ndjson:
+    write_ndjson_event(output, evt);
+    break;
+  case output_format_binary:
+    write_binary_event(output, evt);
+    break;
+  }
+
+  if (line_buffered) output.flush();
+}
+
 static void write_events(const std::vector<event>& events)
 {
+  // The binary batch header precedes the records it counts.
+  if (batch_marker_flag && output_format == output_format_binary)
+    write_binary_batch_header(output, events.size());
+
   for (const event& evt : events)
   {
-    printf_event(format, evt, event_format_callbacks);
-    print_end_of_event_record();
+    write_event(evt);
   }
 
-  write_batch_marker();
+  if (output_format == output_format_text)
+    write_batch_marker();
+  else if (batch_marker_flag && output_format == output_format_ndjson)
+    write_ndjson_batch_marker(output, events.size());
 
   if (_1flag)
   {
@@ -426,12 +545,132 @@ static void write_events(const std::vector<event>& events)
 
 void process_events(const std::vector<event>& events, void *context)
 {
+#ifdef HAVE_UNIX_SEQPACKET
+  // Subscribers receive the events instead of the output.
+  if (active_publisher)
+  {
+    active_publisher->publish(events);
+
+    if (_1flag) close_monitor();
+
+    return;
+  }
+#endif
+
+#ifdef HAVE_CXX_MUTEX
+  // Commands replace the output of the event records.
+  if (active_runner)
+  {
+    active_runner->submit(events);
+
+    if (_1flag) close_monitor();
+
+    return;
+  }
+#endif
+
   if (oflag)
     write_one_batch_event(events);
   else
     write_events(events);
+
+  output.flush();
+}
+
+static void print_stats(std::ostream& stream)
+{
+  const fsw_monitor_stats stats = active_monitor->get_stats();
+  const uint64_t bytes_per_call =
+    stats.read_calls ? stats.bytes_read / stats.read_calls : 0;
+
+  stream << PACKAGE_NAME << _(": read: ") << stats.events_read
+         << _(" events in ") << stats.read_calls << _(" calls (")
+         << bytes_per_call << _(" bytes per call)") << "\n";
+  stream << PACKAGE_NAME << _(": events: ") << stats.events_received
+         << _(" received, ") << stats.events_notified << _(" notified, ")
+         << stats.events_filtered << _(" filtered, ") << stats.overflows
+         << _(" overflows") << "\n";
+  stream << PACKAGE_NAME << _(": watches: ") << stats.watches
+         << _(", scans: ") << stats.scans << _(" (last: ")
+         << stats.last_scan_time << _(" us, total: ")
+         << stats.total_scan_time << _(" us)") << "\n";
+  stream << PACKAGE_NAME << _(": queue depth: ") << stats.queue_depth
+         << _(" (max: ") << stats.max_queue_depth << ")\n";
+  stream << PACKAGE_NAME << _(": verified: ") << stats.files_hashed
+         << _(" files hashed, ") << stats.events_unchanged
+         << _(" unchanged") << "\n";
+  stream << PACKAGE_NAME << _(": callbacks: ") << stats.callbacks;
+
+  for (size_t i = 0; i < FSW_CALLBACK_TIME_BUCKETS; ++i)
+  {
+    if (!stats.callback_time[i]) continue;
+
+    if (i < FSW_CALLBACK_TIME_BUCKETS - 1)
+      stream << ", <" << (1ull << i) << "us: ";
+    else
+      stream << ", >=" << (1ull << (i - 1)) << "us: ";
+
+    stream << stats.callback_time[i];
+  }
+
+  stream << std::endl;
 }
 
+/*
+ * Prints the statistics of the active monitor to standard error every
+ * stats_interval seconds while it is running, and once more when it stops.
+ * Without thread support, only the final report is printed.
+ */
+class stats_printer
+{
+public:
+  stats_printer()
+  {
+    if (!stats_flag) return;
+
+#ifdef HAVE_CXX_MUTEX
+    printer = std::thread(&stats_printer::run, this);
+#endif
+  }
+
+  ~stats_printer()
+  {
+    if (!stats_flag) return;
+
+#ifdef HAVE_CXX_MUTEX
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopped = true;
+    }
+
+    stopped_cond.notify_one();
+    printer.join();
+#endif
+
+    print_stats(std::cerr);
+  }
+
+  stats_printer(const stats_printer&) = delete;
+  stats_printer& operator=(const stats_printer&) = delete;
+
+private:
+#ifdef HAVE_CXX_MUTEX
+  void run()
+  {
+    const std::chrono::duration<double> interval(stats_interval);
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (!stopped_cond.wait_for(lock, interval, [this] { return stopped; }))
+      print_stats(std::cerr);
+  }
+
+  std::thread printer;
+  std::mutex mutex;
+  std::condition_variable stopped_cond;
+  bool stopped = false;
+#endif
+};
+
 static void start_monitor(int argc, char **argv, int optind)
 {
   // parsing paths
@@ -485,6 +724,15 @@ static void start_monitor(int argc, char **argv, int optind)
 
   active_monitor->set_properties(monitor_properties);
   active_monitor->set_allow_overflow(allow_overflow);
+  active_monitor->set_recover_overflow(recover_overflow);
+  active_monitor->set_content_verification(verify_cache_size);
+
+  // Priority paths are compared with the paths of the events.
+  for (std::string& priority_path : priority_paths)
+    priority_path = fsw_realpath(priority_path.c_str(), nullptr);
+
+  active_monitor->set_priority_paths(priority_paths);
+  active_monitor->set_inventory(inventory_batch_size);
   active_monitor->set_latency(lvalue);
   active_monitor->set_fire_idle_event(fieFlag);
   active_monitor->set_recursive(rflag);
@@ -494,6 +742,30 @@ static void start_monitor(int argc, char **argv, int optind)
   active_monitor->set_follow_symlinks(Lflag);
   active_monitor->set_watch_access(aflag);
 
+#ifdef HAVE_CXX_MUTEX
+  std::unique_ptr<exec_runner> runner;
+
+  if (exec_flag)
+  {
+    runner.reset(new exec_runner(exec_command,
+                                 exec_per_path,
+                                 exec_jobs,
+                                 exec_debounce));
+    active_runner = runner.get();
+  }
+#endif
+
+#ifdef HAVE_UNIX_SEQPACKET
+  std::unique_ptr<event_publisher> publisher;
+
+  if (publish_flag)
+  {
+    publisher.reset(new event_publisher(publish_socket));
+    active_publisher = publisher.get();
+  }
+#endif
+
+  stats_printer printer;
   active_monitor->start();
 }
 
@@ -513,6 +785,10 @@ static void parse_opts(int argc, char **argv)
     {"event-flags",          no_argument,       nullptr,       'x'},
     {"event-flag-separator", required_argument, nullptr,       OPT_EVENT_FLAG_SEPARATOR},
     {"exclude",              required_argument, nullptr,       'e'},
+    {"exec",                 required_argument, nullptr,       OPT_EXEC},
+    {"exec-debounce",        required_argument, nullptr,       OPT_EXEC_DEBOUNCE},
+    {"exec-jobs",            required_argument, nullptr,       OPT_EXEC_JOBS},
+    {"exec-mode",            required_argument, nullptr,       OPT_EXEC_MODE},
     {"extended",             no_argument,       nullptr,       'E'},
     {"filter-from",          required_argument, nullptr,       OPT_FILTER_FROM},
     {"fire-idle-events",     no_argument,       nullptr,       OPT_FIRE_IDLE_EVENTS},
@@ -522,18 +798,26 @@ static void parse_opts(int argc, char **argv)
     {"help",                 no_argument,       nullptr,       'h'},
     {"include",              required_argument, nullptr,       'i'},
     {"insensitive",          no_argument,       nullptr,       'I'},
+    {"inventory",            optional_argument, nullptr,       OPT_INVENTORY},
     {"latency",              required_argument, nullptr,       'l'},
+    {"line-buffered",        no_argument,       nullptr,       OPT_LINE_BUFFERED},
     {"list-monitors",        no_argument,       nullptr,       'M'},
     {"monitor",              required_argument, nullptr,       'm'},
     {"monitor-property",     required_argument, nullptr,       OPT_MONITOR_PROPERTY},
     {"numeric",              no_argument,       nullptr,       'n'},
     {"one-per-batch",        no_argument,       nullptr,       'o'},
     {"one-event",            no_argument,       nullptr,       '1'},
+    {"output-format",        required_argument, nullptr,       OPT_OUTPUT_FORMAT},
     {"print0",               no_argument,       nullptr,       '0'},
+    {"priority",             required_argument, nullptr,       OPT_PRIORITY},
+    {"publish",              required_argument, nullptr,       OPT_PUBLISH},
+    {"recover-overflow",     no_argument,       nullptr,       OPT_RECOVER_OVERFLOW},
     {"recursive",            no_argument,       nullptr,       'r'},
+    {"stats",                optional_argument, nullptr,       OPT_STATS},
     {"timestamp",            no_argument,       nullptr,       't'},
     {"utc-time",             no_argument,       nullptr,       'u'},
     {"verbose",              no_argument,       nullptr,       'v'},
+    {"verify-content",       optional_argument, nullptr,       OPT_VERIFY_CONTENT},
     {"version",              no_argument,       &version_flag, true},
     {nullptr, 0,                                nullptr,       0}
   };
@@ -568,7 +852,8 @@ static void parse_opts(int argc, char **argv)
       break;
 
     case 'e':
-      filters.push_back({optarg, fsw_filter_type::filter_exclude});
+      filters.push_back(
+        {optarg, fsw_filter_type::filter_exclude, true, false, false});
       break;
 
     case 'E':
@@ -584,7 +869,8 @@ static void parse_opts(int argc, char **argv)
       exit(FSW_EXIT_OK);
 
     case 'i':
-      filters.push_back({optarg, fsw_filter_type::filter_include});
+      filters.push_back(
+        {optarg, fsw_filter_type::filter_include, true, false, false});
       break;
 
     case 'I':
@@ -653,6 +939,20 @@ static void parse_opts(int argc, char **argv)
       format = optarg;
       break;
 
+    case OPT_OUTPUT_FORMAT:
+      if (std::string(optarg) == "text")
+        output_format = output_format_text;
+      else if (std::string(optarg) == "ndjson")
+        output_format = output_format_ndjson;
+      else if (std::string(optarg) == "binary")
+        output_format = output_format_binary;
+      else
+      {
+        std::cerr << _("Unknown output format: ") << optarg << std::endl;
+        exit(FSW_EXIT_FORMAT);
+      }
+      break;
+
     case OPT_EVENT_FLAG_SEPARATOR:
       event_flag_separator = optarg;
       break;
@@ -668,6 +968,10 @@ static void parse_opts(int argc, char **argv)
       allow_overflow = true;
       break;
 
+    case OPT_RECOVER_OVERFLOW:
+      recover_overflow = true;
+      break;
+
     case OPT_MONITOR_PROPERTY:
     {
       std::string param(optarg);
@@ -690,6 +994,127 @@ static void parse_opts(int argc, char **argv)
       filter_files.emplace_back(optarg);
       break;
 
+    case OPT_EXEC:
+#ifdef HAVE_CXX_MUTEX
+      if (!exec_runner::split_command(optarg, exec_command))
+      {
+        std::cerr << _("Invalid command: ") << optarg << std::endl;
+        exit(FSW_EXIT_OPT);
+      }
+
+      exec_flag = true;
+#else
+      std::cerr << _("--exec is not supported on this platform.") << std::endl;
+      exit(FSW_EXIT_OPT);
+#endif
+      break;
+
+    case OPT_EXEC_MODE:
+      if (std::string(optarg) == "batch")
+        exec_per_path = false;
+      else if (std::string(optarg) == "path")
+        exec_per_path = true;
+      else
+      {
+        std::cerr << _("Invalid value: ") << optarg << std::endl;
+        exit(FSW_EXIT_OPT);
+      }
+      break;
+
+    case OPT_EXEC_JOBS:
+    {
+      char *end;
+      const unsigned long jobs = strtoul(optarg, &end, 10);
+
+      if (*end || jobs == 0 || jobs > 1024)
+      {
+        std::cerr << _("Invalid value: ") << optarg << std::endl;
+        exit(FSW_EXIT_OPT);
+      }
+
+      exec_jobs = jobs;
+    }
+      break;
+
+    case OPT_EXEC_DEBOUNCE:
+      exec_debounce = strtod(optarg, nullptr);
+
+      if (!(exec_debounce >= 0.0) || exec_debounce == HUGE_VAL)
+      {
+        std::cerr << _("Invalid value: ") << optarg << std::endl;
+        exit(FSW_EXIT_OPT);
+      }
+      break;
+
+    case OPT_PUBLISH:
+#ifdef HAVE_UNIX_SEQPACKET
+      publish_flag = true;
+      publish_socket = optarg;
+#else
+      std::cerr << _("--publish is not supported on this platform.") << std::endl;
+      exit(FSW_EXIT_OPT);
+#endif
+      break;
+
+    case OPT_LINE_BUFFERED:
+      line_buffered = true;
+      break;
+
+    case OPT_STATS:
+      stats_flag = true;
+
+      if (optarg)
+      {
+        stats_interval = strtod(optarg, nullptr);
+
+        if (!(stats_interval > 0.0) || stats_interval == HUGE_VAL)
+        {
+          std::cerr << _("Invalid value: ") << optarg << std::endl;
+          exit(FSW_EXIT_OPT);
+        }
+      }
+      break;
+
+    case OPT_INVENTORY:
+      inventory_batch_size = DEFAULT_INVENTORY_BATCH_SIZE;
+
+      if (optarg)
+      {
+        char *end;
+        const unsigned long value = strtoul(optarg, &end, 10);
+
+        if (*end != '\0' || optarg[0] == '-' || value == 0)
+        {
+          std::cerr << _("Invalid value: ") << optarg << std::endl;
+          exit(FSW_EXIT_OPT);
+        }
+
+        inventory_batch_size = value;
+      }
+      break;
+
+    case OPT_PRIORITY:
+      priority_paths.push_back(optarg);
+      break;
+
+    case OPT_VERIFY_CONTENT:
+      verify_cache_size = DEFAULT_VERIFY_CACHE_SIZE;
+
+      if (optarg)
+      {
+        char *end;
+        const unsigned long value = strtoul(optarg, &end, 10);
+
+        if (*end != '\0' || optarg[0] == '-' || value == 0)
+        {
+          std::cerr << _("Invalid value: ") << optarg << std::endl;
+          exit(FSW_EXIT_OPT);
+        }
+
+        verify_cache_size = value;
+      }
+      break;
+
     case '?':
       usage(std::cerr);
       exit(FSW_EXIT_UNK_OPT);
@@ -721,22 +1146,30 @@ static void parse_opts(int argc, char **argv)
     exit(FSW_EXIT_FORMAT);
   }
 
+  // Machine-oriented output formats define their records.
+  if (output_format != output_format_text
+      && (format_flag || tflag || xflag || nflag || oflag || _0flag))
+  {
+    std::cerr <<
+         _("--output-format is incompatible with --format, -0, -n, -o, -t and -x.")
+         <<
+         std::endl;
+    exit(FSW_EXIT_FORMAT);
+  }
+
+  if (publish_flag && exec_flag)
+  {
+    std::cerr << _("--publish is incompatible with --exec.") << std::endl;
+    exit(FSW_EXIT_OPT);
+  }
+
   // If no format was specified use:
   //   * %p as the default.
   //   * -t adds "%t " at the beginning of the format.
   //   * -x adds " %f" at the end of the format.
   //   * '\n' is used as record separator unless -0 is used, in which case '\0'
   //     is used instead.
-  if (format_flag)
-  {
-    // Test the user format
-    if (printf_event_validate_format(format) < 0)
-    {
-      std::cerr << _("Invalid format.") << std::endl;
-      exit(FSW_EXIT_FORMAT);
-    }
-  }
-  else
+  if (!format_flag)
   {
     // Build event format.
     if (tflag)
@@ -751,83 +1184,13 @@ static void parse_opts(int argc, char **argv)
       format += " %f";
     }
   }
-}
-
-static void format_noop(const event& evt)
-{
-}
-
-static int printf_event_validate_format(const std::string& fmt)
-{
-
-  struct printf_event_callbacks noop_callbacks
-    {
-      format_noop,
-      format_noop,
-      format_noop
-    };
-
-  const std::vector<fsw_event_flag> flags;
-  const event empty("", 0, flags);
-  std::ostream noop_stream(nullptr);
-
-  return printf_event(fmt, empty, noop_callbacks, noop_stream);
-}
 
-static int printf_event(const std::string& fmt,
-                        const event& evt,
-                        const struct printf_event_callbacks& callback,
-                        std::ostream& os)
-{
-  /*
-   * %t - time (further formatted using -f and strftime.
-   * %p - event path
-   * %f - event flags (event separator will be formatted with a separate option)
-   */
-  for (size_t i = 0; i < format.length(); ++i)
+  // Compile the format once, and test it if specified by the user.
+  if (printf_event_compile_format(format, compiled_format) < 0)
   {
-    // If the character does not start a format directive, copy it as it is.
-    if (format[i] != '%')
-    {
-      os << format[i];
-      continue;
-    }
-
-    // If this is the end of the string, dump an error.
-    if (i == format.length() - 1)
-    {
-      return -1;
-    }
-
-    // Advance to next format and check which directive it is.
-    const char c = format[++i];
-
-    switch (c)
-    {
-    case '%':
-      os << '%';
-      break;
-    case '0':
-      os << '\0';
-      break;
-    case 'n':
-      os << '\n';
-      break;
-    case 'f':
-      callback.format_f(evt);
-      break;
-    case 'p':
-      callback.format_p(evt);
-      break;
-    case 't':
-      callback.format_t(evt);
-      break;
-    default:
-      return -1;
-    }
+    std::cerr << _("Invalid format.") << std::endl;
+    exit(FSW_EXIT_FORMAT);
   }
-
-  return 0;
 }
 
 int main(int argc, char **argv)
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+#include "output_buffer.hpp"
+#include <cerrno>
+#include <unistd.h>
+
+output_buffer::output_buffer(int fd, size_t size) : fd(fd), buffer(size)
+{
+  setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+output_buffer::~output_buffer()
+{
+  sync();
+}
+
+int output_buffer::overflow(int c)
+{
+  if (!write_buffer()) return traits_type::eof();
+
+  if (!traits_type::eq_int_type(c, traits_type::eof()))
+  {
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+  }
+
+  return traits_type::not_eof(c);
+}
+
+int output_buffer::sync()
+{
+  return write_buffer() ? 0 : -1;
+}
+
+bool output_buffer::write_buffer()
+{
+  const char *data = pbase();
+  size_t size = pptr() - pbase();
+
+  while (size > 0)
+  {
+    const ssize_t written = write(fd, data, size);
+
+    if (written < 0)
+    {
+      if (errno == EINTR) continue;
+
+      return false;
+    }
+
+    data += written;
+    size -= written;
+  }
+
+  setp(buffer.data(), buffer.data() + buffer.size());
+
+  return true;
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_OUTPUT_BUFFER_H
+#  define FSW_OUTPUT_BUFFER_H
+
+#  include <cstddef>
+#  include <streambuf>
+#  include <vector>
+
+/*
+ * Stream buffer writing to a file descriptor.  Characters are accumulated in a
+ * buffer of fixed size, which is written with a single write(2) call when it
+ * is full or when the stream is flushed.
+ */
+class output_buffer : public std::streambuf
+{
+public:
+  static const size_t DEFAULT_SIZE = 64 * 1024;
+
+  explicit output_buffer(int fd, size_t size = DEFAULT_SIZE);
+  ~output_buffer();
+
+  output_buffer(const output_buffer&) = delete;
+  output_buffer& operator=(const output_buffer&) = delete;
+
+protected:
+  int overflow(int c) override;
+  int sync() override;
+
+private:
+  bool write_buffer();
+
+  int fd;
+  std::vector<char> buffer;
+};
+
+#endif  /* FSW_OUTPUT_BUFFER_H */
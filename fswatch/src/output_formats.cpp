@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+#include "output_formats.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+using namespace fsw;
+
+/*
+ * Returns the length of the valid UTF-8 sequence starting at str[i], or 0 if
+ * the bytes starting at str[i] are not a valid sequence.
+ */
+static size_t utf8_sequence_length(const std::string& str, size_t i)
+{
+  const unsigned char c = str[i];
+  size_t length;
+
+  if (c < 0x80) return 1;
+  else if ((c & 0xE0) == 0xC0) length = 2;
+  else if ((c & 0xF0) == 0xE0) length = 3;
+  else if ((c & 0xF8) == 0xF0) length = 4;
+  else return 0;
+
+  uint32_t code_point = c & (0x7F >> length);
+
+  if (i + length > str.size()) return 0;
+
+  for (size_t k = 1; k < length; ++k)
+  {
+    const unsigned char cont = str[i + k];
+    if ((cont & 0xC0) != 0x80) return 0;
+    code_point = (code_point << 6) | (cont & 0x3F);
+  }
+
+  // Reject overlong encodings, surrogates and out of range code points.
+  static const uint32_t min_code_point[] = {0, 0, 0x80, 0x800, 0x10000};
+  if (code_point < min_code_point[length]) return 0;
+  if (code_point >= 0xD800 && code_point <= 0xDFFF) return 0;
+  if (code_point > 0x10FFFF) return 0;
+
+  return length;
+}
+
+static bool is_valid_utf8(const std::string& str)
+{
+  for (size_t i = 0; i < str.size();)
+  {
+    const size_t length = utf8_sequence_length(str, i);
+    if (length == 0) return false;
+    i += length;
+  }
+
+  return true;
+}
+
+// Writes str as a JSON string containing its standard Base64 encoding.
+static void write_json_base64(std::ostream& os, const std::string& str)
+{
+  static const char digits[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+  os << '"';
+
+  for (size_t i = 0; i < str.size(); i += 3)
+  {
+    const size_t length = std::min<size_t>(3, str.size() - i);
+    uint32_t group = static_cast<unsigned char> (str[i]) << 16;
+
+    if (length > 1) group |= static_cast<unsigned char> (str[i + 1]) << 8;
+    if (length > 2) group |= static_cast<unsigned char> (str[i + 2]);
+
+    os << digits[(group >> 18) & 0x3F] << digits[(group >> 12) & 0x3F];
+    os << (length > 1 ? digits[(group >> 6) & 0x3F] : '=');
+    os << (length > 2 ? digits[group & 0x3F] : '=');
+  }
+
+  os << '"';
+}
+
+static void write_json_string(std::ostream& os, const std::string& str)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  os << '"';
+
+  for (size_t i = 0; i < str.size();)
+  {
+    const unsigned char c = str[i];
+    const size_t length = utf8_sequence_length(str, i);
+
+    if (length > 1)
+    {
+      os.write(str.data() + i, length);
+      i += length;
+      continue;
+    }
+
+    switch (c)
+    {
+    case '"':
+      os << "\\\"";
+      break;
+    case '\\':
+      os << "\\\\";
+      break;
+    case '\n':
+      os << "\\n";
+      break;
+    case '\r':
+      os << "\\r";
+      break;
+    case '\t':
+      os << "\\t";
+      break;
+    default:
+      if (c < 0x20 || length == 0)
+        os << "\\u00" << hex[c >> 4] << hex[c & 0xF];
+      else
+        os << c;
+    }
+
+    ++i;
+  }
+
+  os << '"';
+}
+
+/*
+ * Writes a path member.  The escaped string cannot represent the bytes which
+ * are not valid UTF-8: for such a path, it is only meant to be displayed, and
+ * the exact bytes are written in a Base64 member.
+ */
+static void write_json_path(std::ostream& os,
+                            const char *name,
+                            const std::string& path)
+{
+  os << '"' << name << "\":";
+  write_json_string(os, path);
+
+  if (!is_valid_utf8(path))
+  {
+    os << ",\"" << name << "_b64\":";
+    write_json_base64(os, path);
+  }
+}
+
+void write_ndjson_event(std::ostream& os, const event& evt)
+{
+  os << '{';
+  write_json_path(os, "path", evt.get_path());
+  os << ",\"flags\":" << evt.get_flag_mask();
+  os << ",\"time\":" << static_cast<int64_t> (evt.get_time());
+  os << ",\"time_ns\":" << evt.get_time_ns();
+  os << ",\"sequence\":" << evt.get_sequence();
+
+  if (!evt.get_old_path().empty())
+  {
+    os << ',';
+    write_json_path(os, "old_path", evt.get_old_path());
+  }
+
+  os << "}\n";
+}
+
+void write_ndjson_batch_marker(std::ostream& os, size_t event_num)
+{
+  os << "{\"batch_end\":true,\"events\":" << event_num << "}\n";
+}
+
+static void write_little_endian(std::ostream& os, uint64_t value, size_t size)
+{
+  char bytes[8];
+
+  for (size_t i = 0; i < size; ++i)
+  {
+    bytes[i] = static_cast<char> (value & 0xFF);
+    value >>= 8;
+  }
+
+  os.write(bytes, size);
+}
+
+static void write_varint(std::ostream& os, uint64_t value)
+{
+  char bytes[10];
+  size_t size = 0;
+
+  do
+  {
+    bytes[size] = static_cast<char> (value & 0x7F);
+    value >>= 7;
+    if (value) bytes[size] |= 0x80;
+    ++size;
+  }
+  while (value);
+
+  os.write(bytes, size);
+}
+
+void write_binary_event(std::ostream& os, const event& evt)
+{
+  const std::string& path = evt.get_path();
+  const int64_t evt_time = evt.get_time();
+
+  write_varint(os, path.size());
+  os.write(path.data(), path.size());
+  write_little_endian(os, evt.get_flag_mask(), 4);
+  write_little_endian(os, static_cast<uint64_t> (evt_time), 8);
+}
+
+void write_binary_batch_header(std::ostream& os, size_t event_num)
+{
+  os.write("FSWB", 4);
+  write_little_endian(os, event_num, 4);
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_OUTPUT_FORMATS_H
+#  define FSW_OUTPUT_FORMATS_H
+
+#  include <cstddef>
+#  include <ostream>
+#  include "libfswatch/c++/event.hpp"
+
+/*
+ * Writes an event as a JSON object on a single line:
+ *
+ *   {"path":"/a/b","flags":516,"time":1500000000}
+ *
+ * where flags is the bitmask of the event flags and time is the number of
+ * seconds since the epoch.  "old_path" is added when the event carries the
+ * previous path of a renamed object.  Quotes, backslashes, control characters
+ * and bytes which are not part of a valid UTF-8 sequence are escaped.
+ */
+void write_ndjson_event(std::ostream& os, const fsw::event& evt);
+
+/*
+ * Writes the marker ending a batch of the specified number of events as a
+ * JSON object on a single line:
+ *
+ *   {"batch_end":true,"events":3}
+ */
+void write_ndjson_batch_marker(std::ostream& os, size_t event_num);
+
+/*
+ * Writes an event as a binary record:
+ *
+ *   - The length of the path, as an unsigned LEB128 varint.
+ *   - The bytes of the path.
+ *   - The bitmask of the event flags, as a little-endian 32-bit integer.
+ *   - The number of seconds since the epoch, as a little-endian 64-bit
+ *     integer.
+ */
+void write_binary_event(std::ostream& os, const fsw::event& evt);
+
+/*
+ * Writes the header preceding a batch of binary records: the magic bytes
+ * "FSWB" followed by the number of records, as a little-endian 32-bit integer.
+ */
+void write_binary_batch_header(std::ostream& os, size_t event_num);
+
+#endif  /* FSW_OUTPUT_FORMATS_H */
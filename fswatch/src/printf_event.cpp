@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+#include "printf_event.hpp"
+#include <cstdio>
+
+using namespace fsw;
+
+static void append_literal(printf_event_format& compiled, char c)
+{
+  std::vector<printf_event_op>& ops = compiled.ops;
+
+  if (ops.empty() || ops.back().type != printf_event_literal)
+    ops.push_back({printf_event_literal, compiled.literals.size(), 0});
+
+  compiled.literals += c;
+  ++ops.back().length;
+}
+
+int printf_event_compile_format(const std::string& fmt,
+                                printf_event_format& compiled)
+{
+  compiled.literals.clear();
+  compiled.ops.clear();
+
+  /*
+   * %t - time (further formatted using -f and strftime.
+   * %T - time as seconds since the epoch, with nanoseconds
+   * %S - sequence number of the event
+   * %p - event path
+   * %f - event flags (event separator will be formatted with a separate option)
+   */
+  for (size_t i = 0; i < fmt.length(); ++i)
+  {
+    // If the character does not start a format directive, copy it as it is.
+    if (fmt[i] != '%')
+    {
+      append_literal(compiled, fmt[i]);
+      continue;
+    }
+
+    // If this is the end of the string, dump an error.
+    if (i == fmt.length() - 1)
+    {
+      return -1;
+    }
+
+    // Advance to next format and check which directive it is.
+    const char c = fmt[++i];
+
+    switch (c)
+    {
+    case '%':
+      append_literal(compiled, '%');
+      break;
+    case '0':
+      append_literal(compiled, '\0');
+      break;
+    case 'n':
+      append_literal(compiled, '\n');
+      break;
+    case 'f':
+      compiled.ops.push_back({printf_event_flags, 0, 0});
+      break;
+    case 'p':
+      compiled.ops.push_back({printf_event_path, 0, 0});
+      break;
+    case 't':
+      compiled.ops.push_back({printf_event_time, 0, 0});
+      break;
+    case 'T':
+      compiled.ops.push_back({printf_event_time_ns, 0, 0});
+      break;
+    case 'S':
+      compiled.ops.push_back({printf_event_sequence, 0, 0});
+      break;
+    default:
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int printf_event_validate_format(const std::string& fmt)
+{
+  printf_event_format compiled;
+
+  return printf_event_compile_format(fmt, compiled);
+}
+
+static void print_time_ns(const event& evt, std::ostream& os)
+{
+  const timespec& evt_time = evt.get_timespec();
+  char buffer[32];
+
+  const int length = snprintf(buffer,
+                              sizeof(buffer),
+                              "%lld.%09ld",
+                              static_cast<long long> (evt_time.tv_sec),
+                              static_cast<long> (evt_time.tv_nsec));
+
+  if (length > 0) os.write(buffer, length);
+}
+
+void printf_event(const printf_event_format& fmt,
+                  const event& evt,
+                  const struct printf_event_callbacks& callback,
+                  std::ostream& os)
+{
+  for (const printf_event_op& op : fmt.ops)
+  {
+    switch (op.type)
+    {
+    case printf_event_literal:
+      os.write(fmt.literals.data() + op.offset, op.length);
+      break;
+    case printf_event_flags:
+      callback.format_f(evt);
+      break;
+    case printf_event_path:
+      callback.format_p(evt);
+      break;
+    case printf_event_time:
+      callback.format_t(evt);
+      break;
+    case printf_event_time_ns:
+      print_time_ns(evt, os);
+      break;
+    case printf_event_sequence:
+      os << evt.get_sequence();
+      break;
+    }
+  }
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FSW_PRINTF_EVENT_H
+#  define FSW_PRINTF_EVENT_H
+
+#  include <cstddef>
+#  include <iostream>
+#  include <string>
+#  include <vector>
+#  include "libfswatch/c++/event.hpp"
+
+/*
+ * Callbacks printing the event fields referenced by a record format.
+ */
+struct printf_event_callbacks
+{
+  void (*format_f)(const fsw::event& evt);
+  void (*format_p)(const fsw::event& evt);
+  void (*format_t)(const fsw::event& evt);
+};
+
+enum printf_event_op_type
+{
+  printf_event_literal,
+  printf_event_flags,
+  printf_event_path,
+  printf_event_time,
+  printf_event_time_ns,
+  printf_event_sequence
+};
+
+/*
+ * A directive of a compiled record format.  Literal directives print the
+ * characters of the literals of the format in [offset, offset + length).
+ */
+struct printf_event_op
+{
+  printf_event_op_type type;
+  size_t offset;
+  size_t length;
+};
+
+/*
+ * A record format compiled into a sequence of directives, where consecutive
+ * characters and escape sequences are merged into a single literal.
+ */
+struct printf_event_format
+{
+  std::string literals;
+  std::vector<printf_event_op> ops;
+};
+
+/*
+ * Compiles the specified record format.  Returns -1 if the format is invalid,
+ * 0 otherwise.
+ */
+int printf_event_compile_format(const std::string& fmt,
+                                printf_event_format& compiled);
+
+/*
+ * Prints an event using the specified compiled record format: literals are
+ * copied to the stream, and the fields referenced by the format directives are
+ * printed by the callbacks.
+ */
+void printf_event(const printf_event_format& fmt,
+                  const fsw::event& evt,
+                  const struct printf_event_callbacks& callback,
+                  std::ostream& os = std::cout);
+
+/*
+ * Returns -1 if the specified record format is invalid, 0 otherwise.
+ */
+int printf_event_validate_format(const std::string& fmt);
+
+#endif  /* FSW_PRINTF_EVENT_H */
@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "gettext_defs.h"
+#include "auto_monitor.hpp"
+#include "poll_monitor.hpp"
+#include "libfswatch_exception.hpp"
+#include "string/string_utils.hpp"
+#include "../c/libfswatch_log.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#ifdef HAVE_SYS_VFS_H
+#  include <sys/vfs.h>
+#endif
+#ifdef HAVE_SYS_PARAM_H
+#  include <sys/param.h>
+#endif
+#ifdef HAVE_SYS_MOUNT_H
+#  include <sys/mount.h>
+#endif
+
+namespace fsw
+{
+  // Default minimum latency of the poll monitor.
+  static const double MIN_POLL_LATENCY = 3.0;
+
+#if defined(HAVE_STATFS) && !defined(HAVE_STRUCT_STATFS_F_FSTYPENAME)
+  /*
+   * Magic numbers of the Linux file systems whose changes are not all
+   * reported by inotify, as defined by <linux/magic.h> and by the file
+   * systems themselves.
+   */
+  static const unsigned long POLLED_FILE_SYSTEMS[] =
+  {
+    0x6969,      // NFS
+    0x517B,      // SMB
+    0xFF534D42,  // CIFS
+    0xFE534D42,  // SMB2
+    0x65735546,  // FUSE
+    0x794C7630,  // overlayfs
+    0x01021997,  // 9p
+    0x00C36400,  // Ceph
+    0x5346414F,  // AFS
+    0x6B414653,  // kAFS
+    0x73757245,  // Coda
+    0x47504653   // GPFS
+  };
+#endif
+
+  auto_monitor::auto_monitor(std::vector<std::string> paths,
+                             FSW_EVENT_CALLBACK *callback,
+                             void *context) :
+    composite_monitor(std::move(paths), callback, context)
+  {
+  }
+
+  auto_monitor::~auto_monitor()
+  {
+  }
+
+  bool auto_monitor::is_polled_path(const std::string& path)
+  {
+#ifdef HAVE_STATFS
+    std::string checked_path = path;
+    struct statfs fs;
+
+    // A path which does not exist yet will be created in its parent.
+    while (statfs(checked_path.c_str(), &fs) != 0)
+    {
+      const size_t separator = checked_path.find_last_of('/');
+
+      if (errno != ENOENT || separator == std::string::npos) return false;
+
+      checked_path.resize(separator == 0 ? 1 : separator);
+    }
+
+#  ifdef HAVE_STRUCT_STATFS_F_FSTYPENAME
+#    ifdef MNT_LOCAL
+    if (!(fs.f_flags & MNT_LOCAL)) return true;
+#    endif
+
+    return strncmp(fs.f_fstypename, "fuse", 4) == 0
+      || strcmp(fs.f_fstypename, "osxfuse") == 0
+      || strcmp(fs.f_fstypename, "macfuse") == 0;
+#  else
+    const unsigned long type = static_cast<unsigned long> (fs.f_type)
+      & 0xFFFFFFFFUL;
+
+    for (unsigned long polled_type : POLLED_FILE_SYSTEMS)
+    {
+      if (type == polled_type) return true;
+    }
+
+    return false;
+#  endif
+#else
+    (void) path;
+
+    return false;
+#endif
+  }
+
+  double auto_monitor::get_poll_latency()
+  {
+    std::string latency_value = get_property(AUTO_POLL_LATENCY);
+
+    if (latency_value.empty())
+      return latency < MIN_POLL_LATENCY ? MIN_POLL_LATENCY : latency;
+
+    char *end;
+    const double poll_latency = strtod(latency_value.c_str(), &end);
+
+    if (*end != '\0' || !(poll_latency > 0))
+    {
+      std::string msg = string_utils::string_from_format(
+        _("Invalid value of the %s property: %s"),
+        AUTO_POLL_LATENCY,
+        latency_value.c_str());
+      throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+    }
+
+    return poll_latency;
+  }
+
+  std::vector<composite_monitor::partition> auto_monitor::partition_paths()
+  {
+    partition native;
+    native.type = system_default_monitor_type;
+
+    partition polled;
+    polled.type = poll_monitor_type;
+    polled.latency = get_poll_latency();
+
+    // Network file systems have a high latency: directories are only read
+    // when they change and status calls are overlapped.
+    polled.default_properties[poll_monitor::POLL_INCREMENTAL] = "true";
+    polled.default_properties[poll_monitor::POLL_SCAN_IO_URING] = "true";
+
+    for (const std::string& path : paths)
+    {
+      if (is_polled_path(path))
+      {
+        FSW_ELOGF(_("Polling %s: it is on a network or FUSE file system.\n"),
+                  path.c_str());
+        polled.paths.push_back(path);
+      }
+      else
+      {
+        native.paths.push_back(path);
+      }
+    }
+
+    std::vector<partition> partitions;
+    partitions.push_back(std::move(native));
+    partitions.push_back(std::move(polled));
+
+    return partitions;
+  }
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Monitor choosing a backend according to the file system of the paths.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_AUTO_MONITOR_H
+#  define FSW_AUTO_MONITOR_H
+
+#  include "composite_monitor.hpp"
+#  include <string>
+#  include <vector>
+
+namespace fsw
+{
+  /**
+   * @brief Monitor choosing a backend according to the file system of the
+   * paths.
+   *
+   * The native monitors do not receive the changes made by other hosts to
+   * network file systems, nor the changes made behind the back of FUSE file
+   * systems.  This monitor checks the file system of every path when it
+   * starts: the paths on local file systems are watched by the default
+   * monitor of the platform, while the paths on network, FUSE and overlay
+   * file systems are watched by an fsw::poll_monitor, configured to scan
+   * incrementally, to batch its status calls and to poll at most every
+   * #AUTO_POLL_LATENCY seconds.  The settings of this monitor can override
+   * these defaults.  The events of both monitors are notified by this
+   * monitor.
+   *
+   * On platforms where the file system of a path cannot be determined, all
+   * the paths are watched by the default monitor.
+   */
+  class auto_monitor : public composite_monitor
+  {
+  public:
+    /**
+     * @brief Custom monitor property used to set the latency of the poll
+     * monitor.
+     *
+     * The default value is the latency of this monitor, but not less than 3
+     * seconds: NFS clients cache the attributes of files for at least as long
+     * by default, so that polling more often does not detect changes sooner.
+     */
+    static constexpr const char *AUTO_POLL_LATENCY = "auto.poll.latency";
+
+    /**
+     * @brief Constructs an instance of this class.
+     */
+    auto_monitor(std::vector<std::string> paths,
+                 FSW_EVENT_CALLBACK *callback,
+                 void *context = nullptr);
+
+    /**
+     * @brief Destroys an instance of this class.
+     */
+    virtual ~auto_monitor();
+
+    /**
+     * @brief Checks whether the native monitors may miss the changes of a
+     * path.
+     *
+     * @param path The path to check.  If it does not exist, its closest
+     * existing parent directory is checked.
+     * @return @c true if @p path is on a network, FUSE or overlay file system,
+     * @c false otherwise or if the file system cannot be determined.
+     */
+    static bool is_polled_path(const std::string& path);
+
+  protected:
+    /**
+     * @brief Partitions the paths by the kind of their file system.
+     */
+    std::vector<partition> partition_paths() override;
+
+  private:
+    auto_monitor(const auto_monitor& orig) = delete;
+    auto_monitor& operator=(const auto_monitor& that) = delete;
+
+    double get_poll_latency();
+  };
+}
+
+#endif  /* FSW_AUTO_MONITOR_H */
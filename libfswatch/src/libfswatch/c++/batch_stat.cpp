@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "gettext_defs.h"
+#include "batch_stat.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#ifdef HAVE_IO_URING
+#  include <linux/io_uring.h>
+#  include <sys/mman.h>
+#  include <sys/syscall.h>
+#  include <sys/sysmacros.h>
+#  include <unistd.h>
+#endif
+#include "../c/libfswatch_log.h"
+
+namespace fsw
+{
+#ifdef HAVE_IO_URING
+  /*
+   * An io_uring instance set up with the raw system calls, so that no library
+   * is required.  Only one batch is in flight at a time and its completions
+   * are all reaped before the next one is submitted, so that the completion
+   * queue, which is twice as large as the submission queue, cannot overflow.
+   */
+  struct batch_stat_ring
+  {
+    int fd = -1;
+    unsigned int entries = 0;
+    void *sq_ptr = MAP_FAILED;
+    size_t sq_size = 0;
+    void *cq_ptr = MAP_FAILED;
+    size_t cq_size = 0;
+    void *sqes_ptr = MAP_FAILED;
+    size_t sqes_size = 0;
+    unsigned *sq_head = nullptr;
+    unsigned *sq_tail = nullptr;
+    unsigned *sq_mask = nullptr;
+    unsigned *sq_array = nullptr;
+    unsigned *cq_head = nullptr;
+    unsigned *cq_tail = nullptr;
+    unsigned *cq_mask = nullptr;
+    io_uring_sqe *sqes = nullptr;
+    io_uring_cqe *cqes = nullptr;
+    std::vector<struct statx> buffers;
+
+    ~batch_stat_ring();
+    bool setup(unsigned int depth);
+  };
+
+  batch_stat_ring::~batch_stat_ring()
+  {
+    if (sqes_ptr != MAP_FAILED) munmap(sqes_ptr, sqes_size);
+    if (cq_ptr != MAP_FAILED && cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+    if (sq_ptr != MAP_FAILED) munmap(sq_ptr, sq_size);
+    if (fd != -1) close(fd);
+  }
+
+  bool batch_stat_ring::setup(unsigned int depth)
+  {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+    if (fd == -1) return false;
+
+    entries = params.sq_entries;
+    sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+    const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) sq_size = cq_size = std::max(sq_size, cq_size);
+
+    sq_ptr = mmap(nullptr, sq_size, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq_ptr == MAP_FAILED) return false;
+
+    if (single_mmap)
+    {
+      cq_ptr = sq_ptr;
+    }
+    else
+    {
+      cq_ptr = mmap(nullptr, cq_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+      if (cq_ptr == MAP_FAILED) return false;
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ptr = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes_ptr == MAP_FAILED) return false;
+
+    char *sq = static_cast<char *>(sq_ptr);
+    sq_head = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+    char *cq = static_cast<char *>(cq_ptr);
+    cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    sqes = static_cast<io_uring_sqe *>(sqes_ptr);
+    buffers.resize(entries);
+
+    return true;
+  }
+
+  static void copy_statx(const struct statx& stx, struct stat& st)
+  {
+    memset(&st, 0, sizeof(st));
+    st.st_dev = makedev(stx.stx_dev_major, stx.stx_dev_minor);
+    st.st_ino = stx.stx_ino;
+    st.st_mode = stx.stx_mode;
+    st.st_nlink = stx.stx_nlink;
+    st.st_uid = stx.stx_uid;
+    st.st_gid = stx.stx_gid;
+    st.st_rdev = makedev(stx.stx_rdev_major, stx.stx_rdev_minor);
+    st.st_size = stx.stx_size;
+    st.st_blksize = stx.stx_blksize;
+    st.st_blocks = stx.stx_blocks;
+    st.st_atim.tv_sec = stx.stx_atime.tv_sec;
+    st.st_atim.tv_nsec = stx.stx_atime.tv_nsec;
+    st.st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+    st.st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+    st.st_ctim.tv_sec = stx.stx_ctime.tv_sec;
+    st.st_ctim.tv_nsec = stx.stx_ctime.tv_nsec;
+  }
+#else
+  struct batch_stat_ring
+  {
+  };
+#endif
+
+  batch_stat::batch_stat(bool use_io_uring, unsigned int depth)
+  {
+#ifdef HAVE_IO_URING
+    if (!use_io_uring) return;
+
+    ring = new batch_stat_ring();
+
+    if (!ring->setup(depth))
+    {
+      FSW_ELOGF(_("io_uring cannot be used: %s\n"), strerror(errno));
+      delete ring;
+      ring = nullptr;
+    }
+#endif
+  }
+
+  batch_stat::~batch_stat()
+  {
+    delete ring;
+  }
+
+  bool batch_stat::is_asynchronous() const
+  {
+    return ring != nullptr;
+  }
+
+  static int lstat_one(int dir_fd, const char *name, struct stat& fd_stat)
+  {
+    return fstatat(dir_fd, name, &fd_stat, AT_SYMLINK_NOFOLLOW) == 0 ? 0 : errno;
+  }
+
+  void batch_stat::lstat_at(int dir_fd,
+                            const std::vector<const char *>& names,
+                            std::vector<struct stat>& stats,
+                            std::vector<int>& errors)
+  {
+    const size_t n = names.size();
+    stats.resize(n);
+    errors.assign(n, 0);
+
+    size_t next = 0;
+
+#ifdef HAVE_IO_URING
+    bool unsupported = false;
+
+    while (ring && next < n)
+    {
+      const unsigned int batch =
+        static_cast<unsigned int>(std::min<size_t>(n - next, ring->entries));
+      const unsigned int mask = *ring->sq_mask;
+      unsigned int tail = *ring->sq_tail;
+
+      for (unsigned int i = 0; i < batch; ++i)
+      {
+        const unsigned int index = tail & mask;
+        io_uring_sqe *sqe = &ring->sqes[index];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_STATX;
+        sqe->fd = dir_fd;
+        sqe->addr = reinterpret_cast<uintptr_t>(names[next + i]);
+        sqe->len = STATX_BASIC_STATS;
+        sqe->off = reinterpret_cast<uintptr_t>(&ring->buffers[i]);
+        sqe->statx_flags = AT_SYMLINK_NOFOLLOW;
+        sqe->user_data = i;
+        ring->sq_array[index] = index;
+        ++tail;
+      }
+
+      __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+      unsigned int completed = 0;
+
+      while (completed < batch)
+      {
+        const unsigned int to_submit =
+          tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+        if (syscall(__NR_io_uring_enter, ring->fd, to_submit, 1,
+                    IORING_ENTER_GETEVENTS, nullptr, 0) == -1
+            && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+          // The completions of the submitted calls are still reaped below.
+          fsw_log_perror("io_uring_enter");
+          if (to_submit == batch - completed) break;
+        }
+
+        unsigned int head = *ring->cq_head;
+        const unsigned int cq_tail =
+          __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+        for (; head != cq_tail; ++head, ++completed)
+        {
+          const io_uring_cqe& cqe = ring->cqes[head & *ring->cq_mask];
+          const size_t i = next + cqe.user_data;
+
+          if (cqe.res == 0)
+          {
+            copy_statx(ring->buffers[cqe.user_data], stats[i]);
+          }
+          else if (cqe.res == -EINVAL)
+          {
+            // Kernels older than 5.6 do not support IORING_OP_STATX.
+            errors[i] = lstat_one(dir_fd, names[i], stats[i]);
+            if (errors[i] == 0) unsupported = true;
+          }
+          else
+          {
+            errors[i] = -cqe.res;
+          }
+        }
+
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+      }
+
+      if (completed < batch)
+      {
+        // Nothing was submitted: the remaining calls are made synchronously.
+        delete ring;
+        ring = nullptr;
+        break;
+      }
+
+      next += batch;
+
+      if (unsupported)
+      {
+        delete ring;
+        ring = nullptr;
+      }
+    }
+#endif
+
+    for (; next < n; ++next)
+      errors[next] = lstat_one(dir_fd, names[next], stats[next]);
+  }
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::batch_stat class.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_BATCH_STAT_H
+#  define FSW_BATCH_STAT_H
+
+#  include <cstddef>
+#  include <vector>
+#  include <sys/stat.h>
+
+namespace fsw
+{
+  struct batch_stat_ring;
+
+  /**
+   * @brief Gets the status of batches of files.
+   *
+   * When `libfswatch` is built with io_uring support and the kernel allows
+   * it, the `statx()` calls of a batch are submitted to an io_uring instance
+   * and up to the depth of the ring are in flight at the same time, which
+   * overlaps their latency on slow or network file systems.  Otherwise, or if
+   * the ring cannot be created, fstatat() is called for every file.
+   *
+   * An instance is meant to be used by a single thread.
+   */
+  class batch_stat
+  {
+  public:
+    /**
+     * @brief Constructs an instance of this class.
+     *
+     * @param use_io_uring Whether io_uring is used, if available.
+     * @param depth The maximum number of calls in flight.
+     */
+    explicit batch_stat(bool use_io_uring = true, unsigned int depth = 256);
+
+    /**
+     * @brief Destroys an instance of this class.
+     */
+    ~batch_stat();
+
+    batch_stat(const batch_stat&) = delete;
+    batch_stat& operator=(const batch_stat&) = delete;
+
+    /**
+     * @brief Checks whether the calls are submitted to io_uring.
+     *
+     * @return @c true if io_uring is used, @c false otherwise.
+     */
+    bool is_asynchronous() const;
+
+    /**
+     * @brief Gets the status of files without following symbolic links.
+     *
+     * @param dir_fd The directory relative paths are resolved from, or
+     * `AT_FDCWD`.
+     * @param names The paths of the files.
+     * @param stats The status of the files, resized to the size of @p names.
+     * @param errors The error of each call (`0` on success), resized to the
+     * size of @p names.
+     */
+    void lstat_at(int dir_fd,
+                  const std::vector<const char *>& names,
+                  std::vector<struct stat>& stats,
+                  std::vector<int>& errors);
+
+  private:
+    batch_stat_ring *ring = nullptr;
+  };
+}
+
+#endif  /* FSW_BATCH_STAT_H */
@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "gettext_defs.h"
+#include "composite_monitor.hpp"
+#include "monitor_factory.hpp"
+#include "libfswatch_exception.hpp"
+#include "string/string_utils.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <utility>
+#include "../c/libfswatch_log.h"
+
+namespace fsw
+{
+  composite_monitor::composite_monitor(std::vector<std::string> paths,
+                                       FSW_EVENT_CALLBACK *callback,
+                                       void *context) :
+    monitor(std::move(paths), callback, context)
+  {
+  }
+
+  composite_monitor::~composite_monitor()
+  {
+  }
+
+  bool composite_monitor::forwards_events() const
+  {
+    return true;
+  }
+
+  void composite_monitor::child_callback(const std::vector<event>& events,
+                                         void *context)
+  {
+    static_cast<composite_monitor *> (context)->notify_events(events);
+  }
+
+  std::vector<composite_monitor::partition>
+  composite_monitor::partition_paths()
+  {
+    fsw_monitor_type type = system_default_monitor_type;
+    std::string type_value = get_property(COMPOSITE_TYPE);
+
+    if (!type_value.empty()
+        && (!monitor_factory::find_type(type_value, type)
+            || type == composite_monitor_type))
+    {
+      std::string msg = string_utils::string_from_format(
+        _("Invalid value of the %s property: %s"),
+        COMPOSITE_TYPE,
+        type_value.c_str());
+      throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+    }
+
+    unsigned long shards = 0;
+    std::string shards_value = get_property(COMPOSITE_SHARDS);
+
+    if (!shards_value.empty())
+    {
+      char *end;
+      shards = strtoul(shards_value.c_str(), &end, 10);
+
+      if (*end != '\0' || shards_value[0] == '-')
+      {
+        std::string msg = string_utils::string_from_format(
+          _("Invalid value of the %s property: %s"),
+          COMPOSITE_SHARDS,
+          shards_value.c_str());
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+      }
+    }
+
+    if (shards == 0) shards = std::thread::hardware_concurrency();
+    if (shards == 0 || shards > paths.size()) shards = paths.size();
+
+    std::vector<partition> partitions(shards);
+
+    for (partition& part : partitions) part.type = type;
+
+    for (size_t i = 0; i < paths.size(); ++i)
+      partitions[i % shards].paths.push_back(paths[i]);
+
+    return partitions;
+  }
+
+  monitor *composite_monitor::create_child(const partition& part)
+  {
+    monitor *child_monitor = monitor_factory::create_monitor(part.type,
+                                                             part.paths,
+                                                             child_callback,
+                                                             this);
+    copy_settings(*child_monitor);
+    if (part.latency > 0) child_monitor->set_latency(part.latency);
+
+    // The properties set on this monitor take precedence.
+    for (const auto& property : part.default_properties)
+    {
+      if (properties.find(property.first) == properties.end())
+        child_monitor->set_property(property.first, property.second);
+    }
+
+    return child_monitor;
+  }
+
+  void composite_monitor::run_child(child& c)
+  {
+    try
+    {
+      c.mon->start();
+    }
+    catch (...)
+    {
+      std::lock_guard<std::mutex> guard(children_mutex);
+      if (!child_error) child_error = std::current_exception();
+    }
+
+    std::lock_guard<std::mutex> guard(children_mutex);
+    --running_children;
+    children_cond.notify_all();
+  }
+
+  /*
+   * Stops the children and waits for their threads to return.  A child whose
+   * thread has not started it yet ignores stop(): it is stopped again until
+   * every thread has returned.
+   */
+  void composite_monitor::stop_children()
+  {
+    std::unique_lock<std::mutex> lock(children_mutex);
+
+    while (running_children > 0)
+    {
+      lock.unlock();
+      for (child& c : children) c.mon->stop();
+      lock.lock();
+
+      children_cond.wait_for(lock,
+                             std::chrono::milliseconds(10),
+                             [this]
+                             { return running_children == 0; });
+    }
+
+    lock.unlock();
+
+    for (child& c : children) c.thread.join();
+  }
+
+  void composite_monitor::run()
+  {
+    std::vector<partition> partitions = partition_paths();
+
+    try
+    {
+      for (const partition& part : partitions)
+      {
+        if (part.paths.empty()) continue;
+
+        children.emplace_back();
+        children.back().mon.reset(create_child(part));
+      }
+    }
+    catch (...)
+    {
+      children.clear();
+      throw;
+    }
+
+    FSW_ELOGF(_("Starting %zu child monitors.\n"), children.size());
+
+    {
+      std::lock_guard<std::mutex> guard(children_mutex);
+      running_children = children.size();
+    }
+
+    // The vector is not resized while the threads are running.
+    for (child& c : children)
+      c.thread = std::thread(&composite_monitor::run_child, this, std::ref(c));
+
+    {
+      std::unique_lock<std::mutex> lock(children_mutex);
+
+      children_cond.wait(lock,
+                         [this]
+                         {
+                           return stop_requested
+                             || child_error
+                             || running_children == 0;
+                         });
+    }
+
+    stop_children();
+    children.clear();
+
+    std::exception_ptr error;
+
+    {
+      std::lock_guard<std::mutex> guard(children_mutex);
+      error = child_error;
+      child_error = nullptr;
+      stop_requested = false;
+    }
+
+    if (error) std::rethrow_exception(error);
+  }
+
+  void composite_monitor::on_stop()
+  {
+    std::lock_guard<std::mutex> guard(children_mutex);
+    stop_requested = true;
+    children_cond.notify_all();
+  }
+}
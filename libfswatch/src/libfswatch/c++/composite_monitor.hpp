@@ -0,0 +1,178 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Monitor sharding its paths across child monitors.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_COMPOSITE_MONITOR_H
+#  define FSW_COMPOSITE_MONITOR_H
+
+#  include "monitor.hpp"
+#  include <map>
+#  include <string>
+#  include <vector>
+#  include <mutex>
+#  include <condition_variable>
+#  include <exception>
+#  include <memory>
+#  include <thread>
+
+namespace fsw
+{
+  /**
+   * @brief Monitor sharding its paths across child monitors.
+   *
+   * This monitor partitions the paths to watch and creates a child monitor
+   * for every partition, of the type chosen by the partition.  Every child
+   * runs on its own thread and is configured with the settings of this
+   * monitor (see monitor::copy_settings()), so that a busy path, or a path
+   * on a slow file system, does not delay the events of the paths watched by
+   * the other children.  By default, the paths are distributed in turn among
+   * #COMPOSITE_SHARDS children of type #COMPOSITE_TYPE.
+   *
+   * The events of all the children are notified by this monitor, so that its
+   * callbacks, its delivery queue and its coalescing window apply to all of
+   * them.  The batches of the children are notified one at a time, in the
+   * order in which they are received, and they are never interleaved.
+   *
+   * If a child fails, the other children are stopped and the exception is
+   * rethrown by start().  Paths added or removed while the monitor is running
+   * are watched the next time it is started.
+   */
+  class composite_monitor : public monitor
+  {
+  public:
+    /**
+     * @brief Custom monitor property used to set the type of the children.
+     *
+     * The value is the name of a monitor type, such as `poll_monitor`.  The
+     * default is the default monitor of the platform.
+     */
+    static constexpr const char *COMPOSITE_TYPE = "composite.type";
+
+    /**
+     * @brief Custom monitor property used to set the number of children.
+     *
+     * No more children than paths are created.  If `0` is specified, which
+     * is the default, the number of hardware threads is used.
+     */
+    static constexpr const char *COMPOSITE_SHARDS = "composite.shards";
+
+    /**
+     * @brief Constructs an instance of this class.
+     */
+    composite_monitor(std::vector<std::string> paths,
+                      FSW_EVENT_CALLBACK *callback,
+                      void *context = nullptr);
+
+    /**
+     * @brief Destroys an instance of this class.
+     */
+    virtual ~composite_monitor();
+
+  protected:
+    /**
+     * @brief A subset of the paths to watch and the monitor watching them.
+     */
+    struct partition
+    {
+      /**
+       * @brief The type of the child monitor.
+       */
+      fsw_monitor_type type;
+
+      /**
+       * @brief The paths watched by the child monitor.
+       */
+      std::vector<std::string> paths;
+
+      /**
+       * @brief The latency of the child monitor, or @c 0 to use the latency
+       * of this monitor.
+       */
+      double latency = 0;
+
+      /**
+       * @brief Properties set on the child monitor in addition to the
+       * properties of this monitor, unless this monitor sets them.
+       */
+      std::map<std::string, std::string> default_properties;
+    };
+
+    /**
+     * @brief Partitions the paths to watch.
+     *
+     * This function is called by run() every time the monitor starts.  By
+     * default, the paths are distributed in turn among the children
+     * configured by #COMPOSITE_TYPE and #COMPOSITE_SHARDS.
+     *
+     * @return The partitions of monitor::paths.  Empty partitions are
+     * ignored.
+     * @throw libfsw_exception if the properties are not valid.
+     */
+    virtual std::vector<partition> partition_paths();
+
+    /**
+     * @brief Starts the child monitors and waits until they stop.
+     *
+     * This call does not return until the monitor is stopped or a child
+     * fails.
+     *
+     * @see stop()
+     */
+    void run() override;
+
+    /**
+     * @brief Wakes up the monitor loop.
+     */
+    void on_stop() override;
+
+    /**
+     * @brief Returns @c true, since the children watch the paths.
+     */
+    bool forwards_events() const override;
+
+  private:
+    composite_monitor(const composite_monitor& orig) = delete;
+    composite_monitor& operator=(const composite_monitor& that) = delete;
+
+    struct child
+    {
+      std::unique_ptr<monitor> mon;
+      std::thread thread;
+    };
+
+    static void child_callback(const std::vector<event>& events,
+                               void *context);
+    monitor *create_child(const partition& part);
+    void run_child(child& c);
+    void stop_children();
+
+    std::vector<child> children;
+    std::mutex children_mutex;
+    std::condition_variable children_cond;
+    size_t running_children = 0;
+    bool stop_requested = false;
+    std::exception_ptr child_error;
+  };
+}
+
+#endif  /* FSW_COMPOSITE_MONITOR_H */
@@ -0,0 +1,471 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "gettext_defs.h"
+#include "content_verifier.hpp"
+#include "event.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined HAVE_STRUCT_STAT_ST_MTIMESPEC
+#  define FSW_MTIME(stat) ((stat).st_mtimespec.tv_sec)
+#  define FSW_MTIME_NSEC(stat) ((stat).st_mtimespec.tv_nsec)
+#elif defined HAVE_STRUCT_STAT_ST_MTIM
+#  define FSW_MTIME(stat) ((stat).st_mtim.tv_sec)
+#  define FSW_MTIME_NSEC(stat) ((stat).st_mtim.tv_nsec)
+#else
+#  define FSW_MTIME(stat) ((stat).st_mtime)
+#  define FSW_MTIME_NSEC(stat) 0
+#endif
+
+#ifndef O_CLOEXEC
+#  define O_CLOEXEC 0
+#endif
+
+using namespace std;
+
+namespace fsw
+{
+  // Size of the buffer the files are read into.
+  static const size_t READ_BUFFER_SIZE = 128 * 1024;
+
+  // Files at least this large are read ahead aggressively by the kernel.
+  static const off_t SEQUENTIAL_READ_SIZE = 1024 * 1024;
+
+  /*
+   * Streaming implementation of the XXH64 hash.  Words are read in the byte
+   * order of the host, which only affects the value of the hashes, which are
+   * never stored.  The four lanes are independent, so that their rounds can
+   * be executed in parallel by the processor.
+   */
+  class content_hash
+  {
+  public:
+    void update(const char *data, size_t length)
+    {
+      total_length += length;
+
+      if (buffered + length < sizeof(stripe))
+      {
+        memcpy(stripe + buffered, data, length);
+        buffered += length;
+        return;
+      }
+
+      if (buffered > 0)
+      {
+        const size_t fill = sizeof(stripe) - buffered;
+        memcpy(stripe + buffered, data, fill);
+        consume(stripe);
+        data += fill;
+        length -= fill;
+        buffered = 0;
+      }
+
+      while (length >= sizeof(stripe))
+      {
+        consume(data);
+        data += sizeof(stripe);
+        length -= sizeof(stripe);
+      }
+
+      memcpy(stripe, data, length);
+      buffered = length;
+    }
+
+    uint64_t digest() const
+    {
+      uint64_t h;
+
+      if (total_length >= sizeof(stripe))
+      {
+        h = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12)
+          + rotl(lanes[3], 18);
+
+        for (uint64_t lane : lanes) h = merge_round(h, lane);
+      }
+      else
+      {
+        h = PRIME5;
+      }
+
+      h += total_length;
+
+      size_t i = 0;
+
+      for (; i + 8 <= buffered; i += 8)
+      {
+        h ^= round(0, read64(stripe + i));
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+      }
+
+      if (i + 4 <= buffered)
+      {
+        h ^= (uint64_t) read32(stripe + i) * PRIME1;
+        h = rotl(h, 23) * PRIME2 + PRIME3;
+        i += 4;
+      }
+
+      for (; i < buffered; ++i)
+      {
+        h ^= (unsigned char) stripe[i] * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+      }
+
+      h ^= h >> 33;
+      h *= PRIME2;
+      h ^= h >> 29;
+      h *= PRIME3;
+      h ^= h >> 32;
+
+      return h;
+    }
+
+  private:
+    static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+    static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+    static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+    static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+    static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+    static uint64_t rotl(uint64_t x, int r)
+    {
+      return (x << r) | (x >> (64 - r));
+    }
+
+    static uint64_t read64(const char *p)
+    {
+      uint64_t value;
+      memcpy(&value, p, sizeof(value));
+      return value;
+    }
+
+    static uint32_t read32(const char *p)
+    {
+      uint32_t value;
+      memcpy(&value, p, sizeof(value));
+      return value;
+    }
+
+    static uint64_t round(uint64_t acc, uint64_t input)
+    {
+      acc += input * PRIME2;
+      acc = rotl(acc, 31);
+      return acc * PRIME1;
+    }
+
+    static uint64_t merge_round(uint64_t acc, uint64_t lane)
+    {
+      acc ^= round(0, lane);
+      return acc * PRIME1 + PRIME4;
+    }
+
+    void consume(const char *p)
+    {
+      lanes[0] = round(lanes[0], read64(p));
+      lanes[1] = round(lanes[1], read64(p + 8));
+      lanes[2] = round(lanes[2], read64(p + 16));
+      lanes[3] = round(lanes[3], read64(p + 24));
+    }
+
+    uint64_t lanes[4] = {PRIME1 + PRIME2, PRIME2, 0, 0 - PRIME1};
+    char stripe[32];
+    size_t buffered = 0;
+    uint64_t total_length = 0;
+  };
+
+  static uint64_t get_file_key(dev_t dev, ino_t ino)
+  {
+    uint64_t key = (uint64_t) ino;
+    key ^= (uint64_t) dev + 0x9E3779B97F4A7C15ULL + (key << 6) + (key >> 2);
+    return key;
+  }
+
+  static bool same_time(const timespec& lhs, const timespec& rhs)
+  {
+    return lhs.tv_sec == rhs.tv_sec && lhs.tv_nsec == rhs.tv_nsec;
+  }
+
+  static timespec get_mtime(const struct stat& st)
+  {
+    timespec mtime;
+    mtime.tv_sec = FSW_MTIME(st);
+    mtime.tv_nsec = FSW_MTIME_NSEC(st);
+    return mtime;
+  }
+
+  /*
+   * Hashes the content of a file, filling the metadata of the opened file.
+   */
+  static bool hash_file(const char *path,
+                        vector<char>& buffer,
+                        struct stat& st,
+                        uint64_t& hash)
+  {
+    int fd;
+
+    do
+    {
+      fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    while (fd == -1 && errno == EINTR);
+
+    if (fd == -1) return false;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+      close(fd);
+      return false;
+    }
+
+#ifdef HAVE_POSIX_FADVISE
+    if (st.st_size >= SEQUENTIAL_READ_SIZE)
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if (buffer.size() < READ_BUFFER_SIZE) buffer.resize(READ_BUFFER_SIZE);
+
+    content_hash hasher;
+    bool read_all = true;
+
+    for (;;)
+    {
+      const ssize_t count = read(fd, buffer.data(), buffer.size());
+
+      if (count > 0)
+      {
+        hasher.update(buffer.data(), (size_t) count);
+        continue;
+      }
+
+      if (count == 0) break;
+      if (errno == EINTR) continue;
+
+      read_all = false;
+      break;
+    }
+
+    close(fd);
+
+    hash = hasher.digest();
+
+    return read_all;
+  }
+
+  content_verifier::content_verifier(size_t cache_size,
+                                     unsigned int threads,
+                                     const thread_settings& worker_settings) :
+    cache_size(cache_size > 0 ? cache_size : 1),
+    worker_settings(worker_settings)
+  {
+    if (threads == 0) threads = std::thread::hardware_concurrency();
+
+    // The thread calling verify() hashes files as well.
+    for (unsigned int i = 1; i < threads; ++i)
+      workers.emplace_back(&content_verifier::worker_loop, this);
+  }
+
+  content_verifier::~content_verifier()
+  {
+    {
+      lock_guard<mutex> lock(pool_mutex);
+      stopped = true;
+      work_cond.notify_all();
+    }
+
+    for (std::thread& worker : workers) worker.join();
+  }
+
+  void content_verifier::store(const entry& file)
+  {
+    const uint64_t key = get_file_key(file.dev, file.ino);
+    auto it = index.find(key);
+
+    if (it != index.end())
+    {
+      *it->second = file;
+      lru.splice(lru.begin(), lru, it->second);
+      return;
+    }
+
+    if (index.size() >= cache_size)
+    {
+      index.erase(get_file_key(lru.back().dev, lru.back().ino));
+      lru.pop_back();
+    }
+
+    lru.push_front(file);
+    index[key] = lru.begin();
+  }
+
+  bool content_verifier::is_unchanged(const char *path,
+                                      vector<char>& buffer,
+                                      bool& hashed)
+  {
+    struct stat st;
+
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+
+    const timespec mtime = get_mtime(st);
+    entry previous = entry();
+    bool known = false;
+
+    {
+      lock_guard<mutex> lock(cache_mutex);
+      auto it = index.find(get_file_key(st.st_dev, st.st_ino));
+
+      if (it != index.end()
+          && it->second->dev == st.st_dev
+          && it->second->ino == st.st_ino)
+      {
+        previous = *it->second;
+        known = true;
+
+        // A file modified within a second of being hashed may have been
+        // modified again without changing its modification time.
+        const bool trusted_mtime =
+          previous.hashed
+          && previous.mtime.tv_sec < previous.hash_time.tv_sec - 1;
+
+        if (trusted_mtime
+            && previous.size == st.st_size
+            && same_time(previous.mtime, mtime))
+        {
+          lru.splice(lru.begin(), lru, it->second);
+          return true;
+        }
+
+        // A file whose size changed is only hashed when its size is stable.
+        if (previous.size != st.st_size)
+        {
+          it->second->size = st.st_size;
+          it->second->mtime = mtime;
+          it->second->hashed = false;
+          lru.splice(lru.begin(), lru, it->second);
+          return false;
+        }
+      }
+    }
+
+    entry file;
+    file.hash_time = event::get_current_time();
+    hashed = true;
+
+    if (!hash_file(path, buffer, st, file.hash)) return false;
+
+    file.dev = st.st_dev;
+    file.ino = st.st_ino;
+    file.size = st.st_size;
+    file.mtime = get_mtime(st);
+    file.hashed = true;
+
+    {
+      lock_guard<mutex> lock(cache_mutex);
+      store(file);
+    }
+
+    return known
+      && previous.hashed
+      && previous.size == file.size
+      && previous.hash == file.hash;
+  }
+
+  void content_verifier::run_job(job& current, vector<char>& buffer)
+  {
+    const vector<const char *>& paths = *current.paths;
+
+    for (size_t i = current.next++; i < paths.size(); i = current.next++)
+    {
+      bool hashed = false;
+      (*current.unchanged)[i] = is_unchanged(paths[i], buffer, hashed) ? 1 : 0;
+      if (hashed) ++current.hashed;
+    }
+  }
+
+  void content_verifier::worker_loop()
+  {
+    worker_settings.try_apply(_("Content verifier thread"));
+
+    vector<char> worker_buffer;
+    uint64_t seen_generation = 0;
+    unique_lock<mutex> lock(pool_mutex);
+
+    for (;;)
+    {
+      work_cond.wait(lock,
+                     [this, seen_generation]
+                     {
+                       return stopped || generation != seen_generation;
+                     });
+
+      if (stopped) return;
+
+      seen_generation = generation;
+
+      // The job may have been completed before this thread woke up.
+      if (!current_job) continue;
+
+      job *assigned = current_job;
+      ++busy_workers;
+      lock.unlock();
+
+      run_job(*assigned, worker_buffer);
+
+      lock.lock();
+      if (--busy_workers == 0) done_cond.notify_all();
+    }
+  }
+
+  size_t content_verifier::verify(const vector<const char *>& paths,
+                                  vector<char>& unchanged)
+  {
+    lock_guard<mutex> verify_lock(verify_mutex);
+
+    unchanged.assign(paths.size(), 0);
+    if (paths.empty()) return 0;
+
+    job current;
+    current.paths = &paths;
+    current.unchanged = &unchanged;
+
+    const bool parallel = !workers.empty() && paths.size() > 1;
+
+    if (parallel)
+    {
+      lock_guard<mutex> lock(pool_mutex);
+      current_job = &current;
+      ++generation;
+      work_cond.notify_all();
+    }
+
+    run_job(current, buffer);
+
+    if (parallel)
+    {
+      unique_lock<mutex> lock(pool_mutex);
+      done_cond.wait(lock, [this] { return busy_workers == 0; });
+      current_job = nullptr;
+    }
+
+    return current.hashed;
+  }
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::content_verifier class.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_CONTENT_VERIFIER_H
+#  define FSW_CONTENT_VERIFIER_H
+
+#  include "libfswatch_map.hpp"
+#  include "thread_settings.hpp"
+#  include <atomic>
+#  include <condition_variable>
+#  include <cstddef>
+#  include <cstdint>
+#  include <ctime>
+#  include <list>
+#  include <mutex>
+#  include <thread>
+#  include <vector>
+#  include <sys/types.h>
+
+namespace fsw
+{
+  /**
+   * @brief Checker of the regular files whose content did not change.
+   *
+   * The verifier keeps a bounded cache of the hash of the content of the
+   * files it has checked, keyed by their device and inode numbers: when the
+   * cache is full, the least recently checked file is evicted.  A file is
+   * only read if its size is the same as when it was last checked but its
+   * modification time is not: a file whose size changed has changed, and a
+   * file whose size and modification time did not change has not, unless it
+   * was modified less than a second before it was hashed, since the
+   * resolution of the modification time of some file systems is coarser.
+   *
+   * The files checked by a call to verify() are distributed among a pool of
+   * threads, which includes the calling thread.
+   */
+  class content_verifier
+  {
+  public:
+    /**
+     * @brief Constructs a verifier.
+     *
+     * @param cache_size The maximum number of files in the cache.
+     * @param threads The number of threads hashing files, including the
+     * thread calling verify(), or @c 0 to use the number of hardware threads.
+     * @param worker_settings The scheduling attributes of the threads of the
+     * verifier.
+     */
+    content_verifier(size_t cache_size,
+                     unsigned int threads,
+                     const thread_settings& worker_settings = thread_settings());
+
+    /**
+     * @brief Stops the threads of the verifier.
+     */
+    ~content_verifier();
+
+    content_verifier(const content_verifier& orig) = delete;
+    content_verifier& operator=(const content_verifier& that) = delete;
+
+    /**
+     * @brief Checks which files did not change since they were last checked.
+     *
+     * A path which is not a regular file, or which cannot be read, is
+     * considered changed.  So is a file the verifier has not checked before,
+     * which is hashed so that its next changes can be verified.
+     *
+     * @param paths The paths of the files to check.
+     * @param unchanged A vector receiving an element per path, which is not
+     * @c 0 if the content of the file did not change.
+     * @return The number of files which were read.
+     */
+    size_t verify(const std::vector<const char *>& paths,
+                  std::vector<char>& unchanged);
+
+  private:
+    struct entry
+    {
+      dev_t dev;
+      ino_t ino;
+      off_t size;
+      timespec mtime;
+      timespec hash_time;
+      uint64_t hash;
+      bool hashed;
+    };
+
+    struct job
+    {
+      const std::vector<const char *> *paths;
+      std::vector<char> *unchanged;
+      std::atomic<size_t> next{0};
+      std::atomic<size_t> hashed{0};
+    };
+
+    bool is_unchanged(const char *path,
+                      std::vector<char>& buffer,
+                      bool& hashed);
+    void store(const entry& file);
+    void run_job(job& current, std::vector<char>& buffer);
+    void worker_loop();
+
+    size_t cache_size;
+    std::list<entry> lru;
+    fsw_hash_map<uint64_t, std::list<entry>::iterator> index;
+    std::mutex cache_mutex;
+
+    std::vector<std::thread> workers;
+    thread_settings worker_settings;
+    std::mutex pool_mutex;
+    std::condition_variable work_cond;
+    std::condition_variable done_cond;
+    job *current_job = nullptr;
+    uint64_t generation = 0;
+    size_t busy_workers = 0;
+    bool stopped = false;
+
+    std::mutex verify_mutex;
+    std::vector<char> buffer;
+  };
+}
+
+#endif  /* FSW_CONTENT_VERIFIER_H */
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "gettext_defs.h"
+#include "deadline_timer.hpp"
+#include <thread>
+
+using namespace std;
+
+namespace fsw
+{
+  deadline_timer& deadline_timer::get_instance()
+  {
+    // The instance is never destroyed, since its thread is detached and may
+    // still be running when the process exits.
+    static deadline_timer *instance = new deadline_timer();
+
+    return *instance;
+  }
+
+  void deadline_timer::add(void *data,
+                           timer_callback *callback,
+                           clock::time_point deadline,
+                           const thread_settings& settings)
+  {
+    lock_guard<std::mutex> lock(mutex);
+
+    timers.insert({deadline, {data, callback}});
+
+    if (running)
+    {
+      cond.notify_all();
+      return;
+    }
+
+    running = true;
+    thread(&deadline_timer::run, this, settings).detach();
+  }
+
+  bool deadline_timer::erase(void *data)
+  {
+    for (auto it = timers.begin(); it != timers.end(); ++it)
+    {
+      if (it->second.data != data) continue;
+
+      timers.erase(it);
+      return true;
+    }
+
+    return false;
+  }
+
+  void deadline_timer::remove(void *data)
+  {
+    unique_lock<std::mutex> lock(mutex);
+
+    cond.wait(lock, [this, data] { return expiring != data; });
+
+    if (erase(data)) cond.notify_all();
+  }
+
+  void deadline_timer::run(thread_settings settings)
+  {
+    settings.try_apply(_("Timer thread"));
+
+    unique_lock<std::mutex> lock(mutex);
+
+    while (!timers.empty())
+    {
+      auto first = timers.begin();
+
+      if (clock::now() < first->first)
+      {
+        cond.wait_until(lock, first->first);
+        continue;
+      }
+
+      const timer expired = first->second;
+      timers.erase(first);
+      expiring = expired.data;
+
+      // The callback is invoked unlocked, so that it may add other timers.
+      lock.unlock();
+      const clock::time_point next = expired.callback(expired.data);
+      lock.lock();
+
+      if (next != clock::time_point::max())
+        timers.insert({next, expired});
+
+      expiring = nullptr;
+      cond.notify_all();
+    }
+
+    running = false;
+  }
+}
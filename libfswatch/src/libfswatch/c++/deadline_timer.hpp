@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::deadline_timer class.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_DEADLINE_TIMER_H
+#  define FSW_DEADLINE_TIMER_H
+
+#  include <chrono>
+#  include <condition_variable>
+#  include <map>
+#  include <mutex>
+#  include "thread_settings.hpp"
+
+namespace fsw
+{
+  /**
+   * @brief Timer shared by all the monitors of a process.
+   *
+   * A single thread sleeps on a condition variable until the earliest
+   * deadline of the registered timers, and then invokes the callback of the
+   * expired timer.  The callback returns the next deadline of the timer, so
+   * that a timer whose deadline has been postponed since it was armed is
+   * re-armed without waking the timer thread every time it is postponed.
+   *
+   * The thread is started when the first timer is added and it exits when the
+   * last timer is removed.  It is configured by the settings of the timer
+   * which starts it.
+   */
+  class deadline_timer
+  {
+  public:
+    /**
+     * @brief Clock of the deadlines.
+     */
+    typedef std::chrono::steady_clock clock;
+
+    /**
+     * @brief Function invoked when a timer expires.
+     *
+     * The function receives the data the timer was added with and returns the
+     * next deadline of the timer, or clock::time_point::max() to disarm it.
+     */
+    typedef clock::time_point timer_callback(void *data);
+
+    /**
+     * @brief Returns the timer of the process.
+     *
+     * @return The timer of the process.
+     */
+    static deadline_timer& get_instance();
+
+    /**
+     * @brief Adds a timer.
+     *
+     * @param data The data identifying the timer, which is passed to
+     * @p callback.
+     * @param callback The function invoked when the timer expires.
+     * @param deadline The first deadline of the timer.
+     * @param settings The scheduling attributes of the timer thread, applied
+     * if this timer starts it.
+     */
+    void add(void *data,
+             timer_callback *callback,
+             clock::time_point deadline,
+             const thread_settings& settings = thread_settings());
+
+    /**
+     * @brief Removes a timer.
+     *
+     * If the callback of the timer is being invoked, this function waits until
+     * it returns; after this function returns, the callback is never invoked
+     * again.  This function must not be called from the callback of the timer.
+     *
+     * @param data The data identifying the timer.
+     */
+    void remove(void *data);
+
+  private:
+    struct timer
+    {
+      void *data;
+      timer_callback *callback;
+    };
+
+    deadline_timer() = default;
+    deadline_timer(const deadline_timer& orig) = delete;
+    deadline_timer& operator=(const deadline_timer& that) = delete;
+
+    void run(thread_settings settings);
+    bool erase(void *data);
+
+    std::multimap<clock::time_point, timer> timers;
+    std::mutex mutex;
+    std::condition_variable cond;
+    void *expiring = nullptr;
+    bool running = false;
+  };
+}
+
+#endif  /* FSW_DEADLINE_TIMER_H */
@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "delivery_queue.hpp"
+#include <iterator>
+#include <utility>
+
+using namespace std;
+
+namespace fsw
+{
+  bool delivery_queue::slot::empty() const
+  {
+    return events.empty() && batch.empty();
+  }
+
+  void delivery_queue::slot::clear()
+  {
+    events.clear();
+    batch.clear();
+    overflow = false;
+    overflow_path.clear();
+  }
+
+  delivery_queue::delivery_queue(size_t capacity, fsw_delivery_policy policy) :
+    capacity(capacity), policy(policy), slots(capacity)
+  {
+  }
+
+  size_t delivery_queue::size() const
+  {
+    const size_t position = head.load();
+
+    return tail.load() - position + (has_pending.load() ? 1 : 0);
+  }
+
+  bool delivery_queue::full() const
+  {
+    return tail.load() - head.load() >= capacity;
+  }
+
+  void delivery_queue::wake_consumer()
+  {
+    lock_guard<std::mutex> lock(mutex);
+    not_empty.notify_one();
+  }
+
+  void delivery_queue::push(vector<event>& events, event_batch& batch)
+  {
+    if (policy == fsw_delivery_block && full())
+    {
+      unique_lock<std::mutex> lock(mutex);
+      producer_waiting.store(true);
+      not_full.wait(lock, [this] { return closed.load() || !full(); });
+      producer_waiting.store(false);
+    }
+
+    if (closed.load()) return;
+
+    // Once the ring has been full, the events are queued in the pending slot
+    // until the consumer has drained the ring, so that their order is kept.
+    if (!has_pending.load() && !full())
+    {
+      const size_t position = tail.load(memory_order_relaxed);
+      slot& free_slot = slots[position % capacity];
+
+      swap(free_slot.events, events);
+      swap(free_slot.batch, batch);
+      events.clear();
+      batch.clear();
+
+      // The store and the load are sequentially consistent, so that either the
+      // consumer sees the new slot or the producer sees the consumer waiting.
+      tail.store(position + 1);
+      if (consumer_waiting.load()) wake_consumer();
+
+      return;
+    }
+
+    lock_guard<std::mutex> lock(mutex);
+    merge(events, batch);
+    has_pending.store(true);
+    not_empty.notify_one();
+  }
+
+  void delivery_queue::merge(vector<event>& events, event_batch& batch)
+  {
+    if (policy == fsw_delivery_drop)
+    {
+      if (!pending.overflow)
+      {
+        pending.overflow = true;
+
+        if (!events.empty())
+          pending.overflow_path = events[0].get_path();
+        else if (!batch.empty())
+          pending.overflow_path.assign(batch[0].get_path(),
+                                       batch[0].get_path_length());
+      }
+    }
+    else
+    {
+      pending.events.insert(pending.events.end(),
+                            make_move_iterator(events.begin()),
+                            make_move_iterator(events.end()));
+
+      for (size_t i = 0; i < batch.size(); ++i)
+      {
+        const event_view evt = batch[i];
+
+        pending.batch.add(evt.get_path(),
+                          evt.get_path_length(),
+                          evt.get_timespec(),
+                          evt.get_flags(),
+                          evt.get_old_path(),
+                          evt.get_old_path_length());
+      }
+    }
+
+    events.clear();
+    batch.clear();
+  }
+
+  bool delivery_queue::pop(slot& item)
+  {
+    // The storage of item is handed back to the producer.
+    item.clear();
+
+    for (;;)
+    {
+      const size_t position = head.load(memory_order_relaxed);
+
+      if (position != tail.load())
+      {
+        swap(item, slots[position % capacity]);
+        head.store(position + 1);
+
+        if (producer_waiting.load())
+        {
+          lock_guard<std::mutex> lock(mutex);
+          not_full.notify_one();
+        }
+
+        return true;
+      }
+
+      unique_lock<std::mutex> lock(mutex);
+
+      // The producer does not push into the ring while a slot is pending:
+      // since the ring is empty, the pending slot contains the newest events.
+      if (has_pending.load())
+      {
+        swap(item, pending);
+        pending.clear();
+        has_pending.store(false);
+
+        return true;
+      }
+
+      if (closed.load())
+      {
+        if (head.load() == tail.load()) return false;
+        continue;
+      }
+
+      consumer_waiting.store(true);
+      if (head.load() == tail.load()) not_empty.wait(lock);
+      consumer_waiting.store(false);
+    }
+  }
+
+  void delivery_queue::close()
+  {
+    lock_guard<std::mutex> lock(mutex);
+    closed.store(true);
+    not_empty.notify_all();
+    not_full.notify_all();
+  }
+}
@@ -0,0 +1,168 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::delivery_queue class.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_DELIVERY_QUEUE_H
+#  define FSW_DELIVERY_QUEUE_H
+
+#  include "event.hpp"
+#  include "event_batch.hpp"
+#  include "../c/cmonitor.h"
+#  include <atomic>
+#  include <condition_variable>
+#  include <mutex>
+#  include <string>
+#  include <vector>
+
+namespace fsw
+{
+  /**
+   * @brief Bounded queue handing batches of events from the monitor thread to
+   * the callback thread.
+   *
+   * The queue is a single-producer, single-consumer ring: the monitor thread
+   * pushes into it and the delivery thread pops from it without locking as
+   * long as the ring is neither full nor empty.  The mutex is only taken to
+   * sleep and to wake up the other thread, and to manage the pending slot
+   * which collects the events notified while the ring is full, according to
+   * the ::fsw_delivery_policy of the queue.
+   *
+   * The contents of the slots are swapped in and out of the ring, so that the
+   * storage of the events is recycled.
+   */
+  class delivery_queue
+  {
+  public:
+    /**
+     * @brief Batch of events stored by the queue.
+     *
+     * Only one of the two representations of the events is used, either the
+     * vector or the batch, depending on the callback set in the monitor.
+     */
+    struct slot
+    {
+      std::vector<event> events;   /**< The events as a vector. */
+      event_batch batch;           /**< The events as a batch. */
+      bool overflow = false;       /**< Events were dropped before this slot. */
+      std::string overflow_path;   /**< The path of the first dropped event. */
+
+      /**
+       * @brief Checks whether the slot contains no events.
+       *
+       * @return @c true if the slot is empty, @c false otherwise.
+       */
+      bool empty() const;
+
+      /**
+       * @brief Removes the events from the slot, retaining its storage.
+       */
+      void clear();
+    };
+
+    /**
+     * @brief Constructs a queue.
+     *
+     * @param capacity The number of slots of the ring, that is the number of
+     * batches which can be queued before @p policy is applied.  It must be
+     * greater than @c 0.
+     * @param policy The policy applied when the ring is full.
+     */
+    delivery_queue(size_t capacity, fsw_delivery_policy policy);
+
+    /**
+     * @brief This class is not copy constructible.
+     */
+    delivery_queue(const delivery_queue& orig) = delete;
+
+    /**
+     * @brief This class is not copy assignable.
+     */
+    delivery_queue& operator=(const delivery_queue& that) = delete;
+
+    /**
+     * @brief Pushes a batch of events.
+     *
+     * The events are swapped out of @p events and @p batch, which receive the
+     * cleared storage of a previously delivered slot.  This function must only
+     * be called by the producer thread.  If the ring is full, the policy of the
+     * queue is applied.
+     *
+     * @param events The events to push as a vector.
+     * @param batch The events to push as a batch.
+     */
+    void push(std::vector<event>& events, event_batch& batch);
+
+    /**
+     * @brief Pops a batch of events.
+     *
+     * This function blocks until a batch is available, or until the queue is
+     * closed and all its batches have been popped.  The events are swapped
+     * into @p item.  This function must only be called by the consumer
+     * thread.
+     *
+     * @param item The slot receiving the events.
+     * @return @c true if a batch was popped, @c false if the queue is closed
+     * and empty.
+     */
+    bool pop(slot& item);
+
+    /**
+     * @brief Closes the queue.
+     *
+     * A producer blocked in push() returns and the consumer returns from pop()
+     * after the queued batches have been popped.
+     */
+    void close();
+
+    /**
+     * @brief Gets the number of batches waiting to be popped.
+     *
+     * This function can be called by any thread: the value may be outdated
+     * once it is returned.
+     *
+     * @return The number of batches waiting to be popped.
+     */
+    size_t size() const;
+
+  private:
+    bool full() const;
+    void merge(std::vector<event>& events, event_batch& batch);
+    void wake_consumer();
+
+    const size_t capacity;
+    const fsw_delivery_policy policy;
+    std::vector<slot> slots;
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    std::atomic<bool> has_pending{false};
+    std::atomic<bool> consumer_waiting{false};
+    std::atomic<bool> producer_waiting{false};
+    std::atomic<bool> closed{false};
+    slot pending;
+    std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+  };
+}
+
+#endif  /* FSW_DELIVERY_QUEUE_H */
@@ -13,39 +13,142 @@
  * You should have received a copy of the GNU General Public License along with
  * this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
 #include "gettext_defs.h"
 #include "event.hpp"
 #include "libfswatch_exception.hpp"
 #include <map>
+#if !defined(HAVE_CLOCK_GETTIME) && defined(HAVE_GETTIMEOFDAY)
+#  include <sys/time.h>
+#endif
 
 using namespace std;
 
 namespace fsw
 {
+  static timespec make_timespec(time_t seconds)
+  {
+    timespec time;
+    time.tv_sec = seconds;
+    time.tv_nsec = 0;
+
+    return time;
+  }
+
   event::event(string path, time_t evt_time, vector<fsw_event_flag> flags) :
+    path(std::move(path)),
+    evt_time(make_timespec(evt_time)),
+    evt_flags(std::move(flags))
+  {
+  }
+
+  event::event(string path,
+               time_t evt_time,
+               vector<fsw_event_flag> flags,
+               string old_path) :
+    path(std::move(path)),
+    evt_time(make_timespec(evt_time)),
+    evt_flags(std::move(flags)),
+    old_path(std::move(old_path))
+  {
+  }
+
+  event::event(string path,
+               const timespec& evt_time,
+               vector<fsw_event_flag> flags) :
     path(std::move(path)), evt_time(evt_time), evt_flags(std::move(flags))
   {
   }
 
+  event::event(string path,
+               const timespec& evt_time,
+               vector<fsw_event_flag> flags,
+               string old_path) :
+    path(std::move(path)),
+    evt_time(evt_time),
+    evt_flags(std::move(flags)),
+    old_path(std::move(old_path))
+  {
+  }
+
   event::~event()
   {
   }
 
-  string event::get_path() const
+  const string& event::get_path() const
   {
     return path;
   }
 
   time_t event::get_time() const
+  {
+    return evt_time.tv_sec;
+  }
+
+  const timespec& event::get_timespec() const
   {
     return evt_time;
   }
 
-  vector<fsw_event_flag> event::get_flags() const
+  int64_t event::get_time_ns() const
+  {
+    return get_time_ns(evt_time);
+  }
+
+  uint64_t event::get_sequence() const
+  {
+    return sequence;
+  }
+
+  void event::set_sequence(uint64_t sequence)
+  {
+    this->sequence = sequence;
+  }
+
+  void event::assign(const char *path,
+                     size_t path_length,
+                     const timespec& evt_time,
+                     uint32_t flags,
+                     const char *old_path,
+                     size_t old_path_length)
+  {
+    this->path.assign(path, path_length);
+    this->evt_time = evt_time;
+    sequence = 0;
+    this->old_path.assign(old_path, old_path_length);
+
+    evt_flags.clear();
+
+    if (flags == 0)
+    {
+      evt_flags.push_back(NoOp);
+      return;
+    }
+
+    for (const fsw_event_flag& flag : FSW_ALL_EVENT_FLAGS)
+    {
+      if (flags & flag) evt_flags.push_back(flag);
+    }
+  }
+
+  const vector<fsw_event_flag>& event::get_flags() const
   {
     return evt_flags;
   }
 
+  uint32_t event::get_flag_mask() const
+  {
+    return get_flag_mask(evt_flags);
+  }
+
+  const string& event::get_old_path() const
+  {
+    return old_path;
+  }
+
   fsw_event_flag event::get_event_flag_by_name(const string& name)
   {
 #define FSW_MAKE_PAIR_FROM_NAME(p) {#p, p}
@@ -64,7 +167,8 @@ namespace fsw
       FSW_MAKE_PAIR_FROM_NAME(IsDir),
       FSW_MAKE_PAIR_FROM_NAME(IsSymLink),
       FSW_MAKE_PAIR_FROM_NAME(Link),
-      FSW_MAKE_PAIR_FROM_NAME(Overflow)
+      FSW_MAKE_PAIR_FROM_NAME(Overflow),
+      FSW_MAKE_PAIR_FROM_NAME(HistoryDone)
     };
 #undef FSW_MAKE_PAIR_FROM_NAME
 
@@ -94,7 +198,8 @@ namespace fsw
       FSW_MAKE_PAIR_FROM_NAME(IsDir),
       FSW_MAKE_PAIR_FROM_NAME(IsSymLink),
       FSW_MAKE_PAIR_FROM_NAME(Link),
-      FSW_MAKE_PAIR_FROM_NAME(Overflow)
+      FSW_MAKE_PAIR_FROM_NAME(Overflow),
+      FSW_MAKE_PAIR_FROM_NAME(HistoryDone)
     };
 #undef FSW_MAKE_PAIR_FROM_NAME
 
@@ -106,6 +211,59 @@ namespace fsw
     return name->second;
   }
 
+  uint32_t event::get_flag_mask(const vector<fsw_event_flag>& flags)
+  {
+    uint32_t mask = 0;
+
+    for (const fsw_event_flag& flag : flags) mask |= flag;
+
+    return mask;
+  }
+
+  vector<fsw_event_flag> event::get_flags_from_mask(uint32_t mask)
+  {
+    if (mask == 0) return {NoOp};
+
+    vector<fsw_event_flag> flags;
+
+    for (const fsw_event_flag& flag : FSW_ALL_EVENT_FLAGS)
+    {
+      if (mask & flag) flags.push_back(flag);
+    }
+
+    return flags;
+  }
+
+  timespec event::get_current_time()
+  {
+    timespec now;
+
+#if defined(HAVE_CLOCK_GETTIME)
+    if (clock_gettime(CLOCK_REALTIME, &now) == 0) return now;
+#elif defined(HAVE_GETTIMEOFDAY)
+    timeval tv;
+
+    if (gettimeofday(&tv, nullptr) == 0)
+    {
+      now.tv_sec = tv.tv_sec;
+      now.tv_nsec = tv.tv_usec * 1000;
+
+      return now;
+    }
+#endif
+
+    now.tv_sec = time(nullptr);
+    now.tv_nsec = 0;
+
+    return now;
+  }
+
+  int64_t event::get_time_ns(const timespec& time)
+  {
+    return static_cast<int64_t> (time.tv_sec) * 1000000000
+      + static_cast<int64_t> (time.tv_nsec);
+  }
+
   ostream& operator<<(ostream& out, const fsw_event_flag flag)
   {
     return out << event::get_event_flag_name(flag);
@@ -27,6 +27,7 @@
 #  define FSW_EVENT_H
 
 #  include <string>
+#  include <cstdint>
 #  include <ctime>
 #  include <vector>
 #  include <iostream>
@@ -41,8 +42,10 @@ namespace fsw
    * event contains:
    *
    *   - The path.
-   *   - The time the event was raised.
+   *   - The time the event was raised, with nanosecond resolution.
+   *   - The sequence number assigned by the monitor which notified it.
    *   - A vector of flags specifying the type of the event.
+   *   - The previous path of the object, if the event describes a rename.
    */
   class event
   {
@@ -56,6 +59,44 @@ namespace fsw
      */
     event(std::string path, time_t evt_time, std::vector<fsw_event_flag> flags);
 
+    /**
+     * @brief Constructs an event describing a rename.
+     *
+     * @param path The path the event refers to.
+     * @param evt_time The time the event was raised.
+     * @param flags The vector of flags specifying the type of the event.
+     * @param old_path The path of the object before it was renamed.
+     */
+    event(std::string path,
+          time_t evt_time,
+          std::vector<fsw_event_flag> flags,
+          std::string old_path);
+
+    /**
+     * @brief Constructs an event raised at a high-resolution time.
+     *
+     * @param path The path the event refers to.
+     * @param evt_time The time the event was raised.
+     * @param flags The vector of flags specifying the type of the event.
+     */
+    event(std::string path,
+          const timespec& evt_time,
+          std::vector<fsw_event_flag> flags);
+
+    /**
+     * @brief Constructs an event describing a rename raised at a
+     * high-resolution time.
+     *
+     * @param path The path the event refers to.
+     * @param evt_time The time the event was raised.
+     * @param flags The vector of flags specifying the type of the event.
+     * @param old_path The path of the object before it was renamed.
+     */
+    event(std::string path,
+          const timespec& evt_time,
+          std::vector<fsw_event_flag> flags,
+          std::string old_path);
+
     /**
      * @brief Destructs an event.
      *
@@ -63,12 +104,54 @@ namespace fsw
      */
     virtual ~event();
 
+    /**
+     * @brief Constructs a copy of an event.
+     */
+    event(const event& orig) = default;
+
+    /**
+     * @brief Constructs an event taking the storage of another event.
+     */
+    event(event&& orig) = default;
+
+    /**
+     * @brief Copies an event, reusing the storage of this one when it is
+     * large enough.
+     */
+    event& operator=(const event& that) = default;
+
+    /**
+     * @brief Moves an event into this one.
+     */
+    event& operator=(event&& that) = default;
+
+    /**
+     * @brief Replaces the contents of the event.
+     *
+     * The storage of the paths and of the flags of the event is reused when
+     * it is large enough, so that an event can be recycled without allocating
+     * memory.  The sequence number is reset to @c 0.
+     *
+     * @param path The path the event refers to.
+     * @param path_length The length of @p path.
+     * @param evt_time The time the event was raised.
+     * @param flags The bitmask of the flags of the event.
+     * @param old_path The path of the object before it was renamed.
+     * @param old_path_length The length of @p old_path.
+     */
+    void assign(const char *path,
+                size_t path_length,
+                const timespec& evt_time,
+                uint32_t flags,
+                const char *old_path,
+                size_t old_path_length);
+
     /**
      * @brief Returns the path of the event.
      *
      * @return The path of the event.
      */
-    std::string get_path() const;
+    const std::string& get_path() const;
 
     /**
      * @brief Returns the time of the event.
@@ -77,12 +160,69 @@ namespace fsw
      */
     time_t get_time() const;
 
+    /**
+     * @brief Returns the time of the event with nanosecond resolution.
+     *
+     * Monitors take the time when they read the event from the operating
+     * system.  Events constructed from a `time_t` have no fractional second.
+     *
+     * @return The time of the event.
+     */
+    const timespec& get_timespec() const;
+
+    /**
+     * @brief Returns the time of the event in nanoseconds since the epoch.
+     *
+     * @return The time of the event.
+     */
+    int64_t get_time_ns() const;
+
+    /**
+     * @brief Returns the sequence number of the event.
+     *
+     * Every monitor numbers the events it notifies, starting from `1`, in the
+     * order in which they are passed to its callback, so that events raised
+     * at the same time can be ordered and events dropped by the delivery
+     * queue can be detected.  Events which have not been notified yet have
+     * sequence number `0`.
+     *
+     * @return The sequence number of the event.
+     */
+    uint64_t get_sequence() const;
+
+    /**
+     * @brief Sets the sequence number of the event.
+     *
+     * @param sequence The sequence number of the event.
+     * @see get_sequence()
+     */
+    void set_sequence(uint64_t sequence);
+
     /**
      * @brief Returns the flags of the event.
      *
      * @return The flags of the event.
      */
-    std::vector<fsw_event_flag> get_flags() const;
+    const std::vector<fsw_event_flag>& get_flags() const;
+
+    /**
+     * @brief Returns the flags of the event as a bitmask.
+     *
+     * @return The bitmask of the flags of the event.
+     * @see get_flag_mask(const std::vector<fsw_event_flag>&)
+     */
+    uint32_t get_flag_mask() const;
+
+    /**
+     * @brief Returns the previous path of a renamed object.
+     *
+     * Monitors able to match both sides of a rename report it as a single
+     * event whose path is the new path of the object.
+     *
+     * @return The previous path of the object, or an empty string if the event
+     * does not describe a rename.
+     */
+    const std::string& get_old_path() const;
 
     /**
      * @brief Get event flag by name.
@@ -102,10 +242,54 @@ namespace fsw
      */
     static std::string get_event_flag_name(const fsw_event_flag& flag);
 
+    /**
+     * @brief Converts a vector of event flags into a bitmask.
+     *
+     * Since the values of all the event flags are distinct powers of two, a
+     * set of flags can be represented as a bitmask.  fsw_event_flag::NoOp has
+     * value `0` and does not contribute to the bitmask.
+     *
+     * @param flags The flags to convert.
+     * @return The bitmask of @p flags.
+     */
+    static uint32_t get_flag_mask(const std::vector<fsw_event_flag>& flags);
+
+    /**
+     * @brief Converts a bitmask into a vector of event flags.
+     *
+     * @param mask The bitmask to convert.
+     * @return The flags set in @p mask, in increasing order of value, or a
+     * vector containing only fsw_event_flag::NoOp if @p mask is `0`.
+     */
+    static std::vector<fsw_event_flag> get_flags_from_mask(uint32_t mask);
+
+    /**
+     * @brief Returns the current time with the highest resolution available.
+     *
+     * Monitors use this function to time the events they read.  The time is
+     * taken from the real-time clock, so that it can be compared with the
+     * modification times of files, with nanosecond resolution where
+     * `clock_gettime()` is available and with microsecond resolution
+     * otherwise.
+     *
+     * @return The current time.
+     */
+    static timespec get_current_time();
+
+    /**
+     * @brief Converts a time into nanoseconds since the epoch.
+     *
+     * @param time The time to convert.
+     * @return The number of nanoseconds since the epoch.
+     */
+    static int64_t get_time_ns(const timespec& time);
+
   private:
     std::string path;
-    time_t evt_time;
+    timespec evt_time;
+    uint64_t sequence = 0;
     std::vector<fsw_event_flag> evt_flags;
+    std::string old_path;
   };
 
   /**
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "event_batch.hpp"
+#include <cstring>
+
+using namespace std;
+
+namespace fsw
+{
+  event_view::event_view(const char *path,
+                         size_t path_length,
+                         const timespec& evt_time,
+                         uint64_t sequence,
+                         uint32_t flags,
+                         const char *old_path,
+                         size_t old_path_length) :
+    path(path),
+    path_length(path_length),
+    evt_time(evt_time),
+    sequence(sequence),
+    flags(flags),
+    old_path(old_path),
+    old_path_length(old_path_length)
+  {
+  }
+
+  const char *event_view::get_path() const
+  {
+    return path;
+  }
+
+  size_t event_view::get_path_length() const
+  {
+    return path_length;
+  }
+
+  time_t event_view::get_time() const
+  {
+    return evt_time.tv_sec;
+  }
+
+  const timespec& event_view::get_timespec() const
+  {
+    return evt_time;
+  }
+
+  int64_t event_view::get_time_ns() const
+  {
+    return event::get_time_ns(evt_time);
+  }
+
+  uint64_t event_view::get_sequence() const
+  {
+    return sequence;
+  }
+
+  uint32_t event_view::get_flags() const
+  {
+    return flags;
+  }
+
+  bool event_view::has_flag(fsw_event_flag flag) const
+  {
+    if (flag == NoOp) return flags == 0;
+
+    return (flags & flag) != 0;
+  }
+
+  const char *event_view::get_old_path() const
+  {
+    return old_path;
+  }
+
+  size_t event_view::get_old_path_length() const
+  {
+    return old_path_length;
+  }
+
+  event event_view::to_event() const
+  {
+    event evt(string(path, path_length),
+              evt_time,
+              event::get_flags_from_mask(flags),
+              string(old_path, old_path_length));
+    evt.set_sequence(sequence);
+
+    return evt;
+  }
+
+  size_t event_batch::store(const char *str, size_t length)
+  {
+    const size_t offset = storage.size();
+
+    // Strings are NUL-terminated so that views can expose C strings.
+    storage.resize(offset + length + 1);
+    memcpy(&storage[offset], str, length);
+    storage[offset + length] = '\0';
+
+    return offset;
+  }
+
+  void event_batch::add(const char *path,
+                        size_t path_length,
+                        time_t evt_time,
+                        uint32_t flags,
+                        const char *old_path,
+                        size_t old_path_length)
+  {
+    timespec time;
+    time.tv_sec = evt_time;
+    time.tv_nsec = 0;
+
+    add(path, path_length, time, flags, old_path, old_path_length);
+  }
+
+  void event_batch::add(const char *path,
+                        size_t path_length,
+                        const timespec& evt_time,
+                        uint32_t flags,
+                        const char *old_path,
+                        size_t old_path_length)
+  {
+    record rec;
+    rec.path_offset = store(path, path_length);
+    rec.path_length = path_length;
+    rec.old_path_offset = old_path_length ? store(old_path, old_path_length) : 0;
+    rec.old_path_length = old_path_length;
+    rec.evt_time = evt_time;
+    rec.sequence = 0;
+    rec.flags = flags;
+
+    records.push_back(rec);
+  }
+
+  void event_batch::add(const event& evt, uint32_t flags)
+  {
+    const string& path = evt.get_path();
+    const string& old_path = evt.get_old_path();
+
+    add(path.c_str(),
+        path.size(),
+        evt.get_timespec(),
+        flags,
+        old_path.c_str(),
+        old_path.size());
+    records.back().sequence = evt.get_sequence();
+  }
+
+  void event_batch::add(const event& evt)
+  {
+    add(evt, evt.get_flag_mask());
+  }
+
+  size_t event_batch::size() const
+  {
+    return records.size();
+  }
+
+  bool event_batch::empty() const
+  {
+    return records.empty();
+  }
+
+  event_view event_batch::operator[](size_t i) const
+  {
+    const record& rec = records[i];
+
+    return {&storage[rec.path_offset],
+            rec.path_length,
+            rec.evt_time,
+            rec.sequence,
+            rec.flags,
+            rec.old_path_length ? &storage[rec.old_path_offset] : "",
+            rec.old_path_length};
+  }
+
+  void event_batch::set_sequence(size_t i, uint64_t sequence)
+  {
+    records[i].sequence = sequence;
+  }
+
+  void event_batch::remove(const vector<char>& removed)
+  {
+    // The paths of the removed events are left in the storage.
+    size_t kept = 0;
+
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+      if (removed[i]) continue;
+      if (kept != i) records[kept] = records[i];
+      ++kept;
+    }
+
+    records.resize(kept);
+  }
+
+  void event_batch::clear()
+  {
+    storage.clear();
+    records.clear();
+  }
+
+  vector<event> event_batch::to_events() const
+  {
+    vector<event> events;
+    events.reserve(records.size());
+
+    for (size_t i = 0; i < records.size(); ++i)
+      events.push_back((*this)[i].to_event());
+
+    return events;
+  }
+
+  void event_batch::to_events(vector<event>& events) const
+  {
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+      const event_view evt = (*this)[i];
+
+      if (i == events.size())
+      {
+        events.push_back(evt.to_event());
+        continue;
+      }
+
+      events[i].assign(evt.get_path(),
+                       evt.get_path_length(),
+                       evt.get_timespec(),
+                       evt.get_flags(),
+                       evt.get_old_path(),
+                       evt.get_old_path_length());
+      events[i].set_sequence(evt.get_sequence());
+    }
+
+    events.erase(events.begin() + records.size(), events.end());
+  }
+}
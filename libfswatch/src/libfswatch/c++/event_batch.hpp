@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::event_batch and fsw::event_view classes.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_EVENT_BATCH_H
+#  define FSW_EVENT_BATCH_H
+
+#  include <cstddef>
+#  include <cstdint>
+#  include <ctime>
+#  include <vector>
+#  include "event.hpp"
+
+namespace fsw
+{
+  class event_batch;
+
+  /**
+   * @brief Read-only view of a change event stored in an fsw::event_batch.
+   *
+   * A view contains:
+   *
+   *   - The path, pointing into the storage of the batch.
+   *   - The time the event was raised and its sequence number.
+   *   - The flags of the event, as a bitmask of ::fsw_event_flag values.
+   *   - The previous path of the object, if the event describes a rename.
+   *
+   * A view is valid until the batch it was obtained from is modified or
+   * destroyed.  Use to_event() to get an fsw::event which can be kept.
+   */
+  class event_view
+  {
+  public:
+    /**
+     * @brief Returns the path of the event.
+     *
+     * @return The NUL-terminated path of the event.
+     */
+    const char *get_path() const;
+
+    /**
+     * @brief Returns the length of the path of the event.
+     *
+     * @return The length of the path, excluding the terminating NUL.
+     */
+    size_t get_path_length() const;
+
+    /**
+     * @brief Returns the time of the event.
+     *
+     * @return The time of the event.
+     */
+    time_t get_time() const;
+
+    /**
+     * @brief Returns the time of the event with nanosecond resolution.
+     *
+     * @return The time of the event.
+     */
+    const timespec& get_timespec() const;
+
+    /**
+     * @brief Returns the time of the event in nanoseconds since the epoch.
+     *
+     * @return The time of the event.
+     */
+    int64_t get_time_ns() const;
+
+    /**
+     * @brief Returns the sequence number of the event.
+     *
+     * @return The sequence number of the event.
+     * @see event::get_sequence()
+     */
+    uint64_t get_sequence() const;
+
+    /**
+     * @brief Returns the flags of the event.
+     *
+     * A value of `0` is equivalent to fsw_event_flag::NoOp.
+     *
+     * @return The bitmask of the flags of the event.
+     */
+    uint32_t get_flags() const;
+
+    /**
+     * @brief Checks whether the event has a flag.
+     *
+     * @param flag The flag to check.
+     * @return @c true if the event has @p flag, @c false otherwise.
+     */
+    bool has_flag(fsw_event_flag flag) const;
+
+    /**
+     * @brief Returns the previous path of a renamed object.
+     *
+     * @return The NUL-terminated previous path of the object, or an empty
+     * string if the event does not describe a rename.
+     */
+    const char *get_old_path() const;
+
+    /**
+     * @brief Returns the length of the previous path of a renamed object.
+     *
+     * @return The length of the previous path, excluding the terminating NUL.
+     */
+    size_t get_old_path_length() const;
+
+    /**
+     * @brief Copies the event into an fsw::event.
+     *
+     * @return An event with the same path, time, sequence number, flags and
+     * previous path.
+     */
+    event to_event() const;
+
+  private:
+    friend class event_batch;
+
+    event_view(const char *path,
+               size_t path_length,
+               const timespec& evt_time,
+               uint64_t sequence,
+               uint32_t flags,
+               const char *old_path,
+               size_t old_path_length);
+
+    const char *path;
+    size_t path_length;
+    timespec evt_time;
+    uint64_t sequence;
+    uint32_t flags;
+    const char *old_path;
+    size_t old_path_length;
+  };
+
+  /**
+   * @brief Container of change events sharing a single storage.
+   *
+   * The paths of all the events of a batch are stored contiguously in a
+   * storage owned by the batch and the flags of each event are stored as a
+   * bitmask.  Clearing a batch retains its storage, so that a batch which is
+   * reused does not allocate memory once it has grown to the size of the
+   * largest group of events it holds.
+   *
+   * Events are accessed through fsw::event_view instances.
+   */
+  class event_batch
+  {
+  public:
+    /**
+     * @brief Adds an event to the batch.
+     *
+     * @param path The path the event refers to.
+     * @param path_length The length of @p path.
+     * @param evt_time The time the event was raised.
+     * @param flags The bitmask of the flags of the event.
+     * @param old_path The path of the object before it was renamed, if any.
+     * @param old_path_length The length of @p old_path.
+     */
+    void add(const char *path,
+             size_t path_length,
+             time_t evt_time,
+             uint32_t flags,
+             const char *old_path = nullptr,
+             size_t old_path_length = 0);
+
+    /**
+     * @brief Adds an event raised at a high-resolution time to the batch.
+     *
+     * @param path The path the event refers to.
+     * @param path_length The length of @p path.
+     * @param evt_time The time the event was raised.
+     * @param flags The bitmask of the flags of the event.
+     * @param old_path The path of the object before it was renamed, if any.
+     * @param old_path_length The length of @p old_path.
+     */
+    void add(const char *path,
+             size_t path_length,
+             const timespec& evt_time,
+             uint32_t flags,
+             const char *old_path = nullptr,
+             size_t old_path_length = 0);
+
+    /**
+     * @brief Adds an event to the batch.
+     *
+     * @param evt The event to add.
+     * @param flags The bitmask of the flags to store instead of the flags of
+     * @p evt.
+     */
+    void add(const event& evt, uint32_t flags);
+
+    /**
+     * @brief Adds an event to the batch.
+     *
+     * @param evt The event to add.
+     */
+    void add(const event& evt);
+
+    /**
+     * @brief Returns the number of events in the batch.
+     *
+     * @return The number of events.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Checks whether the batch is empty.
+     *
+     * @return @c true if the batch contains no events, @c false otherwise.
+     */
+    bool empty() const;
+
+    /**
+     * @brief Returns a view of an event.
+     *
+     * @param i The index of the event.
+     * @return A view of the event at index @p i.
+     */
+    event_view operator[](size_t i) const;
+
+    /**
+     * @brief Sets the sequence number of an event.
+     *
+     * @param i The index of the event.
+     * @param sequence The sequence number of the event.
+     */
+    void set_sequence(size_t i, uint64_t sequence);
+
+    /**
+     * @brief Removes some events from the batch, retaining the order of the
+     * others.
+     *
+     * @param removed A vector with an element per event: the events whose
+     * element is not @c 0 are removed.
+     */
+    void remove(const std::vector<char>& removed);
+
+    /**
+     * @brief Removes all the events from the batch, retaining its storage.
+     */
+    void clear();
+
+    /**
+     * @brief Copies the events of the batch into a vector of fsw::event.
+     *
+     * @return The events of the batch.
+     */
+    std::vector<event> to_events() const;
+
+    /**
+     * @brief Copies the events of the batch into a vector of fsw::event,
+     * reusing the events it contains.
+     *
+     * The events already in @p events are overwritten with
+     * event::assign(), so that a recycled vector is filled without allocating
+     * memory, and the events in excess are removed.
+     *
+     * @param events The vector receiving the events of the batch.
+     */
+    void to_events(std::vector<event>& events) const;
+
+  private:
+    struct record
+    {
+      size_t path_offset;
+      size_t path_length;
+      size_t old_path_offset;
+      size_t old_path_length;
+      timespec evt_time;
+      uint64_t sequence;
+      uint32_t flags;
+    };
+
+    size_t store(const char *str, size_t length);
+
+    std::vector<char> storage;
+    std::vector<record> records;
+  };
+}
+
+#endif  /* FSW_EVENT_BATCH_H */
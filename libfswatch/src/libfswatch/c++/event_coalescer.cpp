@@ -0,0 +1,177 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "event_coalescer.hpp"
+#include <cstring>
+
+using namespace std;
+
+namespace fsw
+{
+  static const size_t INITIAL_BUCKETS = 64;
+
+  static size_t hash_path(const char *path, size_t length)
+  {
+    // FNV-1a.
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < length; ++i)
+    {
+      hash ^= (unsigned char) path[i];
+      hash *= 1099511628211ULL;
+    }
+
+    return (size_t) hash;
+  }
+
+  size_t event_coalescer::store(const char *str, size_t length)
+  {
+    const size_t offset = storage.size();
+
+    storage.insert(storage.end(), str, str + length);
+
+    return offset;
+  }
+
+  size_t event_coalescer::find_bucket(const char *path,
+                                      size_t path_length,
+                                      size_t hash) const
+  {
+    // The number of buckets is a power of two and the table is never more
+    // than half full: linear probing always finds the path or a free bucket.
+    const size_t mask = buckets.size() - 1;
+
+    for (size_t i = hash & mask;; i = (i + 1) & mask)
+    {
+      const bucket& b = buckets[i];
+
+      if (b.generation != generation) return i;
+
+      const record& rec = records[b.record];
+
+      if (rec.hash == hash
+          && rec.path_length == path_length
+          && memcmp(storage.data() + rec.path_offset, path, path_length) == 0)
+        return i;
+    }
+  }
+
+  void event_coalescer::grow()
+  {
+    buckets.assign(buckets.empty() ? INITIAL_BUCKETS : buckets.size() * 2,
+                   {0, 0});
+    generation = 1;
+
+    const size_t mask = buckets.size() - 1;
+
+    for (size_t r = 0; r < records.size(); ++r)
+    {
+      size_t i = records[r].hash & mask;
+
+      while (buckets[i].generation == generation) i = (i + 1) & mask;
+
+      buckets[i] = {generation, (uint32_t) r};
+    }
+  }
+
+  void event_coalescer::add(const char *path,
+                            size_t path_length,
+                            const timespec& evt_time,
+                            uint32_t flags,
+                            const char *old_path,
+                            size_t old_path_length)
+  {
+    if ((records.size() + 1) * 2 > buckets.size()) grow();
+
+    const size_t hash = hash_path(path, path_length);
+    bucket& b = buckets[find_bucket(path, path_length, hash)];
+
+    if (b.generation == generation)
+    {
+      record& rec = records[b.record];
+
+      rec.flags |= flags;
+      if (event::get_time_ns(evt_time) > event::get_time_ns(rec.evt_time))
+        rec.evt_time = evt_time;
+
+      if (rec.old_path_length == 0 && old_path_length > 0)
+      {
+        rec.old_path_offset = store(old_path, old_path_length);
+        rec.old_path_length = old_path_length;
+      }
+
+      return;
+    }
+
+    record rec;
+    rec.path_offset = store(path, path_length);
+    rec.path_length = path_length;
+    rec.old_path_offset = old_path_length ? store(old_path, old_path_length) : 0;
+    rec.old_path_length = old_path_length;
+    rec.hash = hash;
+    rec.evt_time = evt_time;
+    rec.flags = flags;
+
+    b = {generation, (uint32_t) records.size()};
+    records.push_back(rec);
+  }
+
+  void event_coalescer::add(const event& evt, uint32_t flags)
+  {
+    const string& path = evt.get_path();
+    const string& old_path = evt.get_old_path();
+
+    add(path.c_str(),
+        path.size(),
+        evt.get_timespec(),
+        flags,
+        old_path.c_str(),
+        old_path.size());
+  }
+
+  bool event_coalescer::empty() const
+  {
+    return records.empty();
+  }
+
+  size_t event_coalescer::size() const
+  {
+    return records.size();
+  }
+
+  void event_coalescer::flush(event_batch& batch)
+  {
+    for (const record& rec : records)
+    {
+      batch.add(storage.data() + rec.path_offset,
+                rec.path_length,
+                rec.evt_time,
+                rec.flags,
+                rec.old_path_length ? storage.data() + rec.old_path_offset : nullptr,
+                rec.old_path_length);
+    }
+
+    storage.clear();
+    records.clear();
+
+    // Invalidate all the buckets at once, clearing them only when the
+    // generation wraps around.
+    if (++generation == 0)
+    {
+      buckets.assign(buckets.size(), {0, 0});
+      generation = 1;
+    }
+  }
+}
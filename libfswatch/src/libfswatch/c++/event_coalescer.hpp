@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::event_coalescer class.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_EVENT_COALESCER_H
+#  define FSW_EVENT_COALESCER_H
+
+#  include "event.hpp"
+#  include "event_batch.hpp"
+#  include <cstdint>
+#  include <ctime>
+#  include <vector>
+
+namespace fsw
+{
+  /**
+   * @brief Set of events merging the events of the same path.
+   *
+   * Events are indexed by path in an open-addressing hash table.  When an
+   * event is added for a path which is already in the set, its flags are
+   * merged into the flags of the existing event instead.  Events are kept in
+   * the order their paths were first added.
+   *
+   * The hash table and the storage of the paths are reused once the events
+   * have been flushed: buckets are tagged with a generation which is
+   * incremented by flush(), so that the table need not be cleared.
+   */
+  class event_coalescer
+  {
+  public:
+    /**
+     * @brief Adds an event.
+     *
+     * @param path The path the event refers to.
+     * @param path_length The length of @p path.
+     * @param evt_time The time the event was raised.
+     * @param flags The bitmask of the flags of the event.
+     * @param old_path The path of the object before it was renamed, if any.
+     * @param old_path_length The length of @p old_path.
+     */
+    void add(const char *path,
+             size_t path_length,
+             const timespec& evt_time,
+             uint32_t flags,
+             const char *old_path = nullptr,
+             size_t old_path_length = 0);
+
+    /**
+     * @brief Adds an event.
+     *
+     * @param evt The event to add.
+     * @param flags The bitmask of the flags to store instead of the flags of
+     * @p evt.
+     */
+    void add(const event& evt, uint32_t flags);
+
+    /**
+     * @brief Checks whether the set is empty.
+     *
+     * @return @c true if the set contains no events, @c false otherwise.
+     */
+    bool empty() const;
+
+    /**
+     * @brief Returns the number of events in the set.
+     *
+     * @return The number of distinct paths added since the last flush.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Moves the events into a batch.
+     *
+     * The events are appended to @p batch and removed from the set, which
+     * retains its storage.
+     *
+     * @param batch The batch receiving the events.
+     */
+    void flush(event_batch& batch);
+
+  private:
+    struct record
+    {
+      size_t path_offset;
+      size_t path_length;
+      size_t old_path_offset;
+      size_t old_path_length;
+      size_t hash;
+      timespec evt_time;
+      uint32_t flags;
+    };
+
+    struct bucket
+    {
+      uint32_t generation;
+      uint32_t record;
+    };
+
+    size_t store(const char *str, size_t length);
+    size_t find_bucket(const char *path, size_t path_length, size_t hash) const;
+    void grow();
+
+    std::vector<char> storage;
+    std::vector<record> records;
+    std::vector<bucket> buckets;
+    uint32_t generation = 1;
+  };
+}
+
+#endif  /* FSW_EVENT_COALESCER_H */
@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "gettext_defs.h"
+#include "event_publisher.hpp"
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "libfswatch_exception.hpp"
+#include "string/string_utils.hpp"
+#include "../c/libfswatch_log.h"
+
+namespace fsw
+{
+  static void set_socket_address(const std::string& path, sockaddr_un& address)
+  {
+    if (path.size() >= sizeof(address.sun_path))
+    {
+      throw libfsw_exception(
+        string_utils::string_from_format(_("The socket path is too long: %s"),
+                                         path.c_str()),
+        FSW_ERR_INVALID_PATH);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size());
+  }
+
+  static bool is_stale_socket(const sockaddr_un& address)
+  {
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (fd == -1) return false;
+
+    // Nobody is listening on a socket left over by a terminated publisher.
+    bool stale = connect(fd,
+                         reinterpret_cast<const sockaddr *>(&address),
+                         sizeof(address)) == -1
+                 && errno == ECONNREFUSED;
+    close(fd);
+
+    return stale;
+  }
+
+  static bool set_descriptor_flags(int fd, int status_flags)
+  {
+    int flags = fcntl(fd, F_GETFL);
+
+    return flags != -1
+           && fcntl(fd, F_SETFL, flags | status_flags) != -1
+           && fcntl(fd, F_SETFD, FD_CLOEXEC) != -1;
+  }
+
+  event_publisher::event_publisher(std::string socket_path) :
+    socket_path(std::move(socket_path))
+  {
+    sockaddr_un address;
+    set_socket_address(this->socket_path, address);
+
+    listen_fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+
+    if (listen_fd == -1)
+    {
+      throw libfsw_exception(
+        string_utils::string_from_format(_("Cannot create a socket: %s"),
+                                         strerror(errno)));
+    }
+
+    const sockaddr *addr = reinterpret_cast<const sockaddr *>(&address);
+    int rv = bind(listen_fd, addr, sizeof(address));
+
+    if (rv == -1 && errno == EADDRINUSE && is_stale_socket(address))
+    {
+      unlink(this->socket_path.c_str());
+      rv = bind(listen_fd, addr, sizeof(address));
+    }
+
+    const bool bound = rv == 0;
+
+    if (!bound
+        || listen(listen_fd, SOMAXCONN) == -1
+        || !set_descriptor_flags(listen_fd, O_NONBLOCK))
+    {
+      const int err = errno;
+
+      close(listen_fd);
+      if (bound) unlink(this->socket_path.c_str());
+
+      throw libfsw_exception(
+        string_utils::string_from_format(_("Cannot listen on %s: %s"),
+                                         this->socket_path.c_str(),
+                                         strerror(err)));
+    }
+  }
+
+  event_publisher::~event_publisher()
+  {
+    for (const subscriber& sub : subscribers) close(sub.fd);
+
+    close(listen_fd);
+    unlink(socket_path.c_str());
+  }
+
+  size_t event_publisher::get_subscriber_count() const
+  {
+    return subscribers.size();
+  }
+
+  void event_publisher::accept_subscribers()
+  {
+    for (;;)
+    {
+      int fd = accept(listen_fd, nullptr, nullptr);
+
+      if (fd == -1)
+      {
+        if (errno == EINTR || errno == ECONNABORTED) continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK) fsw_log_perror("accept");
+
+        return;
+      }
+
+      if (!set_descriptor_flags(fd, 0)) fsw_log_perror("fcntl");
+
+      FSW_ELOG(_("Subscriber connected.\n"));
+      subscribers.push_back({fd, false});
+    }
+  }
+
+  void event_publisher::begin_message()
+  {
+    message.resize(sizeof(message_header));
+    message_events = 0;
+  }
+
+  void event_publisher::send_message()
+  {
+    message_header header = {};
+    header.magic = MESSAGE_MAGIC;
+    header.event_num = static_cast<uint32_t>(message_events);
+
+    auto it = subscribers.begin();
+
+    while (it != subscribers.end())
+    {
+      header.flags = it->events_lost ? MESSAGE_EVENTS_LOST : 0;
+      memcpy(message.data(), &header, sizeof(header));
+
+      ssize_t rv;
+
+      do
+      {
+        rv = send(it->fd,
+                  message.data(),
+                  message.size(),
+                  MSG_DONTWAIT | MSG_NOSIGNAL);
+      }
+      while (rv == -1 && errno == EINTR);
+
+      if (rv != -1)
+      {
+        it->events_lost = false;
+        ++it;
+        continue;
+      }
+
+      // A slow subscriber misses the message instead of blocking the monitor.
+      if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+      {
+        it->events_lost = true;
+        ++it;
+        continue;
+      }
+
+      if (errno != EPIPE && errno != ECONNRESET) fsw_log_perror("send");
+
+      FSW_ELOG(_("Subscriber disconnected.\n"));
+      close(it->fd);
+      it = subscribers.erase(it);
+    }
+  }
+
+  void event_publisher::publish(const event_batch& events)
+  {
+    accept_subscribers();
+
+    if (subscribers.empty()) return;
+
+    begin_message();
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+      const event_view evt = events[i];
+      const size_t path_length = evt.get_path_length();
+      const size_t old_path_length = evt.get_old_path_length();
+      const size_t record_size =
+        sizeof(message_record) + path_length + old_path_length;
+
+      if (sizeof(message_header) + record_size > MAX_MESSAGE_SIZE)
+      {
+        FSW_ELOGF(_("Event too large to be published: %s\n"), evt.get_path());
+        continue;
+      }
+
+      if (message.size() + record_size > MAX_MESSAGE_SIZE)
+      {
+        send_message();
+        begin_message();
+      }
+
+      message_record record = {};
+      record.evt_time = evt.get_timespec().tv_sec;
+      record.evt_time_nsec = static_cast<uint32_t>(evt.get_timespec().tv_nsec);
+      record.flags = evt.get_flags();
+      record.path_length = static_cast<uint32_t>(path_length);
+      record.old_path_length = static_cast<uint32_t>(old_path_length);
+
+      const size_t offset = message.size();
+      message.resize(offset + record_size);
+
+      char *dest = message.data() + offset;
+      memcpy(dest, &record, sizeof(record));
+      dest += sizeof(record);
+      memcpy(dest, evt.get_path(), path_length);
+      dest += path_length;
+      if (old_path_length) memcpy(dest, evt.get_old_path(), old_path_length);
+
+      ++message_events;
+    }
+
+    if (message_events) send_message();
+  }
+
+  void event_publisher::publish(const std::vector<event>& events)
+  {
+    converted.clear();
+
+    for (const event& evt : events) converted.add(evt);
+
+    publish(converted);
+  }
+}
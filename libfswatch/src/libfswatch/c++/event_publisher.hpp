@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::event_publisher class.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_EVENT_PUBLISHER_H
+#  define FSW_EVENT_PUBLISHER_H
+
+#  include "event.hpp"
+#  include "event_batch.hpp"
+#  include <cstddef>
+#  include <cstdint>
+#  include <string>
+#  include <vector>
+
+namespace fsw
+{
+  /**
+   * @brief Publisher of batches of events to the subscribers connected to a
+   * Unix domain socket.
+   *
+   * A publisher listens on a `SOCK_SEQPACKET` socket bound to a path of the
+   * file system and sends every published batch to each connected subscriber,
+   * usually an instance of fsw::subscriber_monitor.  A single monitor can thus
+   * serve any number of consumers, each one applying its own filters.
+   *
+   * Every message is a self-contained batch: a #message_header followed by
+   * event_num records, each one made of a #message_record followed by the
+   * path and the old path of the event.  No padding is inserted and integers
+   * are stored in host byte order, since both ends run on the same host.
+   * Batches larger than #MAX_MESSAGE_SIZE are split into several messages.
+   *
+   * A publisher never blocks: a subscriber whose socket buffer is full misses
+   * the message and the next message it receives carries the
+   * #MESSAGE_EVENTS_LOST flag.  Subscribers which closed the connection are
+   * dropped.  Instances of this class are not thread safe: they are meant to
+   * be used by the callback of a monitor, whose invocations are serialized.
+   */
+  class event_publisher
+  {
+  public:
+    /**
+     * @brief The magic number of a message: `FSWP` in little endian order.
+     */
+    static constexpr uint32_t MESSAGE_MAGIC = 0x50575346;
+
+    /**
+     * @brief Flag of a message set when previous messages were lost.
+     */
+    static constexpr uint32_t MESSAGE_EVENTS_LOST = 1;
+
+    /**
+     * @brief The maximum size of a message.
+     */
+    static constexpr size_t MAX_MESSAGE_SIZE = 64 * 1024;
+
+    /**
+     * @brief Header of a message.
+     */
+    struct message_header
+    {
+      uint32_t magic;     /**< The magic number. */
+      uint32_t flags;     /**< The flags of the message. */
+      uint32_t event_num; /**< The number of records in the message. */
+      uint32_t reserved;  /**< Reserved, set to `0`. */
+    };
+
+    /**
+     * @brief Record of an event in a message.
+     */
+    struct message_record
+    {
+      int64_t evt_time;         /**< The time of the event. */
+      uint32_t flags;           /**< The bitmask of the flags of the event. */
+      uint32_t path_length;     /**< The length of the path. */
+      uint32_t old_path_length; /**< The length of the old path. */
+      uint32_t evt_time_nsec;   /**< The nanoseconds of the time of the event. */
+    };
+
+    /**
+     * @brief Constructs a publisher listening on the specified socket.
+     *
+     * A socket left over by a publisher which is no longer running is
+     * replaced.
+     *
+     * @param socket_path The path of the socket.
+     * @throw libfsw_exception if the socket cannot be created.
+     */
+    explicit event_publisher(std::string socket_path);
+
+    /**
+     * @brief Closes the connections and removes the socket.
+     */
+    virtual ~event_publisher();
+
+    event_publisher(const event_publisher&) = delete;
+    event_publisher& operator=(const event_publisher&) = delete;
+
+    /**
+     * @brief Sends a batch of events to the subscribers.
+     *
+     * Pending connections are accepted before sending the batch.
+     *
+     * @param events The batch to send.
+     */
+    void publish(const event_batch& events);
+
+    /**
+     * @brief Sends a batch of events to the subscribers.
+     *
+     * @param events The events to send.
+     */
+    void publish(const std::vector<event>& events);
+
+    /**
+     * @brief Gets the number of connected subscribers.
+     *
+     * @return The number of subscribers.
+     */
+    size_t get_subscriber_count() const;
+
+  private:
+    struct subscriber
+    {
+      int fd;
+      bool events_lost;
+    };
+
+    void accept_subscribers();
+    void begin_message();
+    void send_message();
+
+    std::string socket_path;
+    int listen_fd = -1;
+    std::vector<subscriber> subscribers;
+    std::vector<char> message;
+    size_t message_events = 0;
+    event_batch converted;
+  };
+}
+
+#endif  /* FSW_EVENT_PUBLISHER_H */
@@ -0,0 +1,670 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "gettext_defs.h"
+#include "fanotify_monitor.hpp"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <sstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/statfs.h>
+#include "libfswatch_exception.hpp"
+#include "../c/libfswatch_log.h"
+#include "libfswatch_map.hpp"
+#include "path_utils.hpp"
+
+namespace fsw
+{
+  struct fanotify_mount
+  {
+    fsid_t fsid;
+    int fd;
+  };
+
+  struct fanotify_root
+  {
+    // The path to watch, as it was added to the monitor.
+    std::string path;
+    // The path to watch, resolved and without trailing separators.
+    std::string resolved;
+    // The file system containing the path, once it has been marked.
+    fsid_t fsid;
+    bool marked;
+  };
+
+  struct fanotify_flag_type
+  {
+    uint64_t flag;
+    fsw_event_flag type;
+  };
+
+  struct fanotify_monitor_impl
+  {
+    int fanotify_handle = -1;
+    /*
+     * Event descriptor signalled by on_stop() and on_paths_changed() to wake
+     * up a thread blocked in poll().
+     */
+    int stop_event_handle = -1;
+    bool woken_up = false;
+    unsigned int mark_type = FAN_MARK_FILESYSTEM;
+    uint64_t mark_mask;
+    std::vector<fanotify_root> roots;
+    /*
+     * A descriptor of an object in every marked file system is required to
+     * open the directory file handles reported by the kernel.
+     */
+    std::vector<fanotify_mount> mounts;
+    /*
+     * Cache of the paths of the directories by file system identifier and file
+     * handle.  It is cleared when a directory is moved or removed.
+     */
+    fsw_hash_map<std::string, std::string> directory_paths;
+    std::vector<char> buffer;
+    std::vector<event> events;
+    timespec curr_time;
+  };
+
+  static const unsigned int BUFFER_SIZE = 64 * 1024;
+  static const size_t MAX_CACHED_DIRECTORIES = 64 * 1024;
+
+  static const uint64_t FILESYSTEM_MASK = FAN_CREATE
+                                          | FAN_DELETE
+                                          | FAN_MOVED_FROM
+                                          | FAN_MOVED_TO
+                                          | FAN_MODIFY
+                                          | FAN_ATTRIB
+                                          | FAN_CLOSE_WRITE
+                                          | FAN_DELETE_SELF
+                                          | FAN_MOVE_SELF
+                                          | FAN_ONDIR;
+
+  // Directory entry events are not supported on mount marks.
+  static const uint64_t MOUNT_MASK = FAN_MODIFY | FAN_CLOSE_WRITE | FAN_ONDIR;
+
+  static const uint64_t DIRECTORY_CHANGE_MASK = FAN_MOVED_FROM
+                                                | FAN_MOVED_TO
+                                                | FAN_DELETE
+                                                | FAN_DELETE_SELF
+                                                | FAN_MOVE_SELF;
+
+  static const std::vector<fanotify_flag_type> event_flag_type = {
+    {FAN_CREATE,      fsw_event_flag::Created},
+    {FAN_DELETE,      fsw_event_flag::Removed},
+    {FAN_MOVED_FROM,  fsw_event_flag::Removed},
+    {FAN_MOVED_FROM,  fsw_event_flag::MovedFrom},
+    {FAN_MOVED_TO,    fsw_event_flag::Created},
+    {FAN_MOVED_TO,    fsw_event_flag::MovedTo},
+    {FAN_MODIFY,      fsw_event_flag::Updated},
+    {FAN_CLOSE_WRITE, fsw_event_flag::Updated},
+    {FAN_ATTRIB,      fsw_event_flag::AttributeModified},
+    {FAN_DELETE_SELF, fsw_event_flag::Removed},
+    {FAN_MOVE_SELF,   fsw_event_flag::Updated},
+    {FAN_ONDIR,       fsw_event_flag::IsDir}
+  };
+
+  fanotify_monitor::fanotify_monitor(std::vector<std::string> paths_to_monitor,
+                                     FSW_EVENT_CALLBACK *callback,
+                                     void *context) :
+    monitor(paths_to_monitor, callback, context),
+    impl(new fanotify_monitor_impl())
+  {
+    impl->fanotify_handle = fanotify_init(FAN_CLASS_NOTIF
+                                          | FAN_REPORT_DFID_NAME
+                                          | FAN_CLOEXEC
+                                          | FAN_NONBLOCK,
+                                          O_RDONLY | O_LARGEFILE);
+
+    // The destructor is not invoked if the constructor throws: the resources
+    // acquired so far are released before throwing.
+    if (impl->fanotify_handle == -1)
+    {
+      perror("fanotify_init");
+      delete impl;
+      throw libfsw_exception(_("Cannot initialize fanotify."));
+    }
+
+    impl->stop_event_handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (impl->stop_event_handle == -1)
+    {
+      perror("eventfd");
+      close(impl->fanotify_handle);
+      delete impl;
+      throw libfsw_exception(_("Cannot initialize the stop event descriptor."));
+    }
+
+    impl->buffer.resize(BUFFER_SIZE);
+  }
+
+  fanotify_monitor::~fanotify_monitor()
+  {
+    for (const fanotify_mount& mount : impl->mounts) close(mount.fd);
+
+    if (impl->fanotify_handle != -1) close(impl->fanotify_handle);
+    if (impl->stop_event_handle != -1) close(impl->stop_event_handle);
+
+    delete impl;
+  }
+
+  void fanotify_monitor::configure_monitor()
+  {
+    std::string mark_type = get_property(FANOTIFY_MARK_TYPE);
+
+    if (mark_type.empty() || mark_type == "filesystem")
+    {
+      impl->mark_type = FAN_MARK_FILESYSTEM;
+      impl->mark_mask = FILESYSTEM_MASK;
+    }
+    else if (mark_type == "mount")
+    {
+      impl->mark_type = FAN_MARK_MOUNT;
+      impl->mark_mask = MOUNT_MASK;
+    }
+    else
+    {
+      std::string msg = std::string(_("Invalid value: ")) + mark_type;
+      throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+    }
+
+    impl->roots.clear();
+
+    for (const std::string& path : paths) add_root(path);
+  }
+
+  void fanotify_monitor::add_root(const std::string& path)
+  {
+    fanotify_root root;
+    root.path = path;
+    root.resolved = fsw_realpath(path.c_str(), nullptr);
+    root.marked = false;
+
+    while (root.resolved.size() > 1 && root.resolved.back() == '/')
+      root.resolved.pop_back();
+
+    impl->roots.push_back(root);
+  }
+
+  /*
+   * The mark of a removed path is removed unless another marked path is on the
+   * same file system.  Since marks cannot be told apart when two mounts of the
+   * same file system are marked, a mount mark may be kept longer than needed:
+   * the events outside the paths to watch are discarded anyway.
+   */
+  void fanotify_monitor::remove_root(const std::string& path)
+  {
+    auto removed = std::find_if(impl->roots.begin(),
+                                impl->roots.end(),
+                                [&path](const fanotify_root& root)
+                                {
+                                  return root.path == path;
+                                });
+
+    if (removed == impl->roots.end()) return;
+
+    const fanotify_root root = *removed;
+    impl->roots.erase(removed);
+
+    FSW_DLOGS(_("Removed: ") << root.resolved << "\n");
+
+    if (!root.marked) return;
+
+    auto same_fsid = [&root](const fanotify_root& other)
+    {
+      return other.marked
+        && memcmp(&other.fsid, &root.fsid, sizeof(fsid_t)) == 0;
+    };
+
+    if (std::any_of(impl->roots.begin(), impl->roots.end(), same_fsid)) return;
+
+    if (fanotify_mark(impl->fanotify_handle,
+                      FAN_MARK_REMOVE | impl->mark_type,
+                      impl->mark_mask,
+                      AT_FDCWD,
+                      root.resolved.c_str()) != 0)
+    {
+      fsw_logf_perror(_("Cannot unmark %s"), root.resolved.c_str());
+    }
+
+    for (auto mount = impl->mounts.begin(); mount != impl->mounts.end(); ++mount)
+    {
+      if (memcmp(&mount->fsid, &root.fsid, sizeof(fsid_t)) != 0) continue;
+
+      close(mount->fd);
+      impl->mounts.erase(mount);
+      break;
+    }
+  }
+
+  /*
+   * The paths added while the monitor is running are marked by add_marks(),
+   * which is invoked next by run().
+   */
+  void fanotify_monitor::update_roots()
+  {
+    for (const path_change& change : take_path_changes())
+    {
+      if (change.added) add_root(change.path);
+      else remove_root(change.path);
+    }
+  }
+
+  bool fanotify_monitor::add_marks()
+  {
+    bool all_marked = true;
+
+    for (fanotify_root& marked_root : impl->roots)
+    {
+      if (marked_root.marked) continue;
+
+      const std::string& root = marked_root.resolved;
+
+      if (fanotify_mark(impl->fanotify_handle,
+                        FAN_MARK_ADD | impl->mark_type,
+                        impl->mark_mask,
+                        AT_FDCWD,
+                        root.c_str()) != 0)
+      {
+        fsw_logf_perror(_("Cannot mark %s"), root.c_str());
+        all_marked = false;
+        continue;
+      }
+
+      struct statfs fs_stat;
+
+      if (statfs(root.c_str(), &fs_stat) != 0)
+      {
+        fsw_logf_perror(_("Cannot statfs %s"), root.c_str());
+        all_marked = false;
+        continue;
+      }
+
+      auto same_fsid = [&fs_stat](const fanotify_mount& mount)
+      {
+        return memcmp(&mount.fsid, &fs_stat.f_fsid, sizeof(fsid_t)) == 0;
+      };
+
+      if (std::none_of(impl->mounts.begin(), impl->mounts.end(), same_fsid))
+      {
+        int mount_fd = open(root.c_str(), O_RDONLY | O_CLOEXEC);
+
+        if (mount_fd == -1)
+        {
+          fsw_logf_perror(_("Cannot open %s"), root.c_str());
+          all_marked = false;
+          continue;
+        }
+
+        impl->mounts.push_back({fs_stat.f_fsid, mount_fd});
+      }
+
+      marked_root.fsid = fs_stat.f_fsid;
+      marked_root.marked = true;
+
+      FSW_DLOGS(_("Added: ") << root << "\n");
+    }
+
+    set_watch_count(std::count_if(impl->roots.begin(),
+                                  impl->roots.end(),
+                                  [](const fanotify_root& root)
+                                  {
+                                    return root.marked;
+                                  }));
+
+    return all_marked;
+  }
+
+  bool fanotify_monitor::is_monitored(const std::string& path) const
+  {
+    for (const fanotify_root& monitored_root : impl->roots)
+    {
+      const std::string& root = monitored_root.resolved;
+
+      if (path == root) return true;
+
+      size_t prefix = (root == "/") ? 0 : root.size();
+
+      if (path.size() <= prefix + 1) continue;
+      if (path.compare(0, prefix, root, 0, prefix) != 0) continue;
+      if (path[prefix] != '/') continue;
+
+      // Only the direct children of a root are accepted when not recursive.
+      if (recursive || path.find('/', prefix + 1) == std::string::npos)
+        return true;
+    }
+
+    return false;
+  }
+
+  bool fanotify_monitor::get_directory_path(const struct fanotify_event_info_fid *fid,
+                                            std::string& path)
+  {
+    struct file_handle *handle = (struct file_handle *) fid->handle;
+
+    std::string key(reinterpret_cast<const char *> (&fid->fsid),
+                    sizeof(fid->fsid));
+    key.append(reinterpret_cast<const char *> (&handle->handle_type),
+               sizeof(handle->handle_type));
+    key.append(reinterpret_cast<const char *> (handle->f_handle),
+               handle->handle_bytes);
+
+    auto cached = impl->directory_paths.find(key);
+
+    if (cached != impl->directory_paths.end())
+    {
+      path = cached->second;
+      return true;
+    }
+
+    auto mount = std::find_if(impl->mounts.begin(),
+                              impl->mounts.end(),
+                              [fid](const fanotify_mount& m)
+                              {
+                                return memcmp(&m.fsid,
+                                              &fid->fsid,
+                                              sizeof(fsid_t)) == 0;
+                              });
+
+    if (mount == impl->mounts.end()) return false;
+
+    int dir_fd = open_by_handle_at(mount->fd, handle, O_PATH | O_CLOEXEC);
+
+    // The directory may have been removed in the meantime.
+    if (dir_fd == -1)
+    {
+      fsw_log_perror("open_by_handle_at");
+      return false;
+    }
+
+    std::string fd_path = "/proc/self/fd/" + std::to_string(dir_fd);
+    char link_path[PATH_MAX];
+    ssize_t len = readlink(fd_path.c_str(), link_path, sizeof(link_path) - 1);
+
+    close(dir_fd);
+
+    if (len == -1)
+    {
+      fsw_log_perror("readlink");
+      return false;
+    }
+
+    path.assign(link_path, len);
+
+    if (impl->directory_paths.size() >= MAX_CACHED_DIRECTORIES)
+      impl->directory_paths.clear();
+
+    impl->directory_paths[key] = path;
+
+    return true;
+  }
+
+  void fanotify_monitor::process_event(const struct fanotify_event_metadata *metadata)
+  {
+    const char *begin = reinterpret_cast<const char *> (metadata);
+    const char *info = begin + metadata->metadata_len;
+    const char *end = begin + metadata->event_len;
+
+    const struct fanotify_event_info_fid *fid = nullptr;
+    const char *name = nullptr;
+
+    // Look for the record identifying the directory of the changed object.
+    while (info + sizeof(struct fanotify_event_info_header) <= end)
+    {
+      auto header = reinterpret_cast<const struct fanotify_event_info_header *> (info);
+
+      if (header->len == 0) break;
+
+      if (header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME
+          || header->info_type == FAN_EVENT_INFO_TYPE_DFID)
+      {
+        fid = reinterpret_cast<const struct fanotify_event_info_fid *> (info);
+
+        if (header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+        {
+          auto handle = reinterpret_cast<const struct file_handle *> (fid->handle);
+          name = reinterpret_cast<const char *> (handle->f_handle) + handle->handle_bytes;
+        }
+
+        break;
+      }
+
+      info += header->len;
+    }
+
+    if (!fid) return;
+
+    std::string path;
+    if (!get_directory_path(fid, path)) return;
+
+    // Events on a directory itself are reported with the name ".".
+    if (name && *name && strcmp(name, ".") != 0)
+    {
+      if (path.back() != '/') path += '/';
+      path += name;
+    }
+
+    // A directory change invalidates the cached paths of its descendants.
+    if ((metadata->mask & FAN_ONDIR)
+        && (metadata->mask & DIRECTORY_CHANGE_MASK))
+    {
+      impl->directory_paths.clear();
+    }
+
+    FSW_DLOGS(_("Generic event: ") << metadata->mask << "::" << path << "\n");
+
+    if (!is_monitored(path)) return;
+
+    std::vector<fsw_event_flag> flags;
+
+    for (const fanotify_flag_type& type : event_flag_type)
+    {
+      if (!(metadata->mask & type.flag)) continue;
+
+      // Different kernel events may be mapped to the same flag.
+      if (std::find(flags.begin(), flags.end(), type.type) == flags.end())
+        flags.push_back(type.type);
+    }
+
+    if (flags.size())
+    {
+      impl->events.push_back({path, impl->curr_time, flags});
+    }
+  }
+
+  void fanotify_monitor::read_events()
+  {
+    for (;;)
+    {
+      ssize_t len = read(impl->fanotify_handle,
+                         &impl->buffer[0],
+                         impl->buffer.size());
+
+      if (len == -1)
+      {
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+
+        perror("read()");
+        throw libfsw_exception(_("read() on fanotify descriptor returned -1."));
+      }
+
+      FSW_DLOGS(_("Number of records: ") << len << "\n");
+
+      auto metadata = reinterpret_cast<const struct fanotify_event_metadata *> (&impl->buffer[0]);
+      const ssize_t bytes_read = len;
+      size_t records = 0;
+
+      for (; FAN_EVENT_OK(metadata, len); metadata = FAN_EVENT_NEXT(metadata, len))
+      {
+        ++records;
+
+        if (metadata->vers != FANOTIFY_METADATA_VERSION)
+        {
+          throw libfsw_exception(_("Unsupported fanotify metadata version."));
+        }
+
+        // No descriptor is returned when file handles are reported.
+        if (metadata->fd >= 0) close(metadata->fd);
+
+        if (metadata->mask & FAN_Q_OVERFLOW)
+        {
+          notify_overflow("");
+          continue;
+        }
+
+        process_event(metadata);
+      }
+
+      count_read(records, bytes_read);
+    }
+  }
+
+  void fanotify_monitor::on_stop()
+  {
+    wake_up();
+  }
+
+  void fanotify_monitor::on_paths_changed()
+  {
+    wake_up();
+  }
+
+  /*
+   * Wakes up the thread blocked waiting for events, which then checks whether
+   * the monitor should stop and applies the changes of the paths to watch.
+   */
+  void fanotify_monitor::wake_up()
+  {
+    uint64_t value = 1;
+
+    if (write(impl->stop_event_handle, &value, sizeof(value)) == -1)
+    {
+      fsw_log_perror("write");
+    }
+  }
+
+  bool fanotify_monitor::wait_for_events(double timeout)
+  {
+    // A negative timeout blocks until a descriptor is ready.
+    int timeout_ms = -1;
+
+    if (timeout >= 0)
+    {
+      double ms = std::ceil(timeout * 1000);
+      timeout_ms = (ms < INT_MAX) ? static_cast<int> (ms) : INT_MAX;
+    }
+
+    struct pollfd fds[2];
+    fds[0].fd = impl->fanotify_handle;
+    fds[0].events = POLLIN;
+    fds[1].fd = impl->stop_event_handle;
+    fds[1].events = POLLIN;
+
+    int rv = poll(fds, 2, timeout_ms);
+
+    if (rv == -1)
+    {
+      if (errno != EINTR) fsw_log_perror("poll");
+      return false;
+    }
+
+    if (fds[1].revents & POLLIN)
+    {
+      uint64_t value;
+
+      if (read(impl->stop_event_handle, &value, sizeof(value)) == -1
+          && errno != EAGAIN)
+      {
+        fsw_log_perror("read");
+      }
+
+      impl->woken_up = true;
+    }
+
+    return (fds[0].revents & POLLIN) != 0;
+  }
+
+  void fanotify_monitor::run()
+  {
+    using std::chrono::duration;
+    using std::chrono::steady_clock;
+
+    configure_monitor();
+
+    // Discard a wake up request left over by a previous run.
+    uint64_t stale_value;
+    if (read(impl->stop_event_handle, &stale_value, sizeof(stale_value)) == -1
+        && errno != EAGAIN)
+    {
+      fsw_log_perror("read");
+    }
+
+    for(;;)
+    {
+#ifdef HAVE_CXX_MUTEX
+      std::unique_lock<std::mutex> run_guard(run_mutex);
+      if (should_stop) break;
+      run_guard.unlock();
+#endif
+
+      impl->woken_up = false;
+
+      update_roots();
+
+      // Paths which cannot be marked yet are retried every latency seconds.
+      bool all_marked = add_marks();
+
+      if (!wait_for_events(all_marked ? -1 : latency)) continue;
+
+      impl->curr_time = event::get_current_time();
+      read_events();
+
+      // Coalesce the events received within the latency window into a single
+      // batch, except for the events of the priority paths.
+      const auto deadline = steady_clock::now() + duration<double>(latency);
+      size_t priority_checked = 0;
+
+      while (!impl->woken_up)
+      {
+        notify_priority_events(impl->events, priority_checked);
+
+        duration<double> remaining = deadline - steady_clock::now();
+        if (remaining.count() <= 0) break;
+        if (!wait_for_events(remaining.count())) continue;
+
+        read_events();
+      }
+
+      if (impl->events.size())
+      {
+        notify_events(impl->events);
+        impl->events.clear();
+      }
+    }
+  }
+}
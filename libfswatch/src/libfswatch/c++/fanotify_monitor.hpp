@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief fanotify monitor.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+
+#ifndef FSW_FANOTIFY_MONITOR_H
+#  define FSW_FANOTIFY_MONITOR_H
+
+#  include "monitor.hpp"
+#  include <sys/fanotify.h>
+#  include <string>
+#  include <vector>
+
+namespace fsw
+{
+  /**
+   * @brief Opaque structure containing implementation specific details of the
+   * fanotify monitor.
+   */
+  struct fanotify_monitor_impl;
+
+  /**
+   * @brief fanotify monitor.
+   *
+   * This monitor is built upon the _fanotify_ API of the Linux kernel.  Instead
+   * of adding a watch for every directory, a single mark is added for the file
+   * system (or the mount) containing each path to watch and changes are
+   * reported using a directory file handle and the name of the changed object.
+   * Paths are resolved from file handles only when events are received and
+   * events referring to objects outside the paths to watch are discarded.
+   *
+   * This monitor requires Linux 5.9 or higher and the `CAP_SYS_ADMIN`
+   * capability.
+   */
+  class fanotify_monitor : public monitor
+  {
+  public:
+    /**
+     * @brief Custom monitor property used to set the type of the marks.
+     *
+     * Valid values are `filesystem` (the default), to mark the whole file
+     * system containing each path, and `mount`, to mark the mount containing
+     * each path.  The kernel does not report the creation, removal, renaming
+     * and attribute changes of objects using mount marks.
+     */
+    static constexpr const char *FANOTIFY_MARK_TYPE = "fanotify.mark.type";
+
+    /**
+     * @brief Constructs an instance of this class.
+     */
+    fanotify_monitor(std::vector<std::string> paths,
+                     FSW_EVENT_CALLBACK *callback,
+                     void *context = nullptr);
+
+    /**
+     * @brief Destroys an instance of this class.
+     */
+    virtual ~fanotify_monitor();
+
+  protected:
+    /**
+     * @brief Executes the monitor loop.
+     *
+     * This call does not return until the monitor is stopped.
+     *
+     * @see stop()
+     */
+    void run();
+
+    /**
+     * @brief Wakes up the monitor loop so that it can check the stop flag.
+     */
+    void on_stop();
+
+    /**
+     * @brief Wakes up the monitor loop so that it can mark the added paths and
+     * unmark the removed paths.
+     */
+    void on_paths_changed();
+
+  private:
+    fanotify_monitor(const fanotify_monitor& orig) = delete;
+    fanotify_monitor& operator=(const fanotify_monitor& that) = delete;
+
+    void configure_monitor();
+    void add_root(const std::string& path);
+    void remove_root(const std::string& path);
+    void update_roots();
+    bool add_marks();
+    void wake_up();
+    bool wait_for_events(double timeout);
+    void read_events();
+    void process_event(const struct fanotify_event_metadata *metadata);
+    bool get_directory_path(const struct fanotify_event_info_fid *fid,
+                            std::string& path);
+    bool is_monitored(const std::string& path) const;
+
+    fanotify_monitor_impl *impl;
+  };
+}
+
+#endif  /* FSW_FANOTIFY_MONITOR_H */
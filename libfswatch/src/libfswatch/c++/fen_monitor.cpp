@@ -21,6 +21,7 @@
 
 #  include <time.h>
 #  include <cerrno>
+#  include <chrono>
 #  include <cmath>
 #  include <cstring>
 #  include <cstdlib>
@@ -37,6 +38,7 @@
 #  include "path_utils.hpp"
 
 using namespace std;
+using namespace std::chrono;
 
 namespace fsw
 {
@@ -49,9 +51,11 @@ namespace fsw
   struct fen_monitor_load
   {
     int port;
+    vector<port_event_t> port_events = vector<port_event_t>(256);
     fsw_hash_map<string, struct fen_info *> descriptors_by_file_name;
     fsw_hash_set<struct fen_info *> descriptors_to_remove;
     fsw_hash_set<string> paths_to_rescan;
+    directory_entries scan_entries;
 
     void initialize_fen()
     {
@@ -193,7 +197,7 @@ namespace fsw
 
   bool fen_monitor::associate_port(struct fen_info *finfo, const struct stat &fd_stat)
   {
-    FSW_ELOGF(_("Associating %s.\n"), finfo->fobj.fo_name);
+    FSW_DLOGF(_("Associating %s.\n"), finfo->fobj.fo_name);
 
     struct file_obj *fobjp = &finfo->fobj;
     finfo->fobj.fo_atime = fd_stat.st_atim;
@@ -224,13 +228,13 @@ namespace fsw
       return false;
     }
 
-    FSW_ELOGF(_("Adding %s to list of watched paths.\n"), path.c_str());
+    FSW_DLOGF(_("Adding %s to list of watched paths.\n"), path.c_str());
 
     struct fen_info *finfo = load->get_descriptor_by_name(path);
 
     if (finfo == nullptr)
     {
-      FSW_ELOG(_("Allocating fen_info.\n"));
+      FSW_DLOG(_("Allocating fen_info.\n"));
 
       finfo = static_cast<struct fen_info *>(malloc(sizeof(struct fen_info)));
 
@@ -280,14 +284,29 @@ namespace fsw
     if (!is_dir && !accept_path(path)) return true;
     if (!is_dir) return add_watch(path, fd_stat);
     if (!recursive) return true;
+    if (!accept_subtree(path)) return add_watch(path, fd_stat);
 
-    vector<string> children = get_directory_children(path);
+    directory_entries& children = load->scan_entries;
+    const size_t first_child = children.size();
 
-    for (string& child : children)
+    if (children.append(path))
     {
-      if (child.compare(".") == 0 || child.compare("..") == 0) continue;
+      const size_t last_child = children.size();
+      const string prefix = path + "/";
 
-      scan(path + "/" + child, false);
+      for (size_t i = first_child; i < last_child; ++i)
+      {
+        string child_path = prefix + children.get_name(i);
+
+        // Links are followed by stat(): only other files are skipped.
+        if (!children.may_be_directory(i, true)
+            && (directory_only || !accept_path(child_path)))
+          continue;
+
+        scan(child_path, false);
+      }
+
+      children.truncate(first_child);
     }
 
     return add_watch(path, fd_stat);
@@ -295,31 +314,79 @@ namespace fsw
 
   void fen_monitor::scan_root_paths()
   {
+    const steady_clock::time_point start = steady_clock::now();
+    bool scanned = false;
+
     for (string& path : paths)
     {
       if (is_path_watched(path)) continue;
 
+      scanned = true;
+
       if (!scan(path))
       {
         FSW_ELOGF(_("%s cannot be found. Will retry later.\n"), path.c_str());
       }
     }
+
+    if (scanned) count_scan(steady_clock::now() - start);
+    set_watch_count(load->descriptors_by_file_name.size());
   }
 
-  void fen_monitor::process_events(struct fen_info *finfo, int event_flags)
+  /*
+   * Added paths are scanned by scan_root_paths(), while the files below a
+   * removed path are dissociated unless they are below another path to watch.
+   */
+  void fen_monitor::update_root_paths()
   {
-    time_t curr_time;
-    time(&curr_time);
+    vector<string> removed_paths;
+
+    for (const path_change& change : take_path_changes())
+    {
+      if (!change.added) removed_paths.push_back(change.path);
+    }
+
+    if (removed_paths.empty()) return;
+
+    vector<string> unwatched_paths;
 
-    vector<event> events;
+    for (const auto& watch : load->descriptors_by_file_name)
+    {
+      if (is_unwatched_path(watch.first, removed_paths))
+        unwatched_paths.push_back(watch.first);
+    }
+
+    for (const string& path : unwatched_paths)
+    {
+      FSW_DLOGF(_("Removing %s from list of watched paths.\n"), path.c_str());
+
+      struct fen_info *finfo = load->get_descriptor_by_name(path);
+
+      // Dissociating the file also discards the events queued for it.
+      if (finfo
+          && port_dissociate(load->port,
+                             PORT_SOURCE_FILE,
+                             reinterpret_cast<uintptr_t>(&finfo->fobj)) != 0)
+      {
+        perror("port_dissociate()");
+      }
+
+      load->remove_watch(path);
+    }
+  }
+
+  void fen_monitor::process_events(struct fen_info *finfo,
+                                   int event_flags,
+                                   const timespec& curr_time,
+                                   vector<event>& events)
+  {
     events.push_back({finfo->fobj.fo_name, curr_time, decode_flags(event_flags)});
 
     // The File Events Notification API requires the caller to associate a file path
-    // each time an event is retrieved.
+    // each time an event is retrieved.  Paths are collected and associated
+    // again once the whole batch has been processed.
     if (event_flags & FILE_DELETE) load->descriptors_to_remove.insert(finfo);
     else load->paths_to_rescan.insert(finfo->fobj.fo_name);
-
-    notify_events(events);
   }
 
   void fen_monitor::rescan_removed()
@@ -352,16 +419,43 @@ namespace fsw
 
     while (path != load->paths_to_rescan.end())
     {
-      FSW_ELOGF(_("Rescanning %s.\n"), path->c_str());
+      FSW_DLOGF(_("Rescanning %s.\n"), path->c_str());
+
+      // A file whose descriptor is still known only needs to be associated
+      // again, while a directory is scanned to look for new children.
+      struct fen_info *finfo = load->get_descriptor_by_name(*path);
+      struct stat fd_stat;
 
-      scan(*path);
+      if (finfo && stat_path(*path, fd_stat) && !S_ISDIR(fd_stat.st_mode))
+        associate_port(finfo, fd_stat);
+      else
+        scan(*path);
 
       load->paths_to_rescan.erase(path++);
     }
   }
 
+  void fen_monitor::configure_monitor()
+  {
+    string batch_size_value = get_property(FEN_BATCH_SIZE);
+
+    if (batch_size_value.empty()) return;
+
+    char *end;
+    long parsed_value = strtol(batch_size_value.c_str(), &end, 0);
+
+    if (*end != '\0' || parsed_value <= 0)
+    {
+      string msg = string(_("Invalid value: ")) + batch_size_value;
+      throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+    }
+
+    load->port_events.resize(parsed_value);
+  }
+
   void fen_monitor::run()
   {
+    configure_monitor();
     load->initialize_fen();
 
     double sec;
@@ -377,21 +471,49 @@ namespace fsw
 
       rescan_removed();
       rescan_pending();
+      update_root_paths();
 
       scan_root_paths();
 
-      port_event_t pe;
       struct timespec timeout;
       timeout.tv_sec = sec;
       timeout.tv_nsec = 1000 * 1000 * 1000 * frac;
 
-      if (port_get(load->port, &pe, &timeout) == 0)
+      // Wait for at least one event and retrieve as many as available, up to
+      // the batch size.  On timeout, nget is set to the number of events
+      // retrieved anyway.
+      uint_t nget = 1;
+
+      if (port_getn(load->port,
+                    load->port_events.data(),
+                    load->port_events.size(),
+                    &nget,
+                    &timeout) != 0)
+      {
+        if (errno != ETIME && errno != EINTR) perror("port_getn");
+        if (errno != ETIME) continue;
+      }
+
+      if (nget == 0) continue;
+
+      count_read(nget, nget * sizeof(port_event_t));
+
+      const timespec curr_time = event::get_current_time();
+
+      vector<event> events;
+
+      for (uint_t i = 0; i < nget; ++i)
       {
+        const port_event_t& pe = load->port_events[i];
+
         switch (pe.portev_source)
         {
         case PORT_SOURCE_FILE:
           // Process file events.
-          process_events((struct fen_info *)pe.portev_object, pe.portev_events);
+          process_events((struct fen_info *)pe.portev_object,
+                         pe.portev_events,
+                         curr_time,
+                         events);
           break;
         default:
           const char *msg = _("Event from unexpected source");
@@ -399,7 +521,8 @@ namespace fsw
           throw libfsw_exception(msg);
         }
       }
-      else if (errno != ETIME && errno != EINTR) perror("port_get");
+
+      if (!events.empty()) notify_events(events);
     }
   }
 }
@@ -53,6 +53,16 @@ namespace fsw
   class fen_monitor : public monitor
   {
   public:
+    /**
+     * @brief Custom monitor property used to set the maximum number of events
+     * retrieved from the event port by a single call to `port_getn()`.
+     *
+     * The events retrieved together are notified in the same batch and the
+     * files they refer to are associated again with the port in a single pass
+     * afterwards.  The default value is `256`.
+     */
+    static constexpr const char *FEN_BATCH_SIZE = "fen.batch.size";
+
     /**
      * @brief Constructs an instance of this class.
      */
@@ -79,12 +89,17 @@ namespace fsw
     fen_monitor(const fen_monitor& orig) = delete;
     fen_monitor& operator=(const fen_monitor& that) = delete;
 
+    void configure_monitor();
     void scan_root_paths();
+    void update_root_paths();
     bool scan(const std::string& path, bool is_root_path = true);
     bool is_path_watched(const std::string& path) const;
     bool add_watch(const std::string& path, const struct stat& fd_stat);
     bool associate_port(struct fen_info *finfo, const struct stat& fd_stat);
-    void process_events(struct fen_info *obj, int events);
+    void process_events(struct fen_info *finfo,
+                        int event_flags,
+                        const timespec& curr_time,
+                        std::vector<event>& events);
     void rescan_removed();
     void rescan_pending();
 
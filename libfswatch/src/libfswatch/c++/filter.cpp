@@ -85,7 +85,8 @@ namespace fsw
     //   - '+' or '-', to indicate whether the filter is an inclusion or an exclusion filter.
     //   - 'e', for an extended regular expression.
     //   - 'i', for a case insensitive regular expression.
-    regex filter_grammar("^([+-])([ei]*) (.+)$", regex_constants::extended);
+    //   - 'g', for a glob.
+    regex filter_grammar("^([+-])([eig]*) (.+)$", regex_constants::extended);
     smatch fragments;
 
     if (!regex_match(filter, fragments, filter_grammar))
@@ -127,6 +128,9 @@ namespace fsw
       case 'i':
         filter_object.case_sensitive = false;
         break;
+      case 'g':
+        filter_object.glob = true;
+        break;
       default:
         throw invalid_argument(string(_("Unknown flag: ")) + c);
       }
@@ -52,6 +52,9 @@ namespace fsw
    *
    *   - It can be an _extended_ regular expression (monitor_filter::extended).
    *
+   *   - It can be a _glob_ instead of a regular expression
+   *     (monitor_filter::glob).
+   *
    * Further information about how filtering works in `libfswatch` can be found
    * in @ref path-filtering.
    */
@@ -87,6 +90,17 @@ namespace fsw
      */
     bool extended;
 
+    /**
+     * @brief Flag indicating whether monitor_filter::text is a glob instead of
+     * a regular expression.
+     *
+     * A glob is matched against the whole path: `*` matches any sequence of
+     * characters, including `/`, `?` matches any character, `[...]` is a
+     * bracket expression and a backslash escapes the following character.
+     * When this flag is set, monitor_filter::extended is ignored.
+     */
+    bool glob;
+
     /**
      * @brief Load filters from the specified file.
      *
@@ -94,7 +108,7 @@ namespace fsw
      * A filter has the following structure:
      *
      *   - It is validated by the following regular expression:
-     *     `^([+-])([ei]*) (.+)$`
+     *     `^([+-])([eig]*) (.+)$`
      *
      *   - The first character is the filter type: `+` if it is an _inclusion_
      *     filter, `-` if it is an _exclusion_ filter.
@@ -105,6 +119,8 @@ namespace fsw
      *
      *     - `i` if it is a _case insensitive_ regular expression.
      *
+     *     - `g` if it is a _glob_.
+     *
      *   - A space.
      *
      *   - The filter regular expression text.
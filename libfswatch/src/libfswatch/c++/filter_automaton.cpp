@@ -0,0 +1,887 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "filter_automaton.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+using namespace std;
+
+namespace fsw
+{
+  /*
+   * Maximum number of deterministic states kept in the cache.  When the cache
+   * grows beyond this limit, it is discarded before matching the next path.
+   */
+  static const size_t MAX_DFA_STATES = 2048;
+
+  /*
+   * Maximum repetition count accepted in an interval expression.
+   */
+  static const int MAX_REPETITIONS = 64;
+
+  /*
+   * Flags of the types of filters reachable from a state.
+   */
+  static const int INCLUDE_FILTERS = 1;
+  static const int EXCLUDE_FILTERS = 2;
+
+  /*
+   * Thrown by the parser when a regular expression uses a construct which is
+   * not supported by the automaton.
+   */
+  struct unsupported_construct
+  {
+  };
+
+  /*
+   * Parser of POSIX basic and extended regular expressions.  The expression is
+   * parsed into a syntax tree which is then compiled into the nodes of the
+   * nondeterministic automaton.
+   */
+  class filter_automaton::parser
+  {
+  public:
+    parser(filter_automaton& automaton, const monitor_filter& filter) :
+      automaton(automaton),
+      text(filter.text),
+      extended(filter.extended),
+      icase(!filter.case_sensitive)
+    {
+    }
+
+    int compile(int out)
+    {
+      expression expr = extended ? parse_alternation(0) : parse_sequence(0);
+
+      if (pos != text.size()) throw unsupported_construct();
+
+      return compile(expr, out);
+    }
+
+  private:
+    enum expression_type
+    {
+      expr_set,
+      expr_concat,
+      expr_alternation,
+      expr_repeat,
+      expr_begin,
+      expr_end
+    };
+
+    struct expression
+    {
+      expression_type type;
+      int char_set;
+      int min;
+      int max;
+      vector<expression> children;
+    };
+
+    filter_automaton& automaton;
+    const string& text;
+    const bool extended;
+    const bool icase;
+    size_t pos = 0;
+
+    bool at_end() const
+    {
+      return pos >= text.size();
+    }
+
+    char peek(size_t offset = 0) const
+    {
+      return (pos + offset < text.size()) ? text[pos + offset] : '\0';
+    }
+
+    static expression make(expression_type type)
+    {
+      expression expr;
+      expr.type = type;
+      expr.char_set = -1;
+      expr.min = expr.max = 0;
+      return expr;
+    }
+
+    expression make_set(bitset<256> set)
+    {
+      if (icase) fold_case(set);
+
+      automaton.char_sets.push_back(set);
+
+      expression expr = make(expr_set);
+      expr.char_set = automaton.char_sets.size() - 1;
+      return expr;
+    }
+
+    expression make_char(unsigned char c)
+    {
+      bitset<256> set;
+      set.set(c);
+      return make_set(set);
+    }
+
+    static void fold_case(bitset<256>& set)
+    {
+      for (int c = 0; c < 256; ++c)
+      {
+        if (!set.test(c)) continue;
+
+        set.set(tolower(c));
+        set.set(toupper(c));
+      }
+    }
+
+    // Extended syntax: branches separated by '|'.
+    expression parse_alternation(int depth)
+    {
+      expression alternation = make(expr_alternation);
+      alternation.children.push_back(parse_sequence(depth));
+
+      while (!at_end() && peek() == '|')
+      {
+        ++pos;
+        alternation.children.push_back(parse_sequence(depth));
+      }
+
+      if (alternation.children.size() == 1) return alternation.children[0];
+
+      return alternation;
+    }
+
+    bool at_sequence_end(int depth) const
+    {
+      if (at_end()) return true;
+
+      if (extended) return peek() == '|' || (depth > 0 && peek() == ')');
+
+      return depth > 0 && peek() == '\\' && peek(1) == ')';
+    }
+
+    expression parse_sequence(int depth)
+    {
+      expression sequence = make(expr_concat);
+      const size_t start = pos;
+
+      while (!at_sequence_end(depth))
+      {
+        expression atom = parse_atom(depth, pos == start);
+        sequence.children.push_back(parse_repetitions(atom));
+      }
+
+      // Empty branches and groups are rejected.
+      if (sequence.children.empty()) throw unsupported_construct();
+      if (sequence.children.size() == 1) return sequence.children[0];
+
+      return sequence;
+    }
+
+    expression parse_repetitions(expression atom)
+    {
+      if (atom.type == expr_begin || atom.type == expr_end)
+      {
+        if (!at_end() && is_repetition()) throw unsupported_construct();
+        return atom;
+      }
+
+      if (at_end() || !is_repetition()) return atom;
+
+      expression repeat = make(expr_repeat);
+      parse_repetition(repeat.min, repeat.max);
+      repeat.children.push_back(atom);
+
+      // Repeated repetitions are rejected.
+      if (!at_end() && is_repetition()) throw unsupported_construct();
+
+      return repeat;
+    }
+
+    bool is_repetition() const
+    {
+      const char c = peek();
+
+      if (c == '*') return true;
+      if (extended) return c == '+' || c == '?' || c == '{';
+
+      return c == '\\' && peek(1) == '{';
+    }
+
+    void parse_repetition(int& min, int& max)
+    {
+      const char c = text[pos++];
+
+      switch (c)
+      {
+      case '*':
+        min = 0;
+        max = -1;
+        return;
+      case '+':
+        min = 1;
+        max = -1;
+        return;
+      case '?':
+        min = 0;
+        max = 1;
+        return;
+      default:
+        break;
+      }
+
+      // Interval expression: {m}, {m,} or {m,n}.
+      if (!extended) ++pos;
+
+      min = parse_number();
+      max = min;
+
+      if (peek() == ',')
+      {
+        ++pos;
+        max = isdigit(static_cast<unsigned char> (peek())) ? parse_number() : -1;
+      }
+
+      if (!extended)
+      {
+        if (peek() != '\\') throw unsupported_construct();
+        ++pos;
+      }
+
+      if (peek() != '}') throw unsupported_construct();
+      ++pos;
+
+      if (max != -1 && max < min) throw unsupported_construct();
+      if (max == 0) throw unsupported_construct();
+    }
+
+    int parse_number()
+    {
+      if (!isdigit(static_cast<unsigned char> (peek())))
+        throw unsupported_construct();
+
+      int number = 0;
+
+      while (isdigit(static_cast<unsigned char> (peek())))
+      {
+        number = number * 10 + (text[pos++] - '0');
+        if (number > MAX_REPETITIONS) throw unsupported_construct();
+      }
+
+      return number;
+    }
+
+    expression parse_atom(int depth, bool first)
+    {
+      const char c = text[pos];
+
+      if (extended)
+      {
+        switch (c)
+        {
+        case '(':
+        {
+          ++pos;
+          expression group = parse_alternation(depth + 1);
+          if (peek() != ')') throw unsupported_construct();
+          ++pos;
+          return group;
+        }
+        case ')':
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+        case '|':
+          throw unsupported_construct();
+        case '^':
+          ++pos;
+          return make(expr_begin);
+        case '$':
+          ++pos;
+          return make(expr_end);
+        default:
+          break;
+        }
+      }
+      else
+      {
+        switch (c)
+        {
+        case '*':
+          // A leading '*' is an ordinary character in the basic syntax, but
+          // implementations disagree.
+          throw unsupported_construct();
+        case '^':
+          if (!first) throw unsupported_construct();
+          ++pos;
+          if (!at_end() && peek() == '*') throw unsupported_construct();
+          return make(expr_begin);
+        case '$':
+          ++pos;
+          if (!at_sequence_end(depth)) throw unsupported_construct();
+          return make(expr_end);
+        case '\\':
+          if (peek(1) == '(')
+          {
+            pos += 2;
+            expression group = parse_sequence(depth + 1);
+            if (peek() != '\\' || peek(1) != ')') throw unsupported_construct();
+            pos += 2;
+            return group;
+          }
+          break;
+        default:
+          break;
+        }
+      }
+
+      switch (c)
+      {
+      case '.':
+      {
+        ++pos;
+        bitset<256> set;
+        set.set();
+        set.reset(0);
+        return make_set(set);
+      }
+      case '[':
+        ++pos;
+        return parse_bracket();
+      case '\\':
+        return parse_escape();
+      default:
+        ++pos;
+        return make_char(static_cast<unsigned char> (c));
+      }
+    }
+
+    expression parse_escape()
+    {
+      ++pos;
+      if (at_end()) throw unsupported_construct();
+
+      const char c = text[pos++];
+      const char *special = extended ? ".[]()*+?{}|^$\\" : ".[]*^$\\";
+
+      // Back-references and escapes of ordinary characters are rejected.
+      if (!strchr(special, c)) throw unsupported_construct();
+
+      return make_char(static_cast<unsigned char> (c));
+    }
+
+    expression parse_bracket()
+    {
+      bitset<256> set;
+      bool negate = false;
+
+      if (peek() == '^')
+      {
+        negate = true;
+        ++pos;
+      }
+
+      bool first = true;
+
+      for (;;)
+      {
+        if (at_end()) throw unsupported_construct();
+
+        const unsigned char c = text[pos];
+
+        if (c == ']' && !first)
+        {
+          ++pos;
+          break;
+        }
+
+        first = false;
+
+        if (c == '[' && peek(1) == ':')
+        {
+          parse_class(set);
+          continue;
+        }
+
+        // Equivalence classes and collating symbols are rejected.
+        if (c == '[' && (peek(1) == '=' || peek(1) == '.'))
+          throw unsupported_construct();
+
+        ++pos;
+
+        if (peek() == '-' && pos + 1 < text.size() && text[pos + 1] != ']')
+        {
+          const unsigned char last = text[pos + 1];
+
+          if (last == '[' || last < c) throw unsupported_construct();
+
+          pos += 2;
+          for (unsigned int i = c; i <= last; ++i) set.set(i);
+        }
+        else
+        {
+          set.set(c);
+        }
+      }
+
+      if (icase) fold_case(set);
+      if (negate)
+      {
+        set.flip();
+        set.reset(0);
+      }
+
+      automaton.char_sets.push_back(set);
+
+      expression expr = make(expr_set);
+      expr.char_set = automaton.char_sets.size() - 1;
+      return expr;
+    }
+
+    void parse_class(bitset<256>& set)
+    {
+      const size_t end = text.find(":]", pos + 2);
+      if (end == string::npos) throw unsupported_construct();
+
+      const string name = text.substr(pos + 2, end - pos - 2);
+      pos = end + 2;
+
+      int (*predicate)(int) = nullptr;
+
+      if (name == "alpha") predicate = isalpha;
+      else if (name == "digit") predicate = isdigit;
+      else if (name == "alnum") predicate = isalnum;
+      else if (name == "space") predicate = isspace;
+      else if (name == "blank") predicate = isblank;
+      else if (name == "punct") predicate = ispunct;
+      else if (name == "print") predicate = isprint;
+      else if (name == "graph") predicate = isgraph;
+      else if (name == "cntrl") predicate = iscntrl;
+      else if (name == "xdigit") predicate = isxdigit;
+      else if (name == "upper" && !icase) predicate = isupper;
+      else if (name == "lower" && !icase) predicate = islower;
+      else throw unsupported_construct();
+
+      for (int c = 0; c < 128; ++c)
+      {
+        if (predicate(c)) set.set(c);
+      }
+    }
+
+    // The expression is compiled backwards: out is the node reached after
+    // matching expr and the entry node of expr is returned.
+    int compile(const expression& expr, int out)
+    {
+      switch (expr.type)
+      {
+      case expr_set:
+      {
+        int n = automaton.add_node(node_char, out);
+        automaton.nodes[n].char_set = expr.char_set;
+        return n;
+      }
+      case expr_concat:
+        for (auto it = expr.children.rbegin(); it != expr.children.rend(); ++it)
+          out = compile(*it, out);
+        return out;
+      case expr_alternation:
+      {
+        int entry = compile(expr.children.back(), out);
+
+        for (size_t i = expr.children.size() - 1; i-- > 0;)
+          entry = automaton.add_node(node_split,
+                                     compile(expr.children[i], out),
+                                     entry);
+
+        return entry;
+      }
+      case expr_repeat:
+      {
+        const expression& child = expr.children[0];
+        int entry = out;
+
+        if (expr.max == -1)
+        {
+          int loop = automaton.add_node(node_split, -1, out);
+          int body = compile(child, loop);
+          automaton.nodes[loop].out = body;
+          entry = loop;
+        }
+        else
+        {
+          for (int i = expr.min; i < expr.max; ++i)
+            entry = automaton.add_node(node_split, compile(child, entry), out);
+        }
+
+        for (int i = 0; i < expr.min; ++i) entry = compile(child, entry);
+
+        return entry;
+      }
+      case expr_begin:
+        return automaton.add_node(node_begin, out);
+      case expr_end:
+        return automaton.add_node(node_end, out);
+      }
+
+      throw unsupported_construct();
+    }
+  };
+
+  int filter_automaton::add_node(node_type type, int out, int out1)
+  {
+    nodes.push_back({type, out, out1, -1, fsw_filter_type::filter_include});
+
+    return nodes.size() - 1;
+  }
+
+  bool filter_automaton::add(const monitor_filter& filter)
+  {
+    const size_t node_count = nodes.size();
+    const size_t char_set_count = char_sets.size();
+
+    try
+    {
+      int accept = add_node(node_accept);
+      nodes[accept].filter_type = filter.type;
+
+      parser p(*this, filter);
+      starts.push_back(p.compile(accept));
+    }
+    catch (unsupported_construct&)
+    {
+      nodes.resize(node_count);
+      char_sets.resize(char_set_count);
+      return false;
+    }
+
+    if (filter.type == fsw_filter_type::filter_include) has_includes = true;
+
+#ifdef HAVE_CXX_MUTEX
+    std::lock_guard<std::mutex> states_lock(states_mutex);
+#endif
+    reset_states();
+
+    return true;
+  }
+
+  bool filter_automaton::empty() const
+  {
+    return starts.empty();
+  }
+
+  void filter_automaton::reset_states() const
+  {
+    states.clear();
+    state_by_nodes.clear();
+    start_state = -1;
+  }
+
+  void filter_automaton::closure(int n,
+                                 vector<char>& visited,
+                                 vector<int>& result,
+                                 bool at_start,
+                                 bool at_end) const
+  {
+    while (n >= 0 && !visited[n])
+    {
+      visited[n] = 1;
+      const node& current = nodes[n];
+
+      switch (current.type)
+      {
+      case node_char:
+      case node_accept:
+        result.push_back(n);
+        return;
+      case node_split:
+        closure(current.out1, visited, result, at_start, at_end);
+        n = current.out;
+        break;
+      case node_epsilon:
+        n = current.out;
+        break;
+      case node_begin:
+        if (!at_start) return;
+        n = current.out;
+        break;
+      case node_end:
+        // End assertions are kept in the state and followed only when the
+        // end of the path is reached.
+        if (!at_end)
+        {
+          result.push_back(n);
+          return;
+        }
+        n = current.out;
+        break;
+      }
+    }
+  }
+
+  int filter_automaton::get_state(vector<int>& state_nodes) const
+  {
+    sort(state_nodes.begin(), state_nodes.end());
+
+    auto it = state_by_nodes.find(state_nodes);
+    if (it != state_by_nodes.end()) return it->second;
+
+    dfa_state state;
+    state.next.assign(256, -1);
+    state.includes = false;
+    state.excludes = false;
+    state.end_checked = false;
+    state.includes_at_end = false;
+    state.excludes_at_end = false;
+    state.reachable_filters = -1;
+
+    for (int n : state_nodes)
+    {
+      if (nodes[n].type != node_accept) continue;
+
+      if (nodes[n].filter_type == fsw_filter_type::filter_include)
+        state.includes = true;
+      else
+        state.excludes = true;
+    }
+
+    state.nodes = state_nodes;
+    states.push_back(std::move(state));
+
+    const int id = states.size() - 1;
+    state_by_nodes[state_nodes] = id;
+
+    return id;
+  }
+
+  int filter_automaton::get_start_state() const
+  {
+    if (start_state >= 0) return start_state;
+
+    vector<char> visited(nodes.size(), 0);
+    vector<int> state_nodes;
+
+    for (int start : starts) closure(start, visited, state_nodes, true, false);
+
+    start_state = get_state(state_nodes);
+
+    return start_state;
+  }
+
+  int filter_automaton::step(int state, unsigned char c) const
+  {
+    vector<char> visited(nodes.size(), 0);
+    vector<int> state_nodes;
+
+    for (int n : states[state].nodes)
+    {
+      const node& current = nodes[n];
+
+      if (current.type == node_char && char_sets[current.char_set].test(c))
+        closure(current.out, visited, state_nodes, false, false);
+    }
+
+    // Filters match anywhere in the path: a match may start at any position.
+    for (int start : starts) closure(start, visited, state_nodes, false, false);
+
+    const int next = get_state(state_nodes);
+    states[state].next[c] = next;
+
+    return next;
+  }
+
+  void filter_automaton::check_end(dfa_state& state) const
+  {
+    if (state.end_checked) return;
+
+    vector<char> visited(nodes.size(), 0);
+    vector<int> end_nodes;
+
+    for (int n : state.nodes)
+    {
+      if (nodes[n].type == node_end)
+        closure(nodes[n].out, visited, end_nodes, false, true);
+    }
+
+    state.includes_at_end = state.includes;
+    state.excludes_at_end = state.excludes;
+
+    for (int n : end_nodes)
+    {
+      if (nodes[n].type != node_accept) continue;
+
+      if (nodes[n].filter_type == fsw_filter_type::filter_include)
+        state.includes_at_end = true;
+      else
+        state.excludes_at_end = true;
+    }
+
+    state.end_checked = true;
+  }
+
+  filter_automaton::match_result filter_automaton::match_empty() const
+  {
+    // Both the beginning and the end of the path are at the first position.
+    vector<char> visited(nodes.size(), 0);
+    vector<int> accept_nodes;
+
+    for (int start : starts) closure(start, visited, accept_nodes, true, true);
+
+    bool excluded = false;
+
+    for (int n : accept_nodes)
+    {
+      if (nodes[n].type != node_accept) continue;
+      if (nodes[n].filter_type == fsw_filter_type::filter_include)
+        return include_match;
+
+      excluded = true;
+    }
+
+    return excluded ? exclude_match : no_match;
+  }
+
+  filter_automaton::match_result filter_automaton::match(const string& path) const
+  {
+    if (starts.empty()) return no_match;
+
+#ifdef HAVE_CXX_MUTEX
+    std::lock_guard<std::mutex> states_lock(states_mutex);
+#endif
+
+    if (path.empty()) return match_empty();
+
+    if (states.size() > MAX_DFA_STATES) reset_states();
+
+    int state = get_start_state();
+    bool excluded = false;
+
+    for (const char c : path)
+    {
+      const dfa_state& current = states[state];
+
+      if (current.includes) return include_match;
+      if (current.excludes)
+      {
+        // Without inclusion filters, the result cannot change any more.
+        if (!has_includes) return exclude_match;
+        excluded = true;
+      }
+
+      const unsigned char uc = static_cast<unsigned char> (c);
+      const int next = current.next[uc];
+      state = (next >= 0) ? next : step(state, uc);
+    }
+
+    check_end(states[state]);
+
+    if (states[state].includes_at_end) return include_match;
+    if (excluded || states[state].excludes_at_end) return exclude_match;
+
+    return no_match;
+  }
+
+  int filter_automaton::get_reachable_filters(dfa_state& state) const
+  {
+    if (state.reachable_filters >= 0) return state.reachable_filters;
+
+    // Any character may follow the prefix, so every edge of the automaton is
+    // followed except the assertions of the beginning of the path.  Matches
+    // may also start after the prefix.
+    vector<char> visited(nodes.size(), 0);
+    vector<int> pending(state.nodes);
+    pending.insert(pending.end(), starts.begin(), starts.end());
+    int reachable = 0;
+
+    while (!pending.empty() && reachable != (INCLUDE_FILTERS | EXCLUDE_FILTERS))
+    {
+      const int n = pending.back();
+      pending.pop_back();
+
+      if (n < 0 || visited[n]) continue;
+      visited[n] = 1;
+
+      const node& current = nodes[n];
+
+      switch (current.type)
+      {
+      case node_accept:
+        reachable |= (current.filter_type == fsw_filter_type::filter_include)
+                     ? INCLUDE_FILTERS
+                     : EXCLUDE_FILTERS;
+        break;
+      case node_split:
+        pending.push_back(current.out);
+        pending.push_back(current.out1);
+        break;
+      case node_char:
+      case node_epsilon:
+      case node_end:
+        pending.push_back(current.out);
+        break;
+      case node_begin:
+        break;
+      }
+    }
+
+    state.reachable_filters = reachable;
+
+    return reachable;
+  }
+
+  void filter_automaton::match_prefix(const string& prefix,
+                                      prefix_match& result) const
+  {
+    result = {false, false, false, false};
+
+    if (starts.empty()) return;
+
+#ifdef HAVE_CXX_MUTEX
+    std::lock_guard<std::mutex> states_lock(states_mutex);
+#endif
+
+    if (states.size() > MAX_DFA_STATES) reset_states();
+
+    int state = get_start_state();
+
+    for (const char c : prefix)
+    {
+      const dfa_state& current = states[state];
+
+      // Accepting states reached before the end of the path are kept by every
+      // longer path, while matches depending on the end of the path are not.
+      if (current.includes) result.all_included = true;
+      if (current.excludes) result.all_excluded = true;
+
+      const unsigned char uc = static_cast<unsigned char> (c);
+      const int next = current.next[uc];
+      state = (next >= 0) ? next : step(state, uc);
+    }
+
+    dfa_state& last = states[state];
+
+    if (last.includes) result.all_included = true;
+    if (last.excludes) result.all_excluded = true;
+
+    const int reachable = get_reachable_filters(last);
+
+    result.may_include = result.all_included || (reachable & INCLUDE_FILTERS);
+    result.may_exclude = result.all_excluded || (reachable & EXCLUDE_FILTERS);
+  }
+}
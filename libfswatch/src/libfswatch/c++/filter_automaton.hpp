@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::filter_automaton class.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_FILTER_AUTOMATON_H
+#  define FSW_FILTER_AUTOMATON_H
+
+#  include "filter.hpp"
+#  include <bitset>
+#  include <map>
+#  include <string>
+#  include <vector>
+#  ifdef HAVE_CXX_MUTEX
+#    include <mutex>
+#  endif
+
+namespace fsw
+{
+  /**
+   * @brief Automaton matching a set of path filters in a single pass.
+   *
+   * The regular expressions of all the filters added to the automaton are
+   * compiled into a single nondeterministic finite automaton, which is
+   * converted lazily into a deterministic one while paths are matched: once
+   * the states needed by the paths being matched have been built, a path is
+   * matched against all the filters by looking up one transition per
+   * character.
+   *
+   * Only regular expressions using the POSIX basic and extended syntax
+   * without back-references are supported: add() returns @c false when a
+   * filter cannot be compiled, and the caller is expected to match it with
+   * `std::regex` instead.
+   */
+  class filter_automaton
+  {
+  public:
+    /**
+     * @brief Result of matching a path.
+     */
+    enum match_result
+    {
+      no_match,     /**< No filter matches the path. */
+      include_match,/**< At least one inclusion filter matches the path. */
+      exclude_match /**< Only exclusion filters match the path. */
+    };
+
+    /**
+     * @brief Adds a filter to the automaton.
+     *
+     * @param filter The filter to add.
+     * @return @c true if the filter was added, @c false if its regular
+     * expression uses a construct which is not supported.
+     */
+    bool add(const monitor_filter& filter);
+
+    /**
+     * @brief Checks whether the automaton contains any filter.
+     *
+     * @return @c true if no filter has been added, @c false otherwise.
+     */
+    bool empty() const;
+
+    /**
+     * @brief Matches a path against all the filters of the automaton.
+     *
+     * @param path The path to match.
+     * @return The result of the match.
+     */
+    match_result match(const std::string& path) const;
+
+    /**
+     * @brief Result of matching the paths starting with a prefix.
+     */
+    struct prefix_match
+    {
+      bool all_included; /**< Every path matches an inclusion filter. */
+      bool all_excluded; /**< Every path matches an exclusion filter. */
+      bool may_include;  /**< Some path may match an inclusion filter. */
+      bool may_exclude;  /**< Some path may match an exclusion filter. */
+    };
+
+    /**
+     * @brief Matches the paths starting with a prefix.
+     *
+     * @param prefix The prefix to match.
+     * @param result The result of the match.
+     */
+    void match_prefix(const std::string& prefix, prefix_match& result) const;
+
+  private:
+    enum node_type
+    {
+      node_char,
+      node_split,
+      node_epsilon,
+      node_begin,
+      node_end,
+      node_accept
+    };
+
+    struct node
+    {
+      node_type type;
+      int out;
+      int out1;
+      int char_set;
+      fsw_filter_type filter_type;
+    };
+
+    struct dfa_state
+    {
+      std::vector<int> nodes;
+      std::vector<int> next;
+      bool includes;
+      bool excludes;
+      bool end_checked;
+      bool includes_at_end;
+      bool excludes_at_end;
+      int reachable_filters;
+    };
+
+    class parser;
+    friend class parser;
+
+    int add_node(node_type type, int out = -1, int out1 = -1);
+    void closure(int node, std::vector<char>& visited,
+                 std::vector<int>& nodes, bool at_start, bool at_end) const;
+    int get_state(std::vector<int>& nodes) const;
+    int get_start_state() const;
+    int step(int state, unsigned char c) const;
+    void check_end(dfa_state& state) const;
+    match_result match_empty() const;
+    int get_reachable_filters(dfa_state& state) const;
+    void reset_states() const;
+
+    std::vector<node> nodes;
+    std::vector<std::bitset<256>> char_sets;
+    std::vector<int> starts;
+    bool has_includes = false;
+
+    mutable std::vector<dfa_state> states;
+    mutable std::map<std::vector<int>, int> state_by_nodes;
+    mutable int start_state = -1;
+#  ifdef HAVE_CXX_MUTEX
+    mutable std::mutex states_mutex;
+#  endif
+  };
+}
+
+#endif  /* FSW_FILTER_AUTOMATON_H */
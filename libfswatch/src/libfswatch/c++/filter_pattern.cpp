@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "filter_pattern.hpp"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace fsw
+{
+  static const char *EXTENDED_SPECIAL_CHARS = ".[]()*+?{}|^$\\";
+  static const char *BASIC_SPECIAL_CHARS = ".[]*^$\\";
+
+  static bool is_special(char c, const char *special_chars)
+  {
+    return c == '\0' || strchr(special_chars, c) != nullptr;
+  }
+
+  static bool is_escaped(const string& text, size_t pos, size_t begin)
+  {
+    size_t backslashes = 0;
+
+    while (pos-- > begin && text[pos] == '\\') ++backslashes;
+
+    return (backslashes % 2) != 0;
+  }
+
+  static bool parse_regex_literal(const monitor_filter& filter,
+                                  literal_pattern::match_kind& kind,
+                                  string& literal)
+  {
+    const string& text = filter.text;
+    const char *special_chars =
+      filter.extended ? EXTENDED_SPECIAL_CHARS : BASIC_SPECIAL_CHARS;
+
+    size_t begin = 0;
+    size_t end = text.size();
+    const bool at_begin = (end > 0 && text[0] == '^');
+
+    if (at_begin) ++begin;
+
+    const bool at_end = (end > begin
+                         && text[end - 1] == '$'
+                         && !is_escaped(text, end - 1, begin));
+
+    if (at_end) --end;
+
+    for (size_t i = begin; i < end; ++i)
+    {
+      char c = text[i];
+
+      if (c == '\\')
+      {
+        if (++i == end) return false;
+
+        c = text[i];
+
+        // Other escape sequences are back-references or operators.
+        if (!is_special(c, special_chars) || c == '\0') return false;
+      }
+      else if (is_special(c, special_chars))
+      {
+        return false;
+      }
+
+      literal += c;
+    }
+
+    if (at_begin && at_end) kind = literal_pattern::exact;
+    else if (at_begin) kind = literal_pattern::prefix;
+    else if (at_end) kind = literal_pattern::suffix;
+    else kind = literal_pattern::substring;
+
+    return true;
+  }
+
+  static bool parse_glob_literal(const string& glob,
+                                 literal_pattern::match_kind& kind,
+                                 string& literal)
+  {
+    size_t begin = 0;
+    size_t end = glob.size();
+
+    while (begin < end && glob[begin] == '*') ++begin;
+
+    const bool any_begin = (begin > 0);
+    bool any_end = false;
+
+    while (end > begin && glob[end - 1] == '*' && !is_escaped(glob, end - 1, begin))
+    {
+      --end;
+      any_end = true;
+    }
+
+    for (size_t i = begin; i < end; ++i)
+    {
+      char c = glob[i];
+
+      if (c == '\\')
+      {
+        if (++i == end) return false;
+        c = glob[i];
+      }
+      else if (c == '*' || c == '?' || c == '[')
+      {
+        return false;
+      }
+
+      literal += c;
+    }
+
+    if (any_begin && any_end) kind = literal_pattern::substring;
+    else if (any_begin) kind = literal_pattern::suffix;
+    else if (any_end) kind = literal_pattern::prefix;
+    else kind = literal_pattern::exact;
+
+    return true;
+  }
+
+  bool literal_pattern::from_filter(const monitor_filter& filter,
+                                    literal_pattern& pattern)
+  {
+    if (!filter.case_sensitive) return false;
+
+    match_kind kind;
+    string literal;
+
+    bool is_literal = filter.glob
+                      ? parse_glob_literal(filter.text, kind, literal)
+                      : parse_regex_literal(filter, kind, literal);
+
+    // An empty pattern matches any path but is left to the regular expression
+    // engine.
+    if (!is_literal || literal.empty()) return false;
+
+    pattern.kind = kind;
+    pattern.text = std::move(literal);
+
+    return true;
+  }
+
+  bool literal_pattern::match(const string& path) const
+  {
+    const size_t length = text.size();
+
+    if (path.size() < length) return false;
+
+    switch (kind)
+    {
+    case exact:
+      return path.size() == length && memcmp(path.data(), text.data(), length) == 0;
+    case prefix:
+      return memcmp(path.data(), text.data(), length) == 0;
+    case suffix:
+      return memcmp(path.data() + path.size() - length, text.data(), length) == 0;
+    case substring:
+#ifdef HAVE_MEMMEM
+      return memmem(path.data(), path.size(), text.data(), length) != nullptr;
+#else
+      return path.find(text) != string::npos;
+#endif
+    }
+
+    return false;
+  }
+
+  bool literal_pattern::can_match_extension(const string& path_prefix) const
+  {
+    switch (kind)
+    {
+    case exact:
+      return text.size() > path_prefix.size()
+        && text.compare(0, path_prefix.size(), path_prefix) == 0;
+    case prefix:
+    {
+      const size_t length = std::min(text.size(), path_prefix.size());
+      return text.compare(0, length, path_prefix, 0, length) == 0;
+    }
+    case suffix:
+    case substring:
+      return true;
+    }
+
+    return true;
+  }
+
+  bool literal_pattern::matches_all_extensions(const string& path_prefix) const
+  {
+    switch (kind)
+    {
+    case prefix:
+      return path_prefix.size() >= text.size()
+        && path_prefix.compare(0, text.size(), text) == 0;
+    case substring:
+      return match(path_prefix);
+    case exact:
+    case suffix:
+      return false;
+    }
+
+    return false;
+  }
+
+  literal_pattern::match_kind literal_pattern::get_kind() const
+  {
+    return kind;
+  }
+
+  const string& literal_pattern::get_text() const
+  {
+    return text;
+  }
+
+  static void append_literal(string& regex, char c)
+  {
+    // Closing brackets and braces are ordinary characters and escaping them
+    // is not portable.
+    if (c != ']' && c != '}' && is_special(c, EXTENDED_SPECIAL_CHARS))
+      regex += '\\';
+    regex += c;
+  }
+
+  static size_t find_bracket_end(const string& glob, size_t i)
+  {
+    size_t j = i + 1;
+
+    if (j < glob.size() && (glob[j] == '!' || glob[j] == '^')) ++j;
+    if (j < glob.size() && glob[j] == ']') ++j;
+
+    while (j < glob.size() && glob[j] != ']')
+    {
+      // Skip character classes such as [:alpha:].
+      if (glob[j] == '[' && j + 1 < glob.size() && glob[j + 1] == ':')
+      {
+        size_t class_end = glob.find(":]", j + 2);
+        if (class_end == string::npos) return string::npos;
+        j = class_end + 2;
+        continue;
+      }
+
+      ++j;
+    }
+
+    return (j < glob.size()) ? j : string::npos;
+  }
+
+  string glob_to_regex(const string& glob)
+  {
+    string regex = "^";
+
+    for (size_t i = 0; i < glob.size(); ++i)
+    {
+      const char c = glob[i];
+
+      switch (c)
+      {
+      case '*':
+        regex += ".*";
+        break;
+      case '?':
+        regex += '.';
+        break;
+      case '[':
+      {
+        const size_t end = find_bracket_end(glob, i);
+
+        // An unterminated bracket is an ordinary character.
+        if (end == string::npos)
+        {
+          append_literal(regex, c);
+          break;
+        }
+
+        regex += '[';
+        size_t j = i + 1;
+
+        if (glob[j] == '!' || glob[j] == '^')
+        {
+          regex += '^';
+          ++j;
+        }
+
+        regex.append(glob, j, end - j + 1);
+        i = end;
+        break;
+      }
+      case '\\':
+        if (i + 1 < glob.size()) ++i;
+        append_literal(regex, glob[i]);
+        break;
+      default:
+        append_literal(regex, c);
+        break;
+      }
+    }
+
+    regex += '$';
+
+    return regex;
+  }
+}
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::literal_pattern class and of the glob translation
+ * functions.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_FILTER_PATTERN_H
+#  define FSW_FILTER_PATTERN_H
+
+#  include "filter.hpp"
+#  include <string>
+
+namespace fsw
+{
+  /**
+   * @brief A path filter whose pattern is a literal string.
+   *
+   * Many filters are plain strings, such as `/\.git/` or `\.o$`, and can be
+   * matched with a string comparison instead of a regular expression.  A
+   * literal pattern is matched as the whole path, as a prefix, as a suffix or
+   * as a substring of the path, depending on the anchors of the filter.
+   */
+  class literal_pattern
+  {
+  public:
+    /**
+     * @brief Kind of match performed by a literal pattern.
+     */
+    enum match_kind
+    {
+      exact,     /**< The path must be equal to the pattern. */
+      prefix,    /**< The path must start with the pattern. */
+      suffix,    /**< The path must end with the pattern. */
+      substring  /**< The path must contain the pattern. */
+    };
+
+    /**
+     * @brief Classifies a filter as a literal pattern.
+     *
+     * A regular expression is literal if it only contains ordinary or
+     * escaped characters, optionally anchored by a leading `^` and a trailing
+     * `$`.  A glob is literal if it only contains ordinary or escaped
+     * characters, optionally preceded or followed by a `*` wildcard.  Case
+     * insensitive filters are never classified as literal.
+     *
+     * @param filter The filter to classify.
+     * @param pattern The pattern which is set if the filter is literal.
+     * @return @c true if @p filter is literal, @c false otherwise.
+     */
+    static bool from_filter(const monitor_filter& filter,
+                            literal_pattern& pattern);
+
+    /**
+     * @brief Matches a path against the pattern.
+     *
+     * @param path The path to match.
+     * @return @c true if @p path matches the pattern, @c false otherwise.
+     */
+    bool match(const std::string& path) const;
+
+    /**
+     * @brief Checks whether a path starting with a prefix can match the
+     * pattern.
+     *
+     * @param path_prefix The prefix to check.
+     * @return @c true if some path longer than @p path_prefix and starting with
+     * it can match the pattern, @c false otherwise.
+     */
+    bool can_match_extension(const std::string& path_prefix) const;
+
+    /**
+     * @brief Checks whether all the paths starting with a prefix match the
+     * pattern.
+     *
+     * @param path_prefix The prefix to check.
+     * @return @c true if every path starting with @p path_prefix matches the
+     * pattern, @c false otherwise.
+     */
+    bool matches_all_extensions(const std::string& path_prefix) const;
+
+    /**
+     * @brief Returns the kind of match performed by the pattern.
+     *
+     * @return The kind of match.
+     */
+    match_kind get_kind() const;
+
+    /**
+     * @brief Returns the literal text of the pattern.
+     *
+     * @return The literal text.
+     */
+    const std::string& get_text() const;
+
+  private:
+    match_kind kind = substring;
+    std::string text;
+  };
+
+  /**
+   * @brief Translates a glob into an extended regular expression.
+   *
+   * A glob is matched against the whole path: `*` matches any sequence of
+   * characters, including `/`, `?` matches any character, `[...]` is a bracket
+   * expression (`[!...]` being its negation) and a backslash escapes the
+   * following character.
+   *
+   * @param glob The glob to translate.
+   * @return The equivalent extended regular expression.
+   */
+  std::string glob_to_regex(const std::string& glob);
+}
+
+#endif  /* FSW_FILTER_PATTERN_H */
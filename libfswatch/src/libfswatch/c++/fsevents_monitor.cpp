@@ -21,6 +21,9 @@
 #include "gettext_defs.h"
 #include "libfswatch_exception.hpp"
 #include "c/libfswatch_log.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
 #  ifdef HAVE_CXX_MUTEX
 #    include <mutex>
 #  endif
@@ -44,7 +47,7 @@ namespace fsw
     flags.push_back({kFSEventStreamEventFlagUserDropped, fsw_event_flag::PlatformSpecific});
     flags.push_back({kFSEventStreamEventFlagKernelDropped, fsw_event_flag::PlatformSpecific});
     flags.push_back({kFSEventStreamEventFlagEventIdsWrapped, fsw_event_flag::PlatformSpecific});
-    flags.push_back({kFSEventStreamEventFlagHistoryDone, fsw_event_flag::PlatformSpecific});
+    flags.push_back({kFSEventStreamEventFlagHistoryDone, fsw_event_flag::HistoryDone});
     flags.push_back({kFSEventStreamEventFlagRootChanged, fsw_event_flag::PlatformSpecific});
     flags.push_back({kFSEventStreamEventFlagMount, fsw_event_flag::PlatformSpecific});
     flags.push_back({kFSEventStreamEventFlagUnmount, fsw_event_flag::PlatformSpecific});
@@ -59,6 +62,9 @@ namespace fsw
     flags.push_back({kFSEventStreamEventFlagItemIsFile, fsw_event_flag::IsFile});
     flags.push_back({kFSEventStreamEventFlagItemIsDir, fsw_event_flag::IsDir});
     flags.push_back({kFSEventStreamEventFlagItemIsSymlink, fsw_event_flag::IsSymLink});
+#if defined(HAVE_DECL_KFSEVENTSTREAMCREATEFLAGMARKSELF) && HAVE_DECL_KFSEVENTSTREAMCREATEFLAGMARKSELF
+    flags.push_back({kFSEventStreamEventFlagOwnEvent, fsw_event_flag::PlatformSpecific});
+#endif
 
     return flags;
   }
@@ -73,6 +79,121 @@ namespace fsw
   }
 
 
+  void fsevents_monitor::configure_monitor()
+  {
+    state_file = get_property(DARWIN_EVENTSTREAM_STATE_FILE);
+
+    string flush_interval_value =
+      get_property(DARWIN_EVENTSTREAM_STATE_FLUSH_INTERVAL);
+
+    if (!flush_interval_value.empty())
+    {
+      char *end;
+      long parsed_value = strtol(flush_interval_value.c_str(), &end, 0);
+
+      if (*end != '\0' || parsed_value < 0)
+      {
+        string msg = string(_("Invalid value: ")) + flush_interval_value;
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+      }
+
+      state_flush_interval = parsed_value;
+    }
+
+    string latency_value = get_property(DARWIN_EVENTSTREAM_LATENCY);
+    stream_latency = latency;
+
+    if (!latency_value.empty())
+    {
+      char *end;
+      double parsed_value = strtod(latency_value.c_str(), &end);
+
+      if (*end != '\0' || parsed_value < 0)
+      {
+        string msg = string(_("Invalid value: ")) + latency_value;
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+      }
+
+      stream_latency = parsed_value;
+    }
+  }
+
+  FSEventStreamCreateFlags fsevents_monitor::get_stream_flags()
+  {
+    FSEventStreamCreateFlags streamFlags = kFSEventStreamCreateFlagFileEvents;
+
+    if (no_defer()) streamFlags |= kFSEventStreamCreateFlagNoDefer;
+
+    if (is_property_enabled(DARWIN_EVENTSTREAM_IGNORE_SELF))
+      streamFlags |= kFSEventStreamCreateFlagIgnoreSelf;
+
+#if defined(HAVE_DECL_KFSEVENTSTREAMCREATEFLAGMARKSELF) && HAVE_DECL_KFSEVENTSTREAMCREATEFLAGMARKSELF
+    if (is_property_enabled(DARWIN_EVENTSTREAM_MARK_SELF))
+      streamFlags |= kFSEventStreamCreateFlagMarkSelf;
+#endif
+
+    use_extended_data = false;
+
+#if defined(HAVE_DECL_KFSEVENTSTREAMCREATEFLAGUSEEXTENDEDDATA) && HAVE_DECL_KFSEVENTSTREAMCREATEFLAGUSEEXTENDEDDATA
+    if (is_property_enabled(DARWIN_EVENTSTREAM_USE_EXTENDED_DATA))
+    {
+      streamFlags |= kFSEventStreamCreateFlagUseCFTypes;
+      streamFlags |= kFSEventStreamCreateFlagUseExtendedData;
+      use_extended_data = true;
+    }
+#endif
+
+    return streamFlags;
+  }
+
+  FSEventStreamEventId fsevents_monitor::load_event_id()
+  {
+    if (state_file.empty()) return kFSEventStreamEventIdSinceNow;
+
+    std::ifstream f(state_file);
+    unsigned long long event_id;
+
+    if (!(f >> event_id))
+    {
+      FSW_ELOGF(_("Cannot read the last event id from %s.\n"),
+                state_file.c_str());
+      return kFSEventStreamEventIdSinceNow;
+    }
+
+    FSW_ELOGF(_("Resuming from event id: %llu\n"), event_id);
+    last_event_id = event_id;
+
+    return event_id;
+  }
+
+  void fsevents_monitor::save_event_id(time_t curr_time)
+  {
+    last_state_flush = curr_time;
+
+    if (state_file.empty() || last_event_id == 0) return;
+
+    const string tmp_path = state_file + ".tmp";
+
+    {
+      std::ofstream f(tmp_path, std::ios::trunc);
+      f << static_cast<unsigned long long> (last_event_id) << "\n";
+      f.close();
+
+      if (!f)
+      {
+        fsw_logf_perror(_("Cannot write %s"), tmp_path.c_str());
+        remove(tmp_path.c_str());
+        return;
+      }
+    }
+
+    if (rename(tmp_path.c_str(), state_file.c_str()) != 0)
+    {
+      fsw_logf_perror(_("Cannot save event id to %s"), state_file.c_str());
+      remove(tmp_path.c_str());
+    }
+  }
+
   void fsevents_monitor::run()
   {
 #ifdef HAVE_CXX_MUTEX
@@ -81,6 +202,8 @@ namespace fsw
 
     if (stream) return;
 
+    configure_monitor();
+
     // parsing paths
     vector<CFStringRef> dirs;
 
@@ -106,16 +229,15 @@ namespace fsw
     context->release = nullptr;
     context->copyDescription = nullptr;
 
-    FSEventStreamCreateFlags streamFlags = kFSEventStreamCreateFlagFileEvents;
-    if (this->no_defer()) streamFlags |= kFSEventStreamCreateFlagNoDefer;
+    FSEventStreamCreateFlags streamFlags = get_stream_flags();
 
     FSW_ELOG(_("Creating FSEvent stream...\n"));
     stream = FSEventStreamCreate(nullptr,
                                  &fsevents_monitor::fsevents_callback,
                                  context,
                                  pathsToWatch,
-                                 kFSEventStreamEventIdSinceNow,
-                                 latency,
+                                 load_event_id(),
+                                 stream_latency,
                                  streamFlags);
 
     delete context;
@@ -123,27 +245,37 @@ namespace fsw
     if (!stream)
       throw libfsw_exception(_("Event stream could not be created."));
 
-    // Fire the event loop
-    run_loop = CFRunLoopGetCurrent();
+    // A stream watches all the paths.
+    set_watch_count(paths.size());
 
-    // Loop Initialization
+    // Dispatch queue initialization
+    queue = dispatch_queue_create("fswatch.fsevents", DISPATCH_QUEUE_SERIAL);
+    stop_semaphore = dispatch_semaphore_create(0);
 
-    FSW_ELOG(_("Scheduling stream with run loop...\n"));
-    FSEventStreamScheduleWithRunLoop(stream,
-                                     run_loop,
-                                     kCFRunLoopDefaultMode);
+    FSW_ELOG(_("Scheduling stream with dispatch queue...\n"));
+    FSEventStreamSetDispatchQueue(stream, queue);
 
     FSW_ELOG(_("Starting event stream...\n"));
-    FSEventStreamStart(stream);
+    if (!FSEventStreamStart(stream))
+    {
+      FSEventStreamInvalidate(stream);
+      FSEventStreamRelease(stream);
+      stream = nullptr;
+      dispatch_release(stop_semaphore);
+      stop_semaphore = nullptr;
+      dispatch_release(queue);
+      queue = nullptr;
+
+      throw libfsw_exception(_("Event stream could not be started."));
+    }
 
 #ifdef HAVE_CXX_MUTEX
     run_loop_lock.unlock();
 #endif
 
-    // Loop
-
-    FSW_ELOG(_("Starting run loop...\n"));
-    CFRunLoopRun();
+    // Wait until the monitor is stopped: events are delivered on the queue.
+    FSW_ELOG(_("Waiting for the stop signal...\n"));
+    dispatch_semaphore_wait(stop_semaphore, DISPATCH_TIME_FOREVER);
 
     // Deinitialization part
 
@@ -153,10 +285,28 @@ namespace fsw
     FSW_ELOG(_("Invalidating event stream...\n"));
     FSEventStreamInvalidate(stream);
 
+    // Wait for a callback that may still be executing on the queue.
+    dispatch_sync_f(queue, nullptr, [](void *) {});
+
     FSW_ELOG(_("Releasing event stream...\n"));
     FSEventStreamRelease(stream);
 
     stream = nullptr;
+
+#ifdef HAVE_CXX_MUTEX
+    run_loop_lock.lock();
+#endif
+
+    dispatch_release(stop_semaphore);
+    stop_semaphore = nullptr;
+    dispatch_release(queue);
+    queue = nullptr;
+
+#ifdef HAVE_CXX_MUTEX
+    run_loop_lock.unlock();
+#endif
+
+    save_event_id(time(nullptr));
   }
 
   /*
@@ -164,12 +314,10 @@ namespace fsw
    */
   void fsevents_monitor::on_stop()
   {
-    if (!run_loop) throw libfsw_exception(_("run loop is null"));
+    if (!stop_semaphore) throw libfsw_exception(_("stop semaphore is null"));
 
-    FSW_ELOG(_("Stopping run loop...\n"));
-    CFRunLoopStop(run_loop);
-
-    run_loop = nullptr;
+    FSW_ELOG(_("Signalling the monitor to stop...\n"));
+    dispatch_semaphore_signal(stop_semaphore);
   }
 
   static vector<fsw_event_flag> decode_flags(FSEventStreamEventFlags flag)
@@ -187,6 +335,27 @@ namespace fsw
     return evt_flags;
   }
 
+  static string get_extended_data_path(void *eventPaths, size_t i)
+  {
+#if defined(HAVE_DECL_KFSEVENTSTREAMCREATEFLAGUSEEXTENDEDDATA) && HAVE_DECL_KFSEVENTSTREAMCREATEFLAGUSEEXTENDEDDATA
+    auto data = static_cast<CFDictionaryRef> (
+      CFArrayGetValueAtIndex(static_cast<CFArrayRef> (eventPaths), i));
+    auto cf_path = static_cast<CFStringRef> (
+      CFDictionaryGetValue(data, kFSEventStreamEventExtendedDataPathKey));
+
+    if (!cf_path) return "";
+
+    vector<char> path(CFStringGetMaximumSizeOfFileSystemRepresentation(cf_path));
+
+    if (!CFStringGetFileSystemRepresentation(cf_path, path.data(), path.size()))
+      return "";
+
+    return string(path.data());
+#else
+    return "";
+#endif
+  }
+
   void fsevents_monitor::fsevents_callback(ConstFSEventStreamRef streamRef,
                                            void *clientCallBackInfo,
                                            size_t numEvents,
@@ -201,29 +370,69 @@ namespace fsw
       throw libfsw_exception(_("The callback info cannot be cast to fsevents_monitor."));
     }
 
+    fse_monitor->count_read(numEvents);
+
     // Build the notification objects.
     vector<event> events;
 
-    time_t curr_time;
-    time(&curr_time);
+    const timespec curr_time = event::get_current_time();
 
     for (size_t i = 0; i < numEvents; ++i)
     {
-      events.emplace_back(((char **) eventPaths)[i],
-                          curr_time,
-                          decode_flags(eventFlags[i]));
+      if (fse_monitor->use_extended_data)
+      {
+        events.emplace_back(get_extended_data_path(eventPaths, i),
+                            curr_time,
+                            decode_flags(eventFlags[i]));
+      }
+      else
+      {
+        events.emplace_back(((char **) eventPaths)[i],
+                            curr_time,
+                            decode_flags(eventFlags[i]));
+      }
+
+      if (eventIds[i] > fse_monitor->last_event_id)
+        fse_monitor->last_event_id = eventIds[i];
     }
 
     if (!events.empty())
     {
       fse_monitor->notify_events(events);
     }
+
+    // Events were coalesced or dropped below these paths: their subtrees are
+    // scanned to recover the lost changes.
+    if (fse_monitor->recover_overflow)
+    {
+      const FSEventStreamEventFlags must_scan =
+        kFSEventStreamEventFlagMustScanSubDirs
+        | kFSEventStreamEventFlagUserDropped
+        | kFSEventStreamEventFlagKernelDropped;
+
+      for (size_t i = 0; i < numEvents; ++i)
+      {
+        if (eventFlags[i] & must_scan)
+          fse_monitor->notify_overflow(events[i].get_path());
+      }
+    }
+
+    if (curr_time.tv_sec - fse_monitor->last_state_flush
+        >= fse_monitor->state_flush_interval)
+    {
+      fse_monitor->save_event_id(curr_time.tv_sec);
+    }
   }
 
   bool fsevents_monitor::no_defer()
   {
-    string no_defer = get_property(DARWIN_EVENTSTREAM_NO_DEFER);
+    return is_property_enabled(DARWIN_EVENTSTREAM_NO_DEFER);
+  }
+
+  bool fsevents_monitor::is_property_enabled(const char *name)
+  {
+    string value = get_property(name);
 
-    return (no_defer == "true");
+    return (value == "true");
   }
 }
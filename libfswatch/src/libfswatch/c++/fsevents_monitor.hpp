@@ -28,6 +28,7 @@
 
 #  include "monitor.hpp"
 #  include <CoreServices/CoreServices.h>
+#  include <dispatch/dispatch.h>
 
 namespace fsw
 {
@@ -35,6 +36,8 @@ namespace fsw
    * @brief OS X FSEvents monitor.
    *
    * This monitor is built upon the _FSEvents_ API of the Apple OS X kernel.
+   * The event stream is scheduled on a private serial dispatch queue and the
+   * callback is invoked on the thread serving it.
    */
   class fsevents_monitor : public monitor
   {
@@ -61,6 +64,74 @@ namespace fsw
      */
     static constexpr const char *DARWIN_EVENTSTREAM_NO_DEFER = "darwin.eventStream.noDefer";
 
+    /**
+     * @brief Custom monitor property used to enable the
+     * kFSEventStreamCreateFlagIgnoreSelf flag in the event stream.
+     *
+     * If this flag is specified, events generated by the current process are
+     * not reported.
+     *
+     * @sa https://developer.apple.com/documentation/coreservices/kfseventstreamcreateflagignoreself
+     */
+    static constexpr const char *DARWIN_EVENTSTREAM_IGNORE_SELF = "darwin.eventStream.ignoreSelf";
+
+    /**
+     * @brief Custom monitor property used to enable the
+     * kFSEventStreamCreateFlagMarkSelf flag in the event stream.
+     *
+     * If this flag is specified, events generated by the current process are
+     * reported with an additional fsw_event_flag::PlatformSpecific flag.  This
+     * property has no effect if the SDK does not support this flag.
+     *
+     * @sa https://developer.apple.com/documentation/coreservices/kfseventstreamcreateflagmarkself
+     */
+    static constexpr const char *DARWIN_EVENTSTREAM_MARK_SELF = "darwin.eventStream.markSelf";
+
+    /**
+     * @brief Custom monitor property used to enable the
+     * kFSEventStreamCreateFlagUseExtendedData flag in the event stream.
+     *
+     * If this flag is specified, the paths of the events are retrieved from
+     * the extended data dictionaries provided by the stream.  This property
+     * has no effect if the SDK does not support this flag.
+     *
+     * @sa https://developer.apple.com/documentation/coreservices/kfseventstreamcreateflaguseextendeddata
+     */
+    static constexpr const char *DARWIN_EVENTSTREAM_USE_EXTENDED_DATA = "darwin.eventStream.useExtendedData";
+
+    /**
+     * @brief Custom monitor property used to set the latency of the event
+     * stream, in seconds.
+     *
+     * The latency of the event stream is the time the FSEvents API waits
+     * before delivering a batch of events, and it may be set independently of
+     * the latency of the monitor.  If this property is not set, the latency of
+     * the monitor is used.
+     */
+    static constexpr const char *DARWIN_EVENTSTREAM_LATENCY = "darwin.eventStream.latency";
+
+    /**
+     * @brief Custom monitor property used to set the path of the file where
+     * the identifier of the last event received is persisted.
+     *
+     * If this property is set and the file exists, the event stream is created
+     * starting from the identifier it contains instead of
+     * `kFSEventStreamEventIdSinceNow` and the events which occurred while the
+     * monitor was not running are replayed.  The end of the replay is marked
+     * by an event with the fsw_event_flag::HistoryDone flag.  The identifier
+     * is saved periodically and when the monitor stops.
+     */
+    static constexpr const char *DARWIN_EVENTSTREAM_STATE_FILE = "darwin.eventStream.stateFile";
+
+    /**
+     * @brief Custom monitor property used to set the minimum interval, in
+     * seconds, between two saves of the state file.
+     *
+     * The default value is 5 seconds.  If the value is 0, the state file is
+     * saved after every batch of events.
+     */
+    static constexpr const char *DARWIN_EVENTSTREAM_STATE_FLUSH_INTERVAL = "darwin.eventStream.stateFlushInterval";
+
     /**
      * @brief Constructs an instance of this class.
      */
@@ -93,9 +164,22 @@ namespace fsw
                                   const FSEventStreamEventFlags eventFlags[],
                                   const FSEventStreamEventId eventIds[]);
 
+    void configure_monitor();
+    FSEventStreamCreateFlags get_stream_flags();
+    FSEventStreamEventId load_event_id();
+    void save_event_id(time_t curr_time);
+    bool is_property_enabled(const char *name);
+
     FSEventStreamRef stream = nullptr;
-    CFRunLoopRef run_loop = nullptr;
+    dispatch_queue_t queue = nullptr;
+    dispatch_semaphore_t stop_semaphore = nullptr;
     bool no_defer();
+    bool use_extended_data = false;
+    CFTimeInterval stream_latency = 0;
+    std::string state_file;
+    long state_flush_interval = 5;
+    FSEventStreamEventId last_event_id = 0;
+    time_t last_state_flush = 0;
   };
 }
 
@@ -0,0 +1,343 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#if defined(HAVE_SYS_EVENTFD_H) && defined(HAVE_CXX_MUTEX)
+
+#  include "gettext_defs.h"
+#  include "inotify_dispatcher.hpp"
+#  include "libfswatch_exception.hpp"
+#  include "../c/libfswatch_log.h"
+#  include <algorithm>
+#  include <cerrno>
+#  include <chrono>
+#  include <cstdio>
+#  include <thread>
+#  include <poll.h>
+#  include <unistd.h>
+#  include <sys/eventfd.h>
+#  include <sys/inotify.h>
+
+using namespace std;
+
+namespace fsw
+{
+  static const size_t READ_BUFFER_SIZE = 64 * 1024;
+  /*
+   * Maximum size (in bytes) of the records waiting in an inbox.  When a
+   * monitor falls behind, further records are dropped and a queue overflow is
+   * reported, as the kernel would do.
+   */
+  static const size_t MAX_INBOX_SIZE = 4 * 1024 * 1024;
+
+  inotify_dispatcher& inotify_dispatcher::get_instance()
+  {
+    // The instance is never destroyed, since its thread is detached and may
+    // still be running when the process exits.
+    static inotify_dispatcher *instance = new inotify_dispatcher();
+
+    return *instance;
+  }
+
+  void inotify_dispatcher::open_descriptors()
+  {
+    // The descriptors are kept open once created, and reused by the threads
+    // started when monitors subscribe again.
+    if (inotify_handle == -1)
+    {
+      inotify_handle = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+      if (inotify_handle == -1)
+      {
+        perror("inotify_init1");
+        throw libfsw_exception(_("Cannot initialize inotify."));
+      }
+    }
+
+    if (wake_handle == -1)
+    {
+      wake_handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+      if (wake_handle == -1)
+      {
+        perror("eventfd");
+        throw libfsw_exception(_("Cannot initialize the stop event descriptor."));
+      }
+    }
+  }
+
+  inotify_subscription *
+  inotify_dispatcher::subscribe(const thread_settings& settings)
+  {
+    lock_guard<std::mutex> lock(mutex);
+
+    open_descriptors();
+
+    inotify_subscription *subscription = new inotify_subscription();
+    subscriptions.insert(subscription);
+
+    if (!running)
+    {
+      running = true;
+      thread(&inotify_dispatcher::run, this, settings).detach();
+    }
+
+    return subscription;
+  }
+
+  int inotify_dispatcher::release_watch(inotify_subscription *subscription,
+                                        int wd)
+  {
+    auto it = watches.find(wd);
+    if (it == watches.end()) return 0;
+
+    vector<inotify_subscription *>& owners = it->second;
+    owners.erase(remove(owners.begin(), owners.end(), subscription),
+                 owners.end());
+
+    if (!owners.empty()) return 0;
+
+    watches.erase(it);
+
+    return inotify_rm_watch(inotify_handle, wd);
+  }
+
+  void inotify_dispatcher::unsubscribe(inotify_subscription *subscription)
+  {
+    lock_guard<std::mutex> lock(mutex);
+
+    for (int wd : subscription->watches)
+    {
+      if (release_watch(subscription, wd) != 0) perror("inotify_rm_watch");
+    }
+
+    subscriptions.erase(subscription);
+    delete subscription;
+
+    // Let the dispatcher thread exit if this was the last subscription.
+    if (subscriptions.empty())
+    {
+      uint64_t value = 1;
+
+      if (write(wake_handle, &value, sizeof(value)) == -1)
+        fsw_log_perror("write");
+    }
+  }
+
+  int inotify_dispatcher::add_watch(inotify_subscription *subscription,
+                                    const string& path,
+                                    uint32_t mask)
+  {
+    // The lock is held until the watch is registered, so that its first
+    // records are not discarded by the dispatcher thread.
+    lock_guard<std::mutex> lock(mutex);
+
+    int wd = inotify_add_watch(inotify_handle, path.c_str(), mask | IN_MASK_ADD);
+    if (wd == -1) return -1;
+
+    vector<inotify_subscription *>& owners = watches[wd];
+
+    if (find(owners.begin(), owners.end(), subscription) == owners.end())
+      owners.push_back(subscription);
+
+    subscription->watches.insert(wd);
+
+    return wd;
+  }
+
+  int inotify_dispatcher::remove_watch(inotify_subscription *subscription,
+                                       int wd)
+  {
+    lock_guard<std::mutex> lock(mutex);
+
+    subscription->watches.erase(wd);
+
+    return release_watch(subscription, wd);
+  }
+
+  bool inotify_dispatcher::wait(inotify_subscription *subscription,
+                                double timeout,
+                                bool& woken)
+  {
+    unique_lock<std::mutex> lock(mutex);
+
+    auto ready = [subscription]
+    {
+      return !subscription->inbox.empty() || subscription->woken;
+    };
+
+    if (timeout < 0)
+      subscription->cond.wait(lock, ready);
+    else
+      subscription->cond.wait_for(lock, chrono::duration<double>(timeout), ready);
+
+    woken = subscription->woken;
+    subscription->woken = false;
+
+    return !subscription->inbox.empty();
+  }
+
+  void inotify_dispatcher::wake(inotify_subscription *subscription)
+  {
+    lock_guard<std::mutex> lock(mutex);
+
+    subscription->woken = true;
+    subscription->cond.notify_one();
+  }
+
+  ssize_t inotify_dispatcher::take(inotify_subscription *subscription,
+                                   vector<char>& buffer)
+  {
+    lock_guard<std::mutex> lock(mutex);
+
+    if (subscription->inbox.empty()) return -1;
+
+    buffer.swap(subscription->inbox);
+    subscription->inbox.clear();
+    subscription->overflowed = false;
+
+    return buffer.size();
+  }
+
+  void inotify_dispatcher::append(inotify_subscription *subscription,
+                                  const char *record,
+                                  size_t length)
+  {
+    vector<char>& inbox = subscription->inbox;
+
+    if (subscription->overflowed) return;
+
+    if (inbox.size() + length > MAX_INBOX_SIZE)
+    {
+      struct inotify_event overflow = {};
+      overflow.wd = -1;
+      overflow.mask = IN_Q_OVERFLOW;
+
+      const char *begin = reinterpret_cast<const char *> (&overflow);
+      inbox.insert(inbox.end(), begin, begin + sizeof(overflow));
+      subscription->overflowed = true;
+
+      return;
+    }
+
+    inbox.insert(inbox.end(), record, record + length);
+  }
+
+  void inotify_dispatcher::dispatch(const char *records, ssize_t length)
+  {
+    lock_guard<std::mutex> lock(mutex);
+
+    for (const char *p = records; p < records + length;)
+    {
+      const struct inotify_event *event =
+        reinterpret_cast<const struct inotify_event *> (p);
+      const size_t record_length = sizeof(struct inotify_event) + event->len;
+
+      if (event->wd == -1)
+      {
+        for (inotify_subscription *subscription : subscriptions)
+          append(subscription, p, record_length);
+      }
+      else
+      {
+        auto it = watches.find(event->wd);
+
+        if (it != watches.end())
+        {
+          for (inotify_subscription *subscription : it->second)
+            append(subscription, p, record_length);
+
+          // The kernel has removed the watch.
+          if (event->mask & IN_IGNORED)
+          {
+            for (inotify_subscription *subscription : it->second)
+              subscription->watches.erase(event->wd);
+
+            watches.erase(it);
+          }
+        }
+      }
+
+      p += record_length;
+    }
+
+    for (inotify_subscription *subscription : subscriptions)
+    {
+      if (!subscription->inbox.empty()) subscription->cond.notify_one();
+    }
+  }
+
+  void inotify_dispatcher::run(thread_settings settings)
+  {
+    FSW_ELOG(_("inotify dispatcher thread: starting\n"));
+    settings.try_apply(_("inotify dispatcher thread"));
+
+    vector<char> buffer(READ_BUFFER_SIZE);
+
+    for (;;)
+    {
+      struct pollfd fds[2] = {{inotify_handle, POLLIN, 0},
+                              {wake_handle, POLLIN, 0}};
+
+      if (poll(fds, 2, -1) == -1)
+      {
+        if (errno != EINTR) fsw_log_perror("poll");
+        continue;
+      }
+
+      if (fds[1].revents & POLLIN)
+      {
+        uint64_t value;
+
+        if (read(wake_handle, &value, sizeof(value)) == -1 && errno != EAGAIN)
+          fsw_log_perror("read");
+
+        lock_guard<std::mutex> lock(mutex);
+
+        if (subscriptions.empty())
+        {
+          running = false;
+          break;
+        }
+      }
+
+      if (!(fds[0].revents & POLLIN)) continue;
+
+      for (;;)
+      {
+        ssize_t record_num = read(inotify_handle, &buffer[0], buffer.size());
+
+        if (record_num > 0)
+        {
+          dispatch(&buffer[0], record_num);
+          continue;
+        }
+
+        if (record_num == -1 && errno == EINTR) continue;
+        if (record_num == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+          fsw_log_perror("read");
+
+        break;
+      }
+    }
+
+    FSW_ELOG(_("inotify dispatcher thread: exiting\n"));
+  }
+}
+
+#endif  /* HAVE_SYS_EVENTFD_H && HAVE_CXX_MUTEX */
@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::inotify_dispatcher class.
+ *
+ * This header is only usable if `HAVE_SYS_EVENTFD_H` and `HAVE_CXX_MUTEX` are
+ * defined.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_INOTIFY_DISPATCHER_H
+#  define FSW_INOTIFY_DISPATCHER_H
+
+#  include <condition_variable>
+#  include <cstdint>
+#  include <map>
+#  include <mutex>
+#  include <set>
+#  include <string>
+#  include <vector>
+#  include <sys/types.h>
+#  include "thread_settings.hpp"
+
+namespace fsw
+{
+  /**
+   * @brief Registration of a monitor with the fsw::inotify_dispatcher.
+   *
+   * The records of the watch descriptors of a subscription are copied into
+   * its inbox by the dispatcher thread and consumed by the monitor thread.
+   */
+  struct inotify_subscription
+  {
+    std::vector<char> inbox;
+    std::condition_variable cond;
+    std::set<int> watches;
+    bool woken = false;
+    bool overflowed = false;
+  };
+
+  /**
+   * @brief inotify descriptor shared by the monitors of a process.
+   *
+   * inotify instances are a limited resource: each monitor owning one also
+   * owns helper descriptors and duplicates the kernel watches of the paths it
+   * shares with other monitors.  The dispatcher owns a single inotify
+   * descriptor on which all its subscriptions add their watches: watching the
+   * same inode twice returns the same watch descriptor, whose mask is the union
+   * of the requested masks, and the kernel watch is removed when no
+   * subscription uses it any longer.
+   *
+   * A dispatcher thread reads the descriptor and copies every record into the
+   * inbox of the subscriptions of its watch descriptor.  Queue overflows are
+   * sent to all the subscriptions.  The thread is started when the first
+   * monitor subscribes, with the settings of that monitor, and it exits when
+   * the last one unsubscribes.
+   */
+  class inotify_dispatcher
+  {
+  public:
+    /**
+     * @brief Returns the dispatcher of the process.
+     *
+     * @return The dispatcher of the process.
+     */
+    static inotify_dispatcher& get_instance();
+
+    /**
+     * @brief Registers a monitor.
+     *
+     * @param settings The scheduling attributes of the dispatcher thread,
+     * applied if this subscription starts it.
+     * @return The subscription of the monitor.
+     * @throw libfsw_exception if the inotify descriptor cannot be created.
+     */
+    inotify_subscription *subscribe(
+      const thread_settings& settings = thread_settings());
+
+    /**
+     * @brief Unregisters a monitor, removing its watches.
+     *
+     * @param subscription The subscription to remove, which is deleted.
+     */
+    void unsubscribe(inotify_subscription *subscription);
+
+    /**
+     * @brief Adds a watch to a subscription.
+     *
+     * @param subscription The subscription.
+     * @param path The path to watch.
+     * @param mask The mask of the watch.
+     * @return The watch descriptor, or @c -1 if inotify_add_watch() failed, in
+     * which case @c errno is set.
+     */
+    int add_watch(inotify_subscription *subscription,
+                  const std::string& path,
+                  uint32_t mask);
+
+    /**
+     * @brief Removes a watch from a subscription.
+     *
+     * The kernel watch is only removed when no other subscription uses it.
+     *
+     * @param subscription The subscription.
+     * @param wd The watch descriptor.
+     * @return The return value of inotify_rm_watch(), or @c 0 if the kernel
+     * watch is still in use.
+     */
+    int remove_watch(inotify_subscription *subscription, int wd);
+
+    /**
+     * @brief Waits for records.
+     *
+     * @param subscription The subscription.
+     * @param timeout The maximum time to wait, in seconds.  A negative value
+     * waits until records are available or wake() is called.
+     * @param woken Set to @c true if wake() was called.
+     * @return @c true if records are available, @c false otherwise.
+     */
+    bool wait(inotify_subscription *subscription, double timeout, bool& woken);
+
+    /**
+     * @brief Wakes up a thread blocked in wait().
+     *
+     * @param subscription The subscription.
+     */
+    void wake(inotify_subscription *subscription);
+
+    /**
+     * @brief Takes the records of the inbox of a subscription.
+     *
+     * The inbox is swapped with @p buffer.
+     *
+     * @param subscription The subscription.
+     * @param buffer The buffer receiving the records.
+     * @return The number of bytes in @p buffer, or @c -1 if the inbox is empty.
+     */
+    ssize_t take(inotify_subscription *subscription, std::vector<char>& buffer);
+
+  private:
+    inotify_dispatcher() = default;
+    inotify_dispatcher(const inotify_dispatcher& orig) = delete;
+    inotify_dispatcher& operator=(const inotify_dispatcher& that) = delete;
+
+    void open_descriptors();
+    void run(thread_settings settings);
+    void dispatch(const char *records, ssize_t length);
+    void append(inotify_subscription *subscription,
+                const char *record,
+                size_t length);
+    int release_watch(inotify_subscription *subscription, int wd);
+
+    int inotify_handle = -1;
+    int wake_handle = -1;
+    bool running = false;
+    std::set<inotify_subscription *> subscriptions;
+    std::map<int, std::vector<inotify_subscription *>> watches;
+    std::mutex mutex;
+  };
+}
+
+#endif  /* FSW_INOTIFY_DISPATCHER_H */
@@ -25,32 +25,367 @@
 #  define NAME_MAX         255    /* # chars in a file name */
 #endif
 #include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <cstdlib>
 #include <stdio.h>
 #include <sstream>
 #include <ctime>
 #include <cmath>
 #include <sys/select.h>
+#ifdef HAVE_CXX_MUTEX
+#  include <mutex>
+#  include <thread>
+#endif
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+#  define FSW_INOTIFY_USE_EPOLL
+#  include <sys/epoll.h>
+#  include <sys/eventfd.h>
+#  include <chrono>
+#endif
+#if defined(FSW_INOTIFY_USE_EPOLL) && defined(HAVE_CXX_MUTEX)
+#  define FSW_INOTIFY_USE_DISPATCHER
+#  include "inotify_dispatcher.hpp"
+#endif
+#if defined(HAVE_UNORDERED_MAP)
+#  include <unordered_map>
+#else
+#  include <map>
+#endif
+#include <functional>
+#include <chrono>
+#include <cstdint>
 #include "libfswatch_exception.hpp"
 #include "../c/libfswatch_log.h"
 #include "libfswatch_map.hpp"
 #include "libfswatch_set.hpp"
 #include "path_utils.hpp"
+#include "batch_stat.hpp"
+#include "parallel_scan.hpp"
+#include <memory>
 
 namespace fsw
 {
+  static const size_t NO_NODE = static_cast<size_t> (-1);
+
+  struct inotify_path_key
+  {
+    size_t parent;
+    std::string name;
+
+    bool operator==(const inotify_path_key& other) const
+    {
+      return parent == other.parent && name == other.name;
+    }
+
+    bool operator<(const inotify_path_key& other) const
+    {
+      return parent < other.parent
+        || (parent == other.parent && name < other.name);
+    }
+  };
+
+#if defined(HAVE_UNORDERED_MAP)
+  struct inotify_path_key_hash
+  {
+    size_t operator()(const inotify_path_key& key) const
+    {
+      return std::hash<std::string>()(key.name) ^ (key.parent * 2654435761u);
+    }
+  };
+
+  using inotify_path_index = std::unordered_map<inotify_path_key,
+                                                size_t,
+                                                inotify_path_key_hash>;
+#else
+  using inotify_path_index = std::map<inotify_path_key, size_t>;
+#endif
+
+  struct inotify_path_node
+  {
+    size_t parent;
+    /*
+     * Name of this path component.  The string is owned by the key of this
+     * node in the path index, whose elements are never relocated.
+     */
+    const std::string *name;
+    int wd;
+    unsigned int children;
+  };
+
+  /*
+   * Interned tree of the watched paths.  Each node stores a single path
+   * component and the index of its parent, so that a path shared by many
+   * watches is stored only once.  Watch descriptors are small integers
+   * allocated by the kernel and are used to index a dense array of nodes.
+   *
+   * Paths are split at every separator and empty components are kept, so that
+   * the path built for a node is always identical to the one it was inserted
+   * with.
+   *
+   * This class is not thread-safe.
+   */
+  class inotify_path_tree
+  {
+  public:
+    size_t find(const std::string& path)
+    {
+      return walk(path, false);
+    }
+
+    size_t insert(const std::string& path)
+    {
+      return walk(path, true);
+    }
+
+    void append_path(size_t node, std::string& buffer) const
+    {
+      lineage.clear();
+
+      for (; node != NO_NODE; node = nodes[node].parent)
+        lineage.push_back(node);
+
+      for (auto it = lineage.rbegin(); it != lineage.rend(); ++it)
+      {
+        if (it != lineage.rbegin()) buffer += '/';
+        buffer += *nodes[*it].name;
+      }
+    }
+
+    void append_watch_path(int wd, std::string& buffer) const
+    {
+      size_t node = find_watch(wd);
+
+      if (node != NO_NODE) append_path(node, buffer);
+    }
+
+    std::string get_watch_path(int wd) const
+    {
+      std::string path;
+      append_watch_path(wd, path);
+
+      return path;
+    }
+
+    bool is_watched(size_t node) const
+    {
+      return node != NO_NODE && nodes[node].wd != -1;
+    }
+
+    int get_watch(size_t node) const
+    {
+      return nodes[node].wd;
+    }
+
+    size_t get_parent(size_t node) const
+    {
+      return nodes[node].parent;
+    }
+
+    size_t find_watch(int wd) const
+    {
+      if (wd < 0 || static_cast<size_t> (wd) >= wd_nodes.size()) return NO_NODE;
+
+      return wd_nodes[wd];
+    }
+
+    void add_watch(int wd, const std::string& path)
+    {
+      size_t node = insert(path);
+      nodes[node].wd = wd;
+
+      if (static_cast<size_t> (wd) >= wd_nodes.size())
+        wd_nodes.resize(wd + 1, NO_NODE);
+
+      const size_t previous_node = wd_nodes[wd];
+
+      if (previous_node == NO_NODE) ++watch_number;
+
+      /*
+       * A descriptor may be returned for different paths referring to the same
+       * inode: events are reported using the last one, and the node of the
+       * previous path is no longer watched.
+       */
+      wd_nodes[wd] = node;
+
+      if (previous_node != NO_NODE && previous_node != node)
+      {
+        nodes[previous_node].wd = -1;
+        prune(previous_node);
+      }
+    }
+
+    void remove_watch(int wd)
+    {
+      size_t node = find_watch(wd);
+      if (node == NO_NODE) return;
+
+      wd_nodes[wd] = NO_NODE;
+      --watch_number;
+
+      // The path may have been watched again with a new descriptor.
+      if (nodes[node].wd != wd) return;
+
+      nodes[node].wd = -1;
+      prune(node);
+    }
+
+    /*
+     * Moves the child name of the directory watched by from_wd to the child
+     * to_name of the directory watched by to_wd.  The paths of all the watches
+     * below the moved node are updated at once.  Returns false if the node
+     * does not exist or if the destination node already exists, in which case
+     * the tree is not modified.  The descriptor of the moved node is stored in
+     * moved_wd.
+     */
+    bool rename(int from_wd,
+                const std::string& from_name,
+                int to_wd,
+                const std::string& to_name,
+                int& moved_wd)
+    {
+      size_t from_parent = find_watch(from_wd);
+      size_t to_parent = find_watch(to_wd);
+
+      if (from_parent == NO_NODE || to_parent == NO_NODE) return false;
+
+      lookup_key.parent = to_parent;
+      lookup_key.name = to_name;
+      if (index.find(lookup_key) != index.end()) return false;
+
+      lookup_key.parent = from_parent;
+      lookup_key.name = from_name;
+      auto it = index.find(lookup_key);
+      if (it == index.end()) return false;
+
+      size_t node = it->second;
+      index.erase(it);
+
+      lookup_key.parent = to_parent;
+      lookup_key.name = to_name;
+      it = index.emplace(lookup_key, node).first;
+
+      nodes[node].parent = to_parent;
+      nodes[node].name = &it->first.name;
+      ++nodes[to_parent].children;
+      --nodes[from_parent].children;
+      prune(from_parent);
+
+      moved_wd = nodes[node].wd;
+
+      return true;
+    }
+
+    size_t size() const
+    {
+      return watch_number;
+    }
+
+    std::vector<int> get_watches() const
+    {
+      std::vector<int> watches;
+
+      for (size_t wd = 0; wd < wd_nodes.size(); ++wd)
+      {
+        if (wd_nodes[wd] != NO_NODE) watches.push_back(wd);
+      }
+
+      return watches;
+    }
+
+  private:
+    // Walks the components of path, optionally creating the missing nodes.
+    size_t walk(const std::string& path, bool create)
+    {
+      size_t node = NO_NODE;
+      size_t start = 0;
+
+      for (;;)
+      {
+        size_t end = path.find('/', start);
+        size_t len = (end == std::string::npos) ? end : end - start;
+
+        lookup_key.parent = node;
+        lookup_key.name.assign(path, start, len);
+
+        auto it = index.find(lookup_key);
+
+        if (it != index.end()) node = it->second;
+        else if (create) node = add_node(lookup_key);
+        else return NO_NODE;
+
+        if (end == std::string::npos) return node;
+        start = end + 1;
+      }
+    }
+
+    size_t add_node(const inotify_path_key& key)
+    {
+      size_t node;
+
+      if (free_nodes.empty())
+      {
+        node = nodes.size();
+        nodes.emplace_back();
+      }
+      else
+      {
+        node = free_nodes.back();
+        free_nodes.pop_back();
+      }
+
+      auto it = index.emplace(key, node).first;
+
+      nodes[node] = {key.parent, &it->first.name, -1, 0};
+      if (key.parent != NO_NODE) ++nodes[key.parent].children;
+
+      return node;
+    }
+
+    // Releases a node and its ancestors until a node still in use is found.
+    void prune(size_t node)
+    {
+      while (node != NO_NODE
+             && nodes[node].wd == -1
+             && nodes[node].children == 0)
+      {
+        size_t parent = nodes[node].parent;
+
+        lookup_key.parent = parent;
+        lookup_key.name = *nodes[node].name;
+        index.erase(lookup_key);
+        free_nodes.push_back(node);
+
+        if (parent != NO_NODE) --nodes[parent].children;
+        node = parent;
+      }
+    }
+
+    std::vector<inotify_path_node> nodes;
+    std::vector<size_t> free_nodes;
+    std::vector<size_t> wd_nodes;
+    inotify_path_index index;
+    size_t watch_number = 0;
+    inotify_path_key lookup_key;
+    mutable std::vector<size_t> lineage;
+  };
+
+  /*
+   * The first half of a rename, waiting for the IN_MOVED_TO event with the
+   * same cookie.
+   */
+  struct inotify_pending_move
+  {
+    size_t event_index;
+    std::string path;
+    int wd;
+    std::string name;
+  };
 
   struct inotify_monitor_impl
   {
     int inotify_monitor_handle = -1;
     std::vector<event> events;
-    /*
-     * A map of file names by descriptor is kept in sync because the name field
-     * of the inotify_event structure is present only when it identifies a
-     * child of a watched directory.  In all the other cases, we store the path
-     * for easy retrieval.
-     */
-    fsw_hash_set<int> watched_descriptors;
-    fsw_hash_map<std::string, int> path_to_wd;
     /*
      * Since the inotify API maintains only works with watch
      * descriptors a cache maintaining a relationship between a watch
@@ -61,325 +396,1602 @@ namespace fsw
      *   application's responsibility to cache a mapping (if one is needed)
      *   between watch descriptors and pathnames.  Be aware that directory
      *   renamings may affect multiple cached pathnames.
+     *
+     * The same structure is used to look up watched paths.
+     */
+    inotify_path_tree watches;
+    /*
+     * Reusable buffer where the path of the event being processed is built.
      */
-    fsw_hash_map<int, std::string> wd_to_path;
+    std::string event_path;
     fsw_hash_set<int> descriptors_to_remove;
     fsw_hash_set<int> watches_to_remove;
     std::vector<std::string> paths_to_rescan;
-    time_t curr_time;
+    fsw_hash_map<uint32_t, inotify_pending_move> pending_moves;
+    /*
+     * Descriptors of the directories whose watch has been moved in place: the
+     * IN_MOVE_SELF event they receive must not cause their removal.
+     */
+    fsw_hash_set<int> renamed_descriptors;
+    bool pair_renames = false;
+    std::vector<char> buffer;
+    bool drain_queue = false;
+    unsigned int scan_threads = 1;
+    std::unique_ptr<batch_stat> stats;
+    // Links resolved and directories visited during the current scan.
+    link_resolver links;
+    /*
+     * Entries of the directories being scanned sequentially: every call to
+     * scan() appends the entries of its directory and removes them once they
+     * have been scanned.
+     */
+    directory_entries scan_entries;
+    timespec curr_time;
+    /*
+     * Lazy mode.  The directories at lazy_depth levels below a scanned path
+     * are watched, but their subdirectories are not: they form the frontier,
+     * and are activated when they receive an event.  The activated
+     * directories are deactivated when no event is received below them for
+     * lazy_idle seconds.
+     */
+    int lazy_depth = -1;
+    double lazy_idle = 0;
+    size_t watch_limit = 0;
+    bool watch_limit_reached = false;
+    fsw_hash_set<int> frontier;
+    fsw_hash_map<int, std::chrono::steady_clock::time_point> activations;
+    std::vector<std::string> paths_to_activate;
+    std::chrono::steady_clock::time_point next_idle_check;
+#ifdef FSW_INOTIFY_USE_EPOLL
+    int epoll_handle = -1;
+    /*
+     * Event descriptor signalled by on_stop() to wake up a thread blocked in
+     * epoll_wait().
+     */
+    int stop_event_handle = -1;
+    bool stop_requested = false;
+#endif
+#ifdef FSW_INOTIFY_USE_DISPATCHER
+    /*
+     * Subscription to the shared inotify descriptor, used instead of the
+     * descriptors above.
+     */
+    inotify_subscription *subscription = nullptr;
+#endif
+  };
+
+  static const unsigned int MIN_BUFFER_SIZE = (sizeof(struct inotify_event)) + NAME_MAX + 1;
+  static const unsigned int BUFFER_SIZE = 10 * MIN_BUFFER_SIZE;
+  static const unsigned int DRAIN_BUFFER_SIZE = 64 * 1024;
+  /*
+   * Maximum time (in seconds) a notification is delayed waiting for the second
+   * half of a rename.
+   */
+  static const double RENAME_PAIRING_TIMEOUT = 0.01;
+
+#ifdef HAVE_CXX_MUTEX
+  struct inotify_scan_item
+  {
+    std::string path;
+    bool accept_non_dirs;
+  };
+
+  /*
+   * State of a worker of the parallel scan.  The watches added by a worker
+   * are accumulated locally and merged into the monitor maps when the scan
+   * ends.
+   */
+  struct inotify_scan_worker
+  {
+    std::vector<std::pair<int, std::string>> watches;
+    directory_entries children;
   };
+#endif
+
+  inotify_monitor::inotify_monitor(std::vector<std::string> paths_to_monitor,
+                                   FSW_EVENT_CALLBACK *callback,
+                                   void *context) :
+    monitor(paths_to_monitor, callback, context),
+    impl(new inotify_monitor_impl())
+  {
+  }
+
+  /*
+   * The descriptors are created when the monitor is first started, since a
+   * monitor using the shared descriptor does not need them.
+   */
+  void inotify_monitor::open_descriptors()
+  {
+    impl->inotify_monitor_handle = inotify_init();
+
+    if (impl->inotify_monitor_handle == -1)
+    {
+      perror("inotify_init");
+      throw libfsw_exception(_("Cannot initialize inotify."));
+    }
+
+#ifdef FSW_INOTIFY_USE_EPOLL
+    impl->stop_event_handle = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if (impl->stop_event_handle == -1)
+    {
+      perror("eventfd");
+      throw libfsw_exception(_("Cannot initialize the stop event descriptor."));
+    }
+
+    impl->epoll_handle = epoll_create1(EPOLL_CLOEXEC);
+
+    if (impl->epoll_handle == -1)
+    {
+      perror("epoll_create1");
+      throw libfsw_exception(_("Cannot initialize epoll."));
+    }
+
+    for (int fd : {impl->inotify_monitor_handle, impl->stop_event_handle})
+    {
+      struct epoll_event ev = {};
+      ev.events = EPOLLIN;
+      ev.data.fd = fd;
+
+      if (epoll_ctl(impl->epoll_handle, EPOLL_CTL_ADD, fd, &ev) == -1)
+      {
+        perror("epoll_ctl");
+        throw libfsw_exception(_("Cannot add descriptor to the epoll set."));
+      }
+    }
+#endif
+  }
+
+  inotify_monitor::~inotify_monitor()
+  {
+#ifdef FSW_INOTIFY_USE_DISPATCHER
+    // Remove the watches which are not shared with other monitors.
+    if (impl->subscription)
+      inotify_dispatcher::get_instance().unsubscribe(impl->subscription);
+#endif
+
+    // close inotify watchers
+    for (int inotify_desc_pair : impl->watches.get_watches())
+    {
+      if (impl->inotify_monitor_handle == -1) break;
+
+      FSW_DLOGS(_("Removing: ") << inotify_desc_pair << "\n");
+
+      if (inotify_rm_watch(impl->inotify_monitor_handle, inotify_desc_pair))
+      {
+        perror("inotify_rm_watch");
+      }
+    }
+
+    // close inotify
+    if (impl->inotify_monitor_handle > 0)
+    {
+      close(impl->inotify_monitor_handle);
+    }
+
+#ifdef FSW_INOTIFY_USE_EPOLL
+    if (impl->epoll_handle != -1) close(impl->epoll_handle);
+    if (impl->stop_event_handle != -1) close(impl->stop_event_handle);
+#endif
+
+    delete impl;
+  }
+
+  /*
+   * Gets the inotify events to watch.  Only the events which may be mapped to
+   * an event type accepted by the event type filters are requested, besides
+   * the events needed to keep the watches up to date.
+   */
+  uint32_t inotify_monitor::get_watch_mask() const
+  {
+    const uint32_t accepted = get_event_type_mask();
+
+    // IsDir may be set on any event.
+    if (accepted & fsw_event_flag::IsDir) return IN_ALL_EVENTS;
+
+    uint32_t mask = IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO
+                    | IN_DELETE_SELF | IN_MOVE_SELF;
 
-  static const unsigned int BUFFER_SIZE = (10 * ((sizeof(struct inotify_event)) + NAME_MAX + 1));
+    if (accepted & fsw_event_flag::PlatformSpecific)
+      mask |= IN_ACCESS | IN_CLOSE_NOWRITE | IN_OPEN;
+    if (accepted & fsw_event_flag::AttributeModified) mask |= IN_ATTRIB;
+    if (accepted & fsw_event_flag::Updated) mask |= IN_CLOSE_WRITE | IN_MODIFY;
+    if (accepted & fsw_event_flag::Removed) mask |= IN_DELETE;
+
+    return mask;
+  }
+
+  int inotify_monitor::create_watch(const std::string& path) const
+  {
+    // Adding a watch for a path already watched returns its descriptor.
+    if (is_watch_limit_reached() && !is_watched(path)) return -1;
+
+    // TODO: Consider optionally adding the IN_EXCL_UNLINK flag.
+#ifdef FSW_INOTIFY_USE_DISPATCHER
+    int inotify_desc = impl->subscription
+      ? inotify_dispatcher::get_instance().add_watch(impl->subscription,
+                                                     path,
+                                                     get_watch_mask())
+      : inotify_add_watch(impl->inotify_monitor_handle,
+                          path.c_str(),
+                          get_watch_mask());
+#else
+    int inotify_desc = inotify_add_watch(impl->inotify_monitor_handle,
+                                         path.c_str(),
+                                         get_watch_mask());
+#endif
+
+    if (inotify_desc == -1)
+    {
+      perror("inotify_add_watch");
+    }
+
+    return inotify_desc;
+  }
+
+  void inotify_monitor::register_watch(int wd, const std::string& path)
+  {
+    impl->watches.add_watch(wd, path);
+
+    FSW_DLOGS(_("Added: ") << path << "\n");
+  }
+
+  int inotify_monitor::add_watch(const std::string& path)
+  {
+    int inotify_desc = create_watch(path);
+
+    if (inotify_desc != -1) register_watch(inotify_desc, path);
+
+    return inotify_desc;
+  }
+
+  bool inotify_monitor::is_watch_limit_reached() const
+  {
+    if (impl->watch_limit == 0 || impl->watches.size() < impl->watch_limit)
+      return false;
+
+    if (!impl->watch_limit_reached)
+    {
+      FSW_ELOGF(_("Watch limit reached: %zu watches.\n"), impl->watch_limit);
+      impl->watch_limit_reached = true;
+    }
+
+    return true;
+  }
+
+  /*
+   * Checks whether a path must be watched.  If checked is true, fd_stat
+   * already contains the status of path.
+   */
+  bool inotify_monitor::accept_scan_path(std::string& path,
+                                         const bool accept_non_dirs,
+                                         struct stat& fd_stat,
+                                         bool checked) const
+  {
+    if (!checked && !lstat_path(path, fd_stat)) return false;
+
+    if (follow_symlinks && S_ISLNK(fd_stat.st_mode))
+    {
+      std::string link_path;
+      if (!impl->links.resolve(path, fd_stat, link_path)) return false;
+
+      // A dangling link resolves to itself.
+      if (link_path == path) return false;
+
+      path.swap(link_path);
+
+      return accept_scan_path(path, accept_non_dirs, fd_stat);
+    }
+
+    bool is_dir = S_ISDIR(fd_stat.st_mode);
+
+    /*
+     * When watching a directory the inotify API will return change events of
+     * first-level children.  Therefore, we do not need to manually add a watch
+     * for a child unless it is a directory.  By default, accept_non_dirs is
+     * true to allow watching a file when first invoked on a node.
+     *
+     * For the same reason, the directory_only flag is ignored and treated as if
+     * it were always set to true.
+     */
+    if (!is_dir && !accept_non_dirs) return false;
+    if (!is_dir && directory_only) return false;
+
+    // A rejected directory is still watched if paths below it may be accepted.
+    return accept_path(path) || (is_dir && accept_subtree(path));
+  }
+
+  /*
+   * Scans path, watching the directories up to levels levels below it, or all
+   * of them if levels is negative.
+   */
+  void inotify_monitor::scan(const std::string& path,
+                             const bool accept_non_dirs,
+                             const struct stat *path_stat,
+                             int levels)
+  {
+    std::string watch_path = path;
+    struct stat fd_stat;
+
+    if (path_stat) fd_stat = *path_stat;
+
+    if (!path_stat && !lstat_path(watch_path, fd_stat)) return;
+
+    // Every object found by the first scan is listed, even if not watched.
+    list_inventory_entry(watch_path, fd_stat.st_mode);
+
+    if (!accept_scan_path(watch_path, accept_non_dirs, fd_stat, true)) return;
+    if (!visit_directory(fd_stat)) return;
+
+    // The target of a symbolic link is listed with the path of its events.
+    if (watch_path != path) list_inventory_entry(watch_path, fd_stat.st_mode);
+
+    const int wd = add_watch(watch_path);
+
+    if (wd == -1) return;
+    if (!recursive || !S_ISDIR(fd_stat.st_mode)) return;
+    if (!accept_subtree(watch_path)) return;
+
+    // A subtree activated before it is scanned again stays active.
+    if (levels == 0 && impl->activations.count(wd))
+      levels = get_activation_depth();
+
+    // The subdirectories are watched when the directory is activated.
+    if (levels == 0 || is_watch_limit_reached())
+    {
+      if (impl->lazy_depth >= 0) impl->frontier.insert(wd);
+      return;
+    }
+
+    const int child_levels = (levels > 0) ? levels - 1 : levels;
+
+    directory_entries& children = impl->scan_entries;
+    const size_t first_child = children.size();
+
+    if (!children.append(watch_path)) return;
+
+    const size_t last_child = children.size();
+    const std::string prefix = watch_path + "/";
+
+    /*
+     * Only directories are watched: when the type of a child is known, files
+     * of other types (except symbolic links to follow) are skipped without
+     * calling lstat().
+     */
+    if (impl->stats)
+    {
+      // The status of the children is retrieved in a single batch.
+      std::vector<std::string> child_paths;
+      std::vector<const char *> names;
+
+      for (size_t i = first_child; i < last_child; ++i)
+      {
+        if (!children.may_be_directory(i, follow_symlinks))
+        {
+          list_inventory_child(prefix, children, i);
+          continue;
+        }
+
+        child_paths.push_back(prefix + children.get_name(i));
+      }
+
+      children.truncate(first_child);
+
+      for (const std::string& child_path : child_paths)
+        names.push_back(child_path.c_str());
+
+      std::vector<struct stat> stats;
+      std::vector<int> errors;
+      impl->stats->lstat_at(AT_FDCWD, names, stats, errors);
+
+      for (size_t i = 0; i < child_paths.size(); ++i)
+      {
+        if (errors[i] != 0)
+        {
+          errno = errors[i];
+          fsw_logf_perror(_("Cannot lstat %s"), child_paths[i].c_str());
+          continue;
+        }
+
+        scan(child_paths[i], false, &stats[i], child_levels);
+      }
+
+      return;
+    }
+
+    // The children scanned recursively append their entries after these.
+    for (size_t i = first_child; i < last_child; ++i)
+    {
+      if (!children.may_be_directory(i, follow_symlinks))
+      {
+        list_inventory_child(prefix, children, i);
+        continue;
+      }
+
+      scan(prefix + children.get_name(i), false, nullptr, child_levels);
+    }
+
+    children.truncate(first_child);
+  }
+
+  /*
+   * Lists a child which is not scanned, using the type reported by the
+   * directory entry instead of calling lstat().
+   */
+  void inotify_monitor::list_inventory_child(const std::string& prefix,
+                                             const directory_entries& children,
+                                             size_t i) const
+  {
+    if (!is_listing_inventory()) return;
+
+    mode_t mode = 0;
+
+    switch (children.get_type(i))
+    {
+    case DT_REG:
+      mode = S_IFREG;
+      break;
+    case DT_DIR:
+      mode = S_IFDIR;
+      break;
+    case DT_LNK:
+      mode = S_IFLNK;
+      break;
+    }
+
+    list_inventory_entry(prefix + children.get_name(i), mode);
+  }
+
+  void inotify_monitor::parallel_scan(unsigned int thread_num)
+  {
+#ifdef HAVE_CXX_MUTEX
+    std::vector<inotify_scan_worker> workers(thread_num);
+    std::vector<inotify_scan_item> items;
+
+    impl->links.clear();
+
+    for (const std::string& path : paths)
+    {
+      if (!is_watched(path)) items.push_back({path, true});
+    }
+
+    FSW_ELOGF(_("Scanning with threads: %u\n"), thread_num);
+
+    auto visit = [&](unsigned int id,
+                     inotify_scan_item& item,
+                     std::vector<inotify_scan_item>& children)
+    {
+      inotify_scan_worker& self = workers[id];
+      struct stat fd_stat;
+      const std::string requested_path = item.path;
+      const bool found = lstat_path(item.path, fd_stat);
+
+      if (found) list_inventory_entry(item.path, fd_stat.st_mode);
+
+      if (!found
+          || !accept_scan_path(item.path, item.accept_non_dirs, fd_stat, true)
+          || !visit_directory(fd_stat))
+        return;
+
+      if (item.path != requested_path)
+        list_inventory_entry(item.path, fd_stat.st_mode);
+
+      int wd = create_watch(item.path);
+
+      if (wd == -1) return;
+
+      self.watches.emplace_back(wd, item.path);
+
+      if (!recursive
+          || !S_ISDIR(fd_stat.st_mode)
+          || !accept_subtree(item.path))
+        return;
+
+      self.children.clear();
+      self.children.append(item.path);
+
+      for (size_t i = 0; i < self.children.size(); ++i)
+      {
+        if (!self.children.may_be_directory(i, follow_symlinks))
+        {
+          list_inventory_child(item.path + "/", self.children, i);
+          continue;
+        }
+
+        children.push_back({item.path + "/" + self.children.get_name(i),
+                            false});
+      }
+    };
+
+    scan_in_parallel(items,
+                     thread_num,
+                     get_thread_settings(fsw_thread_worker),
+                     visit);
+
+    // inotify_add_watch() is thread-safe: the maps are merged only once.
+    for (inotify_scan_worker& worker : workers)
+    {
+      for (const auto& watch : worker.watches)
+        register_watch(watch.first, watch.second);
+    }
+#endif
+  }
+
+  /*
+   * Records a directory as visited during the current scan.  When symbolic
+   * links are followed, a directory may be reached through many paths, or
+   * through a link cycle, and it is only scanned the first time.
+   */
+  bool inotify_monitor::visit_directory(const struct stat& fd_stat) const
+  {
+    if (!follow_symlinks || !S_ISDIR(fd_stat.st_mode)) return true;
+
+    return impl->links.visit_directory(fd_stat);
+  }
+
+  bool inotify_monitor::is_watched(const std::string& path) const
+  {
+    return impl->watches.is_watched(impl->watches.find(path));
+  }
+
+  bool inotify_monitor::scan_root_paths()
+  {
+    using std::chrono::steady_clock;
+
+    const steady_clock::time_point start = steady_clock::now();
+    bool all_watched = true;
+    bool scanned = false;
+
+    for (std::string& path : paths)
+    {
+      if (is_watched(path)) continue;
+      if (!scanned) impl->links.clear();
+
+      scan(path, true, nullptr, impl->lazy_depth);
+      scanned = true;
+
+      if (!is_watched(path)) all_watched = false;
+    }
+
+    if (scanned) count_scan(steady_clock::now() - start);
+    set_watch_count(impl->watches.size());
+
+    return all_watched;
+  }
+
+  /*
+   * Added paths are scanned by scan_root_paths(), while the watches below a
+   * removed path are removed unless they are below another path to watch.
+   */
+  void inotify_monitor::update_root_paths()
+  {
+    std::vector<std::string> removed_paths;
+
+    for (const path_change& change : take_path_changes())
+    {
+      if (!change.added) removed_paths.push_back(change.path);
+    }
+
+    if (removed_paths.empty()) return;
+
+    std::string watch_path;
+
+    for (int wd : impl->watches.get_watches())
+    {
+      watch_path.clear();
+      impl->watches.append_watch_path(wd, watch_path);
+
+      if (!is_unwatched_path(watch_path, removed_paths)) continue;
+
+      if (release_watch(wd) != 0) perror("inotify_rm_watch");
+      remove_watch(wd);
+
+      FSW_DLOGS(_("Removed: ") << watch_path << "\n");
+    }
+  }
+
+  int inotify_monitor::get_activation_depth() const
+  {
+    // An activated directory always watches its subdirectories.
+    return (impl->lazy_depth > 0) ? impl->lazy_depth : 1;
+  }
+
+  /*
+   * Records the activity seen in the directory watched by wd: a directory of
+   * the frontier is activated, and the activated directories containing it
+   * are kept active.
+   */
+  void inotify_monitor::track_activity(const struct inotify_event *event)
+  {
+    // A directory being removed is not activated.
+    if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) return;
+
+    if (impl->frontier.count(event->wd))
+      impl->paths_to_activate.push_back(impl->event_path);
+
+    if (impl->lazy_idle <= 0 || impl->activations.empty()) return;
+
+    const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+
+    for (size_t node = impl->watches.find_watch(event->wd);
+         node != NO_NODE;
+         node = impl->watches.get_parent(node))
+    {
+      auto activation = impl->activations.find(impl->watches.get_watch(node));
+
+      if (activation != impl->activations.end()) activation->second = now;
+    }
+  }
+
+  /*
+   * Watches the subdirectories of a directory of the frontier.  A directory
+   * which is already active is only marked as used.
+   */
+  void inotify_monitor::activate_subtree(const std::string& path)
+  {
+    const size_t node = impl->watches.find(path);
+
+    if (impl->watches.is_watched(node))
+    {
+      const int wd = impl->watches.get_watch(node);
+      auto activation = impl->activations.find(wd);
+
+      if (activation != impl->activations.end())
+        activation->second = std::chrono::steady_clock::now();
+
+      if (!impl->frontier.erase(wd)) return;
+    }
+
+    FSW_DLOGS(_("Activating: ") << path << "\n");
+
+    scan(path, true, nullptr, get_activation_depth());
+
+    const size_t activated = impl->watches.find(path);
+
+    if (impl->watches.is_watched(activated))
+    {
+      impl->activations[impl->watches.get_watch(activated)] =
+        std::chrono::steady_clock::now();
+    }
+  }
+
+  void inotify_monitor::activate_subtrees()
+  {
+    if (impl->paths_to_activate.empty()) return;
+
+    impl->links.clear();
+
+    for (const std::string& path : impl->paths_to_activate)
+      activate_subtree(path);
+
+    impl->paths_to_activate.clear();
+    set_watch_count(impl->watches.size());
+  }
+
+  /*
+   * Activates the paths passed to touch_path().  The directories between the
+   * closest watched directory and a touched path are watched as well, so that
+   * the touched subtree is watched again if they are renamed.
+   */
+  void inotify_monitor::activate_touched_paths()
+  {
+    std::vector<std::string> touched_paths = take_touched_paths();
+
+    if (touched_paths.empty() || impl->lazy_depth < 0) return;
+
+    impl->links.clear();
+
+    for (std::string& path : touched_paths)
+    {
+      while (path.size() > 1 && path.back() == '/') path.pop_back();
+
+      auto is_below_root = [this](const std::string& p)
+      {
+        for (const std::string& root : paths)
+        {
+          if (is_path_below(p, root)) return true;
+        }
+
+        return false;
+      };
+
+      if (!is_below_root(path))
+      {
+        FSW_ELOGF(_("Cannot activate %s: it is not below a path to watch.\n"),
+                  path.c_str());
+        continue;
+      }
+
+      std::vector<std::string> parents;
+
+      for (size_t separator = path.find_last_of('/');
+           separator != std::string::npos && separator > 0;
+           separator = path.find_last_of('/', separator - 1))
+      {
+        std::string parent = path.substr(0, separator);
+
+        if (is_watched(parent) || !is_below_root(parent)) break;
+
+        parents.push_back(std::move(parent));
+      }
+
+      for (auto parent = parents.rbegin(); parent != parents.rend(); ++parent)
+        scan(*parent, false, nullptr, 0);
+
+      activate_subtree(path);
+    }
+
+    set_watch_count(impl->watches.size());
+  }
+
+  /*
+   * Removes the watches below the activated directories which have received
+   * no event for the idle period, which get back to the frontier.  The
+   * activations are checked twice per idle period.
+   */
+  void inotify_monitor::deactivate_idle_subtrees()
+  {
+    using std::chrono::duration;
+    using std::chrono::steady_clock;
+
+    if (impl->lazy_idle <= 0 || impl->activations.empty()) return;
+
+    const steady_clock::time_point now = steady_clock::now();
+
+    if (now < impl->next_idle_check) return;
+
+    const duration<double> idle(impl->lazy_idle);
+    impl->next_idle_check =
+      now + std::chrono::duration_cast<steady_clock::duration>(idle / 2);
+
+    std::vector<std::string> idle_paths;
+
+    for (auto it = impl->activations.begin(); it != impl->activations.end();)
+    {
+      if (now - it->second < idle)
+      {
+        ++it;
+        continue;
+      }
+
+      idle_paths.push_back(impl->watches.get_watch_path(it->first));
+      impl->frontier.insert(it->first);
+      it = impl->activations.erase(it);
+    }
+
+    if (idle_paths.empty()) return;
+
+    const size_t watch_number = impl->watches.size();
+    std::string watch_path;
+
+    for (int wd : impl->watches.get_watches())
+    {
+      watch_path.clear();
+      impl->watches.append_watch_path(wd, watch_path);
+
+      for (const std::string& idle_path : idle_paths)
+      {
+        if (watch_path == idle_path || !is_path_below(watch_path, idle_path))
+          continue;
+
+        if (release_watch(wd) != 0) perror("inotify_rm_watch");
+        remove_watch(wd);
+        break;
+      }
+    }
+
+    FSW_ELOGF(_("Deactivated %zu idle subtrees, removing %zu watches.\n"),
+              idle_paths.size(),
+              watch_number - impl->watches.size());
+
+    impl->watch_limit_reached = false;
+
+    set_watch_count(impl->watches.size());
+  }
+
+  void inotify_monitor::preprocess_dir_event(struct inotify_event *event)
+  {
+    std::vector<fsw_event_flag> flags;
+
+    if (event->mask & IN_ISDIR) flags.push_back(fsw_event_flag::IsDir);
+    if (event->mask & IN_MOVE_SELF) flags.push_back(fsw_event_flag::Updated);
+    if (event->mask & IN_UNMOUNT) flags.push_back(fsw_event_flag::PlatformSpecific);
+
+    if (flags.size())
+    {
+      impl->events.push_back({impl->event_path, impl->curr_time, flags});
+    }
+
+    // If a new directory has been created, it should be rescanned if the
+    if ((event->mask & IN_ISDIR) && (event->mask & IN_CREATE))
+    {
+      impl->paths_to_rescan.push_back(impl->event_path);
+    }
+  }
+
+  void inotify_monitor::preprocess_node_event(struct inotify_event *event)
+  {
+    std::vector<fsw_event_flag> flags;
+
+    if (event->mask & IN_ACCESS) flags.push_back(fsw_event_flag::PlatformSpecific);
+    if (event->mask & IN_ATTRIB) flags.push_back(fsw_event_flag::AttributeModified);
+    if (event->mask & IN_CLOSE_NOWRITE) flags.push_back(fsw_event_flag::PlatformSpecific);
+    if (event->mask & IN_CLOSE_WRITE) flags.push_back(fsw_event_flag::Updated);
+    if (event->mask & IN_CREATE) flags.push_back(fsw_event_flag::Created);
+    if (event->mask & IN_DELETE) flags.push_back(fsw_event_flag::Removed);
+    if (event->mask & IN_MODIFY) flags.push_back(fsw_event_flag::Updated);
+    if (event->mask & IN_MOVED_FROM)
+    {
+      flags.push_back(fsw_event_flag::Removed);
+      flags.push_back(fsw_event_flag::MovedFrom);
+    }
+    if (event->mask & IN_MOVED_TO)
+    {
+      flags.push_back(fsw_event_flag::Created);
+      flags.push_back(fsw_event_flag::MovedTo);
+    }
+    if (event->mask & IN_OPEN) flags.push_back(fsw_event_flag::PlatformSpecific);
+
+    // Build the file name.
+    std::string& filename = impl->event_path;
+
+    if (event->len > 1)
+    {
+      filename += '/';
+      filename += event->name;
+    }
+
+    if (flags.size() && !pair_move(event))
+    {
+      impl->events.push_back({filename, impl->curr_time, flags});
+    }
+
+    FSW_DLOGS(_("Generic event: ") << event->wd << "::" << filename << "\n");
+
+    /*
+     * inotify automatically removes the watch of a watched item that has been
+     * removed and posts an IN_IGNORED event after an IN_DELETE_SELF.
+     */
+    if (event->mask & IN_IGNORED)
+    {
+      FSW_DLOGS("IN_IGNORED: " << event->wd << "::" << filename << "\n");
+
+      impl->descriptors_to_remove.insert(event->wd);
+    }
+
+    /*
+     * inotify sends an IN_MOVE_SELF event when a watched object is moved into
+     * the same filesystem and keeps watching it.  Since its path has changed,
+     * we remove the watch so that recreation is attempted at the next
+     * iteration.
+     *
+     * Beware that a race condition exists which may result in events go
+     * unnoticed when a watched file x is removed and a new file named x is
+     * created thereafter.  In this case, fswatch could be blocked on read and
+     * it would not have any chance to create a new watch descriptor for x until
+     *  an event is received and read unblocks.
+     */
+    if (event->mask & IN_MOVE_SELF)
+    {
+      FSW_DLOGS("IN_MOVE_SELF: " << event->wd << "::" << filename << "\n");
+
+      // The watch of a directory renamed in place is still valid.
+      if (impl->renamed_descriptors.erase(event->wd)) return;
+
+      impl->watches_to_remove.insert(event->wd);
+      impl->descriptors_to_remove.insert(event->wd);
+    }
+
+    /*
+     * A file could be moved to a path which is being observed.  The clobbered
+     * file is handled by the corresponding IN_DELETE_SELF event.
+     */
+
+    /*
+     * inotify automatically removes the watch of the object the IN_DELETE_SELF
+     * event is related to.
+     */
+    if (event->mask & IN_DELETE_SELF)
+    {
+      FSW_DLOGS("IN_DELETE_SELF: " << event->wd << "::" << filename << "\n");
+
+      impl->descriptors_to_remove.insert(event->wd);
+    }
+  }
+
+  bool inotify_monitor::pair_move(struct inotify_event *event)
+  {
+    if (!event->cookie) return false;
+
+    /*
+     * The first half of a rename is notified as usual and it is remembered so
+     * that the event can be rewritten if the second half is received before
+     * the batch is notified.  Only directory moves are tracked when renames
+     * are not paired, since they are needed to update the watches.
+     */
+    if (event->mask & IN_MOVED_FROM)
+    {
+      if (!impl->pair_renames && !(event->mask & IN_ISDIR)) return false;
+
+      impl->pending_moves[event->cookie] = {impl->events.size(),
+                                            impl->event_path,
+                                            event->wd,
+                                            event->name};
+      return false;
+    }
+
+    if (!(event->mask & IN_MOVED_TO)) return false;
+
+    auto it = impl->pending_moves.find(event->cookie);
+    if (it == impl->pending_moves.end()) return false;
+
+    inotify_pending_move& move = it->second;
+    int moved_wd = -1;
+
+    /*
+     * Renaming the node of a watched directory in place updates the paths of
+     * all the watches below it, instead of removing the watch and scanning the
+     * subtree again.
+     */
+    if ((event->mask & IN_ISDIR)
+        && impl->watches.rename(move.wd, move.name, event->wd, event->name, moved_wd)
+        && moved_wd != -1)
+    {
+      FSW_DLOGS(_("Renamed: ") << move.path << " -> " << impl->event_path << "\n");
+
+      impl->renamed_descriptors.insert(moved_wd);
+    }
+
+    // The first half was already notified if it is in a priority path.
+    bool paired = impl->pair_renames
+      && !impl->events[move.event_index].get_flags().empty();
+
+    if (paired)
+    {
+      std::vector<fsw_event_flag> flags = {fsw_event_flag::Renamed,
+                                           fsw_event_flag::MovedFrom,
+                                           fsw_event_flag::MovedTo};
+
+      impl->events[move.event_index] = {impl->event_path,
+                                        impl->curr_time,
+                                        flags,
+                                        move.path};
+    }
+
+    impl->pending_moves.erase(it);
+
+    return paired;
+  }
+
+  void inotify_monitor::complete_pending_moves()
+  {
+    using std::chrono::duration;
+    using std::chrono::steady_clock;
+
+    /*
+     * The two halves of a rename are queued one after the other but they
+     * may be returned by different reads: wait a little for the missing
+     * halves before notifying.  Unmatched halves are notified as they are.
+     */
+    const auto deadline = steady_clock::now()
+      + duration<double>(RENAME_PAIRING_TIMEOUT);
+
+    while (!impl->pending_moves.empty())
+    {
+      duration<double> remaining = deadline - steady_clock::now();
+      if (remaining.count() <= 0) break;
+      if (!wait_for_events(remaining.count())) break;
+
+      read_available_events();
+    }
+
+    impl->pending_moves.clear();
+  }
+
+  void inotify_monitor::preprocess_event(struct inotify_event *event)
+  {
+    // The path of the watch is built once and shared by the handlers.
+    impl->event_path.clear();
+
+    // The records queued for a watch before it was removed are discarded.
+    if (event->wd != -1 && impl->watches.find_watch(event->wd) == NO_NODE)
+      return;
+
+    impl->watches.append_watch_path(event->wd, impl->event_path);
+
+    if (impl->lazy_depth >= 0 && event->wd != -1) track_activity(event);
+
+    if (event->mask & IN_Q_OVERFLOW)
+    {
+      notify_overflow(impl->event_path);
+
+      // Directories created while events were lost are not watched yet.
+      if (recover_overflow)
+      {
+        impl->paths_to_rescan.insert(impl->paths_to_rescan.end(),
+                                     paths.begin(),
+                                     paths.end());
+      }
+    }
+
+    preprocess_dir_event(event);
+    preprocess_node_event(event);
+  }
+
+  void inotify_monitor::remove_watch(int wd)
+  {
+    /*
+     * No need to remove the inotify watch because it is removed automatically
+     * when a watched element is deleted.
+     */
+    impl->watches.remove_watch(wd);
+    impl->frontier.erase(wd);
+    impl->activations.erase(wd);
+  }
+
+  int inotify_monitor::release_watch(int wd)
+  {
+#ifdef FSW_INOTIFY_USE_DISPATCHER
+    if (impl->subscription)
+      return inotify_dispatcher::get_instance().remove_watch(impl->subscription,
+                                                             wd);
+#endif
+
+    return inotify_rm_watch(impl->inotify_monitor_handle, wd);
+  }
+
+  void inotify_monitor::process_pending_events()
+  {
+    // Remove watches.
+    auto wtd = impl->watches_to_remove.begin();
+
+    while (wtd != impl->watches_to_remove.end())
+    {
+      if (release_watch(*wtd) != 0)
+      {
+        perror("inotify_rm_watch");
+      }
+      else
+      FSW_DLOGS(_("Removed: ") << *wtd << "\n");
+
+      impl->watches_to_remove.erase(wtd++);
+    }
+
+    // Clean up descriptors.
+    auto fd = impl->descriptors_to_remove.begin();
+
+    while (fd != impl->descriptors_to_remove.end())
+    {
+      remove_watch(*fd);
+
+      impl->descriptors_to_remove.erase(fd++);
+    }
+
+    // Process paths to be rescanned
+    if (!impl->paths_to_rescan.empty()) impl->links.clear();
+
+    std::for_each(impl->paths_to_rescan.begin(),
+		  impl->paths_to_rescan.end(),
+		  [this] (const std::string& p)
+		  {
+		    this->scan(p, true, nullptr, impl->lazy_depth);
+		  }
+		  );
+
+    impl->paths_to_rescan.clear();
+
+    activate_subtrees();
+  }
+
+  void inotify_monitor::configure_scan_threads()
+  {
+    std::string scan_threads_value = get_property(INOTIFY_SCAN_THREADS);
+
+    if (!scan_threads_value.empty())
+    {
+      char *end;
+      long parsed_value = strtol(scan_threads_value.c_str(), &end, 0);
+
+      if (*end != '\0' || parsed_value < 0)
+      {
+        std::string msg = std::string(_("Invalid value: ")) + scan_threads_value;
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+      }
+
+#ifdef HAVE_CXX_MUTEX
+      if (parsed_value == 0) parsed_value = std::thread::hardware_concurrency();
+#else
+      // Scanning is always sequential without thread support.
+      parsed_value = 1;
+#endif
+
+      impl->scan_threads = (parsed_value > 0) ? parsed_value : 1;
+    }
+
+    // The parallel scan overlaps its calls using threads instead.
+    if (get_property(INOTIFY_SCAN_IO_URING) == "true" && !impl->stats)
+    {
+      impl->stats.reset(new batch_stat());
+      if (!impl->stats->is_asynchronous()) impl->stats.reset();
+    }
+  }
+
+  void inotify_monitor::configure_lazy_mode()
+  {
+    std::string depth_value = get_property(INOTIFY_LAZY_DEPTH);
+    impl->lazy_depth = -1;
+
+    if (!depth_value.empty())
+    {
+      char *end;
+      long parsed_value = strtol(depth_value.c_str(), &end, 10);
+
+      if (*end != '\0' || parsed_value < 0 || parsed_value > INT_MAX)
+      {
+        std::string msg = std::string(_("Invalid value: ")) + depth_value;
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+      }
+
+      impl->lazy_depth = static_cast<int> (parsed_value);
+    }
+
+    std::string idle_value = get_property(INOTIFY_LAZY_IDLE);
+    impl->lazy_idle = 0;
+
+    if (!idle_value.empty())
+    {
+      char *end;
+      double parsed_value = strtod(idle_value.c_str(), &end);
+
+      if (*end != '\0' || !(parsed_value >= 0))
+      {
+        std::string msg = std::string(_("Invalid value: ")) + idle_value;
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+      }
+
+      impl->lazy_idle = parsed_value;
+    }
+
+    std::string limit_value = get_property(INOTIFY_WATCH_LIMIT);
+    impl->watch_limit = 0;
+
+    if (!limit_value.empty())
+    {
+      char *end;
+      unsigned long long parsed_value = strtoull(limit_value.c_str(), &end, 10);
+
+      if (*end != '\0' || limit_value[0] == '-')
+      {
+        std::string msg = std::string(_("Invalid value: ")) + limit_value;
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+      }
+
+      impl->watch_limit = static_cast<size_t> (parsed_value);
+    }
+
+    impl->watch_limit_reached = false;
+
+    // The frontier is built by a sequential scan, which adds the watches in
+    // order and stops when the limit is reached.
+    if (impl->scan_threads > 1
+        && (impl->lazy_depth >= 0 || impl->watch_limit > 0))
+    {
+      FSW_ELOG(_("The lazy mode and the watch limit require a sequential scan.\n"));
+      impl->scan_threads = 1;
+    }
+  }
 
-  inotify_monitor::inotify_monitor(std::vector<std::string> paths_to_monitor,
-                                   FSW_EVENT_CALLBACK *callback,
-                                   void *context) :
-    monitor(paths_to_monitor, callback, context),
-    impl(new inotify_monitor_impl())
+  void inotify_monitor::configure_monitor()
   {
-    impl->inotify_monitor_handle = inotify_init();
+#ifdef FSW_INOTIFY_USE_DISPATCHER
+    // The descriptor is chosen when the monitor is first started.
+    if (impl->inotify_monitor_handle == -1 && !impl->subscription)
+    {
+      if (get_property(INOTIFY_SHARED) == "true")
+      {
+        inotify_subscription *subscription =
+          inotify_dispatcher::get_instance().subscribe(
+            get_thread_settings(fsw_thread_monitor));
+
+        std::lock_guard<std::mutex> run_guard(run_mutex);
+        impl->subscription = subscription;
+      }
+    }
+
+    // Records are copied into the inbox of the subscription as soon as they
+    // are read: the inbox is always drained.
+    if (impl->subscription)
+    {
+      impl->drain_queue = true;
+      impl->pair_renames = (get_property(INOTIFY_RENAME_PAIR) == "true");
+      configure_scan_threads();
+
+      return;
+    }
+#else
+    if (get_property(INOTIFY_SHARED) == "true")
+    {
+      throw libfsw_exception(_("The shared inotify descriptor is not supported."),
+                             FSW_ERR_INVALID_PROPERTY);
+    }
+#endif
 
     if (impl->inotify_monitor_handle == -1)
     {
-      perror("inotify_init");
-      throw libfsw_exception(_("Cannot initialize inotify."));
+#ifdef HAVE_CXX_MUTEX
+      std::lock_guard<std::mutex> run_guard(run_mutex);
+#endif
+      open_descriptors();
     }
-  }
 
-  inotify_monitor::~inotify_monitor()
-  {
-    // close inotify watchers
-    for (auto inotify_desc_pair : impl->watched_descriptors)
+    impl->drain_queue = (get_property(INOTIFY_READ_DRAIN) == "true");
+    impl->pair_renames = (get_property(INOTIFY_RENAME_PAIR) == "true");
+
+    size_t buffer_size = impl->drain_queue ? DRAIN_BUFFER_SIZE : BUFFER_SIZE;
+    std::string buffer_size_value = get_property(INOTIFY_READ_BUFFER_SIZE);
+
+    if (!buffer_size_value.empty())
     {
-      std::ostringstream log;
-      log << _("Removing: ") << inotify_desc_pair << "\n";
-      FSW_ELOG(log.str().c_str());
+      long parsed_value = strtol(buffer_size_value.c_str(), nullptr, 0);
 
-      if (inotify_rm_watch(impl->inotify_monitor_handle, inotify_desc_pair))
+      if (parsed_value < (long) MIN_BUFFER_SIZE)
       {
-        perror("inotify_rm_watch");
+        std::string msg = std::string(_("Invalid value: ")) + buffer_size_value;
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
       }
+
+      buffer_size = parsed_value;
     }
 
-    // close inotify
-    if (impl->inotify_monitor_handle > 0)
+    impl->buffer.resize(buffer_size);
+
+    configure_scan_threads();
+
+    // In drain mode the descriptor is read until the kernel queue is empty,
+    // hence reads must not block.
+    int fd_flags = fcntl(impl->inotify_monitor_handle, F_GETFL);
+
+    if (fd_flags == -1)
     {
-      close(impl->inotify_monitor_handle);
+      perror("fcntl");
+      throw libfsw_exception(_("Cannot get the inotify descriptor flags."));
     }
 
-    delete impl;
+    if (impl->drain_queue) fd_flags |= O_NONBLOCK;
+    else fd_flags &= ~O_NONBLOCK;
+
+    if (fcntl(impl->inotify_monitor_handle, F_SETFL, fd_flags) == -1)
+    {
+      perror("fcntl");
+      throw libfsw_exception(_("Cannot set the inotify descriptor flags."));
+    }
   }
 
-  bool inotify_monitor::add_watch(const std::string& path,
-                                  const struct stat& fd_stat)
+  ssize_t inotify_monitor::read_events()
   {
-    // TODO: Consider optionally adding the IN_EXCL_UNLINK flag.
-    int inotify_desc = inotify_add_watch(impl->inotify_monitor_handle,
-                                         path.c_str(),
-                                         IN_ALL_EVENTS);
+#ifdef FSW_INOTIFY_USE_DISPATCHER
+    if (impl->subscription)
+      return inotify_dispatcher::get_instance().take(impl->subscription,
+                                                     impl->buffer);
+#endif
 
-    if (inotify_desc == -1)
+    ssize_t record_num;
+
+    do
     {
-      perror("inotify_add_watch");
+      record_num = read(impl->inotify_monitor_handle,
+                        &impl->buffer[0],
+                        impl->buffer.size());
     }
-    else
+    while (record_num == -1 && errno == EINTR);
+
+    FSW_DLOGS(_("Number of records: ") << record_num << "\n");
+
+    if (!record_num)
+    {
+      throw libfsw_exception(_("read() on inotify descriptor read 0 records."));
+    }
+
+    if (record_num == -1)
     {
-      impl->watched_descriptors.insert(inotify_desc);
-      impl->wd_to_path[inotify_desc] = path;
-      impl->path_to_wd[path] = inotify_desc;
+      if (impl->drain_queue && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return -1;
 
-      std::ostringstream log;
-      log << _("Added: ") << path << "\n";
-      FSW_ELOG(log.str().c_str());
+      perror("read()");
+      throw libfsw_exception(_("read() on inotify descriptor returned -1."));
     }
 
-    return (inotify_desc != -1);
+    return record_num;
   }
 
-  void inotify_monitor::scan(const std::string& path, const bool accept_non_dirs)
+  void inotify_monitor::process_records(ssize_t record_num)
   {
-    struct stat fd_stat;
-    if (!lstat_path(path, fd_stat)) return;
+    char *buffer = &impl->buffer[0];
+    size_t records = 0;
 
-    if (follow_symlinks && S_ISLNK(fd_stat.st_mode))
+    for (char *p = buffer; p < buffer + record_num; ++records)
     {
-      std::string link_path;
-      if (read_link_path(path, link_path))
-        scan(link_path, accept_non_dirs);
+      struct inotify_event *event = reinterpret_cast<struct inotify_event *> (p);
 
-      return;
+      preprocess_event(event);
+
+      p += (sizeof(struct inotify_event)) + event->len;
     }
 
-    bool is_dir = S_ISDIR(fd_stat.st_mode);
+    count_read(records, record_num);
+  }
 
+  void inotify_monitor::drain_events()
+  {
     /*
-     * When watching a directory the inotify API will return change events of
-     * first-level children.  Therefore, we do not need to manually add a watch
-     * for a child unless it is a directory.  By default, accept_non_dirs is
-     * true to allow watching a file when first invoked on a node.
-     *
-     * For the same reason, the directory_only flag is ignored and treated as if
-     * it were always set to true.
+     * Read the descriptor until the kernel reports that no more events are
+     * available: all the records are accumulated into impl->events and
+     * notified as a single batch by the caller.
      */
-    if (!is_dir && !accept_non_dirs) return;
-    if (!is_dir && directory_only) return;
-    if (!accept_path(path)) return;
-    if (!add_watch(path, fd_stat)) return;
-    if (!recursive || !is_dir) return;
-
-    std::vector<std::string> children = get_directory_children(path);
-
-    for (const std::string& child : children)
+    for (;;)
     {
-      if (child == "." || child == "..") continue;
+      ssize_t record_num = read_events();
 
-      /*
-       * Scan children but only watch directories.
-       */
-      scan(path + "/" + child, false);
-    }
-  }
+      if (record_num == -1) break;
 
-  bool inotify_monitor::is_watched(const std::string& path) const
-  {
-    return (impl->path_to_wd.find(path) != impl->path_to_wd.end());
+      process_records(record_num);
+    }
   }
 
-  void inotify_monitor::scan_root_paths()
+  void inotify_monitor::read_available_events()
   {
-    for (std::string& path : paths)
+    if (impl->drain_queue)
+    {
+      drain_events();
+    }
+    else
     {
-      if (!is_watched(path)) scan(path);
+      process_records(read_events());
     }
   }
 
-  void inotify_monitor::preprocess_dir_event(struct inotify_event *event)
+  void inotify_monitor::run()
   {
-    std::vector<fsw_event_flag> flags;
-
-    if (event->mask & IN_ISDIR) flags.push_back(fsw_event_flag::IsDir);
-    if (event->mask & IN_MOVE_SELF) flags.push_back(fsw_event_flag::Updated);
-    if (event->mask & IN_UNMOUNT) flags.push_back(fsw_event_flag::PlatformSpecific);
+    configure_monitor();
+    configure_lazy_mode();
 
-    if (flags.size())
+    if (impl->scan_threads > 1)
     {
-      impl->events.push_back({impl->wd_to_path[event->wd], impl->curr_time, flags});
+      using std::chrono::steady_clock;
+
+      const steady_clock::time_point start = steady_clock::now();
+      parallel_scan(impl->scan_threads);
+      count_scan(steady_clock::now() - start);
     }
 
-    // If a new directory has been created, it should be rescanned if the
-    if ((event->mask & IN_ISDIR) && (event->mask & IN_CREATE))
+    // The inventory ends once the paths which can be watched are scanned.
+    if (is_listing_inventory())
     {
-      impl->paths_to_rescan.push_back(impl->wd_to_path[event->wd]);
+      scan_root_paths();
+      end_inventory();
     }
+
+#ifdef FSW_INOTIFY_USE_EPOLL
+    run_epoll_loop();
+#else
+    run_select_loop();
+#endif
   }
 
-  void inotify_monitor::preprocess_node_event(struct inotify_event *event)
+  bool inotify_monitor::lists_inventory() const
   {
-    std::vector<fsw_event_flag> flags;
+    return true;
+  }
 
-    if (event->mask & IN_ACCESS) flags.push_back(fsw_event_flag::PlatformSpecific);
-    if (event->mask & IN_ATTRIB) flags.push_back(fsw_event_flag::AttributeModified);
-    if (event->mask & IN_CLOSE_NOWRITE) flags.push_back(fsw_event_flag::PlatformSpecific);
-    if (event->mask & IN_CLOSE_WRITE) flags.push_back(fsw_event_flag::Updated);
-    if (event->mask & IN_CREATE) flags.push_back(fsw_event_flag::Created);
-    if (event->mask & IN_DELETE) flags.push_back(fsw_event_flag::Removed);
-    if (event->mask & IN_MODIFY) flags.push_back(fsw_event_flag::Updated);
-    if (event->mask & IN_MOVED_FROM)
-    {
-      flags.push_back(fsw_event_flag::Removed);
-      flags.push_back(fsw_event_flag::MovedFrom);
-    }
-    if (event->mask & IN_MOVED_TO)
+  void inotify_monitor::on_stop()
+  {
+    wake_up();
+  }
+
+  void inotify_monitor::on_paths_changed()
+  {
+    wake_up();
+  }
+
+  /*
+   * Wakes up the thread blocked waiting for events, which then checks whether
+   * the monitor should stop and applies the changes of the paths to watch.
+   */
+  void inotify_monitor::wake_up()
+  {
+#ifdef FSW_INOTIFY_USE_DISPATCHER
+    if (impl->subscription)
     {
-      flags.push_back(fsw_event_flag::Created);
-      flags.push_back(fsw_event_flag::MovedTo);
+      inotify_dispatcher::get_instance().wake(impl->subscription);
+      return;
     }
-    if (event->mask & IN_OPEN) flags.push_back(fsw_event_flag::PlatformSpecific);
+#endif
 
-    // Build the file name.
-    std::ostringstream filename_stream;
-    filename_stream << impl->wd_to_path[event->wd];
+#ifdef FSW_INOTIFY_USE_EPOLL
+    // The monitor has not been started yet.
+    if (impl->stop_event_handle == -1) return;
 
-    if (event->len > 1)
+    uint64_t value = 1;
+
+    if (write(impl->stop_event_handle, &value, sizeof(value)) == -1)
     {
-      filename_stream << "/";
-      filename_stream << event->name;
+      fsw_log_perror("write");
     }
+#endif
+  }
 
-    if (flags.size())
+  bool inotify_monitor::wait_for_events(double timeout)
+  {
+#ifdef FSW_INOTIFY_USE_DISPATCHER
+    if (impl->subscription)
     {
-      impl->events.push_back({filename_stream.str(), impl->curr_time, flags});
+      bool woken;
+      bool readable = inotify_dispatcher::get_instance().wait(impl->subscription,
+                                                              timeout,
+                                                              woken);
+      if (woken) impl->stop_requested = true;
+
+      return readable;
     }
+#endif
+
+#ifdef FSW_INOTIFY_USE_EPOLL
+    // A negative timeout blocks until a descriptor is ready.
+    int timeout_ms = -1;
 
+    if (timeout >= 0)
     {
-      std::ostringstream log;
-      log << _("Generic event: ") << event->wd << "::" << filename_stream.str() << "\n";
-      FSW_ELOG(log.str().c_str());
+      double ms = std::ceil(timeout * 1000);
+      timeout_ms = (ms < INT_MAX) ? static_cast<int> (ms) : INT_MAX;
     }
 
-    /*
-     * inotify automatically removes the watch of a watched item that has been
-     * removed and posts an IN_IGNORED event after an IN_DELETE_SELF.
-     */
-    if (event->mask & IN_IGNORED)
-    {
-      std::ostringstream log;
-      log << "IN_IGNORED: " << event->wd << "::" << filename_stream.str() << "\n";
-      FSW_ELOG(log.str().c_str());
+    struct epoll_event ready[2];
+    int rv = epoll_wait(impl->epoll_handle, ready, 2, timeout_ms);
 
-      impl->descriptors_to_remove.insert(event->wd);
+    if (rv == -1)
+    {
+      if (errno != EINTR) fsw_log_perror("epoll_wait");
+      return false;
     }
 
-    /*
-     * inotify sends an IN_MOVE_SELF event when a watched object is moved into
-     * the same filesystem and keeps watching it.  Since its path has changed,
-     * we remove the watch so that recreation is attempted at the next
-     * iteration.
-     *
-     * Beware that a race condition exists which may result in events go
-     * unnoticed when a watched file x is removed and a new file named x is
-     * created thereafter.  In this case, fswatch could be blocked on read and
-     * it would not have any chance to create a new watch descriptor for x until
-     *  an event is received and read unblocks.
-     */
-    if (event->mask & IN_MOVE_SELF)
+    bool readable = false;
+
+    for (int i = 0; i < rv; ++i)
     {
-      std::ostringstream log;
-      log << "IN_MOVE_SELF: " << event->wd << "::" << filename_stream.str() << "\n";
-      FSW_ELOG(log.str().c_str());
+      if (ready[i].data.fd == impl->stop_event_handle)
+      {
+        uint64_t value;
 
-      impl->watches_to_remove.insert(event->wd);
-      impl->descriptors_to_remove.insert(event->wd);
+        if (read(impl->stop_event_handle, &value, sizeof(value)) == -1
+            && errno != EAGAIN)
+        {
+          fsw_log_perror("read");
+        }
+
+        impl->stop_requested = true;
+      }
+      else
+      {
+        readable = true;
+      }
     }
 
-    /*
-     * A file could be moved to a path which is being observed.  The clobbered
-     * file is handled by the corresponding IN_DELETE_SELF event.
-     */
+    return readable;
+#else
+    fd_set set;
+    struct timeval tv;
+    double sec;
+    double frac = modf(timeout, &sec);
 
-    /*
-     * inotify automatically removes the watch of the object the IN_DELETE_SELF
-     * event is related to.
-     */
-    if (event->mask & IN_DELETE_SELF)
-    {
-      std::ostringstream log;
-      log << "IN_DELETE_SELF: " << event->wd << "::" << filename_stream.str() << "\n";
-      FSW_ELOG(log.str().c_str());
+    FD_ZERO(&set);
+    FD_SET(impl->inotify_monitor_handle, &set);
+    tv.tv_sec = sec;
+    tv.tv_usec = 1000 * 1000 * frac;
 
-      impl->descriptors_to_remove.insert(event->wd);
-    }
-  }
+    int rv = select(impl->inotify_monitor_handle + 1,
+                    &set,
+                    nullptr,
+                    nullptr,
+                    timeout >= 0 ? &tv : nullptr);
 
-  void inotify_monitor::preprocess_event(struct inotify_event *event)
-  {
-    if (event->mask & IN_Q_OVERFLOW)
+    if (rv == -1)
     {
-      notify_overflow(impl->wd_to_path[event->wd]);
+      if (errno != EINTR) fsw_log_perror("select");
+      return false;
     }
 
-    preprocess_dir_event(event);
-    preprocess_node_event(event);
-  }
-
-  void inotify_monitor::remove_watch(int wd)
-  {
-    /*
-     * No need to remove the inotify watch because it is removed automatically
-     * when a watched element is deleted.
-     */
-    impl->wd_to_path.erase(wd);
+    return rv > 0;
+#endif
   }
 
-  void inotify_monitor::process_pending_events()
+  void inotify_monitor::run_epoll_loop()
   {
-    // Remove watches.
-    auto wtd = impl->watches_to_remove.begin();
+#ifdef FSW_INOTIFY_USE_EPOLL
+    using std::chrono::duration;
+    using std::chrono::steady_clock;
 
-    while (wtd != impl->watches_to_remove.end())
+    // Discard a wake up request left over by a previous run.
+#ifdef FSW_INOTIFY_USE_DISPATCHER
+    if (impl->subscription)
     {
-      if (inotify_rm_watch(impl->inotify_monitor_handle, *wtd) != 0)
-      {
-        perror("inotify_rm_watch");
-      }
-      else
+      bool woken;
+      inotify_dispatcher::get_instance().wait(impl->subscription, 0, woken);
+    }
+    else
+#endif
+    {
+      uint64_t stale_value;
+      if (read(impl->stop_event_handle, &stale_value, sizeof(stale_value)) == -1
+          && errno != EAGAIN)
       {
-        std::ostringstream log;
-        log << _("Removed: ") << *wtd << "\n";
-        FSW_ELOG(log.str().c_str());
+        fsw_log_perror("read");
       }
-
-      impl->watches_to_remove.erase(wtd++);
     }
 
-    // Clean up descriptors.
-    auto fd = impl->descriptors_to_remove.begin();
-
-    while (fd != impl->descriptors_to_remove.end())
+    for(;;)
     {
-      const std::string& curr_path = impl->wd_to_path[*fd];
-      impl->path_to_wd.erase(curr_path);
-      impl->wd_to_path.erase(*fd);
-      impl->watched_descriptors.erase(*fd);
+#ifdef HAVE_CXX_MUTEX
+      std::unique_lock<std::mutex> run_guard(run_mutex);
+      if (should_stop) break;
+      run_guard.unlock();
+#endif
 
-      impl->descriptors_to_remove.erase(fd++);
-    }
+      impl->stop_requested = false;
 
-    // Process paths to be rescanned
-    std::for_each(impl->paths_to_rescan.begin(),
-		  impl->paths_to_rescan.end(),
-		  [this] (const std::string& p)
-		  {
-		    this->scan(p);
-		  }
-		  );
+      process_pending_events();
+      deactivate_idle_subtrees();
+      update_root_paths();
+      activate_touched_paths();
+
+      // Block until either an event is available or the monitor is stopped.
+      // Root paths that cannot be watched yet are retried every latency
+      // seconds, and idle subtrees are checked twice per idle period.
+      bool all_watched = scan_root_paths();
+      double timeout = all_watched ? -1 : latency;
+
+      if (impl->lazy_idle > 0
+          && !impl->activations.empty()
+          && (timeout < 0 || timeout > impl->lazy_idle / 2))
+        timeout = impl->lazy_idle / 2;
+
+      if (!wait_for_events(timeout)) continue;
+
+      impl->curr_time = event::get_current_time();
+      read_available_events();
+
+      // Coalesce the events received within the latency window into a single
+      // batch.  Pending events are processed as soon as they are read, so
+      // that newly created directories are watched during the window, and
+      // the events of the priority paths are notified without waiting.
+      const auto deadline = steady_clock::now() + duration<double>(latency);
+      size_t priority_checked = 0;
+
+      while (!impl->stop_requested)
+      {
+        process_pending_events();
+        notify_priority_events(impl->events, priority_checked);
 
-    impl->paths_to_rescan.clear();
+        duration<double> remaining = deadline - steady_clock::now();
+        if (remaining.count() <= 0) break;
+        if (!wait_for_events(remaining.count())) continue;
+
+        read_available_events();
+      }
+
+      complete_pending_moves();
+
+      if (impl->events.size())
+      {
+        notify_events(impl->events);
+        impl->events.clear();
+      }
+    }
+#endif
   }
 
-  void inotify_monitor::run()
+  void inotify_monitor::run_select_loop()
   {
-    char buffer[BUFFER_SIZE];
     double sec;
     double frac = modf(this->latency, &sec);
 
@@ -392,11 +2004,14 @@ namespace fsw
 #endif
 
       process_pending_events();
+      deactivate_idle_subtrees();
+      update_root_paths();
+      activate_touched_paths();
 
       scan_root_paths();
 
       // If no files can be watched, sleep and repeat the loop.
-      if (!impl->watched_descriptors.size())
+      if (!impl->watches.size())
       {
         sleep(latency);
         continue;
@@ -428,37 +2043,10 @@ namespace fsw
       // In case of read timeout just repeat the loop.
       if (rv == 0) continue;
 
-      ssize_t record_num = read(impl->inotify_monitor_handle,
-                                buffer,
-                                BUFFER_SIZE);
-
-      {
-        std::ostringstream log;
-        log << _("Number of records: ") << record_num << "\n";
-        FSW_ELOG(log.str().c_str());
-      }
-
-      if (!record_num)
-      {
-        throw libfsw_exception(_("read() on inotify descriptor read 0 records."));
-      }
-
-      if (record_num == -1)
-      {
-        perror("read()");
-        throw libfsw_exception(_("read() on inotify descriptor returned -1."));
-      }
-
-      time(&impl->curr_time);
+      impl->curr_time = event::get_current_time();
+      read_available_events();
 
-      for (char *p = buffer; p < buffer + record_num;)
-      {
-        struct inotify_event *event = reinterpret_cast<struct inotify_event *> (p);
-
-        preprocess_event(event);
-
-        p += (sizeof(struct inotify_event)) + event->len;
-      }
+      complete_pending_moves();
 
       if (impl->events.size())
       {
@@ -466,7 +2054,9 @@ namespace fsw
         impl->events.clear();
       }
 
-      sleep(latency);
+      // In drain mode the kernel queue is empty at this point: there is no
+      // need to wait before going back to select().
+      if (!impl->drain_queue) sleep(latency);
     }
   }
 }
@@ -31,6 +31,7 @@
 #  include <string>
 #  include <vector>
 #  include <sys/stat.h>
+#  include <sys/types.h>
 
 namespace fsw
 {
@@ -39,6 +40,7 @@ namespace fsw
    * FSEvents monitor.
    */
   struct inotify_monitor_impl;
+  class directory_entries;
 
   /**
    * @brief Solaris/Illumos monitor.
@@ -49,6 +51,112 @@ namespace fsw
   class inotify_monitor : public monitor
   {
   public:
+    /**
+     * @brief Custom monitor property used to enable the _drain_ read mode.
+     *
+     * When this property is set to `true`, the inotify descriptor is put in
+     * non-blocking mode and, every time it becomes readable, it is read
+     * repeatedly until the kernel queue is empty.  All the events read this way
+     * are notified as a single batch and the monitor does not sleep between
+     * consecutive reads.
+     */
+    static constexpr const char *INOTIFY_READ_DRAIN = "inotify.read.drain";
+
+    /**
+     * @brief Custom monitor property used to set the size (in bytes) of the
+     * buffer used to read events from the inotify descriptor.
+     *
+     * The buffer must be large enough to store at least one event with a name
+     * of maximum length.
+     */
+    static constexpr const char *INOTIFY_READ_BUFFER_SIZE = "inotify.read.buffer.size";
+
+    /**
+     * @brief Custom monitor property used to set the number of threads used
+     * to perform the initial scan of the paths to watch.
+     *
+     * When this property is set to a value greater than `1`, the initial scan
+     * is performed by a pool of worker threads which steal work from each
+     * other and add watches concurrently.  If `0` is specified, the number of
+     * hardware threads is used.  By default, the scan is sequential.
+     */
+    static constexpr const char *INOTIFY_SCAN_THREADS = "inotify.scan.threads";
+
+    /**
+     * @brief Custom monitor property used to pair the two halves of a rename.
+     *
+     * When this property is set to `true`, an `IN_MOVED_FROM` event and the
+     * `IN_MOVED_TO` event with the same cookie are notified as a single event
+     * with the `Renamed`, `MovedFrom` and `MovedTo` flags, whose path is the
+     * new path of the object and whose old path is its previous path.
+     */
+    static constexpr const char *INOTIFY_RENAME_PAIR = "inotify.rename.pair";
+
+    /**
+     * @brief Custom monitor property used to share the inotify descriptor with
+     * the other monitors of the process.
+     *
+     * When this property is set to `true` before the monitor is first started,
+     * the monitor does not create its own inotify descriptor: its watches are
+     * added to a descriptor shared by all the monitors with this property set,
+     * and a single thread reads it and routes each event to the monitors
+     * watching its watch descriptor.  The kernel watch of a directory watched
+     * by many monitors is created only once.  Since the records are drained
+     * from the shared descriptor as soon as they are available, the
+     * `inotify.read.drain` and `inotify.read.buffer.size` properties are
+     * ignored.
+     */
+    static constexpr const char *INOTIFY_SHARED = "inotify.shared";
+
+    /**
+     * @brief Custom monitor property used to enable the batched status calls.
+     *
+     * When this property is set to `true` and io_uring is available, the
+     * status of the subdirectories found by a sequential scan is retrieved by
+     * `statx()` calls submitted to io_uring in batches, so that their latency
+     * overlaps.  This is mostly useful on network and other high latency file
+     * systems.
+     */
+    static constexpr const char *INOTIFY_SCAN_IO_URING = "inotify.scan.io_uring";
+
+    /**
+     * @brief Custom monitor property used to enable the lazy mode.
+     *
+     * When this property is set to a non-negative number _n_, the scan of a
+     * path watches the directories up to _n_ levels below it: the deeper
+     * subdirectories are watched only when the directory containing them
+     * receives an event, or when the subtree is requested with touch_path().
+     * An activated directory watches the next _n_ levels below it, or the
+     * next level if _n_ is `0`.  Events in the subtrees which are not watched
+     * yet are lost, and so are the creation and the removal of their files.
+     */
+    static constexpr const char *INOTIFY_LAZY_DEPTH = "inotify.lazy.depth";
+
+    /**
+     * @brief Custom monitor property used to set the idle period (in seconds)
+     * after which an activated subtree is no longer watched.
+     *
+     * In lazy mode, the watches below an activated directory are removed
+     * when no event is received below it for this period, and the directory
+     * is activated again by its next event.  If `0` is specified, which is
+     * the default, activated subtrees are watched until they are removed.
+     */
+    static constexpr const char *INOTIFY_LAZY_IDLE = "inotify.lazy.idle";
+
+    /**
+     * @brief Custom monitor property used to set the maximum number of
+     * watches.
+     *
+     * When the limit is reached, the directories which are not watched yet
+     * are not watched, and the limit is logged.  In lazy mode, the watches
+     * removed from idle subtrees make room for the subtrees activated later.
+     * The limit should be lower than the `fs.inotify.max_user_watches`
+     * setting of the kernel, which is shared by all the inotify descriptors
+     * of the user.  If `0` is specified, which is the default, the number of
+     * watches is only limited by the kernel.
+     */
+    static constexpr const char *INOTIFY_WATCH_LIMIT = "inotify.watch.limit";
+
     /**
      * @brief Constructs an instance of this class.
      */
@@ -71,20 +179,77 @@ namespace fsw
      */
     void run();
 
+    /**
+     * @brief Wakes up the monitor loop so that it can check the stop flag.
+     *
+     * When the monitor loop is built upon `epoll`, an event descriptor is
+     * signalled so that a blocked loop returns immediately instead of waiting
+     * for the next file system event.
+     */
+    void on_stop();
+
+    /**
+     * @brief Wakes up the monitor loop so that it can apply the changes of the
+     * paths to watch.
+     */
+    void on_paths_changed();
+
+    /**
+     * @brief Returns @c true, since the initial scan lists the inventory.
+     */
+    bool lists_inventory() const;
+
   private:
     inotify_monitor(const inotify_monitor& orig) = delete;
     inotify_monitor& operator=(const inotify_monitor& that) = delete;
 
-    void scan_root_paths();
+    void open_descriptors();
+    void configure_monitor();
+    void configure_scan_threads();
+    void configure_lazy_mode();
+    bool scan_root_paths();
+    void update_root_paths();
     bool is_watched(const std::string& path) const;
+    bool visit_directory(const struct stat& fd_stat) const;
     void preprocess_dir_event(struct inotify_event *event);
     void preprocess_event(struct inotify_event *event);
     void preprocess_node_event(struct inotify_event *event);
-    void scan(const std::string& path, const bool accept_non_dirs = true);
-    bool add_watch(const std::string& path,
-                   const struct stat& fd_stat);
+    bool accept_scan_path(std::string& path,
+                          const bool accept_non_dirs,
+                          struct stat& fd_stat,
+                          bool checked = false) const;
+    void scan(const std::string& path,
+              const bool accept_non_dirs = true,
+              const struct stat *path_stat = nullptr,
+              int levels = -1);
+    void parallel_scan(unsigned int thread_num);
+    void list_inventory_child(const std::string& prefix,
+                              const directory_entries& children,
+                              size_t i) const;
+    uint32_t get_watch_mask() const;
+    int create_watch(const std::string& path) const;
+    void register_watch(int wd, const std::string& path);
+    int add_watch(const std::string& path);
+    bool is_watch_limit_reached() const;
+    int get_activation_depth() const;
+    void track_activity(const struct inotify_event *event);
+    void activate_subtree(const std::string& path);
+    void activate_subtrees();
+    void activate_touched_paths();
+    void deactivate_idle_subtrees();
     void process_pending_events();
     void remove_watch(int fd);
+    int release_watch(int wd);
+    bool pair_move(struct inotify_event *event);
+    void complete_pending_moves();
+    ssize_t read_events();
+    void drain_events();
+    void process_records(ssize_t record_num);
+    void read_available_events();
+    void run_select_loop();
+    void run_epoll_loop();
+    bool wait_for_events(double timeout);
+    void wake_up();
 
     inotify_monitor_impl *impl;
   };
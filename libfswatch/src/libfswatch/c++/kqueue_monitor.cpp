@@ -33,9 +33,59 @@
 #  include <cmath>
 #  include <unistd.h>
 #  include <fcntl.h>
+#  include <cerrno>
+#  include <cstdlib>
+#  include <algorithm>
+#  include <chrono>
+#  include <list>
 
 namespace fsw
 {
+  static const unsigned int KQUEUE_EVENTS = NOTE_DELETE | NOTE_EXTEND
+                                            | NOTE_RENAME | NOTE_WRITE
+                                            | NOTE_ATTRIB | NOTE_LINK
+                                            | NOTE_REVOKE;
+
+  // Capacity of the event buffer and maximum size of a changelist submission.
+  static const size_t EVENT_BUFFER_SIZE = 1024;
+
+  /*
+   * Status of a file which is checked using lstat() instead of being watched
+   * with a descriptor.
+   */
+  struct kqueue_polled_file
+  {
+    mode_t mode;
+    ino_t inode;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+  };
+
+  static kqueue_polled_file create_polled_file(const struct stat& fd_stat)
+  {
+    kqueue_polled_file file;
+    file.mode = fd_stat.st_mode;
+    file.inode = fd_stat.st_ino;
+    file.size = fd_stat.st_size;
+#  if defined HAVE_STRUCT_STAT_ST_MTIMESPEC
+    file.mtime = fd_stat.st_mtimespec;
+    file.ctime = fd_stat.st_ctimespec;
+#  elif defined HAVE_STRUCT_STAT_ST_MTIM
+    file.mtime = fd_stat.st_mtim;
+    file.ctime = fd_stat.st_ctim;
+#  else
+    file.mtime = {fd_stat.st_mtime, 0};
+    file.ctime = {fd_stat.st_ctime, 0};
+#  endif
+
+    return file;
+  }
+
+  static bool same_time(const struct timespec& lhs, const struct timespec& rhs)
+  {
+    return lhs.tv_sec == rhs.tv_sec && lhs.tv_nsec == rhs.tv_nsec;
+  }
 
   struct kqueue_monitor_load
   {
@@ -45,11 +95,80 @@ namespace fsw
     fsw_hash_set<int> descriptors_to_remove;
     fsw_hash_set<int> descriptors_to_rescan;
 
+    /*
+     * Descriptors are registered with the kqueue only once: this changelist
+     * only contains the descriptors added since it was last submitted.  There
+     * is no need to submit the removal of a descriptor, since the events
+     * attached to it are deleted when the descriptor is closed.
+     */
+    std::vector<struct kevent> pending_changes;
+    std::vector<struct kevent> event_list;
+
+    /*
+     * Watched descriptors ordered by their most recent activity, the most
+     * recently active first.  When the descriptor budget is exhausted, the
+     * least recently active file is closed and polled instead.
+     */
+    std::list<int> descriptors_by_activity;
+    fsw_hash_map<int, std::list<int>::iterator> activity_positions;
+    fsw_hash_map<std::string, kqueue_polled_file> polled_files;
+    size_t descriptor_budget = 0;
+    double poll_interval = 5.0;
+    time_t last_poll_time = 0;
+    unsigned int file_events = KQUEUE_EVENTS;
+    unsigned int directory_events = KQUEUE_EVENTS;
+
+    // Links resolved and directories visited during the current scan.
+    link_resolver links;
+
+    // Entries of the directories being scanned.
+    directory_entries scan_entries;
+
     void add_watch(int fd, const std::string& path, const struct stat& fd_stat)
     {
       descriptors_by_file_name[path] = fd;
       file_names_by_descriptor[fd] = path;
       file_modes[fd] = fd_stat.st_mode;
+
+      descriptors_by_activity.push_front(fd);
+      activity_positions[fd] = descriptors_by_activity.begin();
+
+      queue_change(fd, fd_stat.st_mode);
+    }
+
+    // A new kqueue has no registration: the watched descriptors are queued
+    // again, replacing the changes queued for the previous kqueue.
+    void queue_all_watches()
+    {
+      pending_changes.clear();
+
+      for (const auto& file_mode : file_modes)
+        queue_change(file_mode.first, file_mode.second);
+    }
+
+    // A closed descriptor may be reused: it must not be registered any longer.
+    void discard_pending_change(int fd)
+    {
+      if (pending_changes.empty()) return;
+
+      pending_changes.erase(
+        std::remove_if(pending_changes.begin(),
+                       pending_changes.end(),
+                       [fd](const struct kevent& change)
+                       {
+                         return change.ident == static_cast<uintptr_t> (fd);
+                       }),
+        pending_changes.end());
+    }
+
+    void touch(int fd)
+    {
+      auto position = activity_positions.find(fd);
+      if (position == activity_positions.end()) return;
+
+      descriptors_by_activity.splice(descriptors_by_activity.begin(),
+                                     descriptors_by_activity,
+                                     position->second);
     }
 
     void remove_watch(int fd)
@@ -58,19 +177,55 @@ namespace fsw
       file_names_by_descriptor.erase(fd);
       descriptors_by_file_name.erase(name);
       file_modes.erase(fd);
+      discard_pending_change(fd);
+      forget_activity(fd);
 
       close(fd);
     }
 
     void remove_watch(const std::string& path)
     {
+      auto polled_file = polled_files.find(path);
+
+      if (polled_file != polled_files.end())
+      {
+        polled_files.erase(polled_file);
+        return;
+      }
+
       int fd = descriptors_by_file_name[path];
       descriptors_by_file_name.erase(path);
       file_names_by_descriptor.erase(fd);
       file_modes.erase(fd);
+      discard_pending_change(fd);
+      forget_activity(fd);
 
       close(fd);
     }
+
+  private:
+    void queue_change(int fd, mode_t mode)
+    {
+      struct kevent change;
+      EV_SET(&change,
+             fd,
+             EVFILT_VNODE,
+             EV_ADD | EV_ENABLE | EV_CLEAR,
+             S_ISDIR(mode) ? directory_events : file_events,
+             0,
+             0);
+
+      pending_changes.push_back(change);
+    }
+
+    void forget_activity(int fd)
+    {
+      auto position = activity_positions.find(fd);
+      if (position == activity_positions.end()) return;
+
+      descriptors_by_activity.erase(position->second);
+      activity_positions.erase(position);
+    }
   };
 
   typedef struct KqueueFlagType
@@ -138,7 +293,39 @@ namespace fsw
 
   bool kqueue_monitor::is_path_watched(const std::string& path) const
   {
-    return load->descriptors_by_file_name.find(path) != load->descriptors_by_file_name.end();
+    return load->descriptors_by_file_name.find(path) != load->descriptors_by_file_name.end()
+      || load->polled_files.find(path) != load->polled_files.end();
+  }
+
+  /*
+   * Closes the descriptor of the least recently active file, which is polled
+   * from now on.  Returns false if no descriptor can be closed.
+   */
+  bool kqueue_monitor::evict_watch()
+  {
+    if (load->descriptors_by_activity.empty()) return false;
+
+    const int fd = load->descriptors_by_activity.back();
+    const std::string path = load->file_names_by_descriptor[fd];
+    struct stat fd_stat;
+    const bool stat_ok = (fstat(fd, &fd_stat) == 0);
+
+    load->remove_watch(fd);
+    load->descriptors_to_remove.erase(fd);
+    load->descriptors_to_rescan.erase(fd);
+
+    // A file which cannot be checked any longer is simply forgotten.
+    if (!stat_ok)
+    {
+      fsw_logf_perror(_("Cannot stat %s"), path.c_str());
+      return true;
+    }
+
+    load->polled_files[path] = create_polled_file(fd_stat);
+
+    FSW_DLOGF(_("Polling: %s\n"), path.c_str());
+
+    return true;
   }
 
   bool kqueue_monitor::add_watch(const std::string& path, const struct stat& fd_stat)
@@ -161,10 +348,26 @@ namespace fsw
     o_flags |= O_RDONLY;
 #  endif
 
+    if (load->descriptor_budget > 0
+        && load->file_names_by_descriptor.size() >= load->descriptor_budget)
+      evict_watch();
+
     int fd = open(path.c_str(), o_flags);
 
+    // When the process runs out of descriptors, retry closing a cold one.
+    if (fd == -1 && (errno == EMFILE || errno == ENFILE) && evict_watch())
+      fd = open(path.c_str(), o_flags);
+
     if (fd == -1)
     {
+      if (errno == EMFILE || errno == ENFILE)
+      {
+        // Poll the file instead of silently not watching it.
+        load->polled_files[path] = create_polled_file(fd_stat);
+
+        return true;
+      }
+
       fsw_logf_perror(_("Cannot open %s"), path.c_str());
 
       return false;
@@ -184,7 +387,7 @@ namespace fsw
     if (follow_symlinks && S_ISLNK(fd_stat.st_mode))
     {
       std::string link_path;
-      if (read_link_path(path, link_path))
+      if (load->links.resolve(path, fd_stat, link_path))
         return scan(link_path);
 
       return false;
@@ -193,20 +396,40 @@ namespace fsw
     bool is_dir = S_ISDIR(fd_stat.st_mode);
 
     if (!is_dir && !is_root_path && directory_only) return true;
-    if (!accept_path(path)) return true;
+    if (!accept_path(path) && !(is_dir && accept_subtree(path))) return true;
+
+    // Directories reachable through many links, or through a link cycle, are
+    // only scanned once.
+    if (follow_symlinks && is_dir && !load->links.visit_directory(fd_stat))
+      return true;
+
     if (!add_watch(path, fd_stat)) return false;
     if (!recursive) return true;
     if (!is_dir) return true;
+    if (!accept_subtree(path)) return true;
+
+    directory_entries& children = load->scan_entries;
+    const size_t first_child = children.size();
+
+    if (!children.append(path)) return true;
 
-    std::vector<std::string> children = get_directory_children(path);
+    const size_t last_child = children.size();
+    const std::string prefix = path + "/";
 
-    for (const std::string& child : children)
+    for (size_t i = first_child; i < last_child; ++i)
     {
-      if (child == "." || child == "..") continue;
+      std::string child_path = prefix + children.get_name(i);
+
+      // Files known not to be watched are skipped without calling lstat().
+      if (!children.may_be_directory(i, follow_symlinks)
+          && (directory_only || !accept_path(child_path)))
+        continue;
 
-      scan(path + "/" + child, false);
+      scan(child_path, false);
     }
 
+    children.truncate(first_child);
+
     return true;
   }
 
@@ -223,6 +446,8 @@ namespace fsw
 
   void kqueue_monitor::rescan_pending()
   {
+    if (!load->descriptors_to_rescan.empty()) load->links.clear();
+
     auto fd = load->descriptors_to_rescan.begin();
 
     while (fd != load->descriptors_to_rescan.end())
@@ -249,15 +474,183 @@ namespace fsw
 
   void kqueue_monitor::scan_root_paths()
   {
+    using std::chrono::steady_clock;
+
+    const steady_clock::time_point start = steady_clock::now();
+    bool scanned = false;
+
     for (std::string& path : paths)
     {
       if (is_path_watched(path)) continue;
+      if (!scanned) load->links.clear();
+
+      scanned = true;
 
       if (!scan(path))
       {
         FSW_ELOGF(_("%s cannot be found. Will retry later.\n"), path.c_str());
       }
     }
+
+    if (scanned) count_scan(steady_clock::now() - start);
+  }
+
+  /*
+   * Added paths are scanned by scan_root_paths(), while the descriptors below
+   * a removed path are closed unless they are below another path to watch.
+   */
+  void kqueue_monitor::update_root_paths()
+  {
+    std::vector<std::string> removed_paths;
+
+    for (const path_change& change : take_path_changes())
+    {
+      if (!change.added) removed_paths.push_back(change.path);
+    }
+
+    if (removed_paths.empty()) return;
+
+    std::vector<int> descriptors;
+
+    for (const auto& watch : load->descriptors_by_file_name)
+    {
+      if (is_unwatched_path(watch.first, removed_paths))
+        descriptors.push_back(watch.second);
+    }
+
+    for (int fd : descriptors)
+    {
+      FSW_DLOGF(_("Removing %s.\n"), load->file_names_by_descriptor[fd].c_str());
+
+      load->descriptors_to_remove.erase(fd);
+      load->descriptors_to_rescan.erase(fd);
+      load->remove_watch(fd);
+    }
+
+    auto polled = load->polled_files.begin();
+
+    while (polled != load->polled_files.end())
+    {
+      if (is_unwatched_path(polled->first, removed_paths))
+        polled = load->polled_files.erase(polled);
+      else
+        ++polled;
+    }
+  }
+
+  /*
+   * Checks the polled files.  A file which changed is notified and promoted
+   * back to a watched descriptor, evicting the least recently active one if
+   * the descriptor budget is exhausted.
+   */
+  void kqueue_monitor::poll_files()
+  {
+    if (load->polled_files.empty()) return;
+
+    const timespec curr_time = event::get_current_time();
+
+    if (difftime(curr_time.tv_sec, load->last_poll_time) < load->poll_interval)
+      return;
+
+    load->last_poll_time = curr_time.tv_sec;
+
+    std::vector<event> events;
+    std::vector<std::string> changed_paths;
+    auto polled = load->polled_files.begin();
+
+    while (polled != load->polled_files.end())
+    {
+      const std::string& path = polled->first;
+      const kqueue_polled_file& previous = polled->second;
+      std::vector<fsw_event_flag> flags;
+      struct stat fd_stat;
+
+      if (lstat(path.c_str(), &fd_stat) != 0)
+      {
+        flags.push_back(fsw_event_flag::Removed);
+        events.push_back({path, curr_time, flags});
+        polled = load->polled_files.erase(polled);
+        continue;
+      }
+
+      const kqueue_polled_file current = create_polled_file(fd_stat);
+
+      if (current.inode != previous.inode)
+        flags.push_back(fsw_event_flag::Created);
+
+      if (!same_time(current.mtime, previous.mtime)
+          || current.size != previous.size)
+        flags.push_back(fsw_event_flag::Updated);
+
+      if (!same_time(current.ctime, previous.ctime))
+        flags.push_back(fsw_event_flag::AttributeModified);
+
+      if (!flags.empty())
+      {
+        events.push_back({path, curr_time, flags});
+        changed_paths.push_back(path);
+      }
+
+      ++polled;
+    }
+
+    if (!changed_paths.empty()) load->links.clear();
+
+    for (const std::string& path : changed_paths)
+    {
+      load->polled_files.erase(path);
+      scan(path);
+    }
+
+    if (!events.empty()) notify_events(events);
+  }
+
+  void kqueue_monitor::configure_monitor()
+  {
+    std::string budget_value = get_property(KQUEUE_DESCRIPTOR_BUDGET);
+
+    if (!budget_value.empty())
+    {
+      char *end;
+      long parsed_value = strtol(budget_value.c_str(), &end, 0);
+
+      if (*end != '\0' || parsed_value < 0)
+      {
+        std::string msg = std::string(_("Invalid value: ")) + budget_value;
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+      }
+
+      load->descriptor_budget = parsed_value;
+    }
+
+    std::string interval_value = get_property(KQUEUE_POLL_INTERVAL);
+
+    if (!interval_value.empty())
+    {
+      char *end;
+      double parsed_value = strtod(interval_value.c_str(), &end);
+
+      if (*end != '\0' || parsed_value < 0)
+      {
+        std::string msg = std::string(_("Invalid value: ")) + interval_value;
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+      }
+
+      load->poll_interval = parsed_value;
+    }
+
+    // Only the notifications which may be accepted by the event type filters
+    // are requested, besides those needed to update the watches.
+    const uint32_t accepted = get_event_type_mask();
+    unsigned int events = NOTE_DELETE | NOTE_RENAME | NOTE_REVOKE;
+
+    if (accepted & fsw_event_flag::Updated) events |= NOTE_WRITE;
+    if (accepted & fsw_event_flag::PlatformSpecific) events |= NOTE_EXTEND;
+    if (accepted & fsw_event_flag::AttributeModified) events |= NOTE_ATTRIB;
+    if (accepted & fsw_event_flag::Link) events |= NOTE_LINK;
+
+    load->file_events = events;
+    load->directory_events = events | NOTE_WRITE | NOTE_LINK;
   }
 
   void kqueue_monitor::initialize_kqueue()
@@ -271,6 +664,8 @@ namespace fsw
       perror("kqueue()");
       throw libfsw_exception(_("kqueue failed."));
     }
+
+    load->queue_all_watches();
   }
 
   void kqueue_monitor::terminate_kqueue()
@@ -279,14 +674,75 @@ namespace fsw
     kq = -1;
   }
 
-  int kqueue_monitor::wait_for_events(const std::vector<struct kevent>& changes,
-                                      std::vector<struct kevent>& event_list)
+  /*
+   * Submits the changelist of the descriptors added since the previous call.
+   * When EV_RECEIPT is available, a receipt is returned for every change
+   * without draining pending events, and registration errors are reported
+   * individually.
+   */
+  void kqueue_monitor::register_pending_changes()
+  {
+    std::vector<struct kevent>& changes = load->pending_changes;
+    std::vector<struct kevent>& receipts = load->event_list;
+    const struct timespec ts = {0, 0};
+
+    for (size_t offset = 0;
+         offset < changes.size();
+         offset += EVENT_BUFFER_SIZE)
+    {
+      const size_t change_num = std::min(EVENT_BUFFER_SIZE,
+                                         changes.size() - offset);
+
+#  ifdef EV_RECEIPT
+      for (size_t i = 0; i < change_num; ++i)
+        changes[offset + i].flags |= EV_RECEIPT;
+
+      int receipt_num = kevent(kq,
+                               &changes[offset],
+                               (int) change_num,
+                               &receipts[0],
+                               (int) change_num,
+                               &ts);
+#  else
+      int receipt_num = kevent(kq,
+                               &changes[offset],
+                               (int) change_num,
+                               nullptr,
+                               0,
+                               &ts);
+#  endif
+
+      if (receipt_num == -1)
+      {
+        perror("kevent");
+        continue;
+      }
+
+      for (int i = 0; i < receipt_num; ++i)
+      {
+        const struct kevent& receipt = receipts[i];
+
+        if ((receipt.flags & EV_ERROR) && receipt.data != 0)
+        {
+          const std::string& path =
+            load->file_names_by_descriptor[receipt.ident];
+
+          errno = (int) receipt.data;
+          fsw_logf_perror(_("Cannot watch %s"), path.c_str());
+        }
+      }
+    }
+
+    changes.clear();
+  }
+
+  int kqueue_monitor::wait_for_events(std::vector<struct kevent>& event_list)
   {
     struct timespec ts = create_timespec_from_latency(latency);
 
     int event_num = kevent(kq,
-                           &changes[0],
-                           (int) changes.size(),
+                           nullptr,
+                           0,
                            &event_list[0],
                            (int) event_list.size(),
                            &ts);
@@ -301,12 +757,10 @@ namespace fsw
     return event_num;
   }
 
-  void kqueue_monitor::process_events(const std::vector<struct kevent>& changes,
-                                      const std::vector<struct kevent>& event_list,
+  void kqueue_monitor::process_events(const std::vector<struct kevent>& event_list,
                                       int event_num)
   {
-    time_t curr_time;
-    time(&curr_time);
+    const timespec curr_time = event::get_current_time();
     std::vector<event> events;
 
     for (auto i = 0; i < event_num; ++i)
@@ -345,6 +799,8 @@ namespace fsw
       // received with a non empty filter flag.
       if (e.fflags)
       {
+        load->touch(e.ident);
+
         events.push_back({load->file_names_by_descriptor[e.ident],
                           curr_time,
                           decode_flags(e.fflags)});
@@ -359,7 +815,9 @@ namespace fsw
 
   void kqueue_monitor::run()
   {
+    configure_monitor();
     initialize_kqueue();
+    load->event_list.resize(EVENT_BUFFER_SIZE);
 
     for(;;)
     {
@@ -375,40 +833,35 @@ namespace fsw
       // rescan the pending descriptors
       rescan_pending();
 
+      // stop watching the paths which have been removed
+      update_root_paths();
+
       // scan the root paths to check whether someone is missing
       scan_root_paths();
 
-      std::vector<struct kevent> changes;
-      std::vector<struct kevent> event_list;
+      // check the files which are not watched with a descriptor
+      poll_files();
 
-      for (const std::pair<int, std::string>& fd_path : load->file_names_by_descriptor)
-      {
-        struct kevent change;
-
-        EV_SET(&change,
-               fd_path.first,
-               EVFILT_VNODE,
-               EV_ADD | EV_ENABLE | EV_CLEAR,
-               NOTE_DELETE | NOTE_EXTEND | NOTE_RENAME | NOTE_WRITE | NOTE_ATTRIB | NOTE_LINK | NOTE_REVOKE,
-               0,
-               0);
-
-        changes.push_back(change);
-        struct kevent event;
-        event_list.push_back(event);
-      }
+      set_watch_count(load->file_names_by_descriptor.size());
 
       /*
        * If no files can be observed yet, then wait and repeat the loop.
        */
-      if (!changes.size())
+      if (load->file_names_by_descriptor.empty())
       {
         sleep(latency);
         continue;
       }
 
-      const int event_num = wait_for_events(changes, event_list);
-      process_events(changes, event_list, event_num);
+      // register the descriptors added since the last iteration
+      register_pending_changes();
+
+      const int event_num = wait_for_events(load->event_list);
+
+      if (event_num > 0)
+        count_read(event_num, event_num * sizeof(struct kevent));
+
+      process_events(load->event_list, event_num);
     }
 
     terminate_kqueue();
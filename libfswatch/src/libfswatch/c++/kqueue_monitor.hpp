@@ -48,6 +48,28 @@ namespace fsw
   class kqueue_monitor : public monitor
   {
   public:
+    /**
+     * @brief Custom monitor property used to set the maximum number of
+     * descriptors used to watch files.
+     *
+     * When the number of watched files exceeds this budget, the least
+     * recently active files are not watched with a descriptor any longer and
+     * they are periodically checked using `lstat()` instead (see
+     * #KQUEUE_POLL_INTERVAL).  A polled file which is found changed is watched
+     * with a descriptor again.  If `0` is specified, which is the default, no
+     * budget is enforced, but files are still polled when the process runs
+     * out of descriptors.
+     */
+    static constexpr const char *KQUEUE_DESCRIPTOR_BUDGET = "kqueue.descriptor.budget";
+
+    /**
+     * @brief Custom monitor property used to set the interval, in seconds,
+     * between the checks of the polled files.
+     *
+     * The default value is `5`.
+     */
+    static constexpr const char *KQUEUE_POLL_INTERVAL = "kqueue.poll.interval";
+
     /**
      * @brief Constructs an instance of this class.
      */
@@ -74,18 +96,21 @@ namespace fsw
     kqueue_monitor(const kqueue_monitor& orig) = delete;
     kqueue_monitor& operator=(const kqueue_monitor& that) = delete;
 
+    void configure_monitor();
     void initialize_kqueue();
     void terminate_kqueue();
     bool scan(const std::string& path, bool is_root_path = true);
     bool add_watch(const std::string& path, const struct stat& fd_stat);
     bool is_path_watched(const std::string& path) const;
+    bool evict_watch();
+    void poll_files();
     void remove_deleted();
     void rescan_pending();
     void scan_root_paths();
-    int wait_for_events(const std::vector<struct kevent>& changes,
-                        std::vector<struct kevent>& event_list);
-    void process_events(const std::vector<struct kevent>& changes,
-                        const std::vector<struct kevent>& event_list,
+    void update_root_paths();
+    void register_pending_changes();
+    int wait_for_events(std::vector<struct kevent>& event_list);
+    void process_events(const std::vector<struct kevent>& event_list,
                         int event_num);
 
     int kq = -1;
@@ -19,9 +19,20 @@
 #include "gettext_defs.h"
 #include "monitor.hpp"
 #include "monitor_factory.hpp"
+#include "filter_automaton.hpp"
+#include "filter_pattern.hpp"
+#include "content_verifier.hpp"
+#include "deadline_timer.hpp"
+#include "delivery_queue.hpp"
+#include "event_coalescer.hpp"
+#include "monitor_counters.hpp"
+#include "tree_snapshot.hpp"
 #include "libfswatch_exception.hpp"
 #include "../c/libfswatch_log.h"
 #include "string/string_utils.hpp"
+#include "path_utils.hpp"
+#include <algorithm>
+#include <exception>
 #include <cstdlib>
 #include <memory>
 #include <thread>
@@ -29,15 +40,25 @@
 #include <sstream>
 #include <utility>
 #include <ctime>
+#include <sys/stat.h>
 
 using namespace std::chrono;
 
 namespace fsw
 {
+  enum filter_matcher
+  {
+    regex_matcher,
+    automaton_matcher,
+    literal_matcher
+  };
+
   struct compiled_monitor_filter
   {
     std::regex regex;
     fsw_filter_type type;
+    filter_matcher matcher;
+    literal_pattern literal;
   };
 
 #ifdef HAVE_CXX_MUTEX
@@ -46,18 +67,27 @@ namespace fsw
   #define FSW_MONITOR_RUN_GUARD_UNLOCK run_guard.unlock();
 
   #define FSW_MONITOR_NOTIFY_GUARD std::unique_lock<std::mutex> notify_guard(notify_mutex);
+
+  #define FSW_MONITOR_RECYCLE_GUARD std::lock_guard<std::mutex> recycle_guard(recycle_mutex);
+
+  #define FSW_MONITOR_INVENTORY_GUARD std::lock_guard<std::mutex> inventory_guard(inventory_mutex);
 #else
   #define FSW_MONITOR_RUN_GUARD
   #define FSW_MONITOR_RUN_GUARD_LOCK
   #define FSW_MONITOR_RUN_GUARD_UNLOCK
 
   #define FSW_MONITOR_NOTIFY_GUARD
+
+  #define FSW_MONITOR_RECYCLE_GUARD
+
+  #define FSW_MONITOR_INVENTORY_GUARD
 #endif
 
   monitor::monitor(std::vector<std::string> paths,
                    FSW_EVENT_CALLBACK *callback,
                    void *context) :
-    paths(std::move(paths)), callback(callback), context(context), latency(1)
+    paths(std::move(paths)), callback(callback), context(context), latency(1),
+    counters(new monitor_counters())
   {
     if (callback == nullptr)
     {
@@ -77,6 +107,11 @@ namespace fsw
     allow_overflow = overflow;
   }
 
+  void monitor::set_recover_overflow(bool recover)
+  {
+    recover_overflow = recover;
+  }
+
   void monitor::set_latency(double latency)
   {
     if (latency < 0)
@@ -88,6 +123,140 @@ namespace fsw
     this->latency = latency;
   }
 
+  void monitor::set_delivery_queue(size_t size, fsw_delivery_policy policy)
+  {
+#ifndef HAVE_ASYNC_DELIVERY
+    if (size > 0)
+      throw libfsw_exception(_("Asynchronous delivery is not supported."));
+#endif
+
+    delivery_queue_size = size;
+    delivery_policy = policy;
+  }
+
+  void monitor::set_coalescing_window(double window)
+  {
+    if (window < 0)
+    {
+      throw libfsw_exception(_("Coalescing window cannot be negative."),
+                             FSW_ERR_INVALID_LATENCY);
+    }
+
+#ifndef HAVE_EVENT_COALESCING
+    if (window > 0)
+      throw libfsw_exception(_("Event coalescing is not supported."));
+#endif
+
+    coalescing_window = window;
+  }
+
+  void monitor::set_content_verification(size_t cache_size,
+                                         unsigned int threads)
+  {
+#ifndef HAVE_CONTENT_VERIFICATION
+    if (cache_size > 0)
+      throw libfsw_exception(_("Content verification is not supported."));
+#endif
+
+    // The cache is kept across runs unless the settings change.
+    if (cache_size == verification_cache_size
+        && threads == verification_threads)
+      return;
+
+    verification_cache_size = cache_size;
+    verification_threads = threads;
+
+    delete verifier;
+    verifier = nullptr;
+  }
+
+  void monitor::set_priority_paths(std::vector<std::string> paths)
+  {
+    // Trailing slashes are removed, since the paths of events have none.
+    for (std::string& path : paths)
+    {
+      while (path.size() > 1 && path.back() == '/') path.pop_back();
+    }
+
+    priority_paths = std::move(paths);
+  }
+
+  void monitor::set_inventory(size_t batch_size)
+  {
+    if (batch_size > 0 && !lists_inventory())
+      throw libfsw_exception(_("This monitor does not list its inventory."));
+
+    inventory_batch_size = batch_size;
+  }
+
+  bool monitor::lists_inventory() const
+  {
+    return false;
+  }
+
+  void monitor::set_thread_settings(fsw_thread_role role,
+                                    const thread_settings& settings)
+  {
+    if (role < 0 || role >= FSW_THREAD_ROLES)
+      throw libfsw_exception(_("Unknown thread role."), FSW_ERR_UNKNOWN_VALUE);
+
+    role_settings[role] = settings;
+  }
+
+  const thread_settings&
+  monitor::get_thread_settings(fsw_thread_role role) const
+  {
+    if (role < 0 || role >= FSW_THREAD_ROLES)
+      throw libfsw_exception(_("Unknown thread role."), FSW_ERR_UNKNOWN_VALUE);
+
+    return role_settings[role];
+  }
+
+  bool monitor::is_listing_inventory() const
+  {
+    return inventory_batch_size > 0 && !inventory_listed;
+  }
+
+  static fsw_event_flag get_inventory_flag(mode_t mode)
+  {
+    if (S_ISREG(mode)) return IsFile;
+    if (S_ISDIR(mode)) return IsDir;
+    if (S_ISLNK(mode)) return IsSymLink;
+
+    return PlatformSpecific;
+  }
+
+  void monitor::list_inventory_entry(const std::string& path, mode_t mode) const
+  {
+    if (!is_listing_inventory()) return;
+
+    FSW_MONITOR_INVENTORY_GUARD;
+
+    inventory_events.push_back({path,
+                                event::get_current_time(),
+                                {get_inventory_flag(mode)}});
+
+    // The inventory is notified in bounded batches while it is listed.
+    if (inventory_events.size() < inventory_batch_size) return;
+
+    notify_events(inventory_events);
+    inventory_events.clear();
+  }
+
+  void monitor::end_inventory() const
+  {
+    if (!is_listing_inventory()) return;
+
+    FSW_MONITOR_INVENTORY_GUARD;
+
+    inventory_events.push_back({"", event::get_current_time(), {HistoryDone}});
+    notify_events(inventory_events);
+    inventory_events.clear();
+    inventory_listed = true;
+
+    FSW_ELOG(_("Inventory listed.\n"));
+  }
+
   void monitor::set_fire_idle_event(bool fire_idle_event)
   {
     this->fire_idle_event = fire_idle_event;
@@ -110,28 +279,66 @@ namespace fsw
 
   void monitor::add_event_type_filter(const fsw_event_type_filter& filter)
   {
+    // The first filter restricts the accepted event types.
+    if (event_type_filters.empty()) event_type_mask = 0;
+
     this->event_type_filters.push_back(filter);
+
+    if (filter.flag == NoOp) accept_no_op = true;
+    else event_type_mask |= filter.flag;
   }
 
   void
   monitor::set_event_type_filters(const std::vector<fsw_event_type_filter>& filters)
   {
     event_type_filters.clear();
+    event_type_mask = ALL_EVENT_TYPES;
+    accept_no_op = false;
 
     for (const auto& filter : filters) add_event_type_filter(filter);
   }
 
+  uint32_t monitor::get_event_type_mask() const
+  {
+    return event_type_mask;
+  }
+
   void monitor::add_filter(const monitor_filter& filter)
   {
+    compiled_monitor_filter compiled;
+    compiled.type = filter.type;
+
+    // The filters are kept as they were set to be copied to other monitors.
+    source_filters.push_back(filter);
+
+    // Cached verdicts do not take the new filter into account.
+    filter_cache.clear();
+
+    // Literal filters are matched with plain string comparisons.
+    if (literal_pattern::from_filter(filter, compiled.literal))
+    {
+      compiled.matcher = literal_matcher;
+      this->filters.push_back(std::move(compiled));
+      return;
+    }
+
+    monitor_filter regex_filter = filter;
+
+    if (filter.glob)
+    {
+      regex_filter.text = glob_to_regex(filter.text);
+      regex_filter.extended = true;
+      regex_filter.glob = false;
+    }
+
     std::regex::flag_type regex_flags = std::regex::basic;
 
-    if (filter.extended) regex_flags = std::regex::extended;
-    if (!filter.case_sensitive) regex_flags |= std::regex::icase;
+    if (regex_filter.extended) regex_flags = std::regex::extended;
+    if (!regex_filter.case_sensitive) regex_flags |= std::regex::icase;
 
     try
     {
-      this->filters.push_back({std::regex(filter.text, regex_flags),
-                               filter.type});
+      compiled.regex = std::regex(regex_filter.text, regex_flags);
     }
     catch (std::regex_error& error)
     {
@@ -141,6 +348,15 @@ namespace fsw
           filter.text.c_str()),
         FSW_ERR_INVALID_REGEX);
     }
+
+    // The regular expression is always compiled by std::regex to validate it,
+    // but it is matched by the automaton when its syntax is supported.
+    if (!path_automaton) path_automaton = new filter_automaton();
+
+    compiled.matcher =
+      path_automaton->add(regex_filter) ? automaton_matcher : regex_matcher;
+
+    this->filters.push_back(std::move(compiled));
   }
 
   void monitor::set_property(const std::string& name, const std::string& value)
@@ -181,25 +397,52 @@ namespace fsw
     // If no filters are set, then accept the event.
     if (event_type_filters.empty()) return true;
 
-    // If filters are set, accept the event only if present amongst the filters.
-    for (const auto& filter : event_type_filters)
-    {
-      if (filter.flag == event_type)
-      {
-        return true;
-      }
-    }
+    if (event_type == NoOp) return accept_no_op;
 
-    // If no filters match, then reject the event.
-    return false;
+    return (event_type & event_type_mask) != 0;
   }
 
   bool monitor::accept_path(const std::string& path) const
   {
     bool is_excluded = false;
 
+    // A path is accepted if it matches any inclusion filter or if it matches
+    // no exclusion filter: the order in which filters are evaluated does not
+    // matter.  Literal filters are the cheapest to match and are checked first.
+    for (const auto& filter : filters)
+    {
+      if (filter.matcher != literal_matcher) continue;
+      if (is_excluded && filter.type == fsw_filter_type::filter_exclude)
+        continue;
+
+      if (filter.literal.match(path))
+      {
+        if (filter.type == fsw_filter_type::filter_include) return true;
+
+        is_excluded = true;
+      }
+    }
+
+    if (path_automaton)
+    {
+      switch (path_automaton->match(path))
+      {
+      case filter_automaton::include_match:
+        return true;
+      case filter_automaton::exclude_match:
+        is_excluded = true;
+        break;
+      case filter_automaton::no_match:
+        break;
+      }
+    }
+
     for (const auto& filter : filters)
     {
+      if (filter.matcher != regex_matcher) continue;
+      if (is_excluded && filter.type == fsw_filter_type::filter_exclude)
+        continue;
+
       if (std::regex_search(path, filter.regex))
       {
         if (filter.type == fsw_filter_type::filter_include) return true;
@@ -211,176 +454,1185 @@ namespace fsw
     return !is_excluded;
   }
 
-  void *monitor::get_context() const
+  monitor::subtree_verdict
+  monitor::get_subtree_verdict(const std::string& prefix) const
   {
-    return context;
-  }
+    bool all_included = false;
+    bool all_excluded = false;
+    bool may_include = false;
+    bool may_exclude = false;
 
-  void monitor::set_context(void *context)
-  {
-    this->context = context;
+    for (const auto& filter : filters)
+    {
+      const bool include = (filter.type == fsw_filter_type::filter_include);
+
+      switch (filter.matcher)
+      {
+      case literal_matcher:
+        if (filter.literal.matches_all_extensions(prefix))
+        {
+          if (include) all_included = true;
+          else all_excluded = true;
+        }
+
+        if (filter.literal.can_match_extension(prefix))
+        {
+          if (include) may_include = true;
+          else may_exclude = true;
+        }
+        break;
+      case regex_matcher:
+        // The paths matched by std::regex cannot be predicted.
+        if (include) may_include = true;
+        else may_exclude = true;
+        break;
+      case automaton_matcher:
+        break;
+      }
+    }
+
+    if (path_automaton)
+    {
+      filter_automaton::prefix_match match;
+      path_automaton->match_prefix(prefix, match);
+
+      all_included = all_included || match.all_included;
+      all_excluded = all_excluded || match.all_excluded;
+      may_include = may_include || match.may_include;
+      may_exclude = may_exclude || match.may_exclude;
+    }
+
+    if (all_included || !may_exclude) return subtree_accepted;
+    if (all_excluded && !may_include) return subtree_rejected;
+
+    return subtree_undecided;
   }
 
-  monitor::~monitor()
+  /*
+   * Gets the verdict of the path filters for the directory containing path,
+   * caching it.
+   */
+  monitor::subtree_verdict
+  monitor::get_cached_verdict(const char *path, size_t length) const
   {
-    stop();
-  }
+    size_t directory_length = length;
 
-#ifdef HAVE_INACTIVITY_CALLBACK
+    while (directory_length > 0 && path[directory_length - 1] != '/')
+      --directory_length;
 
-  void monitor::inactivity_callback(monitor *mon)
-  {
-    if (!mon) throw libfsw_exception(_("Callback argument cannot be null."));
+    // The verdict only applies to paths longer than their directory.
+    if (directory_length == 0 || directory_length == length)
+      return subtree_undecided;
+
+    if (filter_cache_size == 0) return subtree_undecided;
 
-    FSW_ELOG(_("Inactivity notification thread: starting\n"));
+    // The key includes the trailing separator and is matched as a prefix.
+    filter_cache_key.assign(path, directory_length);
 
-    for (;;)
+    auto it = filter_cache.find(filter_cache_key);
+
+    if (it != filter_cache.end())
     {
-      std::unique_lock<std::mutex> run_guard(mon->run_mutex);
-      if (mon->should_stop) break;
-      run_guard.unlock();
+      ++filter_cache_hits;
+      return it->second;
+    }
 
-      milliseconds elapsed =
-        duration_cast<milliseconds>(system_clock::now().time_since_epoch())
-        - mon->last_notification.load();
+    ++filter_cache_misses;
 
-      // Sleep and loop again if sufficient time has not elapsed yet.
-      if (elapsed < mon->get_latency_ms())
-      {
-        milliseconds to_sleep = mon->get_latency_ms() - elapsed;
-        seconds max_sleep_time(2);
+    const subtree_verdict verdict = get_subtree_verdict(filter_cache_key);
 
-        std::this_thread::sleep_for(
-          to_sleep > max_sleep_time ? max_sleep_time : to_sleep);
-        continue;
-      }
+    if (filter_cache.size() >= filter_cache_size) filter_cache.clear();
+    filter_cache.emplace(filter_cache_key, verdict);
 
-      // Build a fake event.
-      time_t curr_time;
-      time(&curr_time);
+    return verdict;
+  }
 
-      std::vector<event> events;
-      events.push_back({"", curr_time, {NoOp}});
+  bool monitor::accept_event_path(const std::string& path) const
+  {
+    if (filters.empty()) return true;
 
-      mon->notify_events(events);
+    switch (get_cached_verdict(path.data(), path.size()))
+    {
+    case subtree_accepted:
+      return true;
+    case subtree_rejected:
+      return false;
+    case subtree_undecided:
+      break;
     }
 
-    FSW_ELOG(_("Inactivity notification thread: exiting\n"));
+    return accept_path(path);
   }
 
-#endif
+  bool monitor::accept_event_path(const char *path, size_t length) const
+  {
+    if (filters.empty()) return true;
 
-  void monitor::start()
+    switch (get_cached_verdict(path, length))
+    {
+    case subtree_accepted:
+      return true;
+    case subtree_rejected:
+      return false;
+    case subtree_undecided:
+      break;
+    }
+
+    // Paths are only copied when the filters must be evaluated.
+    return accept_path(std::string(path, length));
+  }
+
+  bool monitor::is_priority_path(const std::string& path) const
   {
-    FSW_MONITOR_RUN_GUARD;
-    if (this->running) return;
+    return is_priority_path(path.c_str(), path.size());
+  }
 
-    this->running = true;
-    FSW_MONITOR_RUN_GUARD_UNLOCK;
+  bool monitor::is_priority_path(const char *path, size_t length) const
+  {
+    for (const std::string& prefix : priority_paths)
+    {
+      const size_t prefix_length = prefix.size();
 
-    // Fire the inactivity thread
-    std::unique_ptr<std::thread> inactivity_thread;
-#ifdef HAVE_INACTIVITY_CALLBACK
-    if (fire_idle_event)
-      inactivity_thread.reset(
-        new std::thread(monitor::inactivity_callback, this));
-#endif
+      if (length < prefix_length) continue;
+      if (prefix.compare(0, prefix_length, path, prefix_length) != 0) continue;
 
-    // Fire the monitor run loop.
-    this->run();
+      // The prefix must end at a path component boundary.
+      if (length == prefix_length
+          || path[prefix_length] == '/'
+          || prefix.back() == '/')
+        return true;
+    }
 
-    // Join the inactivity thread and wait until it stops.
-    FSW_ELOG(_("Inactivity notification thread: joining\n"));
-    if (inactivity_thread) inactivity_thread->join();
+    return false;
+  }
 
-    FSW_MONITOR_RUN_GUARD_LOCK;
-    this->running = false;
-    this->should_stop = false;
-    FSW_MONITOR_RUN_GUARD_UNLOCK;
+  void monitor::set_filter_cache_size(size_t size)
+  {
+    filter_cache_size = size;
+    filter_cache.clear();
   }
 
-  void monitor::stop()
+  uint64_t monitor::get_filter_cache_hits() const
   {
-    // Stopping a monitor is a cooperative task: the caller request a task to
-    // stop and it's responsibility of each monitor to check for this flag and
-    // timely stop the processing loop.
-    FSW_MONITOR_RUN_GUARD;
-    if (!this->running || this->should_stop) return;
+    return filter_cache_hits;
+  }
 
-    FSW_ELOG(_("Stopping the monitor.\n"));
-    this->should_stop = true;
-    on_stop();
+  uint64_t monitor::get_filter_cache_misses() const
+  {
+    return filter_cache_misses;
   }
 
-  bool monitor::is_running()
+  fsw_monitor_stats monitor::get_stats() const
   {
-    FSW_MONITOR_RUN_GUARD;
-    return this->running;
+    return counters->get_stats();
   }
 
-  std::vector<fsw_event_flag> monitor::filter_flags(const event& evt) const
+  void monitor::count_read(size_t records, size_t bytes) const
   {
-    // If there is nothing to filter, just return the original vector.
-    if (event_type_filters.empty()) return evt.get_flags();
+    counters->count_read(records, bytes);
+  }
 
-    std::vector<fsw_event_flag> filtered_flags;
+  void monitor::set_watch_count(size_t watches) const
+  {
+    counters->set_watches(watches);
+  }
 
-    for (auto const& flag : evt.get_flags())
-    {
-      if (accept_event_type(flag)) filtered_flags.push_back(flag);
-    }
+  void monitor::count_scan(steady_clock::duration duration) const
+  {
+    counters->count_scan(duration);
+  }
 
-    return filtered_flags;
+  bool monitor::accept_subtree(const std::string& directory) const
+  {
+    if (filters.empty()) return true;
+
+    std::string prefix = directory;
+    if (prefix.empty() || prefix.back() != '/') prefix += '/';
+
+    return get_subtree_verdict(prefix) != subtree_rejected;
   }
 
-  void monitor::notify_overflow(const std::string& path) const
+  void monitor::copy_settings(monitor& child) const
+  {
+    child.set_properties(properties);
+    child.set_latency(latency);
+    child.set_allow_overflow(allow_overflow);
+    child.set_recover_overflow(recover_overflow);
+    child.set_recursive(recursive);
+    child.set_directory_only(directory_only);
+    child.set_follow_symlinks(follow_symlinks);
+    child.set_watch_access(watch_access);
+    child.set_filters(source_filters);
+    child.set_event_type_filters(event_type_filters);
+    child.set_filter_cache_size(filter_cache_size);
+    child.set_priority_paths(priority_paths);
+
+    for (int role = 0; role < FSW_THREAD_ROLES; ++role)
+      child.role_settings[role] = role_settings[role];
+  }
+
+  bool monitor::forwards_events() const
   {
-    if (!allow_overflow) throw libfsw_exception(_("Event queue overflow."));
+    return false;
+  }
 
-    time_t curr_time;
-    time(&curr_time);
+  void *monitor::get_context() const
+  {
+    return context;
+  }
 
-    notify_events({{path, curr_time, {fsw_event_flag::Overflow}}});
+  void monitor::set_context(void *context)
+  {
+    this->context = context;
   }
 
-  void monitor::notify_events(const std::vector<event>& events) const
+  monitor::~monitor()
   {
-    FSW_MONITOR_NOTIFY_GUARD;
+    stop();
+
+    delete path_automaton;
+    delete verifier;
+    delete counters;
+    delete snapshot;
+  }
 
-    // Update the last notification timestamp
 #ifdef HAVE_INACTIVITY_CALLBACK
-    milliseconds now =
-      duration_cast<milliseconds>(
-        system_clock::now().time_since_epoch());
-    last_notification.store(now);
+
+  steady_clock::time_point monitor::inactivity_callback(void *data)
+  {
+    monitor *mon = static_cast<monitor *>(data);
+    if (!mon) throw libfsw_exception(_("Callback argument cannot be null."));
+
+    std::unique_lock<std::mutex> run_guard(mon->run_mutex);
+    if (mon->should_stop) return steady_clock::time_point::max();
+    run_guard.unlock();
+
+    milliseconds elapsed =
+      duration_cast<milliseconds>(system_clock::now().time_since_epoch())
+      - mon->last_notification.load();
+
+    // Events were notified after the timer was armed: re-arm it to expire
+    // one idle cycle after the last notification.
+    if (elapsed < mon->get_latency_ms())
+      return steady_clock::now() + (mon->get_latency_ms() - elapsed);
+
+    // Build a fake event.
+    std::vector<event> events;
+    events.push_back({"", event::get_current_time(), {NoOp}});
+
+    mon->notify_events(events);
+
+    return steady_clock::now() + mon->get_latency_ms();
+  }
+
 #endif
 
-    std::vector<event> filtered_events;
+#ifdef HAVE_EVENT_COALESCING
 
-    for (auto const& event : events)
-    {
-      // Filter flags
-      std::vector<fsw_event_flag> filtered_flags = filter_flags(event);
+  void monitor::coalescing_callback(monitor *mon)
+  {
+    if (!mon) throw libfsw_exception(_("Callback argument cannot be null."));
 
-      if (filtered_flags.empty()) continue;
-      if (!accept_path(event.get_path())) continue;
+    FSW_ELOG(_("Coalescing thread: starting\n"));
+    mon->role_settings[fsw_thread_coalescing].try_apply(_("Coalescing thread"));
 
-      filtered_events.emplace_back(event.get_path(),
-                                   event.get_time(),
-                                   filtered_flags);
-    }
+    std::unique_lock<std::mutex> notify_guard(mon->notify_mutex);
 
-    if (!filtered_events.empty())
+    while (!mon->coalescing_stopped)
     {
-      FSW_ELOG(string_utils::string_from_format(_("Notifying events #: %d.\n"),
-                                                filtered_events.size()).c_str());
+      if (mon->coalescer->empty())
+      {
+        mon->coalescing_cond.wait(notify_guard);
+        continue;
+      }
 
-      callback(filtered_events, context);
+      if (mon->coalescing_cond.wait_until(notify_guard,
+                                          mon->coalescing_deadline)
+          == std::cv_status::timeout)
+        mon->flush_coalesced_events();
     }
+
+    // Deliver the events of the last window.
+    mon->flush_coalesced_events();
+
+    FSW_ELOG(_("Coalescing thread: exiting\n"));
   }
 
-  void monitor::on_stop()
+#endif
+
+#ifdef HAVE_ASYNC_DELIVERY
+
+  void monitor::delivery_callback(monitor *mon)
+  {
+    if (!mon) throw libfsw_exception(_("Callback argument cannot be null."));
+
+    FSW_ELOG(_("Delivery thread: starting\n"));
+    mon->role_settings[fsw_thread_delivery].try_apply(_("Delivery thread"));
+
+    delivery_queue::slot item;
+
+    try
+    {
+      while (mon->delivery->pop(item))
+      {
+        mon->counters->set_queue_depth(mon->delivery->size());
+
+        if (item.overflow) mon->counters->count_overflow();
+
+        if (item.overflow && mon->accept_event_type(Overflow))
+        {
+          std::vector<event> overflow = {{item.overflow_path,
+                                          event::get_current_time(),
+                                          {Overflow}}};
+
+          if (mon->batch_callback)
+          {
+            event_batch overflow_batch;
+            overflow_batch.add(overflow[0]);
+            mon->notify_batch(overflow_batch);
+          }
+          else
+          {
+            mon->invoke_callback(overflow);
+          }
+        }
+
+        if (mon->batch_callback)
+        {
+          mon->notify_batch(item.batch);
+        }
+        else if (!item.events.empty())
+        {
+          FSW_DLOGF(_("Notifying events #: %zu.\n"), item.events.size());
+
+          mon->invoke_callback(item.events);
+        }
+      }
+    }
+    catch (std::exception& ex)
+    {
+      // The monitor thread must not wait for a callback thread which is gone.
+      FSW_ELOGF(_("Delivery thread: %s\n"), ex.what());
+      mon->delivery->close();
+      mon->stop();
+    }
+
+    FSW_ELOG(_("Delivery thread: exiting\n"));
+  }
+
+#endif
+
+  void monitor::start()
+  {
+    FSW_MONITOR_RUN_GUARD;
+    if (this->running) return;
+
+    this->running = true;
+    FSW_MONITOR_RUN_GUARD_UNLOCK;
+
+    // The run loop reads the events on the calling thread, whose attributes
+    // are restored when the monitor stops.
+    const thread_settings& run_settings = role_settings[fsw_thread_monitor];
+    const thread_settings caller_settings = run_settings.get_current();
+
+    try
+    {
+      run_settings.apply();
+    }
+    catch (...)
+    {
+      FSW_MONITOR_RUN_GUARD_LOCK;
+      this->running = false;
+      throw;
+    }
+
+    // The inventory is listed by the first scan of every run.
+    inventory_listed = false;
+
+#ifdef HAVE_CONTENT_VERIFICATION
+    if (verification_cache_size > 0 && !verifier)
+      verifier = new content_verifier(verification_cache_size,
+                                      verification_threads,
+                                      role_settings[fsw_thread_worker]);
+#endif
+
+    // Fire the delivery thread
+    std::unique_ptr<std::thread> delivery_thread;
+#ifdef HAVE_ASYNC_DELIVERY
+    if (delivery_queue_size > 0)
+    {
+      delivery = new delivery_queue(delivery_queue_size, delivery_policy);
+      delivery_thread.reset(
+        new std::thread(monitor::delivery_callback, this));
+    }
+#endif
+
+    // Fire the coalescing thread
+    std::unique_ptr<std::thread> coalescing_thread;
+#ifdef HAVE_EVENT_COALESCING
+    if (coalescing_window > 0)
+    {
+      coalescer = new event_coalescer();
+      coalescing_stopped = false;
+      coalescing_thread.reset(
+        new std::thread(monitor::coalescing_callback, this));
+    }
+#endif
+
+    // Arm the inactivity timer
+#ifdef HAVE_INACTIVITY_CALLBACK
+    const bool idle_timer = fire_idle_event;
+
+    if (idle_timer)
+      deadline_timer::get_instance().add(this,
+                                         monitor::inactivity_callback,
+                                         steady_clock::now(),
+                                         role_settings[fsw_thread_timer]);
+#endif
+
+    // If the run loop fails, the monitor is cleaned up as if it had stopped
+    // before the exception is rethrown: the timer must not outlive it and the
+    // threads must be joined before it can be destroyed.
+    std::exception_ptr run_error;
+
+    try
+    {
+      // Record the watched trees to recover from overflows.
+      if (recover_overflow && !forwards_events())
+      {
+        delete snapshot;
+        snapshot = new tree_snapshot(recursive,
+                                     follow_symlinks,
+                                     [this](const std::string& directory)
+                                     {
+                                       return accept_subtree(directory);
+                                     });
+
+        for (const std::string& path : paths) snapshot->add_root(path);
+
+        FSW_ELOGF(_("Recorded %zu objects to recover from overflows.\n"),
+                  snapshot->size());
+      }
+
+      // Fire the monitor run loop.
+      this->run();
+    }
+    catch (...)
+    {
+      run_error = std::current_exception();
+    }
+
+    // Remove the inactivity timer and wait until a pending idle event has been
+    // notified.
+#ifdef HAVE_INACTIVITY_CALLBACK
+    if (idle_timer)
+    {
+      FSW_ELOG(_("Inactivity timer: removing\n"));
+      deadline_timer::get_instance().remove(this);
+    }
+#endif
+
+#ifdef HAVE_EVENT_COALESCING
+    // Join the coalescing thread once the pending events have been flushed.
+    if (coalescing_thread)
+    {
+      FSW_ELOG(_("Coalescing thread: joining\n"));
+      {
+        FSW_MONITOR_NOTIFY_GUARD;
+        coalescing_stopped = true;
+        coalescing_cond.notify_one();
+      }
+      coalescing_thread->join();
+
+      FSW_MONITOR_NOTIFY_GUARD;
+      delete coalescer;
+      coalescer = nullptr;
+    }
+#endif
+
+    // Join the delivery thread once the queued events have been delivered.
+    if (delivery_thread)
+    {
+      FSW_ELOG(_("Delivery thread: joining\n"));
+      delivery->close();
+      delivery_thread->join();
+
+      FSW_MONITOR_NOTIFY_GUARD;
+      delete delivery;
+      delivery = nullptr;
+    }
+
+    delete snapshot;
+    snapshot = nullptr;
+
+    caller_settings.try_apply(_("Monitor thread"));
+
+    FSW_MONITOR_RUN_GUARD_LOCK;
+    this->running = false;
+    this->should_stop = false;
+
+    // Changes not taken by the monitor apply to its next run, while the
+    // subtrees to activate are watched lazily again.
+    apply_path_changes();
+    pending_touched_paths.clear();
+    FSW_MONITOR_RUN_GUARD_UNLOCK;
+
+    if (run_error) std::rethrow_exception(run_error);
+  }
+
+  void monitor::stop()
+  {
+    // Stopping a monitor is a cooperative task: the caller request a task to
+    // stop and it's responsibility of each monitor to check for this flag and
+    // timely stop the processing loop.
+    FSW_MONITOR_RUN_GUARD;
+    if (!this->running || this->should_stop) return;
+
+    FSW_ELOG(_("Stopping the monitor.\n"));
+    this->should_stop = true;
+    on_stop();
+  }
+
+  bool monitor::is_running()
+  {
+    FSW_MONITOR_RUN_GUARD;
+    return this->running;
+  }
+
+  std::vector<fsw_event_flag> monitor::filter_flags(const event& evt) const
+  {
+    // If there is nothing to filter, just return the original vector.
+    if (event_type_filters.empty()) return evt.get_flags();
+
+    std::vector<fsw_event_flag> filtered_flags;
+
+    for (auto const& flag : evt.get_flags())
+    {
+      if (accept_event_type(flag)) filtered_flags.push_back(flag);
+    }
+
+    return filtered_flags;
+  }
+
+  void monitor::notify_overflow(const std::string& path) const
+  {
+    counters->count_overflow();
+
+    if (!allow_overflow && !snapshot)
+      throw libfsw_exception(_("Event queue overflow."));
+
+    const timespec curr_time = event::get_current_time();
+
+    if (allow_overflow)
+      notify_events({{path, curr_time, {fsw_event_flag::Overflow}}});
+
+    if (!snapshot) return;
+
+    // Only the affected subtree is scanned, or all the watched paths if the
+    // monitor cannot tell which changes were lost.
+    std::vector<event> recovered;
+    snapshot->rescan(path, curr_time, recovered);
+
+    FSW_ELOGF(_("Recovered %zu changes after an overflow of %s.\n"),
+              recovered.size(),
+              path.empty() ? _("all the paths") : path.c_str());
+
+    if (!recovered.empty()) notify_events(recovered);
+  }
+
+  void monitor::notify_priority_events(std::vector<event>& events,
+                                       size_t& checked) const
+  {
+    if (priority_paths.empty())
+    {
+      checked = events.size();
+      return;
+    }
+
+    std::vector<event> priority_events;
+
+    for (; checked < events.size(); ++checked)
+    {
+      event& evt = events[checked];
+
+      if (evt.get_flags().empty() || !is_priority_path(evt.get_path()))
+        continue;
+
+      priority_events.push_back(evt);
+      evt = {evt.get_path(), evt.get_timespec(), {}};
+    }
+
+    if (!priority_events.empty())
+    {
+      FSW_DLOGF(_("Notifying priority events #: %zu.\n"),
+                priority_events.size());
+
+      notify_events(priority_events);
+    }
+  }
+
+  /*
+   * Updates the records of the paths of an event, which may have been removed
+   * or moved in place of other objects.
+   */
+  void monitor::update_snapshot(const std::string& path,
+                                const std::string& old_path,
+                                uint32_t flags) const
+  {
+    if (flags & (Overflow | NoOp)) return;
+
+    snapshot->update(path);
+    if (!old_path.empty()) snapshot->update(old_path);
+  }
+
+  void monitor::update_last_notification() const
+  {
+#ifdef HAVE_INACTIVITY_CALLBACK
+    milliseconds now =
+      duration_cast<milliseconds>(
+        system_clock::now().time_since_epoch());
+    last_notification.store(now);
+#endif
+  }
+
+  bool monitor::filter_flags(uint32_t& flags) const
+  {
+    if (event_type_filters.empty()) return true;
+
+    // A bitmask with no flags set represents fsw_event_flag::NoOp.
+    if (flags == 0) return accept_no_op;
+
+    flags &= event_type_mask;
+
+    return flags != 0;
+  }
+
+  /*
+   * Events are numbered when they are passed to the callbacks, which are
+   * invoked either with the notify mutex held or by the delivery thread only,
+   * so that the sequence numbers follow the order of delivery.
+   */
+  void monitor::notify_batch(event_batch& batch) const
+  {
+    if (batch.empty()) return;
+
+    FSW_DLOGF(_("Notifying events #: %zu.\n"), batch.size());
+
+    if (!batch_callback)
+    {
+      std::vector<event> events = acquire_events();
+      batch.to_events(events);
+      invoke_callback(events);
+      return;
+    }
+
+    verify_contents(batch);
+    if (batch.empty()) return;
+
+    for (size_t i = 0; i < batch.size(); ++i)
+      batch.set_sequence(i, ++last_sequence);
+
+    const steady_clock::time_point start = steady_clock::now();
+    batch_callback(batch, context);
+    counters->count_callback(steady_clock::now() - start);
+  }
+
+  void monitor::invoke_callback(std::vector<event>& events) const
+  {
+    verify_contents(events);
+    if (events.empty()) return;
+
+    for (event& evt : events) evt.set_sequence(++last_sequence);
+
+    const steady_clock::time_point start = steady_clock::now();
+
+    if (move_callback) move_callback(std::move(events), context);
+    else callback(events, context);
+
+    counters->count_callback(steady_clock::now() - start);
+
+    // What the move callback left in the vector is recycled as well.
+    recycle_events(std::move(events));
+  }
+
+  std::vector<event> monitor::acquire_events() const
+  {
+    FSW_MONITOR_RECYCLE_GUARD;
+
+    if (recycled_events.empty()) return {};
+
+    std::vector<event> events = std::move(recycled_events.back());
+    recycled_events.pop_back();
+
+    return events;
+  }
+
+  void monitor::recycle_events(std::vector<event>&& events) const
+  {
+    // A vector which was moved from has no storage worth keeping.
+    if (events.capacity() == 0) return;
+
+    FSW_MONITOR_RECYCLE_GUARD;
+
+    if (recycled_events.size() < MAX_RECYCLED_EVENTS)
+      recycled_events.push_back(std::move(events));
+
+    events.clear();
+  }
+
+  /*
+   * Only the updates of the contents of files are verified: the other flags
+   * report changes which are not visible in the contents.
+   */
+  static bool is_content_update(uint32_t flags)
+  {
+    const uint32_t content_flags = Updated | IsFile | PlatformSpecific;
+
+    return (flags & Updated) && (flags & ~content_flags) == 0;
+  }
+
+  /*
+   * Marks the events of the files reported unchanged by the verifier in
+   * unchanged_events and counts them.
+   */
+  void monitor::remove_unchanged_files(size_t hashed, size_t event_count) const
+  {
+    size_t unchanged = 0;
+    unchanged_events.assign(event_count, 0);
+
+    for (size_t i = 0; i < verified_events.size(); ++i)
+    {
+      if (!unchanged_files[i]) continue;
+
+      unchanged_events[verified_events[i]] = 1;
+      ++unchanged;
+    }
+
+    counters->count_verification(hashed, unchanged);
+
+    if (unchanged > 0)
+      FSW_DLOGF(_("Dropping %zu events of unchanged files.\n"), unchanged);
+  }
+
+  void monitor::verify_contents(event_batch& batch) const
+  {
+    if (!verifier) return;
+
+    verified_paths.clear();
+    verified_events.clear();
+
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+      const event_view evt = batch[i];
+      if (!is_content_update(evt.get_flags())) continue;
+
+      verified_paths.push_back(evt.get_path());
+      verified_events.push_back(i);
+    }
+
+    if (verified_paths.empty()) return;
+
+    const size_t hashed = verifier->verify(verified_paths, unchanged_files);
+    remove_unchanged_files(hashed, batch.size());
+    batch.remove(unchanged_events);
+  }
+
+  void monitor::verify_contents(std::vector<event>& events) const
+  {
+    if (!verifier) return;
+
+    verified_paths.clear();
+    verified_events.clear();
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+      if (!is_content_update(events[i].get_flag_mask())) continue;
+
+      verified_paths.push_back(events[i].get_path().c_str());
+      verified_events.push_back(i);
+    }
+
+    if (verified_paths.empty()) return;
+
+    const size_t hashed = verifier->verify(verified_paths, unchanged_files);
+    remove_unchanged_files(hashed, events.size());
+
+    size_t kept = 0;
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+      if (unchanged_events[i]) continue;
+      if (kept != i) events[kept] = std::move(events[i]);
+      ++kept;
+    }
+
+    events.erase(events.begin() + kept, events.end());
+  }
+
+  void monitor::deliver_batch() const
+  {
+    if (delivery)
+    {
+      if (notified_batch.empty()) return;
+
+      if (!batch_callback)
+      {
+        notified_batch.to_events(notified_events);
+        notified_batch.clear();
+      }
+
+      delivery->push(notified_events, notified_batch);
+      counters->set_queue_depth(delivery->size());
+
+      return;
+    }
+
+    notify_batch(notified_batch);
+  }
+
+  void monitor::flush_coalesced_events() const
+  {
+    if (coalescer->empty()) return;
+
+    notified_batch.clear();
+    coalescer->flush(notified_batch);
+    deliver_batch();
+  }
+
+  void monitor::start_coalescing_window(bool was_empty) const
+  {
+#ifdef HAVE_EVENT_COALESCING
+    // The window starts with the first event added to an empty coalescer.
+    if (!was_empty || coalescer->empty()) return;
+
+    coalescing_deadline =
+      steady_clock::now()
+      + duration_cast<steady_clock::duration>(
+        duration<double>(coalescing_window));
+    coalescing_cond.notify_one();
+#endif
+  }
+
+  /*
+   * Stores an event at an index of a vector, overwriting the recycled event in
+   * that position, if any, so that its storage is reused.
+   */
+  static void store_event(std::vector<event>& events,
+                          size_t index,
+                          const event& evt)
+  {
+    if (index < events.size()) events[index] = evt;
+    else events.push_back(evt);
+  }
+
+  static void store_event(std::vector<event>& events, size_t index, event&& evt)
+  {
+    if (index < events.size()) events[index] = std::move(evt);
+    else events.push_back(std::move(evt));
+  }
+
+  void monitor::notify_events(const std::vector<event>& events) const
+  {
+    FSW_MONITOR_NOTIFY_GUARD;
+
+    // Update the last notification timestamp
+    update_last_notification();
+
+    // Filtered events still change the watched trees.
+    if (snapshot)
+    {
+      for (auto const& event : events)
+        update_snapshot(event.get_path(),
+                        event.get_old_path(),
+                        event.get_flag_mask());
+    }
+
+    if (batch_callback || coalescer)
+    {
+      const bool was_empty = coalescer && coalescer->empty();
+      size_t accepted = 0;
+      notified_batch.clear();
+
+      for (auto const& event : events)
+      {
+        if (event.get_flags().empty()) continue;
+
+        uint32_t flags = event.get_flag_mask();
+
+        if (!filter_flags(flags)) continue;
+
+        // The end of an inventory or of a replay has no path to filter.
+        if (!(flags & HistoryDone) && !accept_event_path(event.get_path()))
+          continue;
+
+        ++accepted;
+
+        // The events of the priority paths are not coalesced.
+        if (coalescer && !is_priority_path(event.get_path()))
+          coalescer->add(event, flags);
+        else
+          notified_batch.add(event, flags);
+      }
+
+      counters->count_events(events.size(), accepted);
+
+      if (coalescer) start_coalescing_window(was_empty);
+      if (!coalescer || !notified_batch.empty()) deliver_batch();
+
+      return;
+    }
+
+    // The events of a recycled vector are overwritten, reusing their storage.
+    std::vector<event> filtered_events = acquire_events();
+    size_t filtered = 0;
+
+    for (auto const& event : events)
+    {
+      if (event.get_flags().empty()) continue;
+
+      // Filter flags
+      const uint32_t event_flags = event.get_flag_mask();
+      uint32_t flags = event_flags;
+
+      if (!filter_flags(flags)) continue;
+
+      // The end of an inventory or of a replay has no path to filter.
+      if (!(flags & HistoryDone) && !accept_event_path(event.get_path()))
+        continue;
+
+      if (flags == event_flags)
+      {
+        store_event(filtered_events, filtered++, event);
+        continue;
+      }
+
+      store_event(filtered_events,
+                  filtered++,
+                  fsw::event(event.get_path(),
+                             event.get_timespec(),
+                             filter_flags(event),
+                             event.get_old_path()));
+    }
+
+    filtered_events.erase(filtered_events.begin() + filtered,
+                          filtered_events.end());
+
+    counters->count_events(events.size(), filtered_events.size());
+
+    if (delivery)
+    {
+      if (!filtered_events.empty())
+      {
+        delivery->push(filtered_events, notified_batch);
+        counters->set_queue_depth(delivery->size());
+      }
+      return;
+    }
+
+    if (!filtered_events.empty())
+    {
+      FSW_DLOGF(_("Notifying events #: %zu.\n"), filtered_events.size());
+
+      invoke_callback(filtered_events);
+    }
+  }
+
+  void monitor::notify_events(const event_batch& events) const
+  {
+    FSW_MONITOR_NOTIFY_GUARD;
+
+    // Update the last notification timestamp
+    update_last_notification();
+
+    // Filtered events still change the watched trees.
+    if (snapshot)
+    {
+      for (size_t i = 0; i < events.size(); ++i)
+      {
+        const event_view evt = events[i];
+        std::string old_path;
+
+        if (evt.get_old_path())
+          old_path.assign(evt.get_old_path(), evt.get_old_path_length());
+
+        update_snapshot(std::string(evt.get_path(), evt.get_path_length()),
+                        old_path,
+                        evt.get_flags());
+      }
+    }
+
+    const bool was_empty = coalescer && coalescer->empty();
+    size_t accepted = 0;
+    notified_batch.clear();
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+      const event_view evt = events[i];
+      uint32_t flags = evt.get_flags();
+
+      if (!filter_flags(flags)) continue;
+
+      // The end of an inventory or of a replay has no path to filter.
+      if (!(flags & HistoryDone)
+          && !accept_event_path(evt.get_path(), evt.get_path_length()))
+        continue;
+
+      ++accepted;
+
+      // The events of the priority paths are not coalesced.
+      if (coalescer && !is_priority_path(evt.get_path(), evt.get_path_length()))
+      {
+        coalescer->add(evt.get_path(),
+                       evt.get_path_length(),
+                       evt.get_timespec(),
+                       flags,
+                       evt.get_old_path(),
+                       evt.get_old_path_length());
+        continue;
+      }
+
+      notified_batch.add(evt.get_path(),
+                         evt.get_path_length(),
+                         evt.get_timespec(),
+                         flags,
+                         evt.get_old_path(),
+                         evt.get_old_path_length());
+    }
+
+    counters->count_events(events.size(), accepted);
+
+    if (coalescer) start_coalescing_window(was_empty);
+    if (!coalescer || !notified_batch.empty()) deliver_batch();
+  }
+
+  void monitor::set_batch_callback(FSW_EVENT_BATCH_CALLBACK *batch_callback)
+  {
+    this->batch_callback = batch_callback;
+  }
+
+  void monitor::set_move_callback(FSW_EVENT_MOVE_CALLBACK *move_callback)
+  {
+    this->move_callback = move_callback;
+  }
+
+
+  void monitor::on_stop()
   {
     // No-op implementation.
   }
+
+  void monitor::add_path(const std::string& path)
+  {
+    FSW_MONITOR_RUN_GUARD;
+
+    if (!running)
+    {
+      if (std::find(paths.begin(), paths.end(), path) == paths.end())
+        paths.push_back(path);
+
+      return;
+    }
+
+    pending_path_changes.push_back({path, true});
+    on_paths_changed();
+  }
+
+  void monitor::remove_path(const std::string& path)
+  {
+    FSW_MONITOR_RUN_GUARD;
+
+    if (!running)
+    {
+      paths.erase(std::remove(paths.begin(), paths.end(), path), paths.end());
+
+      return;
+    }
+
+    pending_path_changes.push_back({path, false});
+    on_paths_changed();
+  }
+
+  void monitor::touch_path(const std::string& path)
+  {
+    FSW_MONITOR_RUN_GUARD;
+
+    if (!running) return;
+
+    pending_touched_paths.push_back(path);
+    on_paths_changed();
+  }
+
+  std::vector<std::string> monitor::take_touched_paths()
+  {
+    FSW_MONITOR_RUN_GUARD;
+
+    std::vector<std::string> touched_paths;
+    touched_paths.swap(pending_touched_paths);
+
+    return touched_paths;
+  }
+
+  std::vector<monitor::path_change> monitor::take_path_changes()
+  {
+    FSW_MONITOR_RUN_GUARD;
+
+    return apply_path_changes();
+  }
+
+  /*
+   * Applies the pending changes to the paths to watch.  This function must be
+   * called with a lock on run_mutex.
+   */
+  std::vector<monitor::path_change> monitor::apply_path_changes()
+  {
+    std::vector<path_change> changes;
+    if (pending_path_changes.empty()) return changes;
+
+    for (path_change& change : pending_path_changes)
+    {
+      auto it = std::find(paths.begin(), paths.end(), change.path);
+
+      if (change.added && it == paths.end())
+        paths.push_back(change.path);
+      else if (!change.added && it != paths.end())
+        paths.erase(std::remove(it, paths.end(), change.path), paths.end());
+      else
+        continue;
+
+      if (snapshot && change.added) snapshot->add_root(change.path);
+      else if (snapshot) snapshot->remove_root(change.path);
+
+      changes.push_back(std::move(change));
+    }
+
+    pending_path_changes.clear();
+
+    return changes;
+  }
+
+  void monitor::on_paths_changed()
+  {
+    // No-op implementation.
+  }
+
+  bool monitor::is_unwatched_path(
+    const std::string& path,
+    const std::vector<std::string>& removed_paths) const
+  {
+    bool removed = false;
+
+    for (const std::string& root : removed_paths)
+    {
+      if (is_path_below(path, root)) removed = true;
+    }
+
+    if (!removed) return false;
+
+    for (const std::string& root : paths)
+    {
+      if (is_path_below(path, root)) return false;
+    }
+
+    return true;
+  }
 }
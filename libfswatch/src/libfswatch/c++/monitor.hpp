@@ -35,11 +35,17 @@
 #  include <string>
 #  ifdef HAVE_CXX_MUTEX
 #    include <mutex>
+#    include <condition_variable>
 #  endif
 #  include <atomic>
 #  include <chrono>
 #  include <map>
+#  include <unordered_map>
+#  include <cstdint>
+#  include <sys/types.h>
 #  include "event.hpp"
+#  include "event_batch.hpp"
+#  include "thread_settings.hpp"
 #  include "../c/cmonitor.h"
 
 /**
@@ -59,7 +65,48 @@ namespace fsw
    */
   typedef void FSW_EVENT_CALLBACK(const std::vector<event>&, void *);
 
+  /**
+   * @brief Function definition of an event batch callback.
+   *
+   * The event batch callback is an alternative to ::FSW_EVENT_CALLBACK which
+   * receives the events as views into an fsw::event_batch owned by the
+   * monitor, instead of a vector of fsw::event.  The batch is reused across
+   * notifications and it is only valid during the invocation of the callback.
+   * The following parameters are passed to the callback:
+   *
+   *   * A reference to the batch of events.
+   *   * A pointer to the _context data_ set by the caller.
+   *
+   * @see monitor::set_batch_callback()
+   */
+  typedef void FSW_EVENT_BATCH_CALLBACK(const event_batch&, void *);
+
+  /**
+   * @brief Function definition of an event move callback.
+   *
+   * The event move callback is an alternative to ::FSW_EVENT_CALLBACK which
+   * receives the vector of events as an rvalue: the callback can take
+   * ownership of the vector, or of some of its events, by moving them instead
+   * of copying their paths.  The following parameters are passed to the
+   * callback:
+   *
+   *   * An rvalue reference to the vector of events.
+   *   * A pointer to the _context data_ set by the caller.
+   *
+   * What the callback leaves in the vector is recycled by the monitor.
+   *
+   * @see monitor::set_move_callback()
+   * @see monitor::recycle_events()
+   */
+  typedef void FSW_EVENT_MOVE_CALLBACK(std::vector<event>&&, void *);
+
   struct compiled_monitor_filter;
+  class filter_automaton;
+  class content_verifier;
+  class delivery_queue;
+  class event_coalescer;
+  class monitor_counters;
+  class tree_snapshot;
 
   /**
    * @brief Base class of all monitors.
@@ -170,7 +217,8 @@ namespace fsw
      *
      *   - Stops the monitor.
      *
-     *   - Frees the compiled regular expression of the path filters, if any.
+     *   - Frees the compiled regular expressions and the automaton of the
+     *     path filters, if any.
      *
      * @warning Destroying a monitor in the _running_ state results in undefined
      * behaviour.
@@ -262,6 +310,26 @@ namespace fsw
      */
     void set_allow_overflow(bool overflow);
 
+    /**
+     * @brief Recover from buffer overflows by scanning the affected paths.
+     *
+     * If this flag is set, the monitor records the metadata of the watched
+     * paths when it starts and keeps it up to date using the events it
+     * notifies.  When the monitor overflows, the subtree affected by the
+     * overflow is scanned again and compared with the recorded metadata, and
+     * the objects which were created, removed or modified are notified as
+     * change events instead of throwing an exception.  If
+     * monitor::set_allow_overflow() is set as well, the overflow is notified
+     * before the recovered events.
+     *
+     * @warning Only the monitors which can overflow are affected by this
+     * flag: the inotify, fanotify, FSEvents and Windows monitors.
+     *
+     * @param recover @c true if overflows should be recovered from, @c false
+     * otherwise.
+     */
+    void set_recover_overflow(bool recover);
+
     /**
      * @brief Recursively scan subdirectories.
      *
@@ -430,6 +498,322 @@ namespace fsw
      */
     void set_watch_access(bool access);
 
+    /**
+     * @brief Sets the event batch callback.
+     *
+     * If a batch callback is set, change events are notified to it instead of
+     * the callback passed to the constructor.  Since the events of a batch
+     * share a storage which is reused, no memory is allocated to notify them
+     * once the storage has grown to the size of the largest batch.
+     *
+     * @param batch_callback The batch callback, or @c nullptr to notify change
+     * events to the callback passed to the constructor.
+     */
+    void set_batch_callback(FSW_EVENT_BATCH_CALLBACK *batch_callback);
+
+    /**
+     * @brief Sets the event move callback.
+     *
+     * If a move callback is set, change events are notified to it instead of
+     * the callback passed to the constructor, unless a batch callback is set.
+     * The callback can take ownership of the events by moving the vector it
+     * receives, and give the vector back with recycle_events() once it is
+     * done with it.
+     *
+     * @param move_callback The move callback, or @c nullptr to notify change
+     * events to the callback passed to the constructor.
+     * @see set_batch_callback()
+     */
+    void set_move_callback(FSW_EVENT_MOVE_CALLBACK *move_callback);
+
+    /**
+     * @brief Gives back a vector of events to the monitor.
+     *
+     * The vectors of events built by the monitor are recycled once they have
+     * been notified: the events they contain are overwritten by the following
+     * notifications, reusing the storage of their paths and flags instead of
+     * allocating it again.  A consumer which took ownership of a vector in a
+     * move callback can give it back with this function, so that the monitor
+     * does not allocate memory in the steady state.  A bounded number of
+     * vectors is retained: the vectors in excess are destroyed.
+     *
+     * This function can be called by any thread.
+     *
+     * @param events The vector to recycle.
+     * @see set_move_callback()
+     */
+    void recycle_events(std::vector<event>&& events) const;
+
+    /**
+     * @brief Sets the size of the cache of the path filter verdicts.
+     *
+     * Events are often raised in bursts by a few directories.  When path
+     * filters are set, the verdict of the filters for the paths contained in a
+     * directory is cached, keyed by the directory: when the verdict does not
+     * depend on the name of the paths, the events contained in the directory
+     * are accepted or rejected without evaluating the filters.  The cache is
+     * discarded when it is full.
+     *
+     * @param size The maximum number of directories in the cache, or @c 0 to
+     * disable the cache.  The default value is 1024.
+     */
+    void set_filter_cache_size(size_t size);
+
+    /**
+     * @brief Gets the number of lookups which found a directory in the cache
+     * of the path filter verdicts.
+     *
+     * @return The number of cache hits.
+     * @see set_filter_cache_size()
+     */
+    uint64_t get_filter_cache_hits() const;
+
+    /**
+     * @brief Gets the number of lookups which did not find a directory in the
+     * cache of the path filter verdicts.
+     *
+     * @return The number of cache misses.
+     * @see set_filter_cache_size()
+     */
+    uint64_t get_filter_cache_misses() const;
+
+    /**
+     * @brief Sets the asynchronous delivery queue.
+     *
+     * By default, events are notified to the callback on the thread running
+     * the monitor, which stops watching until the callback returns.  If a
+     * delivery queue is set, the monitor thread pushes the notified events into
+     * a bounded queue and the callback is invoked by a dedicated delivery
+     * thread instead.  When the callback thread falls behind and @p size
+     * batches are waiting to be delivered, @p policy is applied:
+     *
+     *   * ::fsw_delivery_block: the monitor thread waits until a batch has been
+     *     delivered.
+     *
+     *   * ::fsw_delivery_coalesce: the events are merged into a single pending
+     *     batch, which is delivered after the queued ones.
+     *
+     *   * ::fsw_delivery_drop: the events are dropped and an event with the
+     *     fsw_event_flag::Overflow flag is delivered after the queued batches,
+     *     regardless of the value of monitor::allow_overflow.
+     *
+     * This function must be called before start().
+     *
+     * @param size The maximum number of batches waiting to be delivered, or
+     * @c 0 to notify events on the monitor thread.  The default value is @c 0.
+     * @param policy The policy applied when the queue is full.
+     * @throw libfsw_exception if @p size is not @c 0 and the asynchronous
+     * delivery is not supported.
+     */
+    void set_delivery_queue(size_t size,
+                            fsw_delivery_policy policy = fsw_delivery_block);
+
+    /**
+     * @brief Sets the coalescing window.
+     *
+     * Editors and build tools often raise many events for the same file in a
+     * short time.  If a coalescing window is set, the accepted events are not
+     * notified as soon as they are received: the events of the same path
+     * received within the window are merged into a single event whose flags
+     * are the union of their flags, and which is notified when the window
+     * ends.  A window starts with the first event received after the previous
+     * one has ended.  The events of a window are notified in the order their
+     * path was first received, by a dedicated thread unless a delivery queue
+     * is set.
+     *
+     * This function must be called before start().
+     *
+     * @param window The length of the window, in seconds, or @c 0 to notify
+     * events as soon as they are received.  The default value is @c 0.
+     * @throw libfsw_exception if @p window is negative, or if it is positive
+     * and event coalescing is not supported.
+     * @see set_delivery_queue()
+     */
+    void set_coalescing_window(double window);
+
+    /**
+     * @brief Sets the verification of the content of the updated files.
+     *
+     * Editors and build tools often rewrite files with the same content, or
+     * only touch them.  If content verification is enabled, the events of
+     * regular files whose only flags are fsw_event_flag::Updated and
+     * fsw_event_flag::IsFile, or fsw_event_flag::PlatformSpecific, are
+     * dropped before being notified if the content of the file did not
+     * change since the monitor last checked it.  The hash of the content of
+     * the checked files is cached, keyed by their device and inode numbers,
+     * and a file is only read if its size is the same as when it was last
+     * checked but its modification time is not.  The first update of a file
+     * is always notified.
+     *
+     * The files of a batch are hashed when the batch is notified, by a pool
+     * of @p threads threads, including the thread notifying the batch: set a
+     * delivery queue or a coalescing window to hash them on a thread other
+     * than the monitor thread.  The dropped events are counted by
+     * fsw_monitor_stats::events_unchanged.  Monitors reporting file accesses
+     * report the accesses made to hash the files as well.  The cache is kept
+     * when the monitor is started again, unless @p cache_size or @p threads
+     * changed.
+     *
+     * This function must be called before start().
+     *
+     * @param cache_size The maximum number of files whose hash is cached, or
+     * @c 0 to disable content verification.  The default value is @c 0.
+     * @param threads The number of threads hashing the files, or @c 0 to use
+     * the number of hardware threads.
+     * @throw libfsw_exception if @p cache_size is not @c 0 and content
+     * verification is not supported.
+     * @see set_delivery_queue()
+     * @see set_coalescing_window()
+     */
+    void set_content_verification(size_t cache_size,
+                                  unsigned int threads = 0);
+
+    /**
+     * @brief Sets the priority paths.
+     *
+     * The events of a priority path, or of a path below it, are notified as
+     * soon as they are received, in a batch of their own: they are not merged
+     * by the coalescing window, and monitors which collect the events
+     * received within a latency window (the inotify and the fanotify
+     * monitors) notify them without waiting for the end of the window.  The
+     * other events are notified as usual, so that a large tree can be watched
+     * with a high latency while the changes of a few subtrees are notified
+     * with a low one.  The events of a priority path may thus be notified
+     * before the events of other paths received earlier.
+     *
+     * The paths are compared with the paths of the events as they are, with
+     * no trailing slash: a priority path must be specified the way the
+     * monitor reports the events below it.
+     *
+     * This function must be called before start().
+     *
+     * @param paths The priority paths.  By default, there are none.
+     */
+    void set_priority_paths(std::vector<std::string> paths);
+
+    /**
+     * @brief Sets the inventory of the watched paths.
+     *
+     * Consumers often need to list the watched trees before processing their
+     * changes.  If the inventory is enabled, the scan of the watched paths
+     * performed when the monitor starts notifies an event for every object
+     * it finds, in batches of at most @p batch_size events, followed by an
+     * event with the fsw_event_flag::HistoryDone flag and an empty path: the
+     * events notified after it are live changes.  Since the objects are
+     * listed by the same scan which starts watching them, no change is lost
+     * between the inventory and the live events.
+     *
+     * The events of the inventory only have the flag of the type of the
+     * object: fsw_event_flag::IsFile, fsw_event_flag::IsDir,
+     * fsw_event_flag::IsSymLink, or fsw_event_flag::PlatformSpecific for the
+     * other types.  They are filtered like the other events, while the end
+     * of the inventory is only subject to the event type filters.  The paths
+     * which cannot be watched when the monitor starts, and the subtrees
+     * which are not scanned (see inotify_monitor::INOTIFY_LAZY_DEPTH), are
+     * not listed.
+     *
+     * This function must be called before start().
+     *
+     * @param batch_size The maximum number of events of a batch of the
+     * inventory, or @c 0 to disable the inventory.  The default value is
+     * @c 0.
+     * @throw libfsw_exception if @p batch_size is not @c 0 and the monitor
+     * does not list its inventory.
+     */
+    void set_inventory(size_t batch_size);
+
+    /**
+     * @brief Sets the scheduling attributes of the threads of a role.
+     *
+     * The settings of fsw_thread_role::fsw_thread_monitor are applied to the
+     * thread calling start() for the duration of the call, since that thread
+     * reads the events of the operating system, and the previous attributes
+     * of the thread are restored when start() returns.  The settings of the
+     * other roles are applied by every thread of the role when it starts.
+     * The threads shared by all the monitors of the process are configured
+     * by the monitor which starts them.  The threads of a role without
+     * settings inherit the attributes of the thread creating them, which is
+     * the thread running the monitor for the threads of this monitor.
+     *
+     * This function must be called before start().
+     *
+     * @param role The role of the threads.
+     * @param settings The attributes of the threads.
+     * @see get_thread_settings()
+     */
+    void set_thread_settings(fsw_thread_role role,
+                             const thread_settings& settings);
+
+    /**
+     * @brief Gets the scheduling attributes of the threads of a role.
+     *
+     * @param role The role of the threads.
+     * @return The attributes of the threads.
+     * @see set_thread_settings()
+     */
+    const thread_settings& get_thread_settings(fsw_thread_role role) const;
+
+    /**
+     * @brief Adds a path to watch.
+     *
+     * If the monitor is not running, @p path is added to the paths watched
+     * the next time start() is called.  Otherwise, the path is added by the
+     * thread running the monitor: monitors supporting this operation scan the
+     * new path without scanning the paths which are already watched, while
+     * the other monitors watch it the next time they are started.  Adding a
+     * path which is already watched has no effect.
+     *
+     * This function is thread-safe.
+     *
+     * @param path The path to add.
+     * @see remove_path()
+     */
+    void add_path(const std::string& path);
+
+    /**
+     * @brief Removes a path to watch.
+     *
+     * If the monitor is not running, @p path is removed from the paths watched
+     * the next time start() is called.  Otherwise, the path is removed by the
+     * thread running the monitor: monitors supporting this operation remove
+     * the watches of @p path, except the ones which are still required to
+     * watch the other paths, while the other monitors stop watching it the
+     * next time they are started.
+     *
+     * This function is thread-safe.
+     *
+     * @param path The path to remove.
+     * @see add_path()
+     */
+    void remove_path(const std::string& path);
+
+    /**
+     * @brief Requests the monitor to watch a subtree it does not watch yet.
+     *
+     * Monitors watching their paths lazily watch the subtrees below a
+     * configured depth only when activity is seen in their parent directory.
+     * This function activates the subtree of @p path, which must be below one
+     * of the paths to watch, as if activity had been seen in it.  The request
+     * is served by the thread running the monitor and it is ignored if the
+     * monitor is not running or if it watches all its paths.
+     *
+     * This function is thread-safe.
+     *
+     * @param path The path of the directory to watch.
+     */
+    void touch_path(const std::string& path);
+
+    /**
+     * @brief Gets the counters of the monitor.
+     *
+     * The counters are maintained with relaxed atomic operations, so that they
+     * can be read while the monitor is running at no cost for the threads of
+     * the monitor.  This function is thread-safe.
+     *
+     * @return A snapshot of the counters.
+     */
+    fsw_monitor_stats get_stats() const;
+
   protected:
     /**
      * @brief Check whether an event should be accepted.
@@ -453,6 +837,21 @@ namespace fsw
      */
     bool accept_path(const std::string& path) const;
 
+    /**
+     * @brief Check whether any path below a directory may be accepted.
+     *
+     * This function lets monitors prune the subtrees which need not be
+     * scanned: it returns @c false only if every path below @p directory would
+     * be rejected by the path filters, that is if an exclusion filter matches
+     * all of them and no inclusion filter can match any of them.  Filters
+     * which cannot be analysed are assumed to match.
+     *
+     * @param directory The directory to check.
+     * @return @c false if no path below @p directory can be accepted, @c true
+     * otherwise.
+     */
+    bool accept_subtree(const std::string& directory) const;
+
     /**
      * @brief Notify change events.
      *
@@ -462,6 +861,16 @@ namespace fsw
      */
     void notify_events(const std::vector<event>& events) const;
 
+    /**
+     * @brief Notify a batch of change events.
+     *
+     * This function filters the events of @p events and notifies the accepted
+     * ones using the batch callback, if set, or the provided callback.
+     *
+     * @see set_batch_callback()
+     */
+    void notify_events(const event_batch& events) const;
+
     /**
      * @brief Notify an overflow event.
      *
@@ -474,6 +883,77 @@ namespace fsw
      */
     void notify_overflow(const std::string& path) const;
 
+    /**
+     * @brief Checks whether a path is a priority path, or is below one.
+     *
+     * @param path The path to check.
+     * @return @c true if @p path is in a priority path, @c false otherwise.
+     * @see set_priority_paths()
+     */
+    bool is_priority_path(const std::string& path) const;
+
+    /**
+     * @brief Notifies the events of the priority paths collected so far.
+     *
+     * Monitors which collect the events received within a latency window
+     * call this function every time they receive events, so that the events
+     * of the priority paths are notified without waiting for the end of the
+     * window.  The events of the priority paths among the events of
+     * @p events starting at index @p checked are notified, and they are
+     * replaced by events without flags, which notify_events() skips, so that
+     * the indices of the other events do not change.
+     *
+     * @param events The events collected in the current window.
+     * @param checked The index of the first event which was not checked yet.
+     * It is set to the size of @p events.
+     * @see set_priority_paths()
+     */
+    void notify_priority_events(std::vector<event>& events,
+                                size_t& checked) const;
+
+    /**
+     * @brief Checks whether the monitor lists the inventory of the watched
+     * paths.
+     *
+     * Monitors which support set_inventory() override this function to
+     * return @c true, and call list_inventory_entry() and end_inventory()
+     * during their first scan.  By default, this function returns @c false.
+     *
+     * @return @c true if the monitor lists its inventory, @c false otherwise.
+     */
+    virtual bool lists_inventory() const;
+
+    /**
+     * @brief Checks whether the inventory is being listed.
+     *
+     * @return @c true if the inventory is enabled and it has not ended yet,
+     * @c false otherwise.
+     */
+    bool is_listing_inventory() const;
+
+    /**
+     * @brief Lists an object in the inventory.
+     *
+     * The event of the object is added to the current batch of the
+     * inventory, which is notified when it is full.  This function has no
+     * effect if the inventory is not being listed.
+     *
+     * This function is thread-safe.
+     *
+     * @param path The path of the object.
+     * @param mode The mode of the object, as reported by @c lstat().
+     */
+    void list_inventory_entry(const std::string& path, mode_t mode) const;
+
+    /**
+     * @brief Ends the inventory.
+     *
+     * The last batch of the inventory is notified, followed by the event
+     * marking its end.  This function has no effect if the inventory is not
+     * being listed.
+     */
+    void end_inventory() const;
+
     /**
      * @brief Filter event types.
      *
@@ -485,6 +965,17 @@ namespace fsw
      */
     std::vector<fsw_event_flag> filter_flags(const event& evt) const;
 
+    /**
+     * @brief Gets the event types accepted by the event type filters.
+     *
+     * Monitors can use this mask to only request the notifications of the
+     * event types which may be accepted from the operating system.
+     *
+     * @return The bitmask of the accepted ::fsw_event_flag values.  If no
+     * event type filters are set, all the bits are set.
+     */
+    uint32_t get_event_type_mask() const;
+
     /**
      * @brief Execute monitor loop.
      *
@@ -513,6 +1004,131 @@ namespace fsw
      */
     virtual void on_stop();
 
+    /**
+     * @brief A change of the paths to watch.
+     *
+     * @see take_path_changes()
+     */
+    struct path_change
+    {
+      /**
+       * @brief The path which was added or removed.
+       */
+      std::string path;
+
+      /**
+       * @brief @c true if the path was added, @c false if it was removed.
+       */
+      bool added;
+    };
+
+    /**
+     * @brief Applies the pending changes of the paths to watch.
+     *
+     * The paths added or removed by add_path() and remove_path() while the
+     * monitor is running are applied to monitor::paths by this function,
+     * which returns the effective changes in the order they were requested.
+     * Monitors supporting these operations must call this function from the
+     * thread running run() and update their watches accordingly: the pending
+     * changes are otherwise applied when start() returns.
+     *
+     * @return The changes applied to monitor::paths.
+     */
+    std::vector<path_change> take_path_changes();
+
+    /**
+     * @brief Gets the paths passed to touch_path() since the last call.
+     *
+     * Monitors watching their paths lazily must call this function from the
+     * thread running run() when they are woken up by on_paths_changed().
+     *
+     * @return The paths to activate, in the order they were requested.
+     */
+    std::vector<std::string> take_touched_paths();
+
+    /**
+     * @brief Execute an implementation-specific handler when the paths to watch
+     * change.
+     *
+     * This function is executed with a lock on monitor::run_mutex by
+     * add_path(), remove_path() and touch_path() while the monitor is
+     * running.  Monitors
+     * which may block for longer than their latency should override it to
+     * wake up the thread running run(), so that it calls take_path_changes().
+     *
+     * @see take_path_changes()
+     */
+    virtual void on_paths_changed();
+
+    /**
+     * @brief Checks whether a path is no longer watched after some paths to
+     * watch have been removed.
+     *
+     * Monitors use this function to determine which watches are no longer
+     * required after take_path_changes() has returned removed paths.
+     *
+     * @param path The path to check.
+     * @param removed_paths The removed paths.
+     * @return @c true if @p path is below one of @p removed_paths and it is not
+     * below any of the paths to watch, @c false otherwise.
+     */
+    bool is_unwatched_path(const std::string& path,
+                           const std::vector<std::string>& removed_paths) const;
+
+    /**
+     * @brief Counts a call reading records from the monitored API.
+     *
+     * @param records The number of records read.
+     * @param bytes The number of bytes read, if the records are read into a
+     * buffer.
+     * @see get_stats()
+     */
+    void count_read(size_t records, size_t bytes = 0) const;
+
+    /**
+     * @brief Sets the number of watches currently held by the monitor.
+     *
+     * @param watches The number of watches.
+     * @see get_stats()
+     */
+    void set_watch_count(size_t watches) const;
+
+    /**
+     * @brief Counts a scan of the watched paths.
+     *
+     * @param duration The duration of the scan.
+     * @see get_stats()
+     */
+    void count_scan(std::chrono::steady_clock::duration duration) const;
+
+    /**
+     * @brief Copies the settings of this monitor to another monitor.
+     *
+     * Monitors delegating the watching of their paths to other monitors use
+     * this function to configure them: the properties, the latency, the path
+     * and event type filters and the flags affecting how paths are watched
+     * are copied.  The callbacks, the delivery queue, the coalescing window
+     * and the idle events are not copied, since they are applied by this
+     * monitor to the events it notifies.
+     *
+     * @param child The monitor to configure.
+     */
+    void copy_settings(monitor& child) const;
+
+    /**
+     * @brief Checks whether this monitor only notifies the events of other
+     * monitors.
+     *
+     * Such monitors do not record the metadata of the watched paths when
+     * monitor::recover_overflow is set, since the monitors they delegate to
+     * recover from their own overflows.  By default, this function returns
+     * @c false.
+     *
+     * @return @c true if the monitor delegates the watching of its paths,
+     * @c false otherwise.
+     */
+    virtual bool forwards_events() const;
+
   protected:
     /**
      * @brief List of paths to watch.
@@ -536,6 +1152,20 @@ namespace fsw
      */
     FSW_EVENT_CALLBACK *callback;
 
+    /**
+     * @brief Callback to which batches of change events should be notified.
+     *
+     * @see monitor::set_batch_callback()
+     */
+    FSW_EVENT_BATCH_CALLBACK *batch_callback = nullptr;
+
+    /**
+     * @brief Callback to which change events should be moved.
+     *
+     * @see monitor::set_move_callback()
+     */
+    FSW_EVENT_MOVE_CALLBACK *move_callback = nullptr;
+
     /**
      * @brief Pointer to context data that will be passed to the monitor::callback.
      */
@@ -559,6 +1189,12 @@ namespace fsw
      */
     bool allow_overflow = false;
 
+    /**
+     * @brief If @c true, the changes lost by a queue overflow are recovered by
+     * scanning the affected paths.
+     */
+    bool recover_overflow = false;
+
     /**
      * @brief If @c true, directories will be scanned recursively.
      */
@@ -603,15 +1239,92 @@ namespace fsw
 #  endif
 
   private:
+    enum subtree_verdict
+    {
+      subtree_accepted,
+      subtree_rejected,
+      subtree_undecided
+    };
+
     std::chrono::milliseconds get_latency_ms() const;
+    void update_last_notification() const;
+    void update_snapshot(const std::string& path,
+                         const std::string& old_path,
+                         uint32_t flags) const;
+    bool filter_flags(uint32_t& flags) const;
+    void notify_batch(event_batch& batch) const;
+    void invoke_callback(std::vector<event>& events) const;
+    std::vector<event> acquire_events() const;
+    void deliver_batch() const;
+    void flush_coalesced_events() const;
+    void start_coalescing_window(bool was_empty) const;
+    void verify_contents(event_batch& batch) const;
+    void verify_contents(std::vector<event>& events) const;
+    void remove_unchanged_files(size_t hashed, size_t event_count) const;
+    subtree_verdict get_subtree_verdict(const std::string& prefix) const;
+    subtree_verdict get_cached_verdict(const char *path, size_t length) const;
+    bool accept_event_path(const std::string& path) const;
+    bool accept_event_path(const char *path, size_t length) const;
+    bool is_priority_path(const char *path, size_t length) const;
+    std::vector<path_change> apply_path_changes();
+    std::vector<path_change> pending_path_changes;
+    std::vector<std::string> pending_touched_paths;
+    std::vector<monitor_filter> source_filters;
     std::vector<compiled_monitor_filter> filters;
+    filter_automaton *path_automaton = nullptr;
     std::vector<fsw_event_type_filter> event_type_filters;
+    std::vector<std::string> priority_paths;
+    size_t inventory_batch_size = 0;
+    thread_settings role_settings[FSW_THREAD_ROLES];
+    mutable bool inventory_listed = false;
+    mutable std::vector<event> inventory_events;
+#  ifdef HAVE_CXX_MUTEX
+    mutable std::mutex inventory_mutex;
+#  endif
+    static const uint32_t ALL_EVENT_TYPES = 0xFFFFFFFF;
+    uint32_t event_type_mask = ALL_EVENT_TYPES;
+    bool accept_no_op = false;
+    mutable event_batch notified_batch;
+    size_t filter_cache_size = 1024;
+    mutable std::unordered_map<std::string, subtree_verdict> filter_cache;
+    mutable std::string filter_cache_key;
+    mutable std::atomic<uint64_t> filter_cache_hits{0};
+    mutable std::atomic<uint64_t> filter_cache_misses{0};
+    size_t delivery_queue_size = 0;
+    fsw_delivery_policy delivery_policy = fsw_delivery_block;
+    delivery_queue *delivery = nullptr;
+    mutable std::vector<event> notified_events;
+    static const size_t MAX_RECYCLED_EVENTS = 4;
+    mutable std::vector<std::vector<event>> recycled_events;
+#  ifdef HAVE_CXX_MUTEX
+    mutable std::mutex recycle_mutex;
+#  endif
+    mutable uint64_t last_sequence = 0;
+    double coalescing_window = 0;
+    event_coalescer *coalescer = nullptr;
+    size_t verification_cache_size = 0;
+    unsigned int verification_threads = 0;
+    content_verifier *verifier = nullptr;
+    mutable std::vector<const char *> verified_paths;
+    mutable std::vector<size_t> verified_events;
+    mutable std::vector<char> unchanged_files;
+    mutable std::vector<char> unchanged_events;
+    tree_snapshot *snapshot = nullptr;
+    monitor_counters *counters;
 
 #ifdef HAVE_CXX_MUTEX
 # ifdef HAVE_CXX_ATOMIC
 #   define HAVE_INACTIVITY_CALLBACK
-    static void inactivity_callback(monitor *mon);
+    static std::chrono::steady_clock::time_point inactivity_callback(void *data);
     mutable std::atomic<std::chrono::milliseconds> last_notification;
+#   define HAVE_ASYNC_DELIVERY
+    static void delivery_callback(monitor *mon);
+#   define HAVE_EVENT_COALESCING
+    static void coalescing_callback(monitor *mon);
+    mutable std::condition_variable coalescing_cond;
+    mutable std::chrono::steady_clock::time_point coalescing_deadline;
+    bool coalescing_stopped = false;
+#   define HAVE_CONTENT_VERIFICATION
 # endif
 #endif
   };
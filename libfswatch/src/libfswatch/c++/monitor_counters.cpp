@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "monitor_counters.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace fsw
+{
+  static void add(atomic<uint64_t>& counter, uint64_t value)
+  {
+    counter.fetch_add(value, memory_order_relaxed);
+  }
+
+  static uint64_t get(const atomic<uint64_t>& counter)
+  {
+    return counter.load(memory_order_relaxed);
+  }
+
+  void monitor_counters::count_read(size_t records, size_t bytes)
+  {
+    add(events_read, records);
+    add(read_calls, 1);
+    add(bytes_read, bytes);
+  }
+
+  void monitor_counters::count_events(size_t received, size_t notified)
+  {
+    add(events_received, received);
+    add(events_notified, notified);
+  }
+
+  void monitor_counters::count_overflow()
+  {
+    add(overflows, 1);
+  }
+
+  void monitor_counters::set_watches(size_t watches)
+  {
+    this->watches.store(watches, memory_order_relaxed);
+  }
+
+  void monitor_counters::count_scan(steady_clock::duration duration)
+  {
+    const uint64_t us = duration_cast<microseconds>(duration).count();
+
+    add(scans, 1);
+    last_scan_time.store(us, memory_order_relaxed);
+    add(total_scan_time, us);
+  }
+
+  void monitor_counters::count_callback(steady_clock::duration duration)
+  {
+    uint64_t us = duration_cast<microseconds>(duration).count();
+    size_t bucket = 0;
+
+    while (us && bucket < FSW_CALLBACK_TIME_BUCKETS - 1)
+    {
+      us >>= 1;
+      ++bucket;
+    }
+
+    add(callback_time[bucket], 1);
+  }
+
+  void monitor_counters::set_queue_depth(size_t depth)
+  {
+    queue_depth.store(depth, memory_order_relaxed);
+
+    // The depth is set by both the producer and the consumer of the queue.
+    uint64_t max_depth = get(max_queue_depth);
+
+    while (depth > max_depth
+           && !max_queue_depth.compare_exchange_weak(max_depth,
+                                                     depth,
+                                                     memory_order_relaxed))
+    {
+    }
+  }
+
+  void monitor_counters::count_verification(size_t hashed, size_t unchanged)
+  {
+    add(files_hashed, hashed);
+    add(events_unchanged, unchanged);
+  }
+
+  fsw_monitor_stats monitor_counters::get_stats() const
+  {
+    fsw_monitor_stats stats = {};
+
+    stats.events_read = get(events_read);
+    stats.read_calls = get(read_calls);
+    stats.bytes_read = get(bytes_read);
+    stats.events_received = get(events_received);
+    stats.events_notified = get(events_notified);
+    // The counters may be updated between the two loads.
+    if (stats.events_received > stats.events_notified)
+      stats.events_filtered = stats.events_received - stats.events_notified;
+    stats.overflows = get(overflows);
+    stats.watches = get(watches);
+    stats.scans = get(scans);
+    stats.last_scan_time = get(last_scan_time);
+    stats.total_scan_time = get(total_scan_time);
+
+    for (size_t i = 0; i < FSW_CALLBACK_TIME_BUCKETS; ++i)
+    {
+      stats.callback_time[i] = get(callback_time[i]);
+      stats.callbacks += stats.callback_time[i];
+    }
+
+    stats.queue_depth = get(queue_depth);
+    stats.max_queue_depth = get(max_queue_depth);
+    stats.files_hashed = get(files_hashed);
+    stats.events_unchanged = get(events_unchanged);
+
+    return stats;
+  }
+}
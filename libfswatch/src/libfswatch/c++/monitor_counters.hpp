@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::monitor_counters class.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_MONITOR_COUNTERS_H
+#  define FSW_MONITOR_COUNTERS_H
+
+#  include "../c/cmonitor.h"
+#  include <atomic>
+#  include <chrono>
+#  include <cstddef>
+#  include <cstdint>
+
+namespace fsw
+{
+  /**
+   * @brief Counters of a monitor.
+   *
+   * The counters are updated by the threads of a monitor and read by any
+   * other thread.  Since they are only used for reporting, they are relaxed
+   * atomics: no lock is taken and no ordering is imposed on the other memory
+   * operations of the threads updating them.  Counters are updated once per
+   * system call or batch of events, rather than once per event.
+   */
+  class monitor_counters
+  {
+  public:
+    /**
+     * @brief Counts a call reading records from the monitored API.
+     *
+     * @param records The number of records read.
+     * @param bytes The number of bytes read.
+     */
+    void count_read(size_t records, size_t bytes);
+
+    /**
+     * @brief Counts the events checked against the filters.
+     *
+     * @param received The number of events checked.
+     * @param notified The number of events accepted.
+     */
+    void count_events(size_t received, size_t notified);
+
+    /**
+     * @brief Counts a queue overflow.
+     */
+    void count_overflow();
+
+    /**
+     * @brief Sets the number of watches currently held by the monitor.
+     *
+     * @param watches The number of watches.
+     */
+    void set_watches(size_t watches);
+
+    /**
+     * @brief Counts a scan of the watched paths.
+     *
+     * @param duration The duration of the scan.
+     */
+    void count_scan(std::chrono::steady_clock::duration duration);
+
+    /**
+     * @brief Counts an invocation of the callback.
+     *
+     * @param duration The duration of the invocation.
+     */
+    void count_callback(std::chrono::steady_clock::duration duration);
+
+    /**
+     * @brief Sets the number of batches waiting in the delivery queue.
+     *
+     * @param depth The number of batches.
+     */
+    void set_queue_depth(size_t depth);
+
+    /**
+     * @brief Counts the verification of the content of the files of a batch.
+     *
+     * @param hashed The number of files which were read.
+     * @param unchanged The number of events dropped because the content of
+     * their file did not change.
+     */
+    void count_verification(size_t hashed, size_t unchanged);
+
+    /**
+     * @brief Gets a snapshot of the counters.
+     *
+     * Since the counters are read one at a time, the snapshot is not atomic.
+     *
+     * @return The counters.
+     */
+    fsw_monitor_stats get_stats() const;
+
+  private:
+    std::atomic<uint64_t> events_read{0};
+    std::atomic<uint64_t> read_calls{0};
+    std::atomic<uint64_t> bytes_read{0};
+    std::atomic<uint64_t> events_received{0};
+    std::atomic<uint64_t> events_notified{0};
+    std::atomic<uint64_t> overflows{0};
+    std::atomic<uint64_t> watches{0};
+    std::atomic<uint64_t> scans{0};
+    std::atomic<uint64_t> last_scan_time{0};
+    std::atomic<uint64_t> total_scan_time{0};
+    std::atomic<uint64_t> callback_time[FSW_CALLBACK_TIME_BUCKETS] = {};
+    std::atomic<uint64_t> queue_depth{0};
+    std::atomic<uint64_t> max_queue_depth{0};
+    std::atomic<uint64_t> files_hashed{0};
+    std::atomic<uint64_t> events_unchanged{0};
+  };
+}
+
+#endif  /* FSW_MONITOR_COUNTERS_H */
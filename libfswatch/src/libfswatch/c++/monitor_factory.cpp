@@ -33,10 +33,20 @@
 #if defined(HAVE_SYS_INOTIFY_H)
   #include "inotify_monitor.hpp"
 #endif
+#if defined(HAVE_FANOTIFY)
+  #include "fanotify_monitor.hpp"
+#endif
 #if defined(HAVE_WINDOWS)
   #include "windows_monitor.hpp"
 #endif
 #include "poll_monitor.hpp"
+#if defined(HAVE_UNIX_SEQPACKET)
+  #include "subscriber_monitor.hpp"
+#endif
+#if defined(HAVE_CXX_MUTEX)
+  #include "auto_monitor.hpp"
+  #include "composite_monitor.hpp"
+#endif
 
 namespace fsw
 {
@@ -96,6 +106,20 @@ namespace fsw
 #if defined(HAVE_PORT_H)
       case fen_monitor_type:
         return new fen_monitor(paths, callback, context);
+#endif
+#if defined(HAVE_FANOTIFY)
+      case fanotify_monitor_type:
+        return new fanotify_monitor(paths, callback, context);
+#endif
+#if defined(HAVE_UNIX_SEQPACKET)
+      case subscriber_monitor_type:
+        return new subscriber_monitor(paths, callback, context);
+#endif
+#if defined(HAVE_CXX_MUTEX)
+      case auto_monitor_type:
+        return new auto_monitor(paths, callback, context);
+      case composite_monitor_type:
+        return new composite_monitor(paths, callback, context);
 #endif
     default:
       throw libfsw_exception("Unsupported monitor.",
@@ -120,11 +144,21 @@ namespace fsw
 #if defined(HAVE_SYS_INOTIFY_H)
     creator_by_string_set[fsw_quote(inotify_monitor)] = fsw_monitor_type::inotify_monitor_type;
 #endif
+#if defined(HAVE_FANOTIFY)
+    creator_by_string_set[fsw_quote(fanotify_monitor)] = fsw_monitor_type::fanotify_monitor_type;
+#endif
 #if defined(HAVE_WINDOWS)
     creator_by_string_set[fsw_quote(windows_monitor)] = fsw_monitor_type::windows_monitor_type;
 #endif
     creator_by_string_set[fsw_quote(
       poll_monitor)] = fsw_monitor_type::poll_monitor_type;
+#if defined(HAVE_UNIX_SEQPACKET)
+    creator_by_string_set[fsw_quote(subscriber_monitor)] = fsw_monitor_type::subscriber_monitor_type;
+#endif
+#if defined(HAVE_CXX_MUTEX)
+    creator_by_string_set[fsw_quote(auto_monitor)] = fsw_monitor_type::auto_monitor_type;
+    creator_by_string_set[fsw_quote(composite_monitor)] = fsw_monitor_type::composite_monitor_type;
+#endif
 
     return creator_by_string_set;
 #undef fsw_quote
@@ -150,6 +184,18 @@ namespace fsw
     return (i != creators_by_string().end());
   }
 
+  bool monitor_factory::find_type(const std::string& name,
+                                  fsw_monitor_type& type)
+  {
+    auto i = creators_by_string().find(name);
+
+    if (i == creators_by_string().end()) return false;
+
+    type = i->second;
+
+    return true;
+  }
+
   std::vector<std::string> monitor_factory::get_types()
   {
     std::vector<std::string> types;
@@ -112,6 +112,15 @@ namespace fsw
      */
     static bool exists_type(const std::string& name);
 
+    /**
+     * @brief Gets the monitor type specified by @p name.
+     *
+     * @param name The name of the monitor type to look for.
+     * @param type A reference to the variable where the type is stored.
+     * @return `true` if the type @p name exists, `false` otherwise.
+     */
+    static bool find_type(const std::string& name, fsw_monitor_type& type);
+
     monitor_factory() = delete;
     monitor_factory(const monitor_factory& orig) = delete;
     monitor_factory& operator=(const monitor_factory& that) = delete;
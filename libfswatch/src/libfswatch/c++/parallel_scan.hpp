@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Parallel scan of a tree of paths shared by the monitors.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_PARALLEL_SCAN_H
+#  define FSW_PARALLEL_SCAN_H
+
+#  include "gettext_defs.h"
+#  include "thread_settings.hpp"
+#  include <cstddef>
+#  include <utility>
+#  include <vector>
+#  ifdef HAVE_CXX_MUTEX
+#    include <atomic>
+#    include <deque>
+#    include <exception>
+#    include <mutex>
+#    include <thread>
+#  endif
+
+namespace fsw
+{
+#  ifdef HAVE_CXX_MUTEX
+  /**
+   * @brief Scans a tree of items using a pool of threads.
+   *
+   * Each thread pops items from the back of its own queue and, when it is
+   * empty, steals items from the front of the queues of the other threads.
+   * The initial items are distributed among the threads, and the children
+   * found by a thread are appended to its own queue, so that each thread
+   * scans its part of the tree depth-first.  The scan ends when no items are
+   * either queued or being scanned.
+   *
+   * The visitor is called as `visit(worker, item, children)`, where @c worker
+   * is the number of the calling thread, in the range `[0, thread_num)`, and
+   * @c children is an empty vector where the visitor appends the items found
+   * below @c item.  When the visitor throws, the scan stops and the first
+   * exception is rethrown to the caller after the threads are joined.
+   *
+   * @param items The initial items, which are moved to the queues.
+   * @param thread_num The number of threads.
+   * @param worker_settings The scheduling attributes of the threads.
+   * @param visit The visitor of the items.
+   */
+  template<typename Item, typename Visitor>
+  void scan_in_parallel(std::vector<Item>& items,
+                        unsigned int thread_num,
+                        const thread_settings& worker_settings,
+                        Visitor visit)
+  {
+    struct scan_worker
+    {
+      std::mutex queue_mutex;
+      std::deque<Item> queue;
+    };
+
+    std::vector<scan_worker> workers(thread_num);
+    std::atomic<size_t> pending(0);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+
+    size_t next_worker = 0;
+
+    for (Item& item : items)
+    {
+      workers[next_worker++ % thread_num].queue.push_back(std::move(item));
+      ++pending;
+    }
+
+    auto worker_loop = [&](unsigned int id)
+    {
+      worker_settings.try_apply(_("Scan thread"));
+
+      scan_worker& self = workers[id];
+      std::vector<Item> children;
+
+      while (!failed)
+      {
+        Item item;
+        bool found = false;
+
+        {
+          std::lock_guard<std::mutex> guard(self.queue_mutex);
+
+          if (!self.queue.empty())
+          {
+            item = std::move(self.queue.back());
+            self.queue.pop_back();
+            found = true;
+          }
+        }
+
+        for (unsigned int i = 1; !found && i < thread_num; ++i)
+        {
+          scan_worker& victim = workers[(id + i) % thread_num];
+          std::lock_guard<std::mutex> guard(victim.queue_mutex);
+
+          if (!victim.queue.empty())
+          {
+            item = std::move(victim.queue.front());
+            victim.queue.pop_front();
+            found = true;
+          }
+        }
+
+        if (!found)
+        {
+          // No work is left when no items are either queued or being scanned.
+          if (pending == 0) return;
+
+          std::this_thread::yield();
+          continue;
+        }
+
+        try
+        {
+          children.clear();
+          visit(id, item, children);
+
+          if (!children.empty())
+          {
+            std::lock_guard<std::mutex> guard(self.queue_mutex);
+
+            // Children are counted before the current item is released.
+            pending += children.size();
+
+            for (Item& child : children)
+              self.queue.push_back(std::move(child));
+          }
+        }
+        catch (...)
+        {
+          std::lock_guard<std::mutex> guard(error_mutex);
+          if (!error) error = std::current_exception();
+          failed = true;
+        }
+
+        --pending;
+      }
+    };
+
+    std::vector<std::thread> threads;
+
+    for (unsigned int i = 0; i < thread_num; ++i)
+      threads.emplace_back(worker_loop, i);
+
+    for (std::thread& t : threads) t.join();
+
+    if (error) std::rethrow_exception(error);
+  }
+#  endif
+}
+
+#endif  /* FSW_PARALLEL_SCAN_H */
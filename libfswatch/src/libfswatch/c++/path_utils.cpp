@@ -13,13 +13,26 @@
  * You should have received a copy of the GNU General Public License along with
  * this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
 #include "gettext_defs.h"
 #include "path_utils.hpp"
 #include "c/libfswatch_log.h"
 #include <dirent.h>
 #include <cstdlib>
 #include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <errno.h>
+#include <climits>
+#ifdef FSW_HAVE_GETDENTS64
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/syscall.h>
+#endif
 #include <iostream>
 #include <system_error>
 
@@ -27,6 +40,12 @@ using namespace std;
 
 namespace fsw
 {
+  static bool is_dot_entry(const char *name)
+  {
+    return name[0] == '.'
+      && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+  }
+
   vector<string> get_directory_children(const string& path)
   {
     vector<string> children;
@@ -56,6 +75,195 @@ namespace fsw
     return children;
   }
 
+#ifdef FSW_HAVE_GETDENTS64
+  // Layout of the records returned by the getdents64 system call.
+  struct linux_dirent64
+  {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+  };
+
+  static const size_t DIRENT_BUFFER_SIZE = 32 * 1024;
+
+  /*
+   * Invokes fn with the name, the inode and the type of every entry of
+   * dir_fd, except for . and ..
+   */
+  template<typename F>
+  static bool for_each_dirent64(int dir_fd, vector<char>& buffer, F fn)
+  {
+    if (buffer.size() < DIRENT_BUFFER_SIZE) buffer.resize(DIRENT_BUFFER_SIZE);
+
+    for (;;)
+    {
+      long bytes = syscall(SYS_getdents64,
+                           dir_fd,
+                           buffer.data(),
+                           buffer.size());
+
+      if (bytes == -1)
+      {
+        if (errno == EINTR) continue;
+
+        fsw_log_perror("getdents64");
+        return false;
+      }
+
+      if (bytes == 0) return true;
+
+      for (long offset = 0; offset < bytes;)
+      {
+        const char *record = buffer.data() + offset;
+        const linux_dirent64 *ent =
+          reinterpret_cast<const linux_dirent64 *> (record);
+        const char *name = record + offsetof(linux_dirent64, d_name);
+
+        offset += ent->d_reclen;
+
+        if (is_dot_entry(name)) continue;
+
+        fn(name, (ino_t) ent->d_ino, ent->d_type);
+      }
+    }
+  }
+
+  bool read_directory_entries(
+    int dir_fd,
+    vector<char>& buffer,
+    const std::function<void(const char *name, unsigned char type)>& fn)
+  {
+    return for_each_dirent64(dir_fd,
+                             buffer,
+                             [&fn](const char *name, ino_t, unsigned char type)
+                             {
+                               fn(name, type);
+                             });
+  }
+
+#endif
+
+  void directory_entries::add(const char *name,
+                              size_t name_length,
+                              ino_t ino,
+                              unsigned char type)
+  {
+    const size_t offset = storage.size();
+
+    // Names are NUL-terminated so that they can be passed to the C API.
+    storage.resize(offset + name_length + 1);
+    memcpy(&storage[offset], name, name_length + 1);
+    records.push_back({offset, name_length, ino, type});
+  }
+
+  bool directory_entries::append(const string& path)
+  {
+#ifdef FSW_HAVE_GETDENTS64
+    int dir_fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (dir_fd == -1)
+    {
+      if (errno == EMFILE || errno == ENFILE)
+        perror("open");
+      else
+        fsw_logf_perror(_("Cannot open %s"), path.c_str());
+
+      return false;
+    }
+
+    const bool read = for_each_dirent64(
+      dir_fd,
+      dirent_buffer,
+      [this](const char *name, ino_t ino, unsigned char type)
+      {
+        add(name, strlen(name), ino, type);
+      });
+
+    close(dir_fd);
+
+    return read;
+#else
+    DIR *dir = opendir(path.c_str());
+
+    if (!dir)
+    {
+      if (errno == EMFILE || errno == ENFILE)
+        perror("opendir");
+      else
+        fsw_log_perror("opendir");
+
+      return false;
+    }
+
+    while (struct dirent *ent = readdir(dir))
+    {
+      const char *name = ent->d_name;
+
+      if (is_dot_entry(name)) continue;
+
+#  ifdef HAVE_STRUCT_DIRENT_D_TYPE
+      add(name, strlen(name), ent->d_ino, ent->d_type);
+#  else
+      add(name, strlen(name), ent->d_ino, DT_UNKNOWN);
+#  endif
+    }
+
+    closedir(dir);
+
+    return true;
+#endif
+  }
+
+  void directory_entries::truncate(size_t size)
+  {
+    if (size >= records.size()) return;
+
+    storage.resize(records[size].name_offset);
+    records.resize(size);
+  }
+
+  void directory_entries::clear()
+  {
+    storage.clear();
+    records.clear();
+  }
+
+  size_t directory_entries::size() const
+  {
+    return records.size();
+  }
+
+  const char *directory_entries::get_name(size_t i) const
+  {
+    return &storage[records[i].name_offset];
+  }
+
+  size_t directory_entries::get_name_length(size_t i) const
+  {
+    return records[i].name_length;
+  }
+
+  unsigned char directory_entries::get_type(size_t i) const
+  {
+    return records[i].type;
+  }
+
+  ino_t directory_entries::get_inode(size_t i) const
+  {
+    return records[i].ino;
+  }
+
+  bool directory_entries::may_be_directory(size_t i, bool follow_symlinks) const
+  {
+    const unsigned char type = records[i].type;
+
+    return type == DT_DIR
+      || type == DT_UNKNOWN
+      || (type == DT_LNK && follow_symlinks);
+  }
+
   bool read_link_path(const string& path, string& link_path)
   {
     link_path = fsw_realpath(path.c_str(), nullptr);
@@ -63,6 +271,66 @@ namespace fsw
     return true;
   }
 
+#ifdef HAVE_CXX_MUTEX
+#  define FSW_RESOLVER_GUARD \
+  std::lock_guard<std::mutex> resolver_guard(resolver_mutex)
+#else
+#  define FSW_RESOLVER_GUARD
+#endif
+
+  bool link_resolver::resolve(const string& path,
+                              const struct stat& link_stat,
+                              string& link_path)
+  {
+    const file_id id(link_stat.st_dev, link_stat.st_ino);
+
+    {
+      FSW_RESOLVER_GUARD;
+
+      auto it = links.find(id);
+
+      if (it != links.end())
+      {
+        link_path.assign(it->second);
+        return true;
+      }
+    }
+
+#ifdef PATH_MAX
+    // The resolved path is copied into the storage of link_path.
+    char resolved[PATH_MAX];
+
+    if (realpath(path.c_str(), resolved) != nullptr)
+      link_path.assign(resolved);
+    else if (errno == ENOENT)
+      link_path.assign(path);
+    else
+      throw std::system_error(errno, std::generic_category());
+#else
+    link_path = fsw_realpath(path.c_str(), nullptr);
+#endif
+
+    FSW_RESOLVER_GUARD;
+    links.emplace(id, link_path);
+
+    return true;
+  }
+
+  bool link_resolver::visit_directory(const struct stat& fd_stat)
+  {
+    FSW_RESOLVER_GUARD;
+
+    return visited_dirs.emplace(fd_stat.st_dev, fd_stat.st_ino).second;
+  }
+
+  void link_resolver::clear()
+  {
+    FSW_RESOLVER_GUARD;
+
+    links.clear();
+    visited_dirs.clear();
+  }
+
   std::string fsw_realpath(const char *path, char *resolved_path)
   {
     char *ret = realpath(path, resolved_path);
@@ -100,4 +368,13 @@ namespace fsw
     fsw_logf_perror(_("Cannot lstat %s"), path.c_str());
     return false;
   }
+
+  bool is_path_below(const string& path, const string& root)
+  {
+    if (path.compare(0, root.size(), root) != 0) return false;
+    if (path.size() == root.size()) return true;
+
+    // A root ending with a separator, such as /, already ends a component.
+    return (!root.empty() && root.back() == '/') || path[root.size()] == '/';
+  }
 }
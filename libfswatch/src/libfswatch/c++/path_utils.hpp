@@ -28,7 +28,34 @@
 
 #  include <string>
 #  include <vector>
+#  include <functional>
+#  include <map>
+#  include <set>
+#  include <utility>
+#  include <sys/types.h>
 #  include <sys/stat.h>
+#  include <dirent.h>
+#  ifdef HAVE_CXX_MUTEX
+#    include <mutex>
+#  endif
+
+#  if defined(HAVE_DECL_SYS_GETDENTS64) && HAVE_DECL_SYS_GETDENTS64
+#    define FSW_HAVE_GETDENTS64
+#  endif
+
+// The types of the directory entries are unknown where they are not reported.
+#  ifndef DT_UNKNOWN
+#    define DT_UNKNOWN 0
+#  endif
+#  ifndef DT_DIR
+#    define DT_DIR 4
+#  endif
+#  ifndef DT_REG
+#    define DT_REG 8
+#  endif
+#  ifndef DT_LNK
+#    define DT_LNK 10
+#  endif
 
 namespace fsw
 {
@@ -51,6 +78,136 @@ namespace fsw
    */
   std::vector<std::string> get_directory_children(const std::string& path);
 
+  /**
+   * @brief Entries of directories, stored in a reusable storage.
+   *
+   * The names of the entries are stored contiguously in a storage owned by
+   * the instance, together with their type, a @c DT_* constant, and their
+   * inode number.  Since the type is reported by most file systems, a scan
+   * can skip the children which are not directories without calling
+   * @c lstat() on them.  The type is @c DT_UNKNOWN if the file system or the
+   * platform does not report it.
+   *
+   * The entries of many directories can be appended, so that a recursive scan
+   * can share an instance: a scan appends the entries of a directory, scans
+   * them and truncates the instance to its previous size.  Truncating an
+   * instance retains its storage, so that no memory is allocated once it has
+   * grown to the size of the largest set of entries it holds.
+   */
+  class directory_entries
+  {
+  public:
+    /**
+     * @brief Appends the entries of a directory, except for `.` and `..`.
+     *
+     * @param path The directory whose entries must be appended.
+     * @return @c true if the function succeeds, @c false otherwise.
+     */
+    bool append(const std::string& path);
+
+    /**
+     * @brief Removes the entries following the first @p size ones.
+     *
+     * @param size The number of entries to retain.
+     */
+    void truncate(size_t size);
+
+    /**
+     * @brief Removes all the entries, retaining the storage.
+     */
+    void clear();
+
+    /**
+     * @brief Returns the number of entries.
+     *
+     * @return The number of entries.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Returns the name of an entry.
+     *
+     * The name is valid until entries are appended.
+     *
+     * @param i The index of the entry.
+     * @return The NUL-terminated name of the entry.
+     */
+    const char *get_name(size_t i) const;
+
+    /**
+     * @brief Returns the length of the name of an entry.
+     *
+     * @param i The index of the entry.
+     * @return The length of the name, excluding the terminating NUL.
+     */
+    size_t get_name_length(size_t i) const;
+
+    /**
+     * @brief Returns the type of an entry.
+     *
+     * @param i The index of the entry.
+     * @return A @c DT_* constant, @c DT_UNKNOWN if the type is not known.
+     */
+    unsigned char get_type(size_t i) const;
+
+    /**
+     * @brief Returns the inode number of an entry.
+     *
+     * @param i The index of the entry.
+     * @return The inode number of the entry.
+     */
+    ino_t get_inode(size_t i) const;
+
+    /**
+     * @brief Checks whether an entry may be a directory.
+     *
+     * @param i The index of the entry.
+     * @param follow_symlinks Whether symbolic links are followed.
+     * @return @c true if the entry is a directory, if its type is not known,
+     * or if it is a symbolic link and @p follow_symlinks is @c true.
+     */
+    bool may_be_directory(size_t i, bool follow_symlinks) const;
+
+  private:
+    struct record
+    {
+      size_t name_offset;
+      size_t name_length;
+      ino_t ino;
+      unsigned char type;
+    };
+
+    void add(const char *name, size_t name_length, ino_t ino,
+             unsigned char type);
+
+    std::vector<char> storage;
+    std::vector<record> records;
+#  ifdef FSW_HAVE_GETDENTS64
+    std::vector<char> dirent_buffer;
+#  endif
+  };
+
+#  ifdef FSW_HAVE_GETDENTS64
+  /**
+   * @brief Reads the entries of a directory using @c getdents64().
+   *
+   * The entries of the directory referred to by @p dir_fd are read in chunks
+   * into @p buffer, which can be reused across calls to avoid allocations,
+   * and @p fn is invoked with the name and the type (a @c DT_* constant) of
+   * every entry, except for `.` and `..`.  The type is @c DT_UNKNOWN if the
+   * file system does not provide it.
+   *
+   * @param dir_fd An open file descriptor referring to a directory.
+   * @param buffer The buffer used to read the directory entries.
+   * @param fn The function invoked for every entry.
+   * @return @c true if the function succeeds, @c false otherwise.
+   */
+  bool read_directory_entries(
+    int dir_fd,
+    std::vector<char>& buffer,
+    const std::function<void(const char *name, unsigned char type)>& fn);
+#  endif
+
   /**
    * @brief Resolves a path name.
    *
@@ -65,6 +222,62 @@ namespace fsw
    */
   bool read_link_path(const std::string& path, std::string& link_path);
 
+  /**
+   * @brief Cached resolution of the symbolic links met during a scan.
+   *
+   * Links are identified by the device and the inode returned by @c lstat(),
+   * so that a link reached through many paths, for example through other
+   * links to the directory containing it, is resolved only once.  Resolved
+   * paths are built in a reusable buffer instead of letting @c realpath()
+   * allocate one.  The resolver also records the directories visited during a
+   * scan, so that directories reachable through many links are scanned once
+   * and link cycles are detected without resolving paths.
+   *
+   * The caches are valid for the duration of a scan: link_resolver::clear()
+   * must be invoked before a new scan starts.  If @c HAVE_CXX_MUTEX is
+   * defined, the resolver may be shared by concurrent scan threads.
+   */
+  class link_resolver
+  {
+  public:
+    /**
+     * @brief Resolves a symbolic link.
+     *
+     * @param path The path of the link.
+     * @param link_stat The status of the link, as returned by @c lstat().
+     * @param link_path A reference to a `std::string` where the resolved
+     * absolute path is copied to.
+     * @return @c true if the function succeeds, @c false if the link cannot
+     * be resolved.
+     */
+    bool resolve(const std::string& path,
+                 const struct stat& link_stat,
+                 std::string& link_path);
+
+    /**
+     * @brief Records a directory as visited.
+     *
+     * @param fd_stat The status of the directory.
+     * @return @c true if the directory had not been visited during the
+     * current scan, @c false otherwise.
+     */
+    bool visit_directory(const struct stat& fd_stat);
+
+    /**
+     * @brief Forgets the resolved links and the visited directories.
+     */
+    void clear();
+
+  private:
+    typedef std::pair<dev_t, ino_t> file_id;
+
+    std::map<file_id, std::string> links;
+    std::set<file_id> visited_dirs;
+#  ifdef HAVE_CXX_MUTEX
+    std::mutex resolver_mutex;
+#  endif
+  };
+
   /**
    * @brief Wraps a @c lstat(path, fd_stat) call that invokes @c perror() if it
    * fails.
@@ -84,5 +297,19 @@ namespace fsw
    * @return @c true if the function succeeds, @c false otherwise.
    */
   bool stat_path(const std::string& path, struct stat& fd_stat);
+
+  /**
+   * @brief Checks whether a path is equal to or below another path.
+   *
+   * The paths are compared component by component, but they are not
+   * resolved: @p path is below @p root only if it starts with @p root
+   * followed by a path separator.
+   *
+   * @param path The path to check.
+   * @param root The path which may contain @p path.
+   * @return @c true if @p path is @p root or if it is below @p root, @c false
+   * otherwise.
+   */
+  bool is_path_below(const std::string& path, const std::string& root);
 }
 #endif  /* FSW_PATH_UTILS_H */
@@ -21,32 +21,333 @@
 #include "poll_monitor.hpp"
 #include <unistd.h>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
 #include <fcntl.h>
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <utility>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#ifdef HAVE_CXX_MUTEX
+#  include <mutex>
+#  include <thread>
+#endif
 #include "c/libfswatch_log.h"
+#include "libfswatch_exception.hpp"
 #include "path_utils.hpp"
-#include "libfswatch_map.hpp"
-
-#if defined HAVE_STRUCT_STAT_ST_MTIME
-#  define FSW_MTIME(stat) ((stat).st_mtime)
-#  define FSW_CTIME(stat) ((stat).st_ctime)
-#elif defined HAVE_STRUCT_STAT_ST_MTIMESPEC
-#  define FSW_MTIME(stat) (stat.st_mtimespec.tv_sec)
-#  define FSW_CTIME(stat) (stat.st_ctimespec.tv_sec)
-#endif
+#include "batch_stat.hpp"
+#include "parallel_scan.hpp"
 
 namespace fsw
 {
   using std::vector;
   using std::string;
 
+  static const size_t NO_ENTRY = static_cast<size_t> (-1);
+
+  /*
+   * Snapshot of the tracked files.  Entries are sorted by path and each entry
+   * only stores the suffix of its path which is not shared with the path of
+   * the previous entry: since the contents of a directory are stored
+   * contiguously, the common directory prefixes are stored only once.  The
+   * containers are cleared instead of being released, so that their storage
+   * is reused by the following scans.
+   */
   typedef struct poll_monitor::poll_monitor_data
   {
-    fsw_hash_map<string, poll_monitor::watched_file_info> tracked_files;
+    struct entry
+    {
+      size_t suffix_offset;
+      uint32_t prefix_length;
+      uint32_t suffix_length;
+      // Number of entries contained in the subtree rooted at this entry.
+      uint32_t subtree_size;
+      // Link count of a directory, 0 for any other type of file.
+      uint32_t link_count;
+      // Whether the directory contains symbolic links which were followed.
+      bool follows_links;
+      watched_file_info info;
+    };
+
+    vector<char> suffixes;
+    vector<entry> entries;
+    // Index of the entry of each path to watch.
+    vector<size_t> root_indexes;
+    string last_path;
+    vector<size_t> open_entries;
+
+    void clear(size_t root_number)
+    {
+      suffixes.clear();
+      entries.clear();
+      root_indexes.assign(root_number, NO_ENTRY);
+      last_path.clear();
+      open_entries.clear();
+    }
+
+    // Paths must be appended in order.
+    void append(const char *path,
+                size_t length,
+                const watched_file_info& info,
+                uint32_t link_count,
+                bool follows_links)
+    {
+      const size_t max_prefix = std::min(length, last_path.size());
+      size_t prefix = 0;
+
+      while (prefix < max_prefix && last_path[prefix] == path[prefix]) ++prefix;
+
+      // Close the subtrees which do not contain this path.
+      while (!open_entries.empty())
+      {
+        const size_t top = open_entries.back();
+        const size_t top_length = entries[top].prefix_length
+                                  + entries[top].suffix_length;
+
+        if (prefix >= top_length
+            && length > top_length
+            && path[top_length] == '/')
+          break;
+
+        entries[top].subtree_size = entries.size() - top - 1;
+        open_entries.pop_back();
+      }
+
+      open_entries.push_back(entries.size());
+      entries.push_back({suffixes.size(),
+                         static_cast<uint32_t> (prefix),
+                         static_cast<uint32_t> (length - prefix),
+                         0,
+                         link_count,
+                         follows_links,
+                         info});
+      suffixes.insert(suffixes.end(), path + prefix, path + length);
+
+      last_path.resize(prefix);
+      last_path.append(path + prefix, length - prefix);
+    }
+
+    void finish()
+    {
+      for (const size_t open_entry : open_entries)
+        entries[open_entry].subtree_size = entries.size() - open_entry - 1;
+
+      open_entries.clear();
+    }
+
+    /*
+     * Reads the path of an entry.  path must contain the path of the previous
+     * entry, or the path of any entry preceding it whose subtree contains all
+     * the entries in between.
+     */
+    void read_path(size_t index, string& path) const
+    {
+      const entry& e = entries[index];
+
+      path.resize(e.prefix_length);
+      path.append(suffixes.data() + e.suffix_offset, e.suffix_length);
+    }
+
+    /*
+     * Checks that the entries loaded from a snapshot are consistent: the
+     * suffixes must lie in the suffix storage, the prefixes must be shared
+     * with the previous path and the subtrees must be nested in the subtree
+     * of their parent.
+     */
+    bool is_consistent() const
+    {
+      size_t last_length = 0;
+      vector<size_t> subtree_ends;
+
+      for (size_t i = 0; i < entries.size(); ++i)
+      {
+        const entry& e = entries[i];
+
+        if (e.suffix_offset > suffixes.size()
+            || e.suffix_length > suffixes.size() - e.suffix_offset)
+          return false;
+
+        if (e.prefix_length > last_length) return false;
+
+        while (!subtree_ends.empty() && subtree_ends.back() <= i)
+          subtree_ends.pop_back();
+
+        const size_t limit = subtree_ends.empty()
+                             ? entries.size()
+                             : subtree_ends.back();
+
+        if (e.subtree_size >= limit - i) return false;
+
+        subtree_ends.push_back(i + 1 + e.subtree_size);
+        last_length = size_t(e.prefix_length) + e.suffix_length;
+      }
+
+      return true;
+    }
   }
   poll_monitor_data;
 
+  /*
+   * Files collected during a scan.  Full paths are appended to an arena and
+   * records refer to them by offset, since the arena may be reallocated while
+   * the scan is in progress.
+   */
+  struct poll_monitor::poll_scan_shard
+  {
+    struct record
+    {
+      size_t path_offset;
+      size_t path_length;
+      uint32_t link_count;
+      watched_file_info info;
+    };
+
+    vector<char> paths;
+    vector<record> records;
+    // Directories containing symbolic links which were followed.
+    vector<string> link_parents;
+    vector<char> dirent_buffer;
+    // Batched status calls, used when io_uring is enabled.
+    std::unique_ptr<batch_stat> stats;
+    vector<char> names;
+    vector<size_t> name_offsets;
+    vector<const char *> name_ptrs;
+    vector<struct stat> name_stats;
+    vector<int> name_errors;
+  };
+
+  /*
+   * A path to scan.  When the path was tracked by the previous snapshot,
+   * previous_index is the index of its entry.
+   */
+  struct poll_monitor::poll_scan_item
+  {
+    string path;
+    size_t previous_index;
+    // Whether the file was checked and recorded by the scan of its parent, in
+    // which case fd_stat contains its status.
+    bool checked;
+    struct stat fd_stat;
+  };
+
+  struct poll_monitor::poll_scan_result
+  {
+    const char *path;
+    size_t length;
+    uint32_t link_count;
+    bool follows_links;
+    const watched_file_info *info;
+  };
+
+  struct poll_monitor::poll_scan_data
+  {
+    // One shard for each scan thread.
+    vector<poll_scan_shard> shards;
+    vector<poll_scan_result> results;
+    // Links resolved and directories visited during the current scan.
+    link_resolver links;
+    // Whether unchanged directories are not read during the current scan.
+    bool incremental = false;
+    // Time of the scan which produced the previous snapshot.
+    time_t previous_time = 0;
+    unsigned int scans_since_full_scan = 0;
+    // Whether the next scan must be a full scan.
+    bool force_full_scan = false;
+    time_t last_save_time = 0;
+    /*
+     * Paths added and removed since the previous scan, and the paths which
+     * were watched by it.  The files found below an added path are recorded
+     * without being notified as created, and the files which are no longer
+     * watched are dropped without being notified as removed.
+     */
+    vector<string> added_paths;
+    vector<string> removed_paths;
+    vector<string> previous_paths;
+  };
+
+#ifdef HAVE_SYS_MMAN_H
+  static const char SNAPSHOT_MAGIC[8] = {'F', 'S', 'W', 'P', 'O', 'L', 'L', 0};
+  static const uint32_t SNAPSHOT_VERSION = 3;
+  static const uint32_t SNAPSHOT_RECURSIVE = 1 << 0;
+  static const uint32_t SNAPSHOT_FOLLOW_SYMLINKS = 1 << 1;
+
+  /*
+   * Header of a persisted snapshot.  The header is followed by the entries,
+   * the indexes of the root entries, the paths to watch separated by NUL
+   * characters and the path suffixes.  Entries are stored with their
+   * in-memory layout: files written by a build with a different layout are
+   * rejected because of their version or entry size.
+   */
+  struct poll_snapshot_header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t options;
+    uint32_t reserved;
+    uint64_t entry_count;
+    uint64_t root_count;
+    uint64_t roots_size;
+    uint64_t suffix_size;
+    int64_t scan_time;
+  };
+
+  /*
+   * Takes a section of count elements from the remaining size of a snapshot.
+   * Returns false if the section is larger than the remaining size.
+   */
+  static bool take_snapshot_section(uint64_t count,
+                                    size_t element_size,
+                                    size_t& remaining)
+  {
+    if (count > remaining / element_size) return false;
+
+    remaining -= static_cast<size_t> (count) * element_size;
+
+    return true;
+  }
+#endif
+
+  /*
+   * Compares two paths.  The path separator is ordered before any other
+   * character, so that a directory is immediately followed by its contents.
+   */
+  static int compare_paths(const char *lhs, size_t lhs_length,
+                           const char *rhs, size_t rhs_length)
+  {
+    const size_t length = std::min(lhs_length, rhs_length);
+
+    for (size_t i = 0; i < length; ++i)
+    {
+      if (lhs[i] == rhs[i]) continue;
+      if (lhs[i] == '/') return -1;
+      if (rhs[i] == '/') return 1;
+
+      return static_cast<unsigned char> (lhs[i]) <
+             static_cast<unsigned char> (rhs[i]) ? -1 : 1;
+    }
+
+    if (lhs_length == rhs_length) return 0;
+
+    return lhs_length < rhs_length ? -1 : 1;
+  }
+
+  static bool is_below_any(const string& path, const vector<string>& roots)
+  {
+    for (const string& root : roots)
+    {
+      if (is_path_below(path, root)) return true;
+    }
+
+    return false;
+  }
+
   poll_monitor::poll_monitor(vector<string> paths,
                              FSW_EVENT_CALLBACK *callback,
                              void *context) :
@@ -54,147 +355,990 @@ namespace fsw
   {
     previous_data = new poll_monitor_data();
     new_data = new poll_monitor_data();
-    time(&curr_time);
+    scan_data = new poll_scan_data();
+    curr_time = event::get_current_time();
   }
 
   poll_monitor::~poll_monitor()
   {
     delete previous_data;
     delete new_data;
+    delete scan_data;
   }
 
-  bool poll_monitor::initial_scan_callback(const string& path,
-                                           const struct stat& stat)
+  bool poll_monitor::accept_scan_path(string& path,
+                                      struct stat& fd_stat) const
   {
-    if (previous_data->tracked_files.count(path))
-      return false;
+    if (!lstat_path(path, fd_stat)) return false;
+
+    if (follow_symlinks && S_ISLNK(fd_stat.st_mode))
+    {
+      string link_path;
+      if (!scan_data->links.resolve(path, fd_stat, link_path)) return false;
 
-    watched_file_info wfi{FSW_MTIME(stat), FSW_CTIME(stat)};
-    previous_data->tracked_files[path] = wfi;
+      // A dangling link resolves to itself.
+      if (link_path == path) return false;
 
-    return true;
+      path.swap(link_path);
+
+      return accept_scan_path(path, fd_stat);
+    }
+
+    // A rejected directory is still scanned if paths below it may be accepted.
+    return accept_path(path)
+      || (S_ISDIR(fd_stat.st_mode) && accept_subtree(path));
+  }
+
+  /*
+   * Records a directory as visited.  Returns false if the directory has been
+   * visited during the current scan, avoiding scanning overlapping paths or
+   * symbolic link loops more than once.
+   */
+  bool poll_monitor::visit_directory(const struct stat& fd_stat)
+  {
+    return scan_data->links.visit_directory(fd_stat);
+  }
+
+  void poll_monitor::record_path(const string& path,
+                                 const watched_file_info& info,
+                                 uint32_t link_count,
+                                 poll_scan_shard& shard)
+  {
+    shard.records.push_back({shard.paths.size(),
+                             path.size(),
+                             link_count,
+                             info});
+    shard.paths.insert(shard.paths.end(), path.begin(), path.end());
+  }
+
+  /*
+   * Checks whether the contents of a directory can be assumed not to have
+   * changed since the previous scan.  A directory whose times are not older
+   * than the previous scan may have been modified after it was checked in the
+   * same second, and it is always considered changed.  A directory containing
+   * followed symbolic links is always considered changed too: the entries of
+   * the link targets are stored with their own paths, outside the subtree of
+   * the directory, and they could not be taken from the previous snapshot.
+   */
+  bool poll_monitor::is_unchanged_directory(size_t previous_index,
+                                            const struct stat& fd_stat) const
+  {
+    const poll_monitor_data::entry& e = previous_data->entries[previous_index];
+
+    return !e.follows_links
+      && e.link_count == fd_stat.st_nlink
+      && tree_snapshot::same_file_info(e.info,
+                                       tree_snapshot::get_file_info(fd_stat))
+      && e.info.mtime < scan_data->previous_time
+      && e.info.ctime < scan_data->previous_time;
   }
 
-  bool poll_monitor::intermediate_scan_callback(const string& path,
-                                                const struct stat& stat)
+  static size_t find_previous_child(
+    const vector<std::pair<string, size_t>>& previous_children,
+    const char *name,
+    size_t length)
   {
-    if (new_data->tracked_files.count(path)) return false;
+    // Siblings are sorted by name in the snapshot.
+    auto it = std::lower_bound(previous_children.begin(),
+                               previous_children.end(),
+                               name,
+                               [length](const std::pair<string, size_t>& lhs,
+                                        const char *rhs)
+                               {
+                                 return compare_paths(lhs.first.data(),
+                                                      lhs.first.size(),
+                                                      rhs,
+                                                      length) < 0;
+                               });
 
-    watched_file_info wfi{FSW_MTIME(stat), FSW_CTIME(stat)};
-    new_data->tracked_files[path] = wfi;
+    if (it == previous_children.end()) return NO_ENTRY;
+    if (it->first.compare(0, string::npos, name, length) != 0) return NO_ENTRY;
 
-    if (previous_data->tracked_files.count(path))
+    return it->second;
+  }
+
+  /*
+   * Scans an item and appends the items of its children to children.  In
+   * incremental mode, the children of a directory which has not changed are
+   * taken from the previous snapshot: only subdirectories are scanned, while
+   * the records of the other files are copied without checking them.
+   */
+  void poll_monitor::scan(poll_scan_item& item,
+                          poll_scan_shard& shard,
+                          vector<poll_scan_item>& children)
+  {
+    string& path = item.path;
+    const string requested_path =
+      ((scan_data->incremental || follow_symlinks) && !item.checked)
+      ? path : string();
+    struct stat& fd_stat = item.fd_stat;
+
+    if (!item.checked)
     {
-      watched_file_info pwfi = previous_data->tracked_files[path];
-      vector<fsw_event_flag> flags;
+      if (!accept_scan_path(path, fd_stat)) return;
 
-      if (FSW_MTIME(stat) > pwfi.mtime)
+      // The directory containing a followed link is marked in the snapshot.
+      if (follow_symlinks && path != requested_path)
       {
-        flags.push_back(fsw_event_flag::Updated);
+        const size_t separator = requested_path.rfind('/');
+
+        if (separator != string::npos)
+          shard.link_parents.push_back(requested_path.substr(0, separator));
       }
 
-      if (FSW_CTIME(stat) > pwfi.ctime)
+      const bool is_dir = S_ISDIR(fd_stat.st_mode);
+
+      record_path(path,
+                  tree_snapshot::get_file_info(fd_stat),
+                  is_dir ? fd_stat.st_nlink : 0,
+                  shard);
+      list_inventory_entry(path, fd_stat.st_mode);
+    }
+
+    if (!recursive) return;
+    if (!S_ISDIR(fd_stat.st_mode)) return;
+    if (!accept_subtree(path)) return;
+    if (!visit_directory(fd_stat)) return;
+
+    // The previous entry cannot be used if a symbolic link was followed.
+    size_t previous_index = item.previous_index;
+    if (!scan_data->incremental || (!item.checked && path != requested_path))
+      previous_index = NO_ENTRY;
+
+    const bool unchanged = previous_index != NO_ENTRY
+                           && is_unchanged_directory(previous_index, fd_stat);
+    vector<std::pair<string, size_t>> previous_children;
+
+    if (previous_index != NO_ENTRY)
+    {
+      const poll_monitor_data& data = *previous_data;
+      const size_t end = previous_index + 1
+                         + data.entries[previous_index].subtree_size;
+      string child_path = path;
+
+      for (size_t i = previous_index + 1; i < end;
+           i += data.entries[i].subtree_size + 1)
       {
-        flags.push_back(fsw_event_flag::AttributeModified);
+        data.read_path(i, child_path);
+        const poll_monitor_data::entry& e = data.entries[i];
+
+        if (!unchanged)
+        {
+          previous_children.emplace_back(child_path.substr(path.size() + 1), i);
+        }
+        else if (e.link_count != 0)
+        {
+          children.push_back({child_path, i, false, {}});
+        }
+        else
+        {
+          record_path(child_path, e.info, 0, shard);
+        }
       }
+    }
+
+    if (unchanged) return;
+
+    scan_children(path, previous_children, shard, children);
+  }
+
+  /*
+   * Reads a directory and appends the items of its children to children.
+   * When getdents64() is available, the children are checked using fstatat()
+   * relative to the directory descriptor, which saves the kernel the
+   * resolution of their full path.  Child paths are built in a reusable
+   * buffer and the files which are not directories are recorded here, so
+   * that only directories and symbolic links to follow are queued.  When
+   * io_uring is enabled, the children are checked in a single batch after the
+   * directory has been read.
+   */
+  void poll_monitor::scan_children(
+    const string& path,
+    const vector<std::pair<string, size_t>>& previous_children,
+    poll_scan_shard& shard,
+    vector<poll_scan_item>& children)
+  {
+#ifdef FSW_HAVE_GETDENTS64
+    int dir_fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (dir_fd == -1)
+    {
+      fsw_logf_perror(_("Cannot open %s"), path.c_str());
+      return;
+    }
 
-      if (!flags.empty())
+    string child_path = path + "/";
+    const size_t parent_length = child_path.size();
+
+    // Records a child whose status is known, and queues it if needed.
+    auto scan_status = [&](const char *name,
+                           size_t name_length,
+                           const struct stat& fd_stat)
+    {
+      if (follow_symlinks && S_ISLNK(fd_stat.st_mode))
+      {
+        children.push_back({child_path, NO_ENTRY, false, {}});
+        return;
+      }
+
+      const bool is_dir = S_ISDIR(fd_stat.st_mode);
+
+      if (!accept_path(child_path) && !(is_dir && accept_subtree(child_path)))
+        return;
+
+      record_path(child_path,
+                  tree_snapshot::get_file_info(fd_stat),
+                  is_dir ? fd_stat.st_nlink : 0,
+                  shard);
+      list_inventory_entry(child_path, fd_stat.st_mode);
+
+      if (!is_dir) return;
+
+      const size_t previous_index = previous_children.empty()
+        ? NO_ENTRY
+        : find_previous_child(previous_children, name, name_length);
+
+      children.push_back({child_path, previous_index, true, fd_stat});
+    };
+
+    auto scan_entry = [&](const char *name, unsigned char type)
+    {
+      const size_t name_length = strlen(name);
+
+      child_path.resize(parent_length);
+      child_path.append(name, name_length);
+
+      // Symbolic links are resolved by the scan of their own item.
+      if (follow_symlinks && type == DT_LNK)
+      {
+        children.push_back({child_path, NO_ENTRY, false, {}});
+        return;
+      }
+
+      // The status of the children is retrieved later in a single batch.
+      if (shard.stats)
+      {
+        shard.name_offsets.push_back(shard.names.size());
+        shard.names.insert(shard.names.end(), name, name + name_length + 1);
+        return;
+      }
+
+      struct stat fd_stat;
+
+      if (fstatat(dir_fd, name, &fd_stat, AT_SYMLINK_NOFOLLOW) != 0)
       {
-        events.emplace_back(path, curr_time, flags);
+        fsw_logf_perror(_("Cannot lstat %s"), child_path.c_str());
+        return;
       }
 
-      previous_data->tracked_files.erase(path);
+      scan_status(name, name_length, fd_stat);
+    };
+
+    if (shard.stats)
+    {
+      shard.names.clear();
+      shard.name_offsets.clear();
     }
-    else
+
+    read_directory_entries(dir_fd, shard.dirent_buffer, scan_entry);
+
+    if (shard.stats && !shard.name_offsets.empty())
     {
-      vector<fsw_event_flag> flags;
-      flags.push_back(fsw_event_flag::Created);
-      events.emplace_back(path, curr_time, flags);
+      shard.name_ptrs.clear();
+
+      for (size_t offset : shard.name_offsets)
+        shard.name_ptrs.push_back(shard.names.data() + offset);
+
+      shard.stats->lstat_at(dir_fd,
+                            shard.name_ptrs,
+                            shard.name_stats,
+                            shard.name_errors);
+
+      for (size_t i = 0; i < shard.name_ptrs.size(); ++i)
+      {
+        const char *name = shard.name_ptrs[i];
+        const size_t name_length = strlen(name);
+
+        child_path.resize(parent_length);
+        child_path.append(name, name_length);
+
+        if (shard.name_errors[i] != 0)
+        {
+          errno = shard.name_errors[i];
+          fsw_logf_perror(_("Cannot lstat %s"), child_path.c_str());
+          continue;
+        }
+
+        scan_status(name, name_length, shard.name_stats[i]);
+      }
     }
 
-    return true;
+    close(dir_fd);
+#else
+    for (const string& child : get_directory_children(path))
+    {
+      if (child == "." || child == "..") continue;
+
+      const size_t previous_index = previous_children.empty()
+        ? NO_ENTRY
+        : find_previous_child(previous_children, child.c_str(), child.size());
+
+      children.push_back({path + "/" + child, previous_index, false, {}});
+    }
+#endif
   }
 
-  bool poll_monitor::add_path(const string& path,
-                              const struct stat& fd_stat,
-                              poll_monitor_scan_callback poll_callback)
+  void poll_monitor::parallel_scan(vector<poll_scan_item>& items)
   {
-    return ((*this).*(poll_callback))(path, fd_stat);
+#ifdef HAVE_CXX_MUTEX
+    scan_in_parallel(items,
+                     scan_threads,
+                     get_thread_settings(fsw_thread_worker),
+                     [this](unsigned int worker,
+                            poll_scan_item& item,
+                            vector<poll_scan_item>& children)
+                     {
+                       scan(item, scan_data->shards[worker], children);
+                     });
+#endif
   }
 
-  void poll_monitor::scan(const string& path, poll_monitor_scan_callback fn)
+  /*
+   * Scans the paths to watch and sorts the collected files by path.  The
+   * results refer to the storage of the shards and are valid until the next
+   * scan.
+   */
+  void poll_monitor::scan_paths()
   {
-    struct stat fd_stat;
-    if (!lstat_path(path, fd_stat)) return;
+    for (poll_scan_shard& shard : scan_data->shards)
+    {
+      shard.paths.clear();
+      shard.records.clear();
+      shard.link_parents.clear();
+    }
 
-    if (follow_symlinks && S_ISLNK(fd_stat.st_mode))
+    scan_data->links.clear();
+
+    vector<poll_scan_item> items;
+
+    for (size_t i = 0; i < paths.size(); ++i)
     {
-      string link_path;
-      if (read_link_path(path, link_path))
-        scan(link_path, fn);
+      const size_t previous_index = i < previous_data->root_indexes.size()
+                                    ? previous_data->root_indexes[i]
+                                    : NO_ENTRY;
+      items.push_back({paths[i], previous_index, false, {}});
+    }
 
-      return;
+    if (scan_threads > 1)
+    {
+      parallel_scan(items);
     }
+    else
+    {
+      // Items are scanned depth-first, as they are popped from the back.
+      std::reverse(items.begin(), items.end());
+      vector<poll_scan_item> children;
 
-    if (!accept_path(path)) return;
-    if (!add_path(path, fd_stat, fn)) return;
-    if (!recursive) return;
-    if (!S_ISDIR(fd_stat.st_mode)) return;
+      while (!items.empty())
+      {
+        poll_scan_item item = std::move(items.back());
+        items.pop_back();
+
+        children.clear();
+        scan(item, scan_data->shards[0], children);
+
+        for (auto it = children.rbegin(); it != children.rend(); ++it)
+          items.push_back(std::move(*it));
+      }
+    }
 
-    vector<string> children = get_directory_children(path);
+    vector<poll_scan_result>& results = scan_data->results;
+    results.clear();
 
-    for (const string& child : children)
+    for (const poll_scan_shard& shard : scan_data->shards)
     {
-      if (child == "." || child == "..") continue;
+      for (const poll_scan_shard::record& record : shard.records)
+      {
+        results.push_back({shard.paths.data() + record.path_offset,
+                           record.path_length,
+                           record.link_count,
+                           false,
+                           &record.info});
+      }
+    }
+
+    auto less = [](const poll_scan_result& lhs,
+                   const poll_scan_result& rhs)
+    {
+      return compare_paths(lhs.path, lhs.length, rhs.path, rhs.length) < 0;
+    };
+
+    auto equal = [](const poll_scan_result& lhs,
+                    const poll_scan_result& rhs)
+    {
+      return compare_paths(lhs.path, lhs.length, rhs.path, rhs.length) == 0;
+    };
+
+    // The same file may be reached more than once through different paths.
+    std::sort(results.begin(), results.end(), less);
+    results.erase(std::unique(results.begin(), results.end(), equal),
+                  results.end());
+
+    for (const poll_scan_shard& shard : scan_data->shards)
+    {
+      for (const string& parent : shard.link_parents)
+      {
+        const poll_scan_result key{parent.data(), parent.size(), 0, false,
+                                   nullptr};
+        auto it = std::lower_bound(results.begin(), results.end(), key, less);
 
-      scan(path + "/" + child, fn);
+        if (it != results.end() && equal(*it, key)) it->follows_links = true;
+      }
     }
   }
 
-  void poll_monitor::find_removed_files()
+  /*
+   * Applies the changes of the paths to watch before a scan.  Since every scan
+   * walks all the paths to watch, an added path is scanned without rescanning
+   * the other ones, while the entries of a removed path are dropped from the
+   * snapshot built by the scan.
+   */
+  void poll_monitor::update_root_paths()
   {
-    vector<fsw_event_flag> flags;
-    flags.push_back(fsw_event_flag::Removed);
+    vector<string> previous_paths = paths;
+    vector<path_change> changes = take_path_changes();
+
+    if (changes.empty()) return;
 
-    for (auto& removed : previous_data->tracked_files)
+    for (const path_change& change : changes)
     {
-      events.emplace_back(removed.first, curr_time, flags);
+      if (change.added)
+        scan_data->added_paths.push_back(change.path);
+      else
+        scan_data->removed_paths.push_back(change.path);
     }
+
+    // The entries of the paths which are still watched are kept.
+    vector<size_t> root_indexes(paths.size(), NO_ENTRY);
+
+    for (size_t i = 0; i < previous_paths.size(); ++i)
+    {
+      if (i >= previous_data->root_indexes.size()) break;
+
+      auto it = std::find(paths.begin(), paths.end(), previous_paths[i]);
+      if (it != paths.end())
+        root_indexes[it - paths.begin()] = previous_data->root_indexes[i];
+    }
+
+    previous_data->root_indexes.swap(root_indexes);
+    scan_data->previous_paths.swap(previous_paths);
   }
 
-  void poll_monitor::swap_data_containers()
+  bool poll_monitor::is_added_path(const string& path) const
   {
-    delete previous_data;
-    previous_data = new_data;
-    new_data = new poll_monitor_data();
+    return is_below_any(path, scan_data->added_paths)
+      && !is_below_any(path, scan_data->previous_paths);
   }
 
+  bool poll_monitor::is_removed_path(const string& path) const
+  {
+    return is_unwatched_path(path, scan_data->removed_paths);
+  }
+
+  void poll_monitor::store_result(const poll_scan_result& result)
+  {
+    const size_t index = new_data->entries.size();
+
+    new_data->append(result.path,
+                     result.length,
+                     *result.info,
+                     result.link_count,
+                     result.follows_links);
+
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+      if (paths[i].size() == result.length
+          && paths[i].compare(0, string::npos, result.path, result.length) == 0)
+        new_data->root_indexes[i] = index;
+    }
+  }
+
+  /*
+   * Compares the results of a scan with the previous snapshot.  Both are
+   * sorted by path, hence they are merged linearly while the new snapshot is
+   * being built.
+   */
   void poll_monitor::collect_data()
   {
-    poll_monitor_scan_callback fn = &poll_monitor::intermediate_scan_callback;
+    using std::chrono::steady_clock;
 
-    for (string& path : paths)
+    const steady_clock::time_point start = steady_clock::now();
+
+    // Unchanged directories are read anyway during a periodic full scan.
+    scan_data->incremental = incremental && !scan_data->force_full_scan;
+    scan_data->force_full_scan = false;
+
+    if (incremental && full_scan_interval > 0
+        && ++scan_data->scans_since_full_scan >= full_scan_interval)
     {
-      scan(path, fn);
+      scan_data->incremental = false;
+      scan_data->scans_since_full_scan = 0;
     }
 
-    find_removed_files();
-    swap_data_containers();
+    scan_paths();
+
+    const vector<poll_scan_result>& results = scan_data->results;
+    const size_t previous_count = previous_data->entries.size();
+    size_t previous_index = 0;
+    size_t result_index = 0;
+    string previous_path;
+
+    if (previous_count > 0) previous_data->read_path(0, previous_path);
+
+    new_data->clear(paths.size());
+
+    const bool paths_changed = !scan_data->added_paths.empty()
+      || !scan_data->removed_paths.empty();
+
+    while (previous_index < previous_count || result_index < results.size())
+    {
+      int order;
+
+      if (previous_index == previous_count)
+        order = 1;
+      else if (result_index == results.size())
+        order = -1;
+      else
+        order = compare_paths(previous_path.data(),
+                              previous_path.size(),
+                              results[result_index].path,
+                              results[result_index].length);
+
+      if (order < 0)
+      {
+        if (!paths_changed || !is_removed_path(previous_path))
+        {
+          vector<fsw_event_flag> flags;
+          flags.push_back(fsw_event_flag::Removed);
+          events.emplace_back(previous_path, curr_time, flags);
+        }
+      }
+      else
+      {
+        const poll_scan_result& result = results[result_index++];
+        vector<fsw_event_flag> flags;
+
+        if (order > 0)
+        {
+          if (!paths_changed
+              || !is_added_path(string(result.path, result.length)))
+            flags.push_back(fsw_event_flag::Created);
+        }
+        else
+        {
+          tree_snapshot::get_change_flags(
+            *result.info,
+            previous_data->entries[previous_index].info,
+            flags);
+        }
+
+        if (!flags.empty())
+        {
+          events.emplace_back(string(result.path, result.length),
+                              curr_time,
+                              flags);
+        }
+
+        store_result(result);
+
+        if (order > 0) continue;
+      }
+
+      if (++previous_index < previous_count)
+        previous_data->read_path(previous_index, previous_path);
+    }
+
+    new_data->finish();
+    std::swap(previous_data, new_data);
+    scan_data->previous_time = curr_time.tv_sec;
+
+    scan_data->added_paths.clear();
+    scan_data->removed_paths.clear();
+    scan_data->previous_paths.clear();
+
+    count_scan(steady_clock::now() - start);
+    set_watch_count(previous_data->entries.size());
   }
 
   void poll_monitor::collect_initial_data()
   {
-    poll_monitor_scan_callback fn = &poll_monitor::initial_scan_callback;
+    using std::chrono::steady_clock;
+
+    const steady_clock::time_point start = steady_clock::now();
+
+    curr_time = event::get_current_time();
+    scan_paths();
+
+    new_data->clear(paths.size());
+
+    for (const poll_scan_result& result : scan_data->results)
+    {
+      store_result(result);
+    }
+
+    new_data->finish();
+    std::swap(previous_data, new_data);
+    scan_data->previous_time = curr_time.tv_sec;
+
+    count_scan(steady_clock::now() - start);
+    set_watch_count(previous_data->entries.size());
+  }
+
+  uint32_t poll_monitor::get_snapshot_options() const
+  {
+#ifdef HAVE_SYS_MMAN_H
+    return (recursive ? SNAPSHOT_RECURSIVE : 0)
+      | (follow_symlinks ? SNAPSHOT_FOLLOW_SYMLINKS : 0);
+#else
+    return 0;
+#endif
+  }
+
+  /*
+   * Loads the snapshot saved by a previous instance into previous_data.  The
+   * snapshot is only used if it was saved by a compatible build watching the
+   * same paths with the same options.
+   */
+  bool poll_monitor::load_snapshot()
+  {
+#ifdef HAVE_SYS_MMAN_H
+    int fd = open(snapshot_path.c_str(), O_RDONLY);
 
-    for (string& path : paths)
+    if (fd == -1)
     {
-      scan(path, fn);
+      if (errno != ENOENT)
+        fsw_logf_perror(_("Cannot open %s"), snapshot_path.c_str());
+
+      return false;
     }
+
+    struct stat fd_stat;
+
+    if (fstat(fd, &fd_stat) != 0
+        || fd_stat.st_size < (off_t) sizeof(poll_snapshot_header))
+    {
+      close(fd);
+      return false;
+    }
+
+    const size_t file_size = fd_stat.st_size;
+    void *map = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+      fsw_logf_perror(_("Cannot map %s"), snapshot_path.c_str());
+      return false;
+    }
+
+    const char *data = static_cast<const char *> (map);
+    poll_snapshot_header header;
+    memcpy(&header, data, sizeof(header));
+
+    string roots;
+    for (const string& path : paths)
+    {
+      roots += path;
+      roots += '\0';
+    }
+
+    // The sizes of the sections are checked without overflowing.
+    size_t remaining = file_size - sizeof(header);
+    bool valid = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0
+      && header.version == SNAPSHOT_VERSION
+      && header.entry_size == sizeof(poll_monitor_data::entry)
+      && header.options == get_snapshot_options()
+      && header.root_count == paths.size()
+      && header.roots_size == roots.size()
+      && take_snapshot_section(header.entry_count,
+                               sizeof(poll_monitor_data::entry),
+                               remaining)
+      && take_snapshot_section(header.root_count, sizeof(uint64_t), remaining)
+      && take_snapshot_section(header.roots_size, 1, remaining)
+      && header.suffix_size == remaining;
+
+    const size_t entries_size = valid
+      ? header.entry_count * sizeof(poll_monitor_data::entry)
+      : 0;
+    const size_t indexes_size = valid ? header.root_count * sizeof(uint64_t) : 0;
+    const char *entries = data + sizeof(header);
+    const char *indexes = entries + entries_size;
+    const char *root_paths = indexes + indexes_size;
+    const char *suffixes = root_paths + (valid ? header.roots_size : 0);
+
+    if (valid) valid = (memcmp(root_paths, roots.data(), roots.size()) == 0);
+
+    if (valid)
+    {
+      const poll_monitor_data::entry *first =
+        reinterpret_cast<const poll_monitor_data::entry *> (entries);
+
+      previous_data->clear(paths.size());
+      previous_data->entries.assign(first, first + header.entry_count);
+      previous_data->suffixes.assign(suffixes, suffixes + header.suffix_size);
+
+      for (size_t i = 0; i < paths.size(); ++i)
+      {
+        uint64_t index;
+        memcpy(&index, indexes + i * sizeof(index), sizeof(index));
+        previous_data->root_indexes[i] = (index < header.entry_count)
+                                         ? static_cast<size_t> (index)
+                                         : NO_ENTRY;
+      }
+
+      valid = previous_data->is_consistent();
+      scan_data->previous_time = header.scan_time;
+    }
+
+    munmap(map, file_size);
+
+    if (!valid)
+    {
+      previous_data->clear(paths.size());
+      FSW_ELOGF(_("Ignoring incompatible snapshot: %s\n"),
+                snapshot_path.c_str());
+      return false;
+    }
+
+    FSW_ELOGF(_("Loaded snapshot: %s\n"), snapshot_path.c_str());
+
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  /*
+   * Saves previous_data to the snapshot file.  The snapshot is written to a
+   * temporary file which then replaces the snapshot file, so that a snapshot
+   * is never partially written.
+   */
+  void poll_monitor::save_snapshot()
+  {
+#ifdef HAVE_SYS_MMAN_H
+    const poll_monitor_data& snapshot = *previous_data;
+    string roots;
+
+    for (const string& path : paths)
+    {
+      roots += path;
+      roots += '\0';
+    }
+
+    poll_snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.entry_size = sizeof(poll_monitor_data::entry);
+    header.options = get_snapshot_options();
+    header.entry_count = snapshot.entries.size();
+    header.root_count = paths.size();
+    header.roots_size = roots.size();
+    header.suffix_size = snapshot.suffixes.size();
+    header.scan_time = scan_data->previous_time;
+
+    const size_t entries_size =
+      header.entry_count * sizeof(poll_monitor_data::entry);
+    const size_t indexes_size = header.root_count * sizeof(uint64_t);
+    const size_t file_size = sizeof(header) + entries_size + indexes_size
+                             + header.roots_size + header.suffix_size;
+    const string tmp_path = snapshot_path + ".tmp";
+
+    int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+    if (fd == -1)
+    {
+      fsw_logf_perror(_("Cannot open %s"), tmp_path.c_str());
+      return;
+    }
+
+    if (ftruncate(fd, file_size) != 0)
+    {
+      fsw_logf_perror(_("Cannot resize %s"), tmp_path.c_str());
+      close(fd);
+      unlink(tmp_path.c_str());
+      return;
+    }
+
+    void *map = mmap(nullptr,
+                     file_size,
+                     PROT_READ | PROT_WRITE,
+                     MAP_SHARED,
+                     fd,
+                     0);
+    close(fd);
+
+    if (map == MAP_FAILED)
+    {
+      fsw_logf_perror(_("Cannot map %s"), tmp_path.c_str());
+      unlink(tmp_path.c_str());
+      return;
+    }
+
+    char *data = static_cast<char *> (map);
+    memcpy(data, &header, sizeof(header));
+    data += sizeof(header);
+
+    if (entries_size > 0) memcpy(data, snapshot.entries.data(), entries_size);
+    data += entries_size;
+
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+      const uint64_t index = snapshot.root_indexes[i];
+      memcpy(data, &index, sizeof(index));
+      data += sizeof(index);
+    }
+
+    memcpy(data, roots.data(), roots.size());
+    data += roots.size();
+
+    if (header.suffix_size > 0)
+      memcpy(data, snapshot.suffixes.data(), header.suffix_size);
+
+    bool written = (msync(map, file_size, MS_SYNC) == 0);
+    munmap(map, file_size);
+
+    if (!written || rename(tmp_path.c_str(), snapshot_path.c_str()) != 0)
+    {
+      fsw_logf_perror(_("Cannot save snapshot %s"), snapshot_path.c_str());
+      unlink(tmp_path.c_str());
+      return;
+    }
+
+    scan_data->last_save_time = curr_time.tv_sec;
+#endif
+  }
+
+  void poll_monitor::configure_monitor()
+  {
+    string scan_threads_value = get_property(POLL_SCAN_THREADS);
+
+    if (!scan_threads_value.empty())
+    {
+      char *end;
+      long parsed_value = strtol(scan_threads_value.c_str(), &end, 0);
+
+      if (*end != '\0' || parsed_value < 0)
+      {
+        string msg = string(_("Invalid value: ")) + scan_threads_value;
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+      }
+
+#ifdef HAVE_CXX_MUTEX
+      if (parsed_value == 0) parsed_value = std::thread::hardware_concurrency();
+#else
+      // Scanning is always sequential without thread support.
+      parsed_value = 1;
+#endif
+
+      scan_threads = (parsed_value > 0) ? parsed_value : 1;
+    }
+
+    scan_data->shards.resize(scan_threads);
+
+    incremental = (get_property(POLL_INCREMENTAL) == "true");
+    use_io_uring = (get_property(POLL_SCAN_IO_URING) == "true");
+
+    // Every scan thread uses its own ring.
+    for (poll_scan_shard& shard : scan_data->shards)
+    {
+      if (!use_io_uring || shard.stats) continue;
+
+      shard.stats.reset(new batch_stat());
+      if (!shard.stats->is_asynchronous()) shard.stats.reset();
+    }
+
+    string full_scan_value = get_property(POLL_FULL_SCAN_INTERVAL);
+
+    if (!full_scan_value.empty())
+    {
+      char *end;
+      long parsed_value = strtol(full_scan_value.c_str(), &end, 0);
+
+      if (*end != '\0' || parsed_value < 0)
+      {
+        string msg = string(_("Invalid value: ")) + full_scan_value;
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+      }
+
+      full_scan_interval = parsed_value;
+    }
+
+    snapshot_path = get_property(POLL_SNAPSHOT_PATH);
+
+#ifndef HAVE_SYS_MMAN_H
+    if (!snapshot_path.empty())
+    {
+      string msg = string(_("Snapshots are not supported: ")) + snapshot_path;
+      throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+    }
+#endif
+
+    string snapshot_interval_value = get_property(POLL_SNAPSHOT_INTERVAL);
+
+    if (!snapshot_interval_value.empty())
+    {
+      char *end;
+      long parsed_value = strtol(snapshot_interval_value.c_str(), &end, 0);
+
+      if (*end != '\0' || parsed_value < 0)
+      {
+        string msg = string(_("Invalid value: ")) + snapshot_interval_value;
+        throw libfsw_exception(msg, FSW_ERR_INVALID_PROPERTY);
+      }
+
+      snapshot_interval = parsed_value;
+    }
+
+    if (scan_threads > 1)
+      FSW_ELOGF(_("Scanning with threads: %u\n"), scan_threads);
+  }
+
+  bool poll_monitor::lists_inventory() const
+  {
+    return true;
   }
 
   void poll_monitor::run()
   {
-    collect_initial_data();
+    configure_monitor();
+
+    /*
+     * When a snapshot is loaded, the changes which occurred while the monitor
+     * was not running are notified immediately.  Since any file may have
+     * changed in the meantime, the first scan is a full scan.
+     */
+    if (!snapshot_path.empty() && load_snapshot())
+    {
+      scan_data->force_full_scan = true;
+      curr_time = event::get_current_time();
+      scan_data->last_save_time = curr_time.tv_sec;
+      collect_data();
+
+      if (!events.empty())
+      {
+        notify_events(events);
+        events.clear();
+      }
+    }
+    else
+    {
+      collect_initial_data();
+      scan_data->last_save_time = curr_time.tv_sec;
+    }
+
+    // The changes found in a loaded snapshot precede the end of the inventory.
+    end_inventory();
 
     for (;;)
     {
@@ -208,8 +1352,9 @@ namespace fsw
 
       sleep(latency < MIN_POLL_LATENCY ? MIN_POLL_LATENCY : latency);
 
-      time(&curr_time);
+      curr_time = event::get_current_time();
 
+      update_root_paths();
       collect_data();
 
       if (!events.empty())
@@ -217,6 +1362,15 @@ namespace fsw
         notify_events(events);
         events.clear();
       }
+
+      const double since_save = difftime(curr_time.tv_sec, scan_data->last_save_time);
+
+      if (!snapshot_path.empty()
+          && snapshot_interval > 0
+          && since_save >= snapshot_interval)
+        save_snapshot();
     }
+
+    if (!snapshot_path.empty()) save_snapshot();
   }
 }
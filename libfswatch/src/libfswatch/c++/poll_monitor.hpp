@@ -27,8 +27,10 @@
 #  define FSW_POLL_MONITOR_H
 
 #  include "monitor.hpp"
+#  include "tree_snapshot.hpp"
 #  include <sys/stat.h>
 #  include <ctime>
+#  include <cstdint>
 
 namespace fsw
 {
@@ -41,6 +43,76 @@ namespace fsw
   class poll_monitor : public monitor
   {
   public:
+    /**
+     * @brief Custom monitor property used to set the number of threads used
+     * to scan the paths to watch.
+     *
+     * When this property is set to a value greater than `1`, every scan is
+     * performed by a pool of worker threads which steal work from each other.
+     * Each worker collects the files it visits into its own shard and the
+     * shards are then merged and compared with the previous scan.  If `0` is
+     * specified, the number of hardware threads is used.  By default, the scan
+     * is sequential.
+     */
+    static constexpr const char *POLL_SCAN_THREADS = "poll.scan.threads";
+
+    /**
+     * @brief Custom monitor property used to enable the incremental scan.
+     *
+     * When this property is set to `true`, the contents of a directory are
+     * read again only if its modification time, status change time or link
+     * count changed since the previous scan.  The files contained in an
+     * unchanged directory are not checked, except during the periodic full
+     * scan whose frequency is set by #POLL_FULL_SCAN_INTERVAL.  Directories
+     * reached by following symbolic links, and the directories containing
+     * the followed links, are always read.
+     */
+    static constexpr const char *POLL_INCREMENTAL = "poll.incremental";
+
+    /**
+     * @brief Custom monitor property used to set the number of scans after
+     * which an incremental monitor performs a full scan.
+     *
+     * During a full scan, every directory is read and every file is checked
+     * to detect changes which do not modify the directory containing the file,
+     * such as modifications of the file contents.  If `0` is specified, a full
+     * scan is never performed.  The default value is `10`.
+     */
+    static constexpr const char *POLL_FULL_SCAN_INTERVAL = "poll.full.scan.interval";
+
+    /**
+     * @brief Custom monitor property used to set the path of the snapshot
+     * file.
+     *
+     * When this property is set, the state of the watched files is saved to
+     * the specified file when the monitor stops and periodically while it is
+     * running (see #POLL_SNAPSHOT_INTERVAL).  When the monitor starts, the
+     * snapshot is loaded and compared with the current state of the watched
+     * files, and the changes which occurred while the monitor was not running
+     * are notified immediately.  A snapshot saved while watching different
+     * paths or using different options is ignored.
+     */
+    static constexpr const char *POLL_SNAPSHOT_PATH = "poll.snapshot.path";
+
+    /**
+     * @brief Custom monitor property used to set the interval, in seconds,
+     * between snapshot saves.
+     *
+     * If `0` is specified, the snapshot is only saved when the monitor stops.
+     * The default value is `60`.
+     */
+    static constexpr const char *POLL_SNAPSHOT_INTERVAL = "poll.snapshot.interval";
+
+    /**
+     * @brief Custom monitor property used to enable the batched status calls.
+     *
+     * When this property is set to `true` and io_uring is available, the
+     * status of the children of a directory is retrieved by `statx()` calls
+     * submitted to io_uring in batches, so that their latency overlaps.  This
+     * is mostly useful on network and other high latency file systems.
+     */
+    static constexpr const char *POLL_SCAN_IO_URING = "poll.scan.io_uring";
+
     /**
      * @brief Constructs an instance of this class.
      */
@@ -55,6 +127,7 @@ namespace fsw
 
   protected:
     void run();
+    bool lists_inventory() const;
 
   private:
     static const unsigned int MIN_POLL_LATENCY = 1;
@@ -62,35 +135,55 @@ namespace fsw
     poll_monitor(const poll_monitor& orig) = delete;
     poll_monitor& operator=(const poll_monitor& that) = delete;
 
-    typedef bool (poll_monitor::*poll_monitor_scan_callback)(
-      const std::string& path,
-      const struct stat& stat);
-
-    typedef struct watched_file_info
-    {
-      time_t mtime;
-      time_t ctime;
-    } watched_file_info;
+    typedef tree_snapshot::file_info watched_file_info;
 
     struct poll_monitor_data;
+    struct poll_scan_shard;
+    struct poll_scan_data;
+    struct poll_scan_result;
+    struct poll_scan_item;
 
-    void scan(const std::string& path, poll_monitor_scan_callback fn);
+    void configure_monitor();
+    bool accept_scan_path(std::string& path, struct stat& fd_stat) const;
+    bool visit_directory(const struct stat& fd_stat);
+    bool is_unchanged_directory(size_t previous_index,
+                                const struct stat& fd_stat) const;
+    void record_path(const std::string& path,
+                     const watched_file_info& info,
+                     uint32_t link_count,
+                     poll_scan_shard& shard);
+    void scan(poll_scan_item& item,
+              poll_scan_shard& shard,
+              std::vector<poll_scan_item>& children);
+    void scan_children(
+      const std::string& path,
+      const std::vector<std::pair<std::string, size_t>>& previous_children,
+      poll_scan_shard& shard,
+      std::vector<poll_scan_item>& children);
+    void scan_paths();
+    void parallel_scan(std::vector<poll_scan_item>& items);
+    void update_root_paths();
+    bool is_added_path(const std::string& path) const;
+    bool is_removed_path(const std::string& path) const;
+    void store_result(const poll_scan_result& result);
+    uint32_t get_snapshot_options() const;
+    bool load_snapshot();
+    void save_snapshot();
     void collect_initial_data();
     void collect_data();
-    bool add_path(const std::string& path,
-                  const struct stat& fd_stat,
-                  poll_monitor_scan_callback poll_callback);
-    bool initial_scan_callback(const std::string& path, const struct stat& stat);
-    bool intermediate_scan_callback(const std::string& path,
-                                    const struct stat& stat);
-    void find_removed_files();
-    void swap_data_containers();
 
     poll_monitor_data *previous_data;
     poll_monitor_data *new_data;
+    poll_scan_data *scan_data;
 
     std::vector<event> events;
-    time_t curr_time;
+    timespec curr_time;
+    unsigned int scan_threads = 1;
+    bool incremental = false;
+    bool use_io_uring = false;
+    unsigned int full_scan_interval = 10;
+    std::string snapshot_path;
+    unsigned int snapshot_interval = 60;
   };
 }
 
@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "gettext_defs.h"
+#include "subscriber_monitor.hpp"
+#include "event_publisher.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "libfswatch_exception.hpp"
+#include "string/string_utils.hpp"
+#include "../c/libfswatch_log.h"
+
+namespace fsw
+{
+  subscriber_monitor::subscriber_monitor(std::vector<std::string> paths,
+                                         FSW_EVENT_CALLBACK *callback,
+                                         void *context) :
+    monitor(paths, callback, context)
+  {
+    if (this->paths.size() != 1)
+    {
+      throw libfsw_exception(
+        _("The subscriber monitor requires the path of exactly one socket."),
+        FSW_ERR_INVALID_PATH);
+    }
+  }
+
+  subscriber_monitor::~subscriber_monitor()
+  {
+  }
+
+  int subscriber_monitor::connect_publisher() const
+  {
+    const std::string& path = paths[0];
+    sockaddr_un address;
+
+    if (path.size() >= sizeof(address.sun_path))
+    {
+      throw libfsw_exception(
+        string_utils::string_from_format(_("The socket path is too long: %s"),
+                                         path.c_str()),
+        FSW_ERR_INVALID_PATH);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path.c_str(), path.size());
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+
+    if (fd == -1
+        || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1
+        || connect(fd,
+                   reinterpret_cast<const sockaddr *>(&address),
+                   sizeof(address)) == -1)
+    {
+      const int err = errno;
+      if (fd != -1) close(fd);
+
+      throw libfsw_exception(
+        string_utils::string_from_format(_("Cannot connect to %s: %s"),
+                                         path.c_str(),
+                                         strerror(err)));
+    }
+
+    FSW_ELOGF(_("Connected to %s.\n"), path.c_str());
+
+    return fd;
+  }
+
+  bool subscriber_monitor::parse_message(const char *message,
+                                         size_t length,
+                                         bool& events_lost)
+  {
+    event_publisher::message_header header;
+
+    if (length < sizeof(header)) return false;
+
+    memcpy(&header, message, sizeof(header));
+    if (header.magic != event_publisher::MESSAGE_MAGIC) return false;
+
+    events_lost = (header.flags & event_publisher::MESSAGE_EVENTS_LOST) != 0;
+
+    const char *curr = message + sizeof(header);
+    const char *end = message + length;
+
+    batch.clear();
+
+    for (uint32_t i = 0; i < header.event_num; ++i)
+    {
+      event_publisher::message_record record;
+
+      if (static_cast<size_t>(end - curr) < sizeof(record)) return false;
+
+      memcpy(&record, curr, sizeof(record));
+      curr += sizeof(record);
+
+      const size_t paths_length =
+        static_cast<size_t>(record.path_length) + record.old_path_length;
+      if (static_cast<size_t>(end - curr) < paths_length) return false;
+
+      // Publishers older than the nanoseconds field set it to 0.
+      timespec evt_time;
+      evt_time.tv_sec = static_cast<time_t>(record.evt_time);
+      evt_time.tv_nsec = record.evt_time_nsec < 1000000000
+                         ? static_cast<long>(record.evt_time_nsec)
+                         : 0;
+
+      batch.add(curr,
+                record.path_length,
+                evt_time,
+                record.flags,
+                record.old_path_length ? curr + record.path_length : nullptr,
+                record.old_path_length);
+      curr += paths_length;
+    }
+
+    return true;
+  }
+
+  void subscriber_monitor::run()
+  {
+    int fd = connect_publisher();
+
+    {
+#ifdef HAVE_CXX_MUTEX
+      std::lock_guard<std::mutex> run_guard(run_mutex);
+#endif
+      if (should_stop)
+      {
+        close(fd);
+        return;
+      }
+
+      socket_fd = fd;
+    }
+
+    std::vector<char> message(event_publisher::MAX_MESSAGE_SIZE);
+
+    for (;;)
+    {
+      ssize_t rv = recv(fd, message.data(), message.size(), 0);
+
+      if (rv == -1 && errno == EINTR) continue;
+
+      if (rv <= 0)
+      {
+        const int err = errno;
+
+#ifdef HAVE_CXX_MUTEX
+        std::unique_lock<std::mutex> run_guard(run_mutex);
+#endif
+        socket_fd = -1;
+        close(fd);
+
+        // on_stop() shuts the connection down to interrupt recv().
+        if (should_stop) break;
+
+        if (rv == 0)
+          throw libfsw_exception(_("The publisher closed the connection."));
+
+        throw libfsw_exception(
+          string_utils::string_from_format(_("recv() failed: %s"),
+                                           strerror(err)));
+      }
+
+      bool events_lost = false;
+
+      if (!parse_message(message.data(), static_cast<size_t>(rv), events_lost))
+      {
+        FSW_ELOG(_("Discarding a malformed message.\n"));
+        continue;
+      }
+
+      count_read(batch.size(), static_cast<size_t>(rv));
+
+      if (events_lost) notify_overflow(paths[0]);
+      if (!batch.empty()) notify_events(batch);
+    }
+  }
+
+  void subscriber_monitor::on_stop()
+  {
+    if (socket_fd != -1 && shutdown(socket_fd, SHUT_RDWR) == -1)
+    {
+      fsw_log_perror("shutdown");
+    }
+  }
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Monitor receiving the events of an fsw::event_publisher.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_SUBSCRIBER_MONITOR_H
+#  define FSW_SUBSCRIBER_MONITOR_H
+
+#  include "monitor.hpp"
+#  include "event_batch.hpp"
+#  include <string>
+#  include <vector>
+
+namespace fsw
+{
+  /**
+   * @brief Monitor receiving the events of an fsw::event_publisher.
+   *
+   * This monitor does not watch the file system: it connects to the socket of
+   * a publisher, whose path is the only path of the monitor, and notifies the
+   * events published by the monitor of another process.  The filters, the
+   * event type filters and the other settings of this monitor are applied to
+   * the received events, so that several subscribers with different settings
+   * can share the same publisher.  Settings affecting how the file system is
+   * watched, such as the recursive flag, have no effect.
+   *
+   * When the publisher reports that events were lost because this monitor
+   * could not keep up, an overflow is notified for the path of the socket.
+   * When the publisher closes the connection, an exception is thrown.
+   */
+  class subscriber_monitor : public monitor
+  {
+  public:
+    /**
+     * @brief Constructs an instance of this class.
+     *
+     * @throw libfsw_exception if @p paths does not contain exactly one path.
+     */
+    subscriber_monitor(std::vector<std::string> paths,
+                       FSW_EVENT_CALLBACK *callback,
+                       void *context = nullptr);
+
+    /**
+     * @brief Destroys an instance of this class.
+     */
+    virtual ~subscriber_monitor();
+
+  protected:
+    /**
+     * @brief Executes the monitor loop.
+     *
+     * This call does not return until the monitor is stopped.
+     *
+     * @see stop()
+     */
+    void run() override;
+
+    /**
+     * @brief Shuts down the connection to wake up the monitor loop.
+     */
+    void on_stop() override;
+
+  private:
+    subscriber_monitor(const subscriber_monitor& orig) = delete;
+    subscriber_monitor& operator=(const subscriber_monitor& that) = delete;
+
+    int connect_publisher() const;
+    bool parse_message(const char *message, size_t length, bool& events_lost);
+
+    int socket_fd = -1;
+    event_batch batch;
+  };
+}
+
+#endif  /* FSW_SUBSCRIBER_MONITOR_H */
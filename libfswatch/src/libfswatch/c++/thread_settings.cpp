@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "gettext_defs.h"
+#include "thread_settings.hpp"
+#include "libfswatch_exception.hpp"
+#include "string/string_utils.hpp"
+#include <cstring>
+#include <utility>
+#include <pthread.h>
+#include <sched.h>
+#ifdef HAVE_PTHREAD_NP_H
+#  include <pthread_np.h>
+#endif
+#include "../c/libfswatch_log.h"
+
+namespace fsw
+{
+  // The longest name accepted by Linux, excluding the terminating NUL.
+  static const size_t MAX_THREAD_NAME_LENGTH = 15;
+
+  void thread_settings::set_affinity(std::vector<unsigned int> cpus)
+  {
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    for (unsigned int cpu : cpus)
+    {
+      if (cpu >= CPU_SETSIZE)
+      {
+        std::string msg = string_utils::string_from_format(
+          _("Invalid CPU number: %u"), cpu);
+        throw libfsw_exception(msg, FSW_ERR_UNKNOWN_VALUE);
+      }
+    }
+#else
+    if (!cpus.empty())
+      throw libfsw_exception(_("Thread affinity is not supported."),
+                             FSW_ERR_NOT_SUPPORTED);
+#endif
+
+    this->cpus = std::move(cpus);
+  }
+
+  void thread_settings::set_scheduling(int policy, int priority)
+  {
+    const int min_priority = sched_get_priority_min(policy);
+    const int max_priority = sched_get_priority_max(policy);
+
+    if (min_priority == -1 || max_priority == -1)
+    {
+      std::string msg = string_utils::string_from_format(
+        _("Invalid scheduling policy: %d"), policy);
+      throw libfsw_exception(msg, FSW_ERR_UNKNOWN_VALUE);
+    }
+
+    if (priority < min_priority || priority > max_priority)
+    {
+      std::string msg = string_utils::string_from_format(
+        _("Invalid scheduling priority: %d"), priority);
+      throw libfsw_exception(msg, FSW_ERR_UNKNOWN_VALUE);
+    }
+
+    has_scheduling = true;
+    this->policy = policy;
+    this->priority = priority;
+  }
+
+  void thread_settings::set_name(std::string name)
+  {
+#ifndef HAVE_PTHREAD_SETNAME_NP
+    if (!name.empty())
+      throw libfsw_exception(_("Thread names are not supported."),
+                             FSW_ERR_NOT_SUPPORTED);
+#endif
+
+    if (name.size() > MAX_THREAD_NAME_LENGTH)
+      name.resize(MAX_THREAD_NAME_LENGTH);
+
+    this->name = std::move(name);
+  }
+
+  bool thread_settings::empty() const
+  {
+    return cpus.empty() && !has_scheduling && name.empty();
+  }
+
+  void thread_settings::apply() const
+  {
+    int ret;
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    if (!cpus.empty())
+    {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      for (unsigned int cpu : cpus) CPU_SET(cpu, &set);
+
+      if ((ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+      {
+        std::string msg = string_utils::string_from_format(
+          _("Cannot set the thread affinity: %s"), strerror(ret));
+        throw libfsw_exception(msg);
+      }
+    }
+#endif
+
+    if (has_scheduling)
+    {
+      sched_param param{};
+      param.sched_priority = priority;
+
+      if ((ret = pthread_setschedparam(pthread_self(), policy, &param)) != 0)
+      {
+        std::string msg = string_utils::string_from_format(
+          _("Cannot set the thread scheduling policy: %s"), strerror(ret));
+        throw libfsw_exception(msg);
+      }
+    }
+
+#ifdef HAVE_PTHREAD_SETNAME_NP
+    if (!name.empty())
+    {
+#  if defined(__APPLE__)
+      ret = pthread_setname_np(name.c_str());
+#  elif defined(__NetBSD__)
+      ret = pthread_setname_np(pthread_self(),
+                               "%s",
+                               const_cast<char *> (name.c_str()));
+#  else
+      ret = pthread_setname_np(pthread_self(), name.c_str());
+#  endif
+
+      if (ret != 0)
+      {
+        std::string msg = string_utils::string_from_format(
+          _("Cannot set the thread name: %s"), strerror(ret));
+        throw libfsw_exception(msg);
+      }
+    }
+#endif
+  }
+
+  void thread_settings::try_apply(const char *thread) const
+  {
+    if (empty()) return;
+
+    try
+    {
+      apply();
+    }
+    catch (libfsw_exception& ex)
+    {
+      FSW_ELOGF(_("%s: %s\n"), thread, ex.what());
+    }
+  }
+
+  thread_settings thread_settings::get_current() const
+  {
+    thread_settings current;
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t set;
+
+    if (!cpus.empty()
+        && pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+    {
+      for (unsigned int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        if (CPU_ISSET(cpu, &set)) current.cpus.push_back(cpu);
+    }
+#endif
+
+    sched_param param;
+
+    if (has_scheduling
+        && pthread_getschedparam(pthread_self(), &current.policy, &param) == 0)
+    {
+      current.has_scheduling = true;
+      current.priority = param.sched_priority;
+    }
+
+#ifdef HAVE_PTHREAD_GETNAME_NP
+    char current_name[MAX_THREAD_NAME_LENGTH + 1];
+
+    if (!name.empty()
+        && pthread_getname_np(pthread_self(),
+                              current_name,
+                              sizeof(current_name)) == 0)
+      current.name = current_name;
+#endif
+
+    return current;
+  }
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::thread_settings class.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_THREAD_SETTINGS_H
+#  define FSW_THREAD_SETTINGS_H
+
+#  include <string>
+#  include <vector>
+
+namespace fsw
+{
+  /**
+   * @brief Scheduling attributes applied to a thread.
+   *
+   * The settings hold the CPU affinity, the scheduling policy and priority,
+   * and the name of a thread.  Only the attributes which have been set are
+   * changed by apply(): a default-constructed instance leaves the thread
+   * unchanged.
+   *
+   * The setters check that the attributes are supported and valid, while the
+   * errors of the operating system, such as the lack of the privileges
+   * required by a real-time policy, are only reported by apply().
+   */
+  class thread_settings
+  {
+  public:
+    /**
+     * @brief Sets the CPUs the thread may run on.
+     *
+     * @param cpus The numbers of the CPUs, or an empty vector to leave the
+     * affinity of the thread unchanged.
+     * @throw libfsw_exception if the affinity cannot be set on this platform
+     * or if a CPU number is out of range.
+     */
+    void set_affinity(std::vector<unsigned int> cpus);
+
+    /**
+     * @brief Sets the scheduling policy and priority of the thread.
+     *
+     * @param policy The policy, such as `SCHED_FIFO` or `SCHED_RR`.
+     * @param priority The priority, in the range of @p policy.
+     * @throw libfsw_exception if @p policy is unknown or if @p priority is out
+     * of its range.
+     */
+    void set_scheduling(int policy, int priority);
+
+    /**
+     * @brief Sets the name of the thread.
+     *
+     * Names are truncated to 15 characters, the limit of Linux.
+     *
+     * @param name The name, or an empty string to leave the name of the
+     * thread unchanged.
+     * @throw libfsw_exception if the name cannot be set on this platform.
+     */
+    void set_name(std::string name);
+
+    /**
+     * @brief Checks whether no attribute has been set.
+     *
+     * @return @c true if apply() leaves the thread unchanged.
+     */
+    bool empty() const;
+
+    /**
+     * @brief Applies the settings to the calling thread.
+     *
+     * @throw libfsw_exception if an attribute cannot be changed.
+     */
+    void apply() const;
+
+    /**
+     * @brief Applies the settings to the calling thread, logging the errors.
+     *
+     * This function is used by the threads which have no caller to report an
+     * error to: a thread whose attributes cannot be changed keeps running
+     * with the attributes it was created with.
+     *
+     * @param thread The description of the thread used in the log.
+     */
+    void try_apply(const char *thread) const;
+
+    /**
+     * @brief Returns the current attributes of the calling thread.
+     *
+     * Only the attributes set in this instance are read, so that the result
+     * restores the calling thread when it is applied after this instance.
+     *
+     * @return The settings of the calling thread.
+     */
+    thread_settings get_current() const;
+
+  private:
+    std::vector<unsigned int> cpus;
+    bool has_scheduling = false;
+    int policy = 0;
+    int priority = 0;
+    std::string name;
+  };
+}
+
+#endif  /* FSW_THREAD_SETTINGS_H */
@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "gettext_defs.h"
+#include "tree_snapshot.hpp"
+#include <algorithm>
+#include <iterator>
+#include <cerrno>
+#include <cstring>
+#include <utility>
+#include "path_utils.hpp"
+#include "../c/libfswatch_log.h"
+
+#if defined HAVE_STRUCT_STAT_ST_MTIMESPEC
+#  define FSW_MTIME(stat) ((stat).st_mtimespec.tv_sec)
+#  define FSW_CTIME(stat) ((stat).st_ctimespec.tv_sec)
+#  define FSW_MTIME_NSEC(stat) ((stat).st_mtimespec.tv_nsec)
+#  define FSW_CTIME_NSEC(stat) ((stat).st_ctimespec.tv_nsec)
+#elif defined HAVE_STRUCT_STAT_ST_MTIM
+#  define FSW_MTIME(stat) ((stat).st_mtim.tv_sec)
+#  define FSW_CTIME(stat) ((stat).st_ctim.tv_sec)
+#  define FSW_MTIME_NSEC(stat) ((stat).st_mtim.tv_nsec)
+#  define FSW_CTIME_NSEC(stat) ((stat).st_ctim.tv_nsec)
+#elif defined HAVE_STRUCT_STAT_ST_MTIME
+#  define FSW_MTIME(stat) ((stat).st_mtime)
+#  define FSW_CTIME(stat) ((stat).st_ctime)
+#  define FSW_MTIME_NSEC(stat) 0
+#  define FSW_CTIME_NSEC(stat) 0
+#endif
+
+#ifdef HAVE_CXX_MUTEX
+#  define FSW_SNAPSHOT_GUARD \
+  std::lock_guard<std::mutex> snapshot_guard(snapshot_mutex)
+#else
+#  define FSW_SNAPSHOT_GUARD
+#endif
+
+namespace fsw
+{
+  using std::string;
+  using std::vector;
+
+  tree_snapshot::file_info
+  tree_snapshot::get_file_info(const struct stat& fd_stat)
+  {
+    file_info info;
+
+    info.mtime = FSW_MTIME(fd_stat);
+    info.ctime = FSW_CTIME(fd_stat);
+    info.size = fd_stat.st_size;
+    info.inode = fd_stat.st_ino;
+    info.mtime_nsec = FSW_MTIME_NSEC(fd_stat);
+    info.ctime_nsec = FSW_CTIME_NSEC(fd_stat);
+
+    return info;
+  }
+
+  bool tree_snapshot::same_file_info(const file_info& lhs,
+                                     const file_info& rhs)
+  {
+    // The record has no padding, so that records can be compared as a whole.
+    static_assert(sizeof(file_info) ==
+                  4 * sizeof(int64_t) + 2 * sizeof(uint32_t),
+                  "file_info must not contain padding");
+
+    return memcmp(&lhs, &rhs, sizeof(lhs)) == 0;
+  }
+
+  void tree_snapshot::get_change_flags(const file_info& current,
+                                       const file_info& previous,
+                                       vector<fsw_event_flag>& flags)
+  {
+    // Most files do not change: check the whole record first.
+    if (same_file_info(current, previous)) return;
+
+    // The file was replaced, e.g. by renaming another file over it.
+    if (current.inode != previous.inode)
+    {
+      flags.push_back(fsw_event_flag::Created);
+    }
+
+    if (current.mtime != previous.mtime
+        || current.mtime_nsec != previous.mtime_nsec
+        || current.size != previous.size)
+    {
+      flags.push_back(fsw_event_flag::Updated);
+    }
+
+    if (current.ctime != previous.ctime
+        || current.ctime_nsec != previous.ctime_nsec)
+    {
+      flags.push_back(fsw_event_flag::AttributeModified);
+    }
+  }
+
+  tree_snapshot::tree_snapshot(bool recursive,
+                               bool follow_symlinks,
+                               subtree_filter accept_subtree) :
+    recursive(recursive),
+    follow_symlinks(follow_symlinks),
+    accept_subtree(std::move(accept_subtree))
+  {
+  }
+
+  bool tree_snapshot::stat_path(const string& path, struct stat& fd_stat) const
+  {
+    // Objects removed in the meantime are expected: no error is logged.
+    if (follow_symlinks) return ::stat(path.c_str(), &fd_stat) == 0;
+
+    return ::lstat(path.c_str(), &fd_stat) == 0;
+  }
+
+  const string *tree_snapshot::find_root(const string& path) const
+  {
+    for (const string& root : roots)
+    {
+      if (is_path_below(path, root)) return &root;
+    }
+
+    return nullptr;
+  }
+
+  /*
+   * Checks whether a path is recorded by the snapshot.  Only the direct
+   * children of the root paths are recorded by non-recursive snapshots.
+   */
+  bool tree_snapshot::is_tracked(const string& path) const
+  {
+    const string *root = find_root(path);
+    if (!root) return false;
+    if (recursive || path == *root) return true;
+
+    const size_t separator = path.find_last_of('/');
+
+    return separator != string::npos
+      && (path.compare(0, separator, *root) == 0
+          || (separator == 0 && *root == "/"))
+      && (separator == root->size()
+          || (root->back() == '/' && separator + 1 == root->size()));
+  }
+
+  bool tree_snapshot::lists_children(const string& path) const
+  {
+    return recursive
+      || std::find(roots.begin(), roots.end(), path) != roots.end();
+  }
+
+  void tree_snapshot::scan(const string& path,
+                           bool list_children,
+                           entry_map& scanned) const
+  {
+    struct stat fd_stat;
+    if (!stat_path(path, fd_stat)) return;
+
+    const bool directory = S_ISDIR(fd_stat.st_mode);
+    scanned[path] = {get_file_info(fd_stat), directory};
+
+    if (!directory || !list_children) return;
+    if (accept_subtree && !accept_subtree(path)) return;
+
+    const string prefix = (path.back() == '/') ? path : path + "/";
+
+    const size_t first_child = scan_entries.size();
+
+    if (!scan_entries.append(path)) return;
+
+    const size_t last_child = scan_entries.size();
+
+    for (size_t i = first_child; i < last_child; ++i)
+      scan(prefix + scan_entries.get_name(i), recursive, scanned);
+
+    scan_entries.truncate(first_child);
+  }
+
+  void tree_snapshot::erase_subtree(const string& path)
+  {
+    entries.erase(path);
+
+    const string prefix = (path.back() == '/') ? path : path + "/";
+    const entry_range subtree = get_subtree(entries, prefix);
+
+    entries.erase(subtree.first, subtree.second);
+  }
+
+  void tree_snapshot::add_root(const string& path)
+  {
+    FSW_SNAPSHOT_GUARD;
+
+    if (path.empty()
+        || std::find(roots.begin(), roots.end(), path) != roots.end())
+      return;
+
+    roots.push_back(path);
+
+    entry_map scanned;
+    scan(path, true, scanned);
+
+    // Nested roots may have recorded some of these objects already.
+    for (auto& e : scanned) entries[e.first] = e.second;
+  }
+
+  void tree_snapshot::remove_root(const string& path)
+  {
+    FSW_SNAPSHOT_GUARD;
+
+    auto it = std::find(roots.begin(), roots.end(), path);
+    if (it == roots.end()) return;
+
+    roots.erase(it);
+
+    // The objects still recorded below other roots are scanned again.
+    erase_subtree(path);
+
+    for (const string& root : roots)
+    {
+      if (!is_path_below(root, path)) continue;
+
+      entry_map scanned;
+      scan(root, true, scanned);
+      for (auto& e : scanned) entries[e.first] = e.second;
+    }
+  }
+
+  void tree_snapshot::update(const string& path)
+  {
+    FSW_SNAPSHOT_GUARD;
+
+    if (path.empty() || !is_tracked(path)) return;
+
+    struct stat fd_stat;
+
+    if (!stat_path(path, fd_stat))
+    {
+      erase_subtree(path);
+
+      return;
+    }
+
+    const bool directory = S_ISDIR(fd_stat.st_mode);
+    auto it = entries.find(path);
+
+    if (it != entries.end() && it->second.directory == directory)
+    {
+      it->second.info = get_file_info(fd_stat);
+
+      return;
+    }
+
+    // A new directory, which may have been moved into the tree with its
+    // contents.
+    erase_subtree(path);
+
+    entry_map scanned;
+    scan(path, lists_children(path), scanned);
+    entries.insert(scanned.begin(), scanned.end());
+  }
+
+  void tree_snapshot::rescan(const string& path,
+                             const timespec& curr_time,
+                             vector<event>& events)
+  {
+    FSW_SNAPSHOT_GUARD;
+
+    // Some monitors report directories with a trailing separator.
+    string subtree = path;
+    while (subtree.size() > 1 && subtree.back() == '/') subtree.pop_back();
+
+    if (!subtree.empty() && is_tracked(subtree))
+    {
+      rescan_subtree(subtree, curr_time, events);
+
+      return;
+    }
+
+    for (const string& root : roots) rescan_subtree(root, curr_time, events);
+  }
+
+  /*
+   * Appends the changes between two sorted ranges of records.
+   */
+  void tree_snapshot::diff_entries(entry_range previous,
+                                   entry_range current,
+                                   const timespec& curr_time,
+                                   vector<event>& events)
+  {
+    while (previous.first != previous.second
+           || current.first != current.second)
+    {
+      const int order =
+        (previous.first == previous.second) ? 1
+        : (current.first == current.second) ? -1
+        : previous.first->first.compare(current.first->first);
+
+      vector<fsw_event_flag> flags;
+
+      if (order < 0)
+      {
+        flags.push_back(fsw_event_flag::Removed);
+        events.emplace_back(previous.first->first, curr_time, flags);
+        ++previous.first;
+        continue;
+      }
+
+      if (order > 0)
+      {
+        flags.push_back(fsw_event_flag::Created);
+      }
+      else
+      {
+        get_change_flags(current.first->second.info,
+                         previous.first->second.info,
+                         flags);
+        ++previous.first;
+      }
+
+      if (!flags.empty())
+        events.emplace_back(current.first->first, curr_time, flags);
+
+      ++current.first;
+    }
+  }
+
+  tree_snapshot::entry_range
+  tree_snapshot::get_subtree(const entry_map& records,
+                             const string& prefix)
+  {
+    auto first = records.lower_bound(prefix);
+    auto last = first;
+
+    while (last != records.end()
+           && last->first.compare(0, prefix.size(), prefix) == 0)
+      ++last;
+
+    return {first, last};
+  }
+
+  /*
+   * Compares the records below path with the result of a new scan.  The
+   * record of the path and the records below it are not contiguous, since
+   * paths such as path-1 sort in between, and they are compared separately.
+   */
+  void tree_snapshot::rescan_subtree(const string& path,
+                                     const timespec& curr_time,
+                                     vector<event>& events)
+  {
+    entry_map scanned;
+    scan(path, lists_children(path), scanned);
+
+    const string prefix = (path.back() == '/') ? path : path + "/";
+    const entry_range scanned_subtree = get_subtree(scanned, prefix);
+
+    if (path != prefix)
+    {
+      auto self = entries.find(path);
+      auto next_self = (self == entries.end()) ? self : std::next(self);
+
+      diff_entries({self, next_self},
+                   {scanned.cbegin(), scanned_subtree.first},
+                   curr_time,
+                   events);
+    }
+
+    diff_entries(get_subtree(entries, prefix),
+                 scanned_subtree,
+                 curr_time,
+                 events);
+
+    erase_subtree(path);
+    entries.insert(scanned.begin(), scanned.end());
+  }
+
+  size_t tree_snapshot::size() const
+  {
+    FSW_SNAPSHOT_GUARD;
+
+    return entries.size();
+  }
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Header of the fsw::tree_snapshot class.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_TREE_SNAPSHOT_H
+#  define FSW_TREE_SNAPSHOT_H
+
+#  include "event.hpp"
+#  include "path_utils.hpp"
+#  include <cstdint>
+#  include <ctime>
+#  include <functional>
+#  include <map>
+#  include <string>
+#  include <utility>
+#  include <vector>
+#  include <sys/stat.h>
+#  ifdef HAVE_CXX_MUTEX
+#    include <mutex>
+#  endif
+
+namespace fsw
+{
+  /**
+   * @brief In-memory snapshot of the metadata of the watched trees.
+   *
+   * A snapshot records the times, the size and the inode of every object
+   * below a set of root paths.  It is kept up to date by updating the paths
+   * of the events received by a monitor and it is used to recover from an
+   * overflow: the subtree affected by the overflow is scanned again and
+   * compared with the snapshot, and the differences are returned as change
+   * events.  The cost of a recovery thus depends on the size of the subtree,
+   * not on the size of the watched trees.
+   *
+   * The file information and the way changes are detected are shared with
+   * fsw::poll_monitor.
+   */
+  class tree_snapshot
+  {
+  public:
+    /**
+     * @brief The metadata of an object used to detect its changes.
+     */
+    typedef struct file_info
+    {
+      int64_t mtime;
+      int64_t ctime;
+      int64_t size;
+      uint64_t inode;
+      uint32_t mtime_nsec;
+      uint32_t ctime_nsec;
+    } file_info;
+
+    /**
+     * @brief Function used to prune the subtrees which need not be scanned.
+     */
+    typedef std::function<bool(const std::string& directory)> subtree_filter;
+
+    /**
+     * @brief Gets the metadata of an object from its status.
+     */
+    static file_info get_file_info(const struct stat& fd_stat);
+
+    /**
+     * @brief Checks whether two records are equal.
+     */
+    static bool same_file_info(const file_info& lhs, const file_info& rhs);
+
+    /**
+     * @brief Appends the flags describing how an object changed.
+     *
+     * @param current The current metadata of the object.
+     * @param previous The previous metadata of the object.
+     * @param flags The vector the flags are appended to.
+     */
+    static void get_change_flags(const file_info& current,
+                                 const file_info& previous,
+                                 std::vector<fsw_event_flag>& flags);
+
+    /**
+     * @brief Constructs an empty snapshot.
+     *
+     * @param recursive Whether the whole trees below the root paths are
+     * recorded, instead of their direct children only.
+     * @param follow_symlinks Whether symbolic links are followed.
+     * @param accept_subtree The function used to prune subtrees.
+     */
+    tree_snapshot(bool recursive,
+                  bool follow_symlinks,
+                  subtree_filter accept_subtree);
+
+    /**
+     * @brief Records the tree below a root path.
+     */
+    void add_root(const std::string& path);
+
+    /**
+     * @brief Forgets the tree below a root path.
+     */
+    void remove_root(const std::string& path);
+
+    /**
+     * @brief Updates the record of a path after a change event.
+     *
+     * The path is checked again: its record is updated if it exists, or it is
+     * removed together with the records below it otherwise.  A directory
+     * which was not recorded is scanned.  Paths outside the root paths are
+     * ignored.
+     */
+    void update(const std::string& path);
+
+    /**
+     * @brief Scans a subtree again and returns its changes.
+     *
+     * The objects below @p path are compared with the snapshot, which is
+     * updated, and a change event is appended to @p events for every object
+     * which was created, removed or modified.  If @p path is empty, or if it
+     * is not below a root path, all the root paths are scanned.
+     *
+     * @param path The root of the subtree to scan.
+     * @param curr_time The time of the events.
+     * @param events The vector the change events are appended to.
+     */
+    void rescan(const std::string& path,
+                const timespec& curr_time,
+                std::vector<event>& events);
+
+    /**
+     * @brief Gets the number of recorded objects.
+     */
+    size_t size() const;
+
+  private:
+    struct entry
+    {
+      file_info info;
+      bool directory;
+    };
+
+    typedef std::map<std::string, entry> entry_map;
+    typedef std::pair<entry_map::const_iterator,
+                      entry_map::const_iterator> entry_range;
+
+    static entry_range get_subtree(const entry_map& records,
+                                   const std::string& prefix);
+    static void diff_entries(entry_range previous,
+                             entry_range current,
+                             const timespec& curr_time,
+                             std::vector<event>& events);
+
+    bool stat_path(const std::string& path, struct stat& fd_stat) const;
+    const std::string *find_root(const std::string& path) const;
+    bool is_tracked(const std::string& path) const;
+    bool lists_children(const std::string& path) const;
+    void scan(const std::string& path,
+              bool list_children,
+              entry_map& scanned) const;
+    void erase_subtree(const std::string& path);
+    void rescan_subtree(const std::string& path,
+                        const timespec& curr_time,
+                        std::vector<event>& events);
+
+    bool recursive;
+    bool follow_symlinks;
+    subtree_filter accept_subtree;
+    std::vector<std::string> roots;
+    entry_map entries;
+    // Entries of the directories being scanned, guarded by snapshot_mutex.
+    mutable directory_entries scan_entries;
+#  ifdef HAVE_CXX_MUTEX
+    mutable std::mutex snapshot_mutex;
+#  endif
+  };
+}
+
+#endif  /* FSW_TREE_SNAPSHOT_H */
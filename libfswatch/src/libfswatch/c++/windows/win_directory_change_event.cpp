@@ -25,57 +25,125 @@
 #include "../../gettext_defs.h"
 #include <string>
 #include <cstdlib>
-#include <set>
+#include <cstring>
+#include <iostream>
 
 namespace fsw
 {
   using namespace std;
 
-  struct win_flag_type
-  {
-    DWORD action;
-    vector<fsw_event_flag> types;
-  };
+  static const DWORD NOTIFY_FILTER = FILE_NOTIFY_CHANGE_FILE_NAME
+    | FILE_NOTIFY_CHANGE_DIR_NAME
+    | FILE_NOTIFY_CHANGE_LAST_WRITE
+    | FILE_NOTIFY_CHANGE_LAST_ACCESS
+    | FILE_NOTIFY_CHANGE_CREATION;
 
-  static vector<win_flag_type> create_flag_type_vector()
+  static uint32_t decode_flags(DWORD action)
   {
-    vector<win_flag_type> flags;
-    flags.push_back({FILE_ACTION_ADDED,            {fsw_event_flag::Created}});
-    flags.push_back({FILE_ACTION_REMOVED,          {fsw_event_flag::Removed}});
-    flags.push_back({FILE_ACTION_MODIFIED,         {fsw_event_flag::Updated}});
-    flags.push_back({FILE_ACTION_RENAMED_OLD_NAME, {fsw_event_flag::MovedFrom, fsw_event_flag::Renamed}});
-    flags.push_back({FILE_ACTION_RENAMED_NEW_NAME, {fsw_event_flag::MovedTo, fsw_event_flag::Renamed}});
-
-    return flags;
+    switch (action)
+    {
+    case FILE_ACTION_ADDED:
+      return Created;
+    case FILE_ACTION_REMOVED:
+      return Removed;
+    case FILE_ACTION_MODIFIED:
+      return Updated;
+    case FILE_ACTION_RENAMED_OLD_NAME:
+      return MovedFrom | Renamed;
+    case FILE_ACTION_RENAMED_NEW_NAME:
+      return MovedTo | Renamed;
+    default:
+      return 0;
+    }
   }
 
-  static const vector<win_flag_type> event_flag_type = create_flag_type_vector();
+#if defined(HAVE_DECL_READDIRECTORYCHANGESEXW) && HAVE_DECL_READDIRECTORYCHANGESEXW
+  typedef decltype(&ReadDirectoryChangesExW) read_changes_ex_function;
 
-  static vector<fsw_event_flag> decode_flags(DWORD flag)
+  /*
+   * ReadDirectoryChangesExW is looked up at run time, so that the library
+   * still runs on the versions of Windows which lack it.
+   */
+  static read_changes_ex_function get_read_changes_ex()
   {
-    set<fsw_event_flag> evt_flags_set;
+    static const read_changes_ex_function read_changes_ex =
+      reinterpret_cast<read_changes_ex_function> (
+        GetProcAddress(GetModuleHandleW(L"kernel32.dll"),
+                       "ReadDirectoryChangesExW"));
 
-    for (const win_flag_type & event_type : event_flag_type)
-    {
-      if (flag == event_type.action)
-      {
-        for (const auto & type : event_type.types) evt_flags_set.insert(type);
-      }
-    }
+    return read_changes_ex;
+  }
 
-    return vector<fsw_event_flag>(evt_flags_set.begin(), evt_flags_set.end());
+  static uint32_t decode_type(const FILE_NOTIFY_EXTENDED_INFORMATION& info)
+  {
+    // The attributes of some removed objects are not known.
+    if (info.FileAttributes == 0) return 0;
+
+    if ((info.FileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+        && info.ReparsePointTag == IO_REPARSE_TAG_SYMLINK)
+      return IsSymLink;
+
+    if (info.FileAttributes & FILE_ATTRIBUTE_DIRECTORY) return IsDir;
+
+    return IsFile;
   }
+#endif
 
-  directory_change_event::directory_change_event(size_t buffer_length)
+  directory_change_event::directory_change_event(size_t buffer_length,
+                                                 size_t max_buffer_length)
     : handle{INVALID_HANDLE_VALUE},
       buffer_size{sizeof (FILE_NOTIFY_INFORMATION) * buffer_length},
+      spare_buffer_size{buffer_size},
+      min_buffer_size{buffer_size},
+      max_buffer_size{sizeof (FILE_NOTIFY_INFORMATION) * (max_buffer_length > buffer_length ? max_buffer_length : buffer_length)},
+      requested_buffer_size{buffer_size},
+      last_resize{GetTickCount64()},
       bytes_returned{}
     {
       buffer.reset(malloc(buffer_size));
+      spare_buffer.reset(malloc(spare_buffer_size));
       if (buffer.get() == nullptr) throw libfsw_exception(_("malloc failed."));
+      if (spare_buffer.get() == nullptr) throw libfsw_exception(_("malloc failed."));
       if (overlapped.get() == nullptr) throw libfsw_exception(_("malloc failed."));
     }
 
+  void directory_change_event::swap_buffers()
+  {
+    swap(buffer, spare_buffer);
+    swap(buffer_size, spare_buffer_size);
+    swap(buffer_extended, spare_buffer_extended);
+  }
+
+  bool directory_change_event::grow_buffer()
+  {
+    last_resize = GetTickCount64();
+
+    if (requested_buffer_size >= max_buffer_size) return false;
+
+    requested_buffer_size *= 2;
+    if (requested_buffer_size > max_buffer_size) requested_buffer_size = max_buffer_size;
+
+    FSW_ELOGF(_("Growing buffer to %zu bytes.\n"), requested_buffer_size);
+
+    return true;
+  }
+
+  bool directory_change_event::shrink_buffer(ULONGLONG interval)
+  {
+    if (requested_buffer_size <= min_buffer_size) return false;
+
+    const ULONGLONG now = GetTickCount64();
+    if (now - last_resize < interval) return false;
+
+    last_resize = now;
+    requested_buffer_size /= 2;
+    if (requested_buffer_size < min_buffer_size) requested_buffer_size = min_buffer_size;
+
+    FSW_ELOGF(_("Shrinking buffer to %zu bytes.\n"), requested_buffer_size);
+
+    return true;
+  }
+
   bool directory_change_event::is_io_incomplete()
   {
     return (read_error.get_error_code() == ERROR_IO_INCOMPLETE);
@@ -89,22 +157,88 @@ namespace fsw
   bool directory_change_event::read_changes_async()
   {
     continue_read();
+    read_pending = false;
+
+    // The buffer is resized only when no read is using it.
+    if (buffer_size != requested_buffer_size)
+    {
+      buffer.reset(malloc(requested_buffer_size));
+      if (buffer.get() == nullptr) throw libfsw_exception(_("malloc failed."));
+      buffer_size = requested_buffer_size;
+    }
 
     FSW_ELOGF(_("%p.\n"), this);
 
-    return ReadDirectoryChangesW((HANDLE) handle,
-                                 buffer.get(),
-                                 buffer_size,
-                                 TRUE,
-                                 FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
-                                 FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_LAST_ACCESS | FILE_NOTIFY_CHANGE_CREATION,
-                                 &bytes_returned,
-                                 overlapped.get(),
-                                 nullptr);
+#if defined(HAVE_DECL_READDIRECTORYCHANGESEXW) && HAVE_DECL_READDIRECTORYCHANGESEXW
+    const read_changes_ex_function read_changes_ex =
+      extended_info ? get_read_changes_ex() : nullptr;
+
+    if (read_changes_ex != nullptr)
+    {
+      buffer_extended = true;
+
+      if (read_changes_ex((HANDLE) handle,
+                          buffer.get(),
+                          buffer_size,
+                          TRUE,
+                          NOTIFY_FILTER,
+                          &bytes_returned,
+                          overlapped.get(),
+                          nullptr,
+                          ReadDirectoryNotifyExtendedInformation))
+      {
+        read_pending = true;
+        return true;
+      }
+
+      // The file systems which do not support the extended information, such
+      // as network shares, refuse the call: fall back for this path.
+      const DWORD error = GetLastError();
+
+      if (error != ERROR_INVALID_PARAMETER
+          && error != ERROR_INVALID_FUNCTION
+          && error != ERROR_NOT_SUPPORTED)
+        return false;
+
+      FSW_ELOGF(_("ReadDirectoryChangesExW is not supported by %s.\n"),
+                posix_path.c_str());
+      extended_info = false;
+    }
+#endif
+
+    buffer_extended = false;
+
+    read_pending = ReadDirectoryChangesW((HANDLE) handle,
+                                         buffer.get(),
+                                         buffer_size,
+                                         TRUE,
+                                         NOTIFY_FILTER,
+                                         &bytes_returned,
+                                         overlapped.get(),
+                                         nullptr);
+
+    return read_pending;
+  }
+
+  bool directory_change_event::cancel_read()
+  {
+    if (!read_pending) return false;
+
+    // The read may complete before it is cancelled: its outcome is ignored.
+    CancelIoEx(handle, overlapped.get());
+
+    DWORD bytes;
+    GetOverlappedResult(handle, overlapped.get(), &bytes, TRUE);
+    read_pending = false;
+
+    return true;
   }
 
   bool directory_change_event::try_read()
   {
+    // The completion of the read has been dequeued.
+    read_pending = false;
+
     bool ret = GetOverlappedResult(handle, overlapped.get(), &bytes_returned, FALSE);
 
     read_error = win_error_message::current();
@@ -116,47 +250,92 @@ namespace fsw
 
   void directory_change_event::continue_read()
   {
-    if (!ResetEvent(overlapped.get()->hEvent)) throw libfsw_exception(_("ResetEvent failed."));
-
-    FSW_ELOGF(_("Event %d reset.\n"), overlapped.get()->hEvent);
+    // Completions are reported to an I/O completion port: an OVERLAPPED
+    // structure must be zeroed before being reused and no event is needed.
+    memset(overlapped.get(), 0, sizeof (OVERLAPPED));
   }
 
-  vector<event> directory_change_event::get_events()
+  void directory_change_event::append_event(const wchar_t *name,
+                                            size_t name_length,
+                                            uint32_t flags,
+                                            const timespec& evt_time,
+                                            event_batch& events,
+                                            string& path_buffer) const
   {
-    // TO DO: We are relying on callers to know events are ready.
-    vector<event> events;
+    // The FileName member of the FILE_NOTIFY_INFORMATION structure has the
+    // following characteristics:
+    //
+    //   * It's not NUL terminated.
+    //
+    //   * Its length is specified in bytes.
+    if (name_length == 0)
+    {
+      cerr << _("File name unexpectedly empty.") << endl;
+      return;
+    }
+
+    if (fast_conversion)
+    {
+      path_buffer = posix_path;
+      if (path_buffer.empty() || path_buffer.back() != '/') path_buffer.push_back('/');
+      win_paths::append_win_w_as_posix(path_buffer, name, name_length);
+    }
+    else
+    {
+      path_buffer = win_paths::win_w_to_posix(path
+                                              + L"\\"
+                                              + wstring(name, name_length));
+    }
 
-    time_t curr_time;
-    time(&curr_time);
+    events.add(path_buffer.data(), path_buffer.size(), evt_time, flags);
+  }
 
-    char * curr_entry = static_cast<char *> (buffer.get());
+  size_t directory_change_event::append_events(const void *changes,
+                                               bool extended,
+                                               event_batch& events,
+                                               string& path_buffer) const
+  {
+    const timespec curr_time = event::get_current_time();
+    const char *curr_entry = static_cast<const char *> (changes);
+    size_t records = 0;
 
     while (curr_entry != nullptr)
     {
-      FILE_NOTIFY_INFORMATION * currEntry = reinterpret_cast<FILE_NOTIFY_INFORMATION *> (curr_entry);
+      DWORD next_entry_offset;
+      ++records;
 
-      if (currEntry->FileNameLength > 0)
+#if defined(HAVE_DECL_READDIRECTORYCHANGESEXW) && HAVE_DECL_READDIRECTORYCHANGESEXW
+      if (extended)
       {
-        // The FileName member of the FILE_NOTIFY_INFORMATION structure
-        // has the following characteristics:
-        //
-        //   * It's not NUL terminated.
-        //
-        //   * Its length is specified in bytes.
-        wstring file_name = path
-          + L"\\"
-          + wstring(currEntry->FileName, currEntry->FileNameLength / sizeof (wchar_t));
-
-        events.push_back({win_paths::win_w_to_posix(file_name), curr_time, decode_flags(currEntry->Action)});
+        const FILE_NOTIFY_EXTENDED_INFORMATION *info =
+          reinterpret_cast<const FILE_NOTIFY_EXTENDED_INFORMATION *> (curr_entry);
+
+        append_event(info->FileName,
+                     info->FileNameLength / sizeof (wchar_t),
+                     decode_flags(info->Action) | decode_type(*info),
+                     curr_time,
+                     events,
+                     path_buffer);
+        next_entry_offset = info->NextEntryOffset;
       }
       else
+#endif
       {
-        cerr << _("File name unexpectedly empty.") << endl;
+        const FILE_NOTIFY_INFORMATION *info =
+          reinterpret_cast<const FILE_NOTIFY_INFORMATION *> (curr_entry);
+
+        append_event(info->FileName,
+                     info->FileNameLength / sizeof (wchar_t),
+                     decode_flags(info->Action),
+                     curr_time,
+                     events,
+                     path_buffer);
+        next_entry_offset = info->NextEntryOffset;
       }
 
-      curr_entry = (currEntry->NextEntryOffset == 0) ? nullptr : curr_entry + currEntry->NextEntryOffset;
+      curr_entry = (next_entry_offset == 0) ? nullptr : curr_entry + next_entry_offset;
     }
 
-    return events;
+    return records;
   }
 }
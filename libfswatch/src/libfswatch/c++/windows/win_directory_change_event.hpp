@@ -33,6 +33,7 @@
 #  include "win_handle.hpp"
 #  include "win_error_message.hpp"
 #  include "../event.hpp"
+#  include "../event_batch.hpp"
 
 namespace fsw
 {
@@ -40,25 +41,73 @@ namespace fsw
    * @brief Header of the fsw::directory_change_event class, a helper class to
    * wrap Microsoft Windows' `ReadDirectoryChangesW` function and a common
    * workflow to detect file system changes.
+   *
+   * Two buffers are used: swap_buffers() makes the buffer filled by the last
+   * read the spare buffer, so that the next read can be issued before its
+   * changes are decoded.  The size of the buffer grows when it overflows and
+   * shrinks back when it does not, between the initial and the maximum
+   * length.
+   *
+   * The paths of the changes are converted from the UTF-16 records into a
+   * reusable UTF-8 buffer by appending the relative path of every change to
+   * the POSIX path of the watched directory, unless a Cygwin mount point is
+   * found below it.  If extended_info is set and `ReadDirectoryChangesExW`
+   * is available, the records also carry the attributes of the objects,
+   * which are used to set their type without querying the file system.  A
+   * file system which does not support them falls back to
+   * `ReadDirectoryChangesW`.
+   *
+   * read_pending is set while a read issued by read_changes_async() has not
+   * been completed by try_read(): the buffer and the `OVERLAPPED` structure
+   * are still in use by the kernel and the event must not be released until
+   * the completion of the read is dequeued, or until cancel_read() returns.
    */
   class directory_change_event
   {
   public:
     std::wstring path;
+    std::string posix_path;
+    bool fast_conversion = false;
+    bool extended_info = false;
+    bool buffer_extended = false;
+    bool spare_buffer_extended = false;
     win_handle handle;
     size_t buffer_size;
+    size_t spare_buffer_size;
+    size_t min_buffer_size;
+    size_t max_buffer_size;
+    size_t requested_buffer_size;
+    ULONGLONG last_resize;
     DWORD bytes_returned;
+    bool read_pending = false;
     std::unique_ptr<void, decltype(free)*> buffer = {nullptr, free};
+    std::unique_ptr<void, decltype(free)*> spare_buffer = {nullptr, free};
     std::unique_ptr<OVERLAPPED, decltype(free)*> overlapped = {static_cast<OVERLAPPED *> (malloc(sizeof (OVERLAPPED))), free};
     win_error_message read_error;
 
-    directory_change_event(size_t buffer_length = 16);
+    directory_change_event(size_t buffer_length = 16,
+                           size_t max_buffer_length = 0);
     bool is_io_incomplete();
     bool is_buffer_overflowed();
     bool read_changes_async();
+    bool cancel_read();
     bool try_read();
     void continue_read();
-    std::vector<event> get_events();
+    void swap_buffers();
+    bool grow_buffer();
+    bool shrink_buffer(ULONGLONG interval);
+    size_t append_events(const void *changes,
+                         bool extended,
+                         event_batch& events,
+                         std::string& path_buffer) const;
+
+  private:
+    void append_event(const wchar_t *name,
+                      size_t name_length,
+                      uint32_t flags,
+                      const timespec& evt_time,
+                      event_batch& events,
+                      std::string& path_buffer) const;
   };
 }
 
@@ -14,7 +14,12 @@
  * this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "win_paths.hpp"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mntent.h>
 #include <sys/cygwin.h>
+#include <windows.h>
 #include "../libfswatch_exception.hpp"
 #include "../../gettext_defs.h"
 
@@ -47,5 +52,151 @@ namespace fsw
 
       return posix_path;
     }
+
+    // Cygwin maps into U+F000 + c the characters c which Windows does not
+    // accept in file names, as well as the trailing dots and spaces.
+    static bool is_mapped_character(unsigned int c)
+    {
+      if (c == 0) return false;
+
+      return c < 0x20 || strchr("\"*:<>?| .", static_cast<int> (c)) != nullptr;
+    }
+
+    static void append_utf8(string& out, uint32_t c)
+    {
+      if (c < 0x80)
+      {
+        out.push_back(static_cast<char> (c));
+      }
+      else if (c < 0x800)
+      {
+        out.push_back(static_cast<char> (0xC0 | (c >> 6)));
+        out.push_back(static_cast<char> (0x80 | (c & 0x3F)));
+      }
+      else if (c < 0x10000)
+      {
+        out.push_back(static_cast<char> (0xE0 | (c >> 12)));
+        out.push_back(static_cast<char> (0x80 | ((c >> 6) & 0x3F)));
+        out.push_back(static_cast<char> (0x80 | (c & 0x3F)));
+      }
+      else
+      {
+        out.push_back(static_cast<char> (0xF0 | (c >> 18)));
+        out.push_back(static_cast<char> (0x80 | ((c >> 12) & 0x3F)));
+        out.push_back(static_cast<char> (0x80 | ((c >> 6) & 0x3F)));
+        out.push_back(static_cast<char> (0x80 | (c & 0x3F)));
+      }
+    }
+
+    void append_win_w_as_posix(string& out,
+                               const wchar_t *path,
+                               size_t length)
+    {
+      static_assert(sizeof (wchar_t) == 2, "wchar_t must hold UTF-16 code units.");
+
+      // A code point takes at most 3 bytes per UTF-16 code unit.
+      out.reserve(out.size() + 3 * length);
+
+      size_t i = 0;
+
+      while (i < length)
+      {
+        // Copy the runs of ASCII characters four code units at a time: Windows
+        // is little-endian, so the first code unit is the lowest one.
+        uint64_t units;
+
+        while (i + 4 <= length)
+        {
+          memcpy(&units, path + i, sizeof (units));
+          if (units & UINT64_C(0xFF80FF80FF80FF80)) break;
+
+          for (unsigned int k = 0; k < 4; ++k)
+          {
+            const char c = static_cast<char> (units >> (16 * k));
+            out.push_back(c == '\\' ? '/' : c);
+          }
+
+          i += 4;
+        }
+
+        if (i == length) break;
+
+        uint32_t c = static_cast<uint16_t> (path[i++]);
+
+        if (c == '\\')
+        {
+          c = '/';
+        }
+        else if (c >= 0xF000 && c < 0xF080 && is_mapped_character(c - 0xF000))
+        {
+          c -= 0xF000;
+        }
+        else if (c >= 0xD800 && c < 0xDC00)
+        {
+          const uint32_t low = (i < length) ? static_cast<uint16_t> (path[i]) : 0;
+
+          if (low >= 0xDC00 && low < 0xE000)
+          {
+            c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+            ++i;
+          }
+          else
+          {
+            c = 0xFFFD;
+          }
+        }
+        else if (c >= 0xDC00 && c < 0xE000)
+        {
+          c = 0xFFFD;
+        }
+
+        append_utf8(out, c);
+      }
+    }
+
+    bool has_mount_below(const wstring& path)
+    {
+      FILE *mounts = setmntent("/etc/mtab", "r");
+      if (mounts == nullptr) return true;
+
+      bool found = false;
+      struct mntent *entry;
+
+      while (!found && (entry = getmntent(mounts)) != nullptr)
+      {
+        void *raw_path = cygwin_create_path(CCP_POSIX_TO_WIN_W, entry->mnt_dir);
+        if (raw_path == nullptr) continue;
+
+        const wstring mount_path(static_cast<wchar_t *> (raw_path));
+        free(raw_path);
+
+        // File names are compared ignoring case, as Windows does.
+        found = mount_path.size() > path.size()
+          && (path.back() == L'\\' || mount_path[path.size()] == L'\\')
+          && CompareStringOrdinal(mount_path.c_str(),
+                                  static_cast<int> (path.size()),
+                                  path.c_str(),
+                                  static_cast<int> (path.size()),
+                                  TRUE) == CSTR_EQUAL;
+      }
+
+      endmntent(mounts);
+
+      return found;
+    }
+
+    wstring to_long_path(const wstring& path)
+    {
+      if (path.size() < MAX_PATH || path.compare(0, 4, L"\\\\?\\") == 0)
+        return path;
+
+      if (path.compare(0, 2, L"\\\\") == 0)
+        return L"\\\\?\\UNC\\" + path.substr(2);
+
+      if (path.size() > 2 && path[1] == L':')
+        return L"\\\\?\\" + path;
+
+      return path;
+    }
   }
 }
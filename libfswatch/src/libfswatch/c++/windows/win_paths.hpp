@@ -26,6 +26,7 @@
 #ifndef FSW_WIN_PATHS_HPP
 #  define  FSW_WIN_PATHS_HPP
 
+#  include <cstddef>
 #  include <string>
 
 namespace fsw
@@ -53,6 +54,50 @@ namespace fsw
      * @return The converted POSIX path.
      */
     std::string win_w_to_posix(std::wstring path);
+
+    /**
+     * @brief Converts a relative Windows path to POSIX, appending it to a
+     * string.
+     *
+     * The UTF-16 path is transcoded to UTF-8 without intermediate strings,
+     * its separators are converted to slashes and the characters which
+     * Cygwin maps into the Unicode private use area, because Windows does
+     * not accept them in file names, are restored.  Unpaired surrogates are
+     * replaced by U+FFFD.  The result is the same as converting the path
+     * with win_w_to_posix() if no mount point is found below the path it is
+     * relative to (see has_mount_below()).
+     *
+     * @param out The string the converted path is appended to.
+     * @param path The path to convert, which need not be NUL-terminated.
+     * @param length The number of UTF-16 code units of @p path.
+     */
+    void append_win_w_as_posix(std::string& out,
+                               const wchar_t *path,
+                               size_t length);
+
+    /**
+     * @brief Checks whether a Cygwin mount point is below a Windows path.
+     *
+     * The POSIX path of the objects below such a path cannot be derived from
+     * the POSIX path of the path itself.
+     *
+     * @param path The absolute Windows path to check.
+     * @return @c true if a mount point is found below @p path.
+     */
+    bool has_mount_below(const std::wstring& path);
+
+    /**
+     * @brief Converts an absolute Windows path to the form which is not
+     * limited to `MAX_PATH` characters.
+     *
+     * Paths longer than `MAX_PATH` are prefixed with `\\?\`, or with
+     * `\\?\UNC\` if they are UNC paths.  Other paths are returned as
+     * they are.
+     *
+     * @param path The absolute Windows path to convert.
+     * @return The converted path.
+     */
+    std::wstring to_long_path(const std::wstring& path);
   }
 }
 #endif	/* FSW_WIN_PATHS_HPP */
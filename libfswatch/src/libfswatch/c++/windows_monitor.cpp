@@ -28,6 +28,7 @@
 #  include <algorithm>
 #  include <set>
 #  include <iostream>
+#  include <iterator>
 #  include <memory>
 #  include <sys/types.h>
 #  include <cstdlib>
@@ -47,12 +48,48 @@ using namespace std;
 
 namespace fsw
 {
+  /*
+   * Maximum number of completion packets retrieved by a single call to
+   * GetQueuedCompletionStatusEx.
+   */
+  static const ULONG COMPLETION_ENTRIES = 64;
+
+  /*
+   * The completion key of the packet posted by on_stop() to wake up the
+   * monitor loop.  The completion key of the directory handles is the address
+   * of the corresponding path in windows_monitor_load::win_paths, which is
+   * never null.
+   */
+  static const ULONG_PTR WAKE_UP_KEY = 0;
+
   struct windows_monitor_load
   {
     fsw_hash_set<wstring> win_paths;
+    /*
+     * Paths which are no longer watched.  They are kept in win_paths, since
+     * the completions of the reads cancelled when their search is stopped may
+     * still refer to them.
+     */
+    fsw_hash_set<wstring> removed_paths;
     fsw_hash_map<wstring, directory_change_event> dce_by_path;
-    fsw_hash_map<wstring, win_handle> event_by_path;
+    /*
+     * Stopped searches whose read has been cancelled, by the address of their
+     * OVERLAPPED structure.  The kernel may still use their buffers until the
+     * completion of the cancelled read is dequeued, and their addresses cannot
+     * be reused by a new search in the meantime.
+     */
+    fsw_hash_map<const OVERLAPPED *, directory_change_event> closing_events;
+    win_handle completion_port;
+    /*
+     * The batch of the changes of a loop and the buffer their paths are
+     * converted into, reused by every loop.
+     */
+    event_batch batch;
+    string path_buffer;
+    bool extended_info = false;
     long buffer_size = 128;
+    long max_buffer_size = 4096;
+    ULONGLONG buffer_shrink_interval = 60000;
   };
 
   windows_monitor::windows_monitor(vector<string> paths_to_monitor,
@@ -61,45 +98,51 @@ namespace fsw
     monitor(paths_to_monitor, callback, context), load(new windows_monitor_load())
   {
     SetConsoleOutputCP(CP_UTF8);
+
+    load->completion_port = CreateIoCompletionPort(INVALID_HANDLE_VALUE,
+                                                   nullptr,
+                                                   0,
+                                                   1);
+
+    if (!load->completion_port.is_valid())
+    {
+      delete load;
+      throw libfsw_exception(_("CreateIoCompletionPort failed."));
+    }
   }
 
   windows_monitor::~windows_monitor()
   {
+    // The buffers of the pending reads are released only when they are done.
+    for (auto & dce : load->dce_by_path) dce.second.cancel_read();
+    for (auto & dce : load->closing_events) dce.second.cancel_read();
+
     delete load;
   }
 
   void windows_monitor::initialize_windows_path_list()
   {
-    for (const auto & path : paths)
+    // The paths watched by a previous run may have been removed since.
+    for (const auto & path : load->win_paths)
     {
-      load->win_paths.insert(win_paths::posix_to_win_w(path));
+      load->removed_paths.insert(path);
     }
-  }
 
-  void windows_monitor::initialize_events()
-  {
-    for (const wstring & path : load->win_paths)
+    for (const auto & path : paths)
     {
-      FSW_ELOGF(_("Creating event for %s.\n"), win_strings::wstring_to_string(path).c_str());
-
-      HANDLE h = CreateEvent(nullptr,
-                             TRUE,
-                             FALSE,
-                             nullptr);
-
-      if (h == NULL) throw libfsw_exception(_("CreateEvent failed."));
-
-      FSW_ELOGF(_("Event %d created for %s.\n"), h, win_strings::wstring_to_string(path).c_str());
+      const wstring win_path = win_paths::posix_to_win_w(path);
 
-      load->event_by_path.emplace(path, h);
+      load->win_paths.insert(win_path);
+      load->removed_paths.erase(win_path);
     }
   }
 
-  bool windows_monitor::init_search_for_path(const wstring path)
+  bool windows_monitor::init_search_for_path(const wstring & path)
   {
     FSW_ELOGF(_("Initializing search structures for %s.\n"), win_strings::wstring_to_string(path).c_str());
 
-    HANDLE h = CreateFileW(path.c_str(),
+    // The path of a deep directory exceeds MAX_PATH only in its long form.
+    HANDLE h = CreateFileW(win_paths::to_long_path(path).c_str(),
                            GENERIC_READ,
                            FILE_SHARE_DELETE | FILE_SHARE_READ | FILE_SHARE_WRITE,
                            nullptr, OPEN_EXISTING,
@@ -114,10 +157,22 @@ namespace fsw
 
     FSW_ELOGF(_("Open file handle: %d.\n"), h);
 
-    directory_change_event dce(load->buffer_size);
+    directory_change_event dce(load->buffer_size, load->max_buffer_size);
     dce.path = path;
     dce.handle = h;
-    dce.overlapped.get()->hEvent = load->event_by_path[path];
+    dce.posix_path = win_paths::win_w_to_posix(path);
+    dce.fast_conversion = !win_paths::has_mount_below(path);
+    dce.extended_info = load->extended_info;
+
+    // Completions are reported to the completion port using the address of
+    // the path as key: the elements of win_paths are never moved.
+    const ULONG_PTR key = reinterpret_cast<ULONG_PTR> (&path);
+
+    if (CreateIoCompletionPort(h, load->completion_port, key, 0) == nullptr)
+    {
+      FSW_ELOGF(_("CreateIoCompletionPort: %s\n"), win_strings::wstring_to_string(win_error_message::current()).c_str());
+      return false;
+    }
 
     if (!dce.read_changes_async())
     {
@@ -132,7 +187,26 @@ namespace fsw
 
   void windows_monitor::stop_search_for_path(const wstring path)
   {
-    load->dce_by_path.erase(path);
+    auto it = load->dce_by_path.find(path);
+    if (it == load->dce_by_path.end()) return;
+
+    directory_change_event & dce = it->second;
+
+    // A pending read is cancelled, and the search is released when the
+    // completion of the cancelled read is dequeued.
+    if (dce.read_pending)
+    {
+      if (!CancelIoEx(dce.handle, dce.overlapped.get())
+          && GetLastError() != ERROR_NOT_FOUND)
+      {
+        FSW_ELOGF(_("CancelIoEx: %s\n"), win_strings::wstring_to_string(win_error_message::current()).c_str());
+      }
+
+      const OVERLAPPED * overlapped = dce.overlapped.get();
+      load->closing_events.emplace(overlapped, move(dce));
+    }
+
+    load->dce_by_path.erase(it);
   }
 
   bool windows_monitor::is_path_watched(wstring path)
@@ -140,76 +214,149 @@ namespace fsw
     return (load->dce_by_path.find(path) != load->dce_by_path.end());
   }
 
-  void windows_monitor::process_path(const wstring & path)
+  void windows_monitor::initialize_searches()
   {
-    FSW_ELOGF(_("Processing %s.\n"), win_strings::wstring_to_string(path).c_str());
-
-    // If the path is not currently watched, then initialize the search
+    // If a path is not currently watched, then initialize the search
     // structures.  If the initalization fails, skip the path altogether
-    // until the next iteration.
-    if (!is_path_watched(path))
+    // until the next attempt.
+    for (const auto & path : load->win_paths)
     {
-      if (!init_search_for_path(path)) return;
+      if (load->removed_paths.find(path) != load->removed_paths.end()) continue;
+      if (!is_path_watched(path)) init_search_for_path(path);
     }
+  }
 
-    auto it = load->dce_by_path.find(path);
-    if (it == load->dce_by_path.end()) throw libfsw_exception(_("Initialization failed."));
-
-    directory_change_event & dce = it->second;
-
-    if (!dce.try_read())
+  /*
+   * Each path to watch has its own search: a search is started for an added
+   * path and stopped for a removed path without affecting the other ones.
+   */
+  void windows_monitor::update_root_paths()
+  {
+    for (const path_change & change : take_path_changes())
     {
-      if (dce.is_io_incomplete())
+      const wstring path = win_paths::posix_to_win_w(change.path);
+
+      if (change.added)
       {
-        FSW_ELOG(_("I/O incomplete.\n"));
-        return;
-      }
+        load->removed_paths.erase(path);
 
-      if (dce.is_buffer_overflowed())
+        const wstring & win_path = *load->win_paths.insert(path).first;
+        if (!is_path_watched(win_path)) init_search_for_path(win_path);
+      }
+      else if (load->win_paths.find(path) != load->win_paths.end())
       {
-        notify_overflow(win_paths::win_w_to_posix(path));
+        FSW_ELOGF(_("Stopping search for %s.\n"), change.path.c_str());
+
+        load->removed_paths.insert(path);
+        stop_search_for_path(path);
       }
+    }
+  }
+
+  void windows_monitor::process_completion(const OVERLAPPED_ENTRY & entry,
+                                           event_batch & events)
+  {
+    const wstring & path = *reinterpret_cast<const wstring *> (entry.lpCompletionKey);
+
+    FSW_DLOGF(_("Processing %s.\n"), win_strings::wstring_to_string(path).c_str());
+
+    // The cancelled read of a stopped search is done: its search is released.
+    if (load->closing_events.erase(entry.lpOverlapped) > 0) return;
+
+    auto it = load->dce_by_path.find(path);
+
+    // Discard the completion of a read issued on a search which has since
+    // been stopped.
+    if (it == load->dce_by_path.end()) return;
+    directory_change_event & dce = it->second;
+    if (entry.lpOverlapped != dce.overlapped.get()) return;
 
+    // The read has already completed: GetOverlappedResult does not wait and
+    // is only used to retrieve its outcome.
+    const bool read = dce.try_read();
+
+    if (!read && !dce.is_buffer_overflowed())
+    {
       stop_search_for_path(path);
 
       return;
     }
 
-    FSW_ELOGF(_("GetOverlappedResult returned %d bytes\n"), dce.bytes_returned);
+    FSW_DLOGF(_("GetOverlappedResult returned %d bytes\n"), dce.bytes_returned);
 
-    if (dce.bytes_returned == 0)
-    {
-      notify_overflow(win_paths::win_w_to_posix(path));
-    }
-    else
+    if (!read || dce.bytes_returned == 0)
     {
-      vector<event> events = dce.get_events();
+      // The buffer is grown before the read is issued again, but the changes
+      // received in the meantime are lost and an overflow is notified anyway.
+      dce.grow_buffer();
+      notify_overflow(dce.posix_path);
+
+      if (!dce.read_changes_async())
+      {
+        FSW_ELOGF(_("ReadDirectoryChangesW: %s\n"), win_strings::wstring_to_string(win_error_message::current()).c_str());
+        stop_search_for_path(path);
+      }
 
-      if (events.size()) notify_events(events);
+      return;
     }
 
-    if (!dce.read_changes_async())
+    // Re-arm the read on the spare buffer before decoding the changes, so
+    // that the kernel can buffer new changes in the meantime.  If no overflow
+    // occurred for a while, the buffer is shrunk.
+    dce.shrink_buffer(load->buffer_shrink_interval);
+    dce.swap_buffers();
+
+    const bool rearmed = dce.read_changes_async();
+
+    if (!rearmed)
     {
       FSW_ELOGF(_("ReadDirectoryChangesW: %s\n"), win_strings::wstring_to_string(win_error_message::current()).c_str());
-      stop_search_for_path(path);
     }
-  }
 
-  void windows_monitor::configure_monitor()
-  {
-    string buffer_size_value = get_property("windows.ReadDirectoryChangesW.buffer.size");
+    const size_t records = dce.append_events(dce.spare_buffer.get(),
+                                             dce.spare_buffer_extended,
+                                             events,
+                                             load->path_buffer);
+    count_read(records, dce.bytes_returned);
 
-    if (buffer_size_value.empty()) return;
+    if (!rearmed) stop_search_for_path(path);
+  }
 
-    long parsed_value = strtol(buffer_size_value.c_str(), nullptr, 0);
+  static long parse_positive_property(const string & value)
+  {
+    long parsed_value = strtol(value.c_str(), nullptr, 0);
 
     if (parsed_value <= 0)
     {
-      string msg = string(_("Invalid value: ")) + buffer_size_value;
+      string msg = string(_("Invalid value: ")) + value;
       throw libfsw_exception(msg.c_str());
     }
 
-    load->buffer_size = parsed_value;
+    return parsed_value;
+  }
+
+  void windows_monitor::configure_monitor()
+  {
+    string buffer_size_value = get_property("windows.ReadDirectoryChangesW.buffer.size");
+
+    if (!buffer_size_value.empty())
+      load->buffer_size = parse_positive_property(buffer_size_value);
+
+    string max_buffer_size_value = get_property("windows.ReadDirectoryChangesW.buffer.max.size");
+
+    if (!max_buffer_size_value.empty())
+      load->max_buffer_size = parse_positive_property(max_buffer_size_value);
+
+    // The buffer starts with its initial size and never shrinks below it.
+    if (load->max_buffer_size < load->buffer_size)
+      load->max_buffer_size = load->buffer_size;
+
+    string shrink_interval_value = get_property("windows.ReadDirectoryChangesW.buffer.shrink.interval");
+
+    if (!shrink_interval_value.empty())
+      load->buffer_shrink_interval = 1000 * parse_positive_property(shrink_interval_value);
+
+    load->extended_info = (get_property("windows.ReadDirectoryChangesExW") == "true");
   }
 
   void windows_monitor::run()
@@ -223,7 +370,10 @@ namespace fsw
 
     configure_monitor();
     initialize_windows_path_list();
-    initialize_events();
+
+    const DWORD timeout = static_cast<DWORD> (latency * 1000);
+    OVERLAPPED_ENTRY entries[COMPLETION_ENTRIES];
+    ULONGLONG last_initialization = 0;
 
     for (;;)
     {
@@ -233,14 +383,62 @@ namespace fsw
       run_guard.unlock();
 #endif
 
-      sleep(latency);
+      // Searches which could not be initialized or which were stopped because
+      // of an error are retried at most once per latency period.
+      update_root_paths();
+
+      const ULONGLONG now = GetTickCount64();
+
+      if (now - last_initialization >= timeout)
+      {
+        initialize_searches();
+        last_initialization = now;
+        set_watch_count(load->dce_by_path.size());
+      }
+
+      ULONG removed = 0;
+
+      if (!GetQueuedCompletionStatusEx(load->completion_port,
+                                       entries,
+                                       COMPLETION_ENTRIES,
+                                       &removed,
+                                       timeout,
+                                       FALSE))
+      {
+        if (GetLastError() == WAIT_TIMEOUT) continue;
+
+        throw libfsw_exception(_("GetQueuedCompletionStatusEx failed."));
+      }
 
-      for (const auto & path : load->win_paths)
+      event_batch & events = load->batch;
+      events.clear();
+
+      for (ULONG i = 0; i < removed; ++i)
       {
-        process_path(path);
+        if (entries[i].lpCompletionKey == WAKE_UP_KEY) continue;
+
+        process_completion(entries[i], events);
       }
+
+      if (!events.empty()) notify_events(events);
     }
   }
+
+  /*
+   * on_stop() is designed to be invoked with a lock on the run_mutex.
+   */
+  void windows_monitor::on_stop()
+  {
+    PostQueuedCompletionStatus(load->completion_port, 0, WAKE_UP_KEY, nullptr);
+  }
+
+  /*
+   * on_paths_changed() is designed to be invoked with a lock on the run_mutex.
+   */
+  void windows_monitor::on_paths_changed()
+  {
+    PostQueuedCompletionStatus(load->completion_port, 0, WAKE_UP_KEY, nullptr);
+  }
 }
 
 #endif  /* HAVE_WINDOWS */
@@ -29,6 +29,7 @@
 #  include "monitor.hpp"
 #  include <string>
 #  include <vector>
+#  include <windows.h>
 
 namespace fsw
 {
@@ -42,7 +43,8 @@ namespace fsw
    * @brief Windows monitor.
    *
    * This monitor is built upon the `ReadDirectoryChanges` API of the Windows
-   * operating systems.
+   * operating systems.  The directory handles are associated with an I/O
+   * completion port and the monitor loop blocks until a read completes.
    */
   class windows_monitor : public monitor
   {
@@ -69,16 +71,29 @@ namespace fsw
      */
     void run();
 
+    /**
+     * @brief Wakes up the monitor loop so that it can check the stop flag.
+     */
+    void on_stop();
+
+    /**
+     * @brief Wakes up the monitor loop so that it can apply the changes of the
+     * paths to watch.
+     */
+    void on_paths_changed();
+
   private:
     windows_monitor(const windows_monitor& orig) = delete;
     windows_monitor& operator=(const windows_monitor& that) = delete;
 
     void configure_monitor();
     void initialize_windows_path_list();
-    void initialize_events();
-    bool init_search_for_path(const std::wstring path);
+    void initialize_searches();
+    void update_root_paths();
+    bool init_search_for_path(const std::wstring& path);
     void stop_search_for_path(const std::wstring path);
-    void process_path(const std::wstring& path);
+    void process_completion(const OVERLAPPED_ENTRY& entry,
+                            event_batch& events);
     bool is_path_watched(std::wstring path);
 
     // initial load
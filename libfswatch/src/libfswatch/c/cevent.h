@@ -29,6 +29,7 @@
 
 #  include <time.h>
 #  include <limits.h>
+#  include <stdint.h>
 #  include "libfswatch_types.h"
 
 #  ifdef __cplusplus
@@ -76,10 +77,11 @@ extern "C"
     IsDir = (1 << 10),            /**< The object is a directory. */
     IsSymLink = (1 << 11),        /**< The object is a symbolic link. */
     Link = (1 << 12),             /**< The link count of an object has changed. */
-    Overflow = (1 << 13)          /**< The event queue has overflowed. */
+    Overflow = (1 << 13),         /**< The event queue has overflowed. */
+    HistoryDone = (1 << 14)       /**< The replay of historical events is complete. */
   };
 
-  extern enum fsw_event_flag FSW_ALL_EVENT_FLAGS[15];
+  extern enum fsw_event_flag FSW_ALL_EVENT_FLAGS[16];
 
   /**
    * @brief Get event flag by name.
@@ -112,6 +114,10 @@ extern "C"
    *   - evt_time the time when the event was triggered.
    *   - flags is an array of fsw_event_flag of size flags_num.
    *   - flags_num is the size of the flags array.
+   *   - evt_time_nsec the nanoseconds of the time when the event was
+   *     triggered, in the range [0, 999999999].
+   *   - sequence is the number of the event in the order in which the events
+   *     are notified by the monitor, starting from 1.
    */
   typedef struct fsw_cevent
   {
@@ -119,6 +125,8 @@ extern "C"
     time_t evt_time;
     enum fsw_event_flag * flags;
     unsigned int flags_num;
+    long evt_time_nsec;
+    uint64_t sequence;
   } fsw_cevent;
 
   /**
@@ -137,6 +145,83 @@ extern "C"
                                       const unsigned int event_num,
                                       void *data);
 
+  /**
+   * A batch of file change events is stored in a single, contiguous buffer
+   * starting with an instance of this struct where:
+   *   - size is the size of the buffer in bytes, including this header.
+   *   - event_num is the number of event records.
+   *   - record_size is the size of each record in bytes.
+   *
+   * The header is followed by event_num records of type fsw_cevent_record,
+   * which are followed by the NUL-terminated paths of the events.  The records
+   * refer to the paths by their offset from the start of the buffer, so that
+   * the whole buffer can be copied as a single block.  Use
+   * FSW_CEVENT_BATCH_RECORD() and FSW_CEVENT_BATCH_STRING() to access them.
+   */
+  typedef struct fsw_cevent_batch
+  {
+    uint64_t size;
+    uint32_t event_num;
+    uint32_t record_size;
+  } fsw_cevent_batch;
+
+  /**
+   * A file change event stored in an fsw_cevent_batch where:
+   *   - evt_time the time when the event was triggered.
+   *   - path_offset is the offset of the path where the event was triggered.
+   *   - path_length is the length of the path, excluding the terminating NUL.
+   *   - old_path_offset is the offset of the previous path of a renamed object.
+   *   - old_path_length is the length of the previous path, or 0 if the event
+   *     does not describe a rename.
+   *   - flags is the bitmask of the fsw_event_flag values of the event.
+   *   - evt_time_nsec the nanoseconds of the time when the event was
+   *     triggered.
+   *   - sequence is the number of the event in the order in which the events
+   *     are notified by the monitor.
+   * Fields may be appended to this struct in later versions: records must be
+   * accessed with FSW_CEVENT_BATCH_RECORD(), which honours record_size.
+   */
+  typedef struct fsw_cevent_record
+  {
+    int64_t evt_time;
+    uint32_t path_offset;
+    uint32_t path_length;
+    uint32_t old_path_offset;
+    uint32_t old_path_length;
+    uint32_t flags;
+    uint32_t evt_time_nsec;
+    uint64_t sequence;
+  } fsw_cevent_record;
+
+  /**
+   * Gets a pointer to the record of index i of a batch.
+   */
+#  define FSW_CEVENT_BATCH_RECORD(batch, i)                                    \
+  ((const fsw_cevent_record *) ((const char *) (batch)                        \
+                                + sizeof(fsw_cevent_batch)                    \
+                                + (size_t) (i) * (batch)->record_size))
+
+  /**
+   * Gets a pointer to the string at the specified offset of a batch.
+   */
+#  define FSW_CEVENT_BATCH_STRING(batch, offset)                               \
+  ((const char *) (batch) + (offset))
+
+  /**
+   * A function pointer of type FSW_CEVENT_BATCH_CALLBACK is used by the API as
+   * an alternative to FSW_CEVENT_CALLBACK to provide the received events as a
+   * single batch.  The callback is passed the following arguments:
+   *   - batch, a const pointer to the read-only batch of events.
+   *   - data, optional persisted data for a callback.
+   *
+   * The batch is owned by the library and its storage is reused by the
+   * following invocations: no memory is allocated for each event.  A callback
+   * should copy the batch, or the data it needs, instead of storing a pointer
+   * to it.
+   */
+  typedef void (*FSW_CEVENT_BATCH_CALLBACK)(const fsw_cevent_batch *batch,
+                                            void *data);
+
 #  ifdef __cplusplus
 }
 #  endif
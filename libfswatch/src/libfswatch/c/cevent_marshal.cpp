@@ -0,0 +1,156 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "cevent_marshal.hpp"
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "error.h"
+
+using namespace std;
+
+namespace fsw
+{
+  fsw_cevent *copy_cevents(const vector<event>& events)
+  {
+    fsw_cevent *const cevents = static_cast<fsw_cevent *> (malloc(
+      sizeof(fsw_cevent) * events.size()));
+
+    if (cevents == nullptr)
+      throw int(FSW_ERR_MEMORY);
+
+    for (unsigned int i = 0; i < events.size(); ++i)
+    {
+      fsw_cevent *cevt = &cevents[i];
+      const event& evt = events[i];
+
+      // Copy event into C event wrapper.
+      const string path = evt.get_path();
+
+      // Copy std::string into char * buffer and null-terminate it.
+      cevt->path = static_cast<char *> (malloc(
+        sizeof(char *) * (path.length() + 1)));
+      if (!cevt->path) throw int(FSW_ERR_MEMORY);
+
+      strncpy(cevt->path, path.c_str(), path.length());
+      cevt->path[path.length()] = '\0';
+      cevt->evt_time = evt.get_timespec().tv_sec;
+      cevt->evt_time_nsec = evt.get_timespec().tv_nsec;
+      cevt->sequence = evt.get_sequence();
+
+      const vector<fsw_event_flag> flags = evt.get_flags();
+      cevt->flags_num = flags.size();
+
+      if (!cevt->flags_num) cevt->flags = nullptr;
+      else
+      {
+        cevt->flags =
+          static_cast<fsw_event_flag *> (
+            malloc(sizeof(fsw_event_flag) * cevt->flags_num));
+        if (!cevt->flags) throw int(FSW_ERR_MEMORY);
+      }
+
+      for (unsigned int e = 0; e < cevt->flags_num; ++e)
+      {
+        cevt->flags[e] = flags[e];
+      }
+    }
+
+    return cevents;
+  }
+
+  void free_cevents(fsw_cevent *cevents, size_t event_num)
+  {
+    // Deallocate memory allocated by events.
+    for (unsigned int i = 0; i < event_num; ++i)
+    {
+      fsw_cevent *cevt = &cevents[i];
+
+      if (cevt->flags) free(static_cast<void *> (cevt->flags));
+      free(static_cast<void *> (cevt->path));
+    }
+
+    free(static_cast<void *> (cevents));
+  }
+
+  fsw_cevent_batch *pack_cevent_batch(const event_batch& events,
+                                      vector<char>& buffer)
+  {
+    const size_t records_size = sizeof(fsw_cevent_batch)
+                                + events.size() * sizeof(fsw_cevent_record);
+    size_t size = records_size;
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+      const event_view evt = events[i];
+
+      size += evt.get_path_length() + 1;
+      if (evt.get_old_path_length()) size += evt.get_old_path_length() + 1;
+    }
+
+    if (size > UINT32_MAX)
+      throw int(FSW_ERR_MEMORY);
+
+    if (buffer.size() < size) buffer.resize(size);
+
+    char *data = buffer.data();
+    fsw_cevent_batch *batch = reinterpret_cast<fsw_cevent_batch *> (data);
+    fsw_cevent_record *records =
+      reinterpret_cast<fsw_cevent_record *> (data + sizeof(fsw_cevent_batch));
+
+    batch->size = size;
+    batch->event_num = events.size();
+    batch->record_size = sizeof(fsw_cevent_record);
+
+    size_t offset = records_size;
+
+    auto append = [data, &offset](const char *str, size_t length)
+    {
+      const size_t str_offset = offset;
+
+      memcpy(data + offset, str, length);
+      data[offset + length] = '\0';
+      offset += length + 1;
+
+      return static_cast<uint32_t> (str_offset);
+    };
+
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+      const event_view evt = events[i];
+      fsw_cevent_record& record = records[i];
+
+      record.evt_time = evt.get_timespec().tv_sec;
+      record.evt_time_nsec = evt.get_timespec().tv_nsec;
+      record.sequence = evt.get_sequence();
+      record.path_length = evt.get_path_length();
+      record.path_offset = append(evt.get_path(), evt.get_path_length());
+      record.old_path_length = evt.get_old_path_length();
+      record.old_path_offset = record.old_path_length
+                               ? append(evt.get_old_path(),
+                                        record.old_path_length)
+                               : 0;
+      record.flags = evt.get_flags();
+    }
+
+    return batch;
+  }
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/**
+ * @file
+ * @brief Conversion of C++ events into the events of the C API.
+ *
+ * These functions are used by the callback proxies of the C API and are not
+ * part of the public interface of the library.
+ *
+ * @copyright Copyright (c) 2014-2016 Enrico M. Crisostomo
+ * @license GNU General Public License v. 3.0
+ * @author Enrico M. Crisostomo
+ * @version 1.8.0
+ */
+#ifndef FSW_CEVENT_MARSHAL_H
+#  define FSW_CEVENT_MARSHAL_H
+
+#  include <cstddef>
+#  include <vector>
+#  include "cevent.h"
+#  include "../c++/event.hpp"
+#  include "../c++/event_batch.hpp"
+
+namespace fsw
+{
+  /**
+   * @brief Copies events into a newly allocated array of ::fsw_cevent.
+   *
+   * The array and the paths and flags of its events are allocated with
+   * `malloc()` and must be released with free_cevents().
+   *
+   * @param events The events to copy.
+   * @return The array of events.
+   * @exception int ::FSW_ERR_MEMORY if memory cannot be allocated.
+   */
+  fsw_cevent *copy_cevents(const std::vector<event>& events);
+
+  /**
+   * @brief Releases an array allocated by copy_cevents().
+   *
+   * @param cevents The array to release.
+   * @param event_num The number of events in the array.
+   */
+  void free_cevents(fsw_cevent *cevents, size_t event_num);
+
+  /**
+   * @brief Packs the events of a batch into an ::fsw_cevent_batch.
+   *
+   * The header is followed by the records and by the paths.  The buffer only
+   * grows, so that no memory is allocated once it fits the largest batch.
+   *
+   * @param events The events to pack.
+   * @param buffer The storage of the batch.
+   * @return The batch, which points into @p buffer.
+   * @exception int ::FSW_ERR_MEMORY if the batch does not fit the 32-bit
+   * offsets of its records.
+   */
+  fsw_cevent_batch *pack_cevent_batch(const event_batch& events,
+                                      std::vector<char>& buffer);
+}
+
+#endif  /* FSW_CEVENT_MARSHAL_H */
@@ -27,6 +27,7 @@
 #  define FSW__CMONITOR_H
 
 #  include <time.h>
+#  include <stdint.h>
 
 #  ifdef __cplusplus
 extern "C"
@@ -48,9 +49,90 @@ extern "C"
     inotify_monitor_type,            /**< Linux `inotify` monitor. */
     windows_monitor_type,            /**< Windows monitor. */
     poll_monitor_type,               /**< `stat()`-based poll monitor. */
-    fen_monitor_type                 /**< Solaris/Illumos monitor. */
+    fen_monitor_type,                /**< Solaris/Illumos monitor. */
+    fanotify_monitor_type,           /**< Linux `fanotify` monitor. */
+    subscriber_monitor_type,         /**< Subscriber of a publisher socket. */
+    auto_monitor_type,               /**< File system-aware monitor. */
+    composite_monitor_type           /**< Monitor sharding paths. */
   };
 
+  /**
+   * @brief Policies of the asynchronous delivery queue.
+   *
+   * This enumeration lists the policies applied when the monitor thread
+   * notifies a batch of events and the asynchronous delivery queue is full.
+   */
+  enum fsw_delivery_policy
+  {
+    fsw_delivery_block = 0, /**< Wait until the callback thread frees a slot. */
+    fsw_delivery_coalesce,  /**< Merge the events into a pending batch. */
+    fsw_delivery_drop       /**< Drop the events and notify an overflow. */
+  };
+
+  /**
+   * @brief Threads whose scheduling attributes can be set.
+   *
+   * This enumeration lists the roles of the threads run by a monitor.  The
+   * threads of the inactivity timer and of the shared `inotify` descriptor
+   * are shared by all the monitors of the process: they are configured by the
+   * monitor which starts them.
+   */
+  enum fsw_thread_role
+  {
+    fsw_thread_monitor = 0, /**< The thread running the monitor and the thread reading a shared `inotify` descriptor. */
+    fsw_thread_delivery,    /**< The thread invoking the callback of the asynchronous delivery queue. */
+    fsw_thread_coalescing,  /**< The thread flushing the coalescing window. */
+    fsw_thread_timer,       /**< The thread of the inactivity timer. */
+    fsw_thread_worker       /**< The threads scanning the watched paths and verifying the content of the files. */
+  };
+
+  /**
+   * @brief Number of the elements of ::fsw_thread_role.
+   */
+#  define FSW_THREAD_ROLES 5
+
+  /**
+   * @brief Number of buckets of the histogram of the callback times.
+   *
+   * @see fsw_monitor_stats
+   */
+#  define FSW_CALLBACK_TIME_BUCKETS 20
+
+  /**
+   * @brief Counters of a monitor.
+   *
+   * The counters are accumulated since the monitor was created, except
+   * fsw_monitor_stats::watches and fsw_monitor_stats::queue_depth, which hold
+   * the current values.  The counters of the API read by a monitor are only
+   * maintained by the monitors reading it with a system call, and
+   * fsw_monitor_stats::bytes_read is @c 0 if its records have no fixed size.
+   *
+   * Bucket @c 0 of fsw_monitor_stats::callback_time counts the callbacks
+   * which took less than 1 microsecond, bucket @c i the callbacks which took
+   * at least 2<sup>i-1</sup> and less than 2<sup>i</sup> microseconds, and
+   * the last bucket all the longer ones.
+   */
+  typedef struct fsw_monitor_stats
+  {
+    uint64_t events_read;       /**< Records read from the monitored API. */
+    uint64_t read_calls;        /**< Calls reading the records. */
+    uint64_t bytes_read;        /**< Bytes read by the calls reading the records. */
+    uint64_t events_received;   /**< Events checked against the filters. */
+    uint64_t events_notified;   /**< Events accepted by the filters. */
+    uint64_t events_filtered;   /**< Events rejected by the filters. */
+    uint64_t overflows;         /**< Queue overflows. */
+    uint64_t watches;           /**< Watches currently held by the monitor. */
+    uint64_t scans;             /**< Scans of the watched paths. */
+    uint64_t last_scan_time;    /**< Duration of the last scan, in microseconds. */
+    uint64_t total_scan_time;   /**< Duration of all the scans, in microseconds. */
+    uint64_t callbacks;         /**< Invocations of the callback. */
+    uint64_t callback_time[FSW_CALLBACK_TIME_BUCKETS]; /**< Histogram of the callback times. */
+    uint64_t queue_depth;       /**< Batches waiting in the delivery queue. */
+    uint64_t max_queue_depth;   /**< Maximum number of batches waiting in the delivery queue. */
+    uint64_t files_hashed;      /**< Files read to verify their content. */
+    uint64_t events_unchanged;  /**< Events dropped because the content of their file did not change. */
+  } fsw_monitor_stats;
+
 #  ifdef __cplusplus
 }
 #  endif
@@ -208,8 +208,16 @@
  * opaque type identified by a handle of type ::FSW_HANDLE that can be
  * manipulated using the C functions of this library.
  *
- * Session-modifying API calls (such as fsw_add_path()) will take effect the
- * next time a monitor is started with fsw_start_monitor().
+ * Session-modifying API calls (such as fsw_set_latency()) will take effect the
+ * next time a monitor is started with fsw_start_monitor().  Paths can be added
+ * and removed with fsw_add_path() and fsw_remove_path() while the monitor is
+ * running.
+ *
+ * A session can also be started with fsw_start_monitor_async(), in which case
+ * the monitor is run by a thread of the library and its events are queued
+ * instead of being passed to a callback.  The caller adds the descriptor
+ * returned by fsw_get_event_fd() to its own event loop and reads the queued
+ * events with fsw_read_events() when it becomes readable.
  *
  * @section cpp-to-c Translating the C++ API to C
  *
@@ -431,40 +439,85 @@
 #include <memory>
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <climits>
 #include "libfswatch.h"
+#include "libfswatch_log.h"
+#include "cevent_marshal.hpp"
 #include "../c++/libfswatch_map.hpp"
 #include "../c++/filter.hpp"
 #include "../c++/monitor.hpp"
 #include "../c++/monitor_factory.hpp"
 #include "../c++/libfswatch_exception.hpp"
 
+#if defined(HAVE_CXX_MUTEX) && defined(HAVE_UNISTD_H)
+#  define FSW_HAVE_EVENT_QUEUE
+#  include <cerrno>
+#  include <chrono>
+#  include <condition_variable>
+#  include <mutex>
+#  include <system_error>
+#  include <thread>
+#  include <fcntl.h>
+#  include <unistd.h>
+#  ifdef HAVE_SYS_EVENTFD_H
+#    include <sys/eventfd.h>
+#  endif
+#endif
+
 using namespace std;
 using namespace fsw;
 
+// The default maximum number of events queued by an asynchronous session.
+static const size_t DEFAULT_EVENT_QUEUE_SIZE = 65536;
+
+/*
+ * Queue of the events of a session started with fsw_start_monitor_async().
+ */
+struct fsw_event_queue;
+
 typedef struct FSW_SESSION
 {
   vector<string> paths;
   fsw_monitor_type type;
   fsw::monitor *monitor;
   FSW_CEVENT_CALLBACK callback;
+  FSW_CEVENT_BATCH_CALLBACK batch_callback;
   double latency;
   bool allow_overflow;
+  bool recover_overflow;
   bool recursive;
   bool directory_only;
   bool follow_symlinks;
+  size_t delivery_queue_size;
+  fsw_delivery_policy delivery_policy;
+  size_t event_queue_size;
+  fsw_delivery_policy event_queue_policy;
+  double coalescing_window;
+  size_t verification_cache_size;
+  unsigned int verification_threads;
+  size_t inventory_batch_size;
+  fsw::thread_settings thread_roles[FSW_THREAD_ROLES];
   vector<monitor_filter> filters;
   vector<fsw_event_type_filter> event_type_filters;
+  vector<string> priority_paths;
   map<string, string> properties;
   void *data;
+  void *batch_data;
+  fsw_event_queue *queue;
 } FSW_SESSION;
 
-static bool fsw_libfswatch_verbose = false;
 static FSW_THREAD_LOCAL FSW_STATUS last_error;
 
 // Forward declarations.
 static FSW_EVENT_CALLBACK libfsw_cpp_callback_proxy;
+static FSW_EVENT_BATCH_CALLBACK libfsw_cpp_batch_callback_proxy;
+#ifdef FSW_HAVE_EVENT_QUEUE
+static FSW_EVENT_BATCH_CALLBACK libfsw_cpp_queue_callback_proxy;
+#endif
 static FSW_SESSION *get_session(const FSW_HANDLE handle);
 static int create_monitor(FSW_HANDLE handle, const fsw_monitor_type type);
+static void configure_monitor(FSW_SESSION *session);
 static FSW_STATUS fsw_set_last_error(const int error);
 
 /*
@@ -485,7 +538,11 @@ typedef struct fsw_callback_context
 {
   FSW_HANDLE handle;
   FSW_CEVENT_CALLBACK callback;
+  FSW_CEVENT_BATCH_CALLBACK batch_callback;
   void *data;
+  void *batch_data;
+  // Storage of the batches passed to batch_callback, reused across calls.
+  vector<char> batch_buffer;
 } fsw_callback_context;
 
 void libfsw_cpp_callback_proxy(const std::vector<event>& events,
@@ -496,70 +553,307 @@ void libfsw_cpp_callback_proxy(const std::vector<event>& events,
     throw int(FSW_ERR_MISSING_CONTEXT);
 
   const fsw_callback_context *context = static_cast<fsw_callback_context *> (context_ptr);
+  fsw_cevent *const cevents = copy_cevents(events);
 
-  fsw_cevent *const cevents = static_cast<fsw_cevent *> (malloc(
-    sizeof(fsw_cevent) * events.size()));
+  // TODO manage C++ exceptions from C code
+  (*(context->callback))(cevents, events.size(), context->data);
 
-  if (cevents == nullptr)
-    throw int(FSW_ERR_MEMORY);
+  free_cevents(cevents, events.size());
+}
 
-  for (unsigned int i = 0; i < events.size(); ++i)
-  {
-    fsw_cevent *cevt = &cevents[i];
-    const event& evt = events[i];
+FSW_HANDLE fsw_init_session(const fsw_monitor_type type)
+{
+  FSW_SESSION *session = new FSW_SESSION{};
+  session->type = type;
+  session->event_queue_size = DEFAULT_EVENT_QUEUE_SIZE;
+  session->event_queue_policy = fsw_delivery_drop;
+
+  return session;
+}
+
+/*
+ * Passes the events of a batch to the batch callback, packed into the buffer
+ * of the context.
+ */
+void libfsw_cpp_batch_callback_proxy(const event_batch& events,
+                                     void *context_ptr)
+{
+  if (!context_ptr)
+    throw int(FSW_ERR_MISSING_CONTEXT);
+
+  fsw_callback_context *context = static_cast<fsw_callback_context *> (context_ptr);
+  const fsw_cevent_batch *batch = pack_cevent_batch(events,
+                                                    context->batch_buffer);
 
-    // Copy event into C event wrapper.
-    const string path = evt.get_path();
+  (*(context->batch_callback))(batch, context->batch_data);
+}
 
-    // Copy std::string into char * buffer and null-terminate it.
-    cevt->path = static_cast<char *> (malloc(
-      sizeof(char *) * (path.length() + 1)));
-    if (!cevt->path) throw int(FSW_ERR_MEMORY);
+#ifdef FSW_HAVE_EVENT_QUEUE
+/*
+ * Header of a queued event, which is followed by the bytes of its path and of
+ * its old path.
+ */
+typedef struct fsw_queued_event
+{
+  int64_t evt_time;
+  uint64_t sequence;
+  uint32_t evt_time_nsec;
+  uint32_t flags;
+  uint32_t path_length;
+  uint32_t old_path_length;
+} fsw_queued_event;
+
+struct fsw_event_queue
+{
+  mutex queue_mutex;
+  condition_variable terminated_cond;
+  condition_variable not_full_cond;
+  // The queued events, starting at read_offset.
+  vector<char> events;
+  size_t read_offset = 0;
+  size_t event_num = 0;
+  /*
+   * The maximum number of queued events, or 0 if the queue is unbounded, and
+   * the policy applied when the queue is full.  Once an overflow is queued,
+   * the following events are dropped without queuing another one until the
+   * consumer reads events.
+   */
+  size_t capacity = 0;
+  fsw_delivery_policy policy = fsw_delivery_drop;
+  bool overflowed = false;
+  bool queue_overflow = true;
+  uint64_t overflows = 0;
+  // Set by fsw_stop_monitor() to release a monitor thread waiting for room.
+  bool stopping = false;
+  // With eventfd, read_fd and write_fd are the same descriptor.
+  int read_fd = -1;
+  int write_fd = -1;
+  bool signalled = false;
+  bool terminated = true;
+  FSW_STATUS status = FSW_OK;
+  thread monitor_thread;
+};
+
+static void close_event_queue_descriptors(fsw_event_queue *queue)
+{
+  if (queue->write_fd != -1 && queue->write_fd != queue->read_fd)
+    close(queue->write_fd);
+  if (queue->read_fd != -1) close(queue->read_fd);
+}
 
-    strncpy(cevt->path, path.c_str(), path.length());
-    cevt->path[path.length()] = '\0';
-    cevt->evt_time = evt.get_time();
+static fsw_event_queue *create_event_queue()
+{
+  unique_ptr<fsw_event_queue> queue(new fsw_event_queue());
 
-    const vector<fsw_event_flag> flags = evt.get_flags();
-    cevt->flags_num = flags.size();
+#  ifdef HAVE_SYS_EVENTFD_H
+  queue->read_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  queue->write_fd = queue->read_fd;
 
-    if (!cevt->flags_num) cevt->flags = nullptr;
-    else
-    {
-      cevt->flags =
-        static_cast<fsw_event_flag *> (
-          malloc(sizeof(fsw_event_flag) * cevt->flags_num));
-      if (!cevt->flags) throw int(FSW_ERR_MEMORY);
-    }
+  if (queue->read_fd == -1)
+    throw int(FSW_ERR_UNKNOWN_ERROR);
+#  else
+  int fds[2];
 
-    for (unsigned int e = 0; e < cevt->flags_num; ++e)
+  if (pipe(fds) == -1)
+    throw int(FSW_ERR_UNKNOWN_ERROR);
+
+  queue->read_fd = fds[0];
+  queue->write_fd = fds[1];
+
+  for (int fd : fds)
+  {
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == -1
+        || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1)
     {
-      cevt->flags[e] = flags[e];
+      close_event_queue_descriptors(queue.get());
+      throw int(FSW_ERR_UNKNOWN_ERROR);
     }
   }
+#  endif
 
-  // TODO manage C++ exceptions from C code
-  (*(context->callback))(cevents, events.size(), context->data);
+  return queue.release();
+}
 
-  // Deallocate memory allocated by events.
-  for (unsigned int i = 0; i < events.size(); ++i)
+static void destroy_event_queue(fsw_event_queue *queue)
+{
+  if (queue->monitor_thread.joinable()) queue->monitor_thread.join();
+
+  close_event_queue_descriptors(queue);
+  delete queue;
+}
+
+/*
+ * The descriptor is readable while the queue is signalled.  These functions
+ * are invoked with the queue lock held.
+ */
+static void signal_event_queue(fsw_event_queue *queue)
+{
+  if (queue->signalled) return;
+
+  uint64_t value = 1;
+  ssize_t ret;
+
+#  ifdef HAVE_SYS_EVENTFD_H
+  ret = write(queue->write_fd, &value, sizeof(value));
+#  else
+  ret = write(queue->write_fd, &value, 1);
+#  endif
+
+  if (ret == -1 && errno != EAGAIN) return;
+
+  queue->signalled = true;
+}
+
+static void clear_event_queue_signal(fsw_event_queue *queue)
+{
+  if (!queue->signalled) return;
+
+  uint64_t value;
+  ssize_t ret;
+
+#  ifdef HAVE_SYS_EVENTFD_H
+  ret = read(queue->read_fd, &value, sizeof(value));
+#  else
+  ret = read(queue->read_fd, &value, 1);
+#  endif
+
+  if (ret == -1 && errno != EAGAIN) return;
+
+  queue->signalled = false;
+}
+
+// Overflow events are queued unless the event type filters exclude them.
+static bool accepts_overflow_events(const FSW_SESSION *session)
+{
+  if (session->event_type_filters.empty()) return true;
+
+  for (const fsw_event_type_filter& filter : session->event_type_filters)
+    if (filter.flag == Overflow) return true;
+
+  return false;
+}
+
+// Appends an event to the queue.  This function is invoked with the queue
+// lock held.
+static void push_queued_event(fsw_event_queue *queue, const event_view& evt)
+{
+  vector<char>& storage = queue->events;
+  fsw_queued_event header;
+
+  header.evt_time = evt.get_timespec().tv_sec;
+  header.evt_time_nsec = evt.get_timespec().tv_nsec;
+  header.sequence = evt.get_sequence();
+  header.flags = evt.get_flags();
+  header.path_length = evt.get_path_length();
+  header.old_path_length = evt.get_old_path_length();
+
+  const char *header_ptr = reinterpret_cast<const char *> (&header);
+  storage.insert(storage.end(), header_ptr, header_ptr + sizeof(header));
+  storage.insert(storage.end(),
+                 evt.get_path(),
+                 evt.get_path() + header.path_length);
+  storage.insert(storage.end(),
+                 evt.get_old_path(),
+                 evt.get_old_path() + header.old_path_length);
+  ++queue->event_num;
+}
+
+/*
+ * Appends the events of a batch to the queue of the session.  Only the paths
+ * are copied: no memory is allocated once the queue storage fits the events
+ * waiting to be read.  When the queue is full, the monitor thread either
+ * waits for the consumer to read events, or drops the remaining events of the
+ * batch and queues an overflow event, depending on the policy of the queue.
+ */
+void libfsw_cpp_queue_callback_proxy(const event_batch& events,
+                                     void *context_ptr)
+{
+  if (!context_ptr)
+    throw int(FSW_ERR_MISSING_CONTEXT);
+
+  const fsw_callback_context *context = static_cast<fsw_callback_context *> (context_ptr);
+  fsw_event_queue *queue = context->handle->queue;
+
+  unique_lock<mutex> lock(queue->queue_mutex);
+
+  for (size_t i = 0; i < events.size(); ++i)
   {
-    fsw_cevent *cevt = &cevents[i];
+    const event_view evt = events[i];
 
-    if (cevt->flags) free(static_cast<void *> (cevt->flags));
-    free(static_cast<void *> (cevt->path));
+    if (queue->capacity > 0 && queue->event_num >= queue->capacity)
+    {
+      if (queue->policy == fsw_delivery_block)
+      {
+        // The consumer is woken up before the monitor thread waits.
+        signal_event_queue(queue);
+        queue->not_full_cond.wait(lock,
+                                  [queue]
+                                  {
+                                    return queue->stopping
+                                      || queue->event_num < queue->capacity;
+                                  });
+
+        if (queue->stopping) break;
+      }
+      else
+      {
+        if (queue->overflowed) break;
+
+        queue->overflowed = true;
+        ++queue->overflows;
+
+        if (queue->queue_overflow)
+        {
+          event_batch overflow;
+          overflow.add(evt.get_path(),
+                       evt.get_path_length(),
+                       event::get_current_time(),
+                       Overflow);
+          push_queued_event(queue, overflow[0]);
+        }
+
+        break;
+      }
+    }
+
+    push_queued_event(queue, evt);
   }
 
-  free(static_cast<void *> (cevents));
+  if (queue->read_offset < queue->events.size()) signal_event_queue(queue);
 }
 
-FSW_HANDLE fsw_init_session(const fsw_monitor_type type)
+static void run_async_monitor(FSW_SESSION *session)
 {
-  FSW_SESSION *session = new FSW_SESSION{};
-  session->type = type;
+  FSW_STATUS status = FSW_OK;
 
-  return session;
+  try
+  {
+    session->monitor->start();
+  }
+  catch (libfsw_exception& ex)
+  {
+    status = int(ex);
+  }
+  catch (int error)
+  {
+    status = error;
+  }
+  catch (...)
+  {
+    status = FSW_ERR_UNKNOWN_ERROR;
+  }
+
+  fsw_event_queue *queue = session->queue;
+  lock_guard<mutex> lock(queue->queue_mutex);
+
+  // The descriptor stays readable, so that the caller notices the monitor has
+  // terminated.
+  queue->status = status;
+  queue->terminated = true;
+  signal_event_queue(queue);
+  queue->terminated_cond.notify_all();
 }
+#endif
 
 int create_monitor(const FSW_HANDLE handle, const fsw_monitor_type type)
 {
@@ -567,10 +861,6 @@ int create_monitor(const FSW_HANDLE handle, const fsw_monitor_type type)
   {
     FSW_SESSION *session = get_session(handle);
 
-    // Check sufficient data is present to build a monitor.
-    if (!session->callback)
-      return fsw_set_last_error(int(FSW_ERR_CALLBACK_NOT_SET));
-
     if (session->monitor)
       return fsw_set_last_error(int(FSW_ERR_MONITOR_ALREADY_EXISTS));
 
@@ -580,12 +870,15 @@ int create_monitor(const FSW_HANDLE handle, const fsw_monitor_type type)
     fsw_callback_context *context_ptr = new fsw_callback_context;
     context_ptr->handle = session;
     context_ptr->callback = session->callback;
+    context_ptr->batch_callback = session->batch_callback;
     context_ptr->data = session->data;
+    context_ptr->batch_data = session->batch_data;
 
     monitor *current_monitor = monitor_factory::create_monitor(type,
                                                                session->paths,
                                                                libfsw_cpp_callback_proxy,
                                                                context_ptr);
+
     session->monitor = current_monitor;
   }
   catch (libfsw_exception& ex)
@@ -608,6 +901,38 @@ FSW_STATUS fsw_add_path(const FSW_HANDLE handle, const char *path)
   FSW_SESSION *session = get_session(handle);
   session->paths.push_back(path);
 
+  // The monitor is created with the paths of the session when it is first
+  // started: it is updated directly afterwards.
+  if (session->monitor) session->monitor->add_path(path);
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+FSW_STATUS fsw_remove_path(const FSW_HANDLE handle, const char *path)
+{
+  if (!path)
+    return fsw_set_last_error(int(FSW_ERR_INVALID_PATH));
+
+  FSW_SESSION *session = get_session(handle);
+  session->paths.erase(remove(session->paths.begin(),
+                              session->paths.end(),
+                              string(path)),
+                       session->paths.end());
+
+  if (session->monitor) session->monitor->remove_path(path);
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+FSW_STATUS fsw_touch_path(const FSW_HANDLE handle, const char *path)
+{
+  if (!path)
+    return fsw_set_last_error(int(FSW_ERR_INVALID_PATH));
+
+  FSW_SESSION *session = get_session(handle);
+
+  if (session->monitor) session->monitor->touch_path(path);
+
   return fsw_set_last_error(FSW_OK);
 }
 
@@ -638,6 +963,20 @@ FSW_STATUS fsw_set_callback(const FSW_HANDLE handle,
   return fsw_set_last_error(FSW_OK);
 }
 
+FSW_STATUS fsw_set_batch_callback(const FSW_HANDLE handle,
+                                  const FSW_CEVENT_BATCH_CALLBACK callback,
+                                  void *data)
+{
+  if (!callback)
+    return fsw_set_last_error(int(FSW_ERR_INVALID_CALLBACK));
+
+  FSW_SESSION *session = get_session(handle);
+  session->batch_callback = callback;
+  session->batch_data = data;
+
+  return fsw_set_last_error(FSW_OK);
+}
+
 FSW_STATUS fsw_set_allow_overflow(const FSW_HANDLE handle,
                                   const bool allow_overflow)
 {
@@ -647,6 +986,15 @@ FSW_STATUS fsw_set_allow_overflow(const FSW_HANDLE handle,
   return fsw_set_last_error(FSW_OK);
 }
 
+FSW_STATUS fsw_set_recover_overflow(const FSW_HANDLE handle,
+                                    const bool recover_overflow)
+{
+  FSW_SESSION *session = get_session(handle);
+  session->recover_overflow = recover_overflow;
+
+  return fsw_set_last_error(FSW_OK);
+}
+
 FSW_STATUS fsw_set_latency(const FSW_HANDLE handle, const double latency)
 {
   if (latency < 0)
@@ -684,6 +1032,137 @@ FSW_STATUS fsw_set_follow_symlinks(const FSW_HANDLE handle,
   return fsw_set_last_error(FSW_OK);
 }
 
+FSW_STATUS fsw_set_delivery_queue(const FSW_HANDLE handle,
+                                  const size_t size,
+                                  const enum fsw_delivery_policy policy)
+{
+  FSW_SESSION *session = get_session(handle);
+  session->delivery_queue_size = size;
+  session->delivery_policy = policy;
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+FSW_STATUS fsw_set_event_queue(const FSW_HANDLE handle,
+                               const size_t size,
+                               const enum fsw_delivery_policy policy)
+{
+  if (policy != fsw_delivery_block && policy != fsw_delivery_drop)
+    return fsw_set_last_error(int(FSW_ERR_UNKNOWN_VALUE));
+
+  FSW_SESSION *session = get_session(handle);
+  session->event_queue_size = size;
+  session->event_queue_policy = policy;
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+FSW_STATUS fsw_set_coalescing_window(const FSW_HANDLE handle,
+                                     const double window)
+{
+  if (window < 0)
+    return fsw_set_last_error(int(FSW_ERR_INVALID_LATENCY));
+
+  FSW_SESSION *session = get_session(handle);
+  session->coalescing_window = window;
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+FSW_STATUS fsw_set_content_verification(const FSW_HANDLE handle,
+                                        const size_t cache_size,
+                                        const unsigned int threads)
+{
+  FSW_SESSION *session = get_session(handle);
+  session->verification_cache_size = cache_size;
+  session->verification_threads = threads;
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+FSW_STATUS fsw_set_inventory(const FSW_HANDLE handle, const size_t batch_size)
+{
+  FSW_SESSION *session = get_session(handle);
+  session->inventory_batch_size = batch_size;
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+FSW_STATUS fsw_set_thread_affinity(const FSW_HANDLE handle,
+                                   const fsw_thread_role role,
+                                   const unsigned int *cpus,
+                                   const size_t cpu_num)
+{
+  if (role < 0 || role >= FSW_THREAD_ROLES || (cpu_num > 0 && !cpus))
+    return fsw_set_last_error(int(FSW_ERR_UNKNOWN_VALUE));
+
+  try
+  {
+    FSW_SESSION *session = get_session(handle);
+    session->thread_roles[role].set_affinity(
+      vector<unsigned int>(cpus, cpus + cpu_num));
+  }
+  catch (libfsw_exception& ex)
+  {
+    return fsw_set_last_error(int(ex));
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+FSW_STATUS fsw_set_thread_scheduling(const FSW_HANDLE handle,
+                                     const fsw_thread_role role,
+                                     const int policy,
+                                     const int priority)
+{
+  if (role < 0 || role >= FSW_THREAD_ROLES)
+    return fsw_set_last_error(int(FSW_ERR_UNKNOWN_VALUE));
+
+  try
+  {
+    FSW_SESSION *session = get_session(handle);
+    session->thread_roles[role].set_scheduling(policy, priority);
+  }
+  catch (libfsw_exception& ex)
+  {
+    return fsw_set_last_error(int(ex));
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+FSW_STATUS fsw_set_thread_name(const FSW_HANDLE handle,
+                               const fsw_thread_role role,
+                               const char *name)
+{
+  if (role < 0 || role >= FSW_THREAD_ROLES || !name)
+    return fsw_set_last_error(int(FSW_ERR_UNKNOWN_VALUE));
+
+  try
+  {
+    FSW_SESSION *session = get_session(handle);
+    session->thread_roles[role].set_name(name);
+  }
+  catch (libfsw_exception& ex)
+  {
+    return fsw_set_last_error(int(ex));
+  }
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+FSW_STATUS fsw_add_priority_path(const FSW_HANDLE handle,
+                                 const char *path)
+{
+  if (!path)
+    return fsw_set_last_error(int(FSW_ERR_INVALID_PATH));
+
+  FSW_SESSION *session = get_session(handle);
+  session->priority_paths.push_back(path);
+
+  return fsw_set_last_error(FSW_OK);
+}
+
 FSW_STATUS fsw_add_event_type_filter(const FSW_HANDLE handle,
                                      const fsw_event_type_filter event_type)
 {
@@ -698,14 +1177,24 @@ FSW_STATUS fsw_add_filter(const FSW_HANDLE handle,
 {
   FSW_SESSION *session = get_session(handle);
   session->filters.push_back(
-    {filter.text, filter.type, filter.case_sensitive, filter.extended});
+    {filter.text, filter.type, filter.case_sensitive, filter.extended, false});
 
   return fsw_set_last_error(FSW_OK);
 }
 
-bool fsw_is_running(const FSW_HANDLE handle)
+/*
+ * A session started with fsw_start_monitor_async() is running until its
+ * monitor thread terminates, even if the monitor has not been started yet.
+ */
+static bool is_session_running(FSW_SESSION *session)
 {
-  FSW_SESSION *session = get_session(handle);
+#ifdef FSW_HAVE_EVENT_QUEUE
+  if (session->queue)
+  {
+    lock_guard<mutex> lock(session->queue->queue_mutex);
+    if (!session->queue->terminated) return true;
+  }
+#endif
 
   if (!session->monitor)
     return false;
@@ -713,12 +1202,77 @@ bool fsw_is_running(const FSW_HANDLE handle)
   return session->monitor->is_running();
 }
 
+bool fsw_is_running(const FSW_HANDLE handle)
+{
+  return is_session_running(get_session(handle));
+}
+
+FSW_STATUS fsw_get_stats(const FSW_HANDLE handle, fsw_monitor_stats *stats)
+{
+  if (!stats)
+    return fsw_set_last_error(int(FSW_ERR_UNKNOWN_VALUE));
+
+  FSW_SESSION *session = get_session(handle);
+
+  if (!session->monitor)
+    return fsw_set_last_error(int(FSW_ERR_UNKNOWN_MONITOR_TYPE));
+
+  *stats = session->monitor->get_stats();
+
+#ifdef FSW_HAVE_EVENT_QUEUE
+  if (session->queue)
+  {
+    lock_guard<mutex> lock(session->queue->queue_mutex);
+    stats->overflows += session->queue->overflows;
+  }
+#endif
+
+  return fsw_set_last_error(FSW_OK);
+}
+
+void configure_monitor(FSW_SESSION *session)
+{
+  // The callbacks and their data may have been changed since the monitor was
+  // created.
+  fsw_callback_context *context_ptr =
+    static_cast<fsw_callback_context *> (session->monitor->get_context());
+  context_ptr->callback = session->callback;
+  context_ptr->batch_callback = session->batch_callback;
+  context_ptr->data = session->data;
+  context_ptr->batch_data = session->batch_data;
+
+  session->monitor->set_properties(session->properties);
+  session->monitor->set_allow_overflow(session->allow_overflow);
+  session->monitor->set_recover_overflow(session->recover_overflow);
+  session->monitor->set_filters(session->filters);
+  session->monitor->set_event_type_filters(session->event_type_filters);
+  session->monitor->set_follow_symlinks(session->follow_symlinks);
+  if (session->latency) session->monitor->set_latency(session->latency);
+  session->monitor->set_recursive(session->recursive);
+  session->monitor->set_directory_only(session->directory_only);
+  session->monitor->set_delivery_queue(session->delivery_queue_size,
+                                       session->delivery_policy);
+  session->monitor->set_coalescing_window(session->coalescing_window);
+  session->monitor->set_content_verification(session->verification_cache_size,
+                                             session->verification_threads);
+  session->monitor->set_priority_paths(session->priority_paths);
+  session->monitor->set_inventory(session->inventory_batch_size);
+
+  for (int role = 0; role < FSW_THREAD_ROLES; ++role)
+    session->monitor->set_thread_settings(fsw_thread_role(role),
+                                          session->thread_roles[role]);
+}
+
 FSW_STATUS fsw_start_monitor(const FSW_HANDLE handle)
 {
   try
   {
     FSW_SESSION *session = get_session(handle);
 
+    // Check sufficient data is present to build a monitor.
+    if (!session->callback && !session->batch_callback)
+      return fsw_set_last_error(int(FSW_ERR_CALLBACK_NOT_SET));
+
     if (!session->monitor)
     {
       FSW_STATUS ret = create_monitor(handle, session->type);
@@ -730,16 +1284,13 @@ FSW_STATUS fsw_start_monitor(const FSW_HANDLE handle)
     if (session->monitor == nullptr) // create_monitor returned OK, but monitor were not created
       return fsw_set_last_error(FSW_ERR_UNKNOWN_MONITOR_TYPE);
 
-    if (session->monitor->is_running())
+    if (is_session_running(session))
       return fsw_set_last_error(int(FSW_ERR_MONITOR_ALREADY_RUNNING));
 
-    session->monitor->set_allow_overflow(session->allow_overflow);
-    session->monitor->set_filters(session->filters);
-    session->monitor->set_event_type_filters(session->event_type_filters);
-    session->monitor->set_follow_symlinks(session->follow_symlinks);
-    if (session->latency) session->monitor->set_latency(session->latency);
-    session->monitor->set_recursive(session->recursive);
-    session->monitor->set_directory_only(session->directory_only);
+    configure_monitor(session);
+    session->monitor->set_batch_callback(session->batch_callback
+                                         ? libfsw_cpp_batch_callback_proxy
+                                         : nullptr);
 
     session->monitor->start();
   }
@@ -755,6 +1306,225 @@ FSW_STATUS fsw_start_monitor(const FSW_HANDLE handle)
   return fsw_set_last_error(FSW_OK);
 }
 
+FSW_STATUS fsw_start_monitor_async(const FSW_HANDLE handle)
+{
+#ifdef FSW_HAVE_EVENT_QUEUE
+  try
+  {
+    FSW_SESSION *session = get_session(handle);
+
+    if (!session->monitor)
+    {
+      FSW_STATUS ret = create_monitor(handle, session->type);
+
+      if (ret != FSW_OK)
+        return fsw_set_last_error(ret);
+    }
+
+    if (session->monitor == nullptr)
+      return fsw_set_last_error(FSW_ERR_UNKNOWN_MONITOR_TYPE);
+
+    if (is_session_running(session))
+      return fsw_set_last_error(int(FSW_ERR_MONITOR_ALREADY_RUNNING));
+
+    if (!session->queue) session->queue = create_event_queue();
+
+    fsw_event_queue *queue = session->queue;
+
+    // Join the thread of the previous run, if any.
+    if (queue->monitor_thread.joinable()) queue->monitor_thread.join();
+
+    configure_monitor(session);
+    session->monitor->set_batch_callback(libfsw_cpp_queue_callback_proxy);
+
+    {
+      lock_guard<mutex> lock(queue->queue_mutex);
+      queue->terminated = false;
+      queue->stopping = false;
+      queue->status = FSW_OK;
+      queue->capacity = session->event_queue_size;
+      queue->policy = session->event_queue_policy;
+      queue->queue_overflow = accepts_overflow_events(session);
+      if (queue->read_offset == queue->events.size())
+        clear_event_queue_signal(queue);
+    }
+
+    try
+    {
+      queue->monitor_thread = thread(run_async_monitor, session);
+    }
+    catch (system_error&)
+    {
+      lock_guard<mutex> lock(queue->queue_mutex);
+      queue->terminated = true;
+
+      throw int(FSW_ERR_UNKNOWN_ERROR);
+    }
+  }
+  catch (libfsw_exception& ex)
+  {
+    return fsw_set_last_error(int(ex));
+  }
+  catch (int error)
+  {
+    return fsw_set_last_error(error);
+  }
+
+  return fsw_set_last_error(FSW_OK);
+#else
+  (void) handle;
+
+  return fsw_set_last_error(FSW_ERR_NOT_SUPPORTED);
+#endif
+}
+
+int fsw_get_event_fd(const FSW_HANDLE handle)
+{
+#ifdef FSW_HAVE_EVENT_QUEUE
+  FSW_SESSION *session = get_session(handle);
+
+  return session->queue ? session->queue->read_fd : -1;
+#else
+  (void) handle;
+
+  return -1;
+#endif
+}
+
+int fsw_read_events(const FSW_HANDLE handle, void *buffer, const size_t size)
+{
+#ifdef FSW_HAVE_EVENT_QUEUE
+  FSW_SESSION *session = get_session(handle);
+  fsw_event_queue *queue = session->queue;
+
+  if (!queue)
+  {
+    fsw_set_last_error(FSW_ERR_UNKNOWN_MONITOR_TYPE);
+    return -1;
+  }
+
+  lock_guard<mutex> lock(queue->queue_mutex);
+  vector<char>& storage = queue->events;
+
+  // Count the events fitting in the buffer.
+  size_t offset = queue->read_offset;
+  size_t batch_size = sizeof(fsw_cevent_batch);
+  int event_num = 0;
+
+  while (offset < storage.size() && event_num < INT_MAX)
+  {
+    fsw_queued_event header;
+    memcpy(&header, &storage[offset], sizeof(header));
+
+    size_t event_size = sizeof(fsw_cevent_record) + header.path_length + 1;
+    if (header.old_path_length) event_size += header.old_path_length + 1;
+
+    if (!buffer || batch_size + event_size > size) break;
+
+    batch_size += event_size;
+    offset += sizeof(header) + header.path_length + header.old_path_length;
+    ++event_num;
+  }
+
+  if (event_num == 0)
+  {
+    if (offset < storage.size())
+    {
+      fsw_set_last_error(FSW_ERR_BUFFER_TOO_SMALL);
+      return -1;
+    }
+
+    if (queue->terminated && queue->status != FSW_OK)
+    {
+      fsw_set_last_error(queue->status);
+      return -1;
+    }
+
+    fsw_set_last_error(FSW_OK);
+    return 0;
+  }
+
+  char *data = static_cast<char *> (buffer);
+  fsw_cevent_batch *batch = reinterpret_cast<fsw_cevent_batch *> (data);
+  fsw_cevent_record *records =
+    reinterpret_cast<fsw_cevent_record *> (data + sizeof(fsw_cevent_batch));
+
+  batch->size = batch_size;
+  batch->event_num = event_num;
+  batch->record_size = sizeof(fsw_cevent_record);
+
+  size_t event_offset = queue->read_offset;
+  size_t str_offset = sizeof(fsw_cevent_batch)
+                      + event_num * sizeof(fsw_cevent_record);
+
+  auto append = [data, &storage, &event_offset, &str_offset](uint32_t length)
+  {
+    const size_t begin = str_offset;
+
+    memcpy(data + str_offset, &storage[event_offset], length);
+    data[str_offset + length] = '\0';
+    event_offset += length;
+    str_offset += length + 1;
+
+    return static_cast<uint32_t> (begin);
+  };
+
+  for (int i = 0; i < event_num; ++i)
+  {
+    fsw_queued_event header;
+    memcpy(&header, &storage[event_offset], sizeof(header));
+    event_offset += sizeof(header);
+
+    fsw_cevent_record& record = records[i];
+    record.evt_time = header.evt_time;
+    record.evt_time_nsec = header.evt_time_nsec;
+    record.sequence = header.sequence;
+    record.flags = header.flags;
+    record.path_length = header.path_length;
+    record.path_offset = append(header.path_length);
+    record.old_path_length = header.old_path_length;
+    record.old_path_offset = header.old_path_length
+                             ? append(header.old_path_length)
+                             : 0;
+  }
+
+  queue->event_num -= event_num;
+  queue->overflowed = false;
+  queue->not_full_cond.notify_all();
+
+  // Storage is reused once all the events have been read, and compacted when
+  // the events already read take more than half of it.
+  if (offset == storage.size())
+  {
+    storage.clear();
+    queue->read_offset = 0;
+
+    if (!queue->terminated) clear_event_queue_signal(queue);
+  }
+  else if (offset > storage.size() / 2)
+  {
+    storage.erase(storage.begin(), storage.begin() + offset);
+    queue->read_offset = 0;
+  }
+  else
+  {
+    queue->read_offset = offset;
+  }
+
+  fsw_set_last_error(FSW_OK);
+
+  return event_num;
+#else
+  (void) handle;
+  (void) buffer;
+  (void) size;
+
+  fsw_set_last_error(FSW_ERR_NOT_SUPPORTED);
+
+  return -1;
+#endif
+}
+
 FSW_STATUS fsw_stop_monitor(const FSW_HANDLE handle)
 {
   try
@@ -764,6 +1534,37 @@ FSW_STATUS fsw_stop_monitor(const FSW_HANDLE handle)
     if (session->monitor == nullptr)
       return fsw_set_last_error(int(FSW_ERR_UNKNOWN_MONITOR_TYPE));
 
+#ifdef FSW_HAVE_EVENT_QUEUE
+    fsw_event_queue *queue = session->queue;
+
+    if (queue && queue->monitor_thread.joinable())
+    {
+      {
+        lock_guard<mutex> lock(queue->queue_mutex);
+        queue->stopping = true;
+        queue->not_full_cond.notify_all();
+      }
+
+      // The monitor thread may not have started the monitor yet, in which
+      // case stop() has no effect and is invoked again.
+      for (;;)
+      {
+        session->monitor->stop();
+
+        unique_lock<mutex> lock(queue->queue_mutex);
+        if (queue->terminated_cond.wait_for(lock,
+                                            chrono::milliseconds(10),
+                                            [queue]
+                                            { return queue->terminated; }))
+          break;
+      }
+
+      queue->monitor_thread.join();
+
+      return fsw_set_last_error(FSW_OK);
+    }
+#endif
+
     if (!session->monitor->is_running())
       return fsw_set_last_error(int(FSW_OK));
 
@@ -789,12 +1590,15 @@ FSW_STATUS fsw_destroy_session(const FSW_HANDLE handle)
   {
     FSW_SESSION *session = get_session(handle);
 
+    if (is_session_running(session))
+      return fsw_set_last_error(FSW_ERR_MONITOR_ALREADY_RUNNING);
+
+#ifdef FSW_HAVE_EVENT_QUEUE
+    if (session->queue) destroy_event_queue(session->queue);
+#endif
+
     if (session->monitor)
     {
-      if (session->monitor->is_running())
-      {
-        return fsw_set_last_error(FSW_ERR_MONITOR_ALREADY_RUNNING);
-      }
 
       void *context = session->monitor->get_context();
 
@@ -835,10 +1639,10 @@ FSW_STATUS fsw_last_error()
 
 bool fsw_is_verbose()
 {
-  return fsw_libfswatch_verbose;
+  return fsw_get_log_level() != FSW_LOG_LEVEL_OFF;
 }
 
 void fsw_set_verbose(bool verbose)
 {
-  fsw_libfswatch_verbose = verbose;
+  fsw_set_log_level(verbose ? FSW_LOG_LEVEL_DEBUG : FSW_LOG_LEVEL_OFF);
 }
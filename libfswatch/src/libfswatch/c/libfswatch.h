@@ -29,6 +29,7 @@
 #define LIBFSW_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "libfswatch_types.h"
 #include "cevent.h"
 #include "cmonitor.h"
@@ -51,8 +52,10 @@ extern "C"
    * thread_local storage specified then this API is thread safe and a
    * different state is maintained on a per-thread basis.
    *
-   * Session-modifying API calls (such as fsw_add_path) will take effect the
-   * next time a monitor is started with fsw_start_monitor.
+   * Session-modifying API calls (such as fsw_set_latency) will take effect the
+   * next time a monitor is started with fsw_start_monitor.  Paths can be added
+   * and removed with fsw_add_path and fsw_remove_path while the monitor is
+   * running.
    *
    * Currently not all monitors supports being stopped, in which case
    * fsw_start_monitor is a non-returning API call.
@@ -103,10 +106,29 @@ extern "C"
 
   /**
    * Adds a path to watch to the specified session.  At least one path must be
-   * added to the current session in order for it to be valid.
+   * added to the current session in order for it to be valid.  This function
+   * can be called from another thread while the monitor is running: in this
+   * case, the monitor starts watching @p path without scanning again the
+   * paths it already watches, if it supports it.
    */
   FSW_STATUS fsw_add_path(const FSW_HANDLE handle, const char * path);
 
+  /**
+   * Removes a path to watch from the specified session.  This function can be
+   * called from another thread while the monitor is running: in this case, the
+   * monitor stops watching @p path without scanning again the other paths, if
+   * it supports it.
+   */
+  FSW_STATUS fsw_remove_path(const FSW_HANDLE handle, const char * path);
+
+  /**
+   * Requests a running monitor watching its paths lazily to watch the subtree
+   * of @p path, which must be below one of the paths to watch.  This function
+   * can be called from another thread while the monitor is running, and it has
+   * no effect on the monitors watching all their paths.
+   */
+  FSW_STATUS fsw_touch_path(const FSW_HANDLE handle, const char * path);
+
   /**
    * Adds the specified monitor property.
    */
@@ -118,6 +140,13 @@ extern "C"
    */
   FSW_STATUS fsw_set_allow_overflow(const FSW_HANDLE handle, const bool allow_overflow);
 
+  /**
+   * Sets the recover overflow flag of the monitor.  When this flag is set, the
+   * changes lost by an overflow are recovered by scanning the affected paths
+   * again and they are reported as change events.
+   */
+  FSW_STATUS fsw_set_recover_overflow(const FSW_HANDLE handle, const bool recover_overflow);
+
   /**
    * Sets the callback the monitor invokes when some events are received.  The
    * callback must be set in the current session in order for it to be valid.
@@ -128,6 +157,20 @@ extern "C"
                               const FSW_CEVENT_CALLBACK callback,
                               void * data);
 
+  /**
+   * Sets the batch callback the monitor invokes when some events are received.
+   * If a batch callback is set, it is invoked instead of the callback set with
+   * fsw_set_callback, which need not be set.  The events are passed as a single
+   * read-only buffer owned by the library, which is reused across invocations.
+   * @p data is passed to the batch callback and it does not replace the data
+   * set with fsw_set_callback.
+   *
+   * See cevent.h for the definition of FSW_CEVENT_BATCH_CALLBACK.
+   */
+  FSW_STATUS fsw_set_batch_callback(const FSW_HANDLE handle,
+                                    const FSW_CEVENT_BATCH_CALLBACK callback,
+                                    void * data);
+
   /**
    * Sets the latency of the monitor.  By default, the latency is set to 1 s.
    */
@@ -153,6 +196,91 @@ extern "C"
   FSW_STATUS fsw_set_follow_symlinks(const FSW_HANDLE handle,
                                      const bool follow_symlinks);
 
+  /**
+   * Sets the asynchronous delivery queue of the monitor.  If @p size is not 0,
+   * the callback is invoked by a dedicated thread and at most @p size batches
+   * of events wait to be delivered: when the queue is full, @p policy is
+   * applied.  By default, the callback is invoked by the monitor thread.
+   */
+  FSW_STATUS fsw_set_delivery_queue(const FSW_HANDLE handle,
+                                    const size_t size,
+                                    const enum fsw_delivery_policy policy);
+
+  /**
+   * Sets the coalescing window of the monitor, in seconds.  If @p window is not
+   * 0, the events of the same path received within the window are merged into
+   * a single event whose flags are the union of their flags.  By default,
+   * events are not coalesced.
+   */
+  FSW_STATUS fsw_set_coalescing_window(const FSW_HANDLE handle,
+                                       const double window);
+
+  /**
+   * Sets the verification of the content of the updated files.  If
+   * @p cache_size is not 0, the update events of regular files whose content
+   * did not change since the monitor last checked it are dropped: the hash of
+   * at most @p cache_size files is cached and the files are hashed by
+   * @p threads threads, or by as many threads as the hardware threads if
+   * @p threads is 0.  By default, the content of files is not verified.
+   */
+  FSW_STATUS fsw_set_content_verification(const FSW_HANDLE handle,
+                                          const size_t cache_size,
+                                          const unsigned int threads);
+
+  /**
+   * Sets the inventory of the watched paths.  If @p batch_size is not 0, the
+   * initial scan of the monitor notifies an event for every object it finds,
+   * in batches of at most @p batch_size events, followed by an event with the
+   * HistoryDone flag and an empty path, after which live changes are
+   * notified.  The events of the inventory only have the flag of the type of
+   * the object.  Only the inotify and the poll monitors list their inventory:
+   * starting another monitor fails.  By default, the inventory is not listed.
+   */
+  FSW_STATUS fsw_set_inventory(const FSW_HANDLE handle,
+                               const size_t batch_size);
+
+  /**
+   * Sets the CPUs the threads of @p role may run on to the @p cpu_num CPUs
+   * listed in @p cpus.  If @p cpu_num is 0, the affinity of the threads is
+   * not changed, which is the default.  Setting the affinity of the threads
+   * of ::fsw_thread_monitor pins the thread reading the events of the
+   * operating system.
+   */
+  FSW_STATUS fsw_set_thread_affinity(const FSW_HANDLE handle,
+                                     const enum fsw_thread_role role,
+                                     const unsigned int *cpus,
+                                     const size_t cpu_num);
+
+  /**
+   * Sets the scheduling policy and priority of the threads of @p role, as
+   * accepted by pthread_setschedparam().  By default, the threads are
+   * scheduled like the thread starting the monitor.  If the privileges of the
+   * process are not sufficient to set the policy of the thread running the
+   * monitor, fsw_start_monitor() fails.
+   */
+  FSW_STATUS fsw_set_thread_scheduling(const FSW_HANDLE handle,
+                                       const enum fsw_thread_role role,
+                                       const int policy,
+                                       const int priority);
+
+  /**
+   * Sets the name of the threads of @p role, truncated to 15 characters.  If
+   * @p name is empty, which is the default, the name of the threads is not
+   * changed.
+   */
+  FSW_STATUS fsw_set_thread_name(const FSW_HANDLE handle,
+                                 const enum fsw_thread_role role,
+                                 const char *name);
+
+  /**
+   * Adds a priority path to the current session.  The events of @p path, and
+   * of the paths below it, are notified as soon as they are received instead
+   * of being held until the end of the latency or coalescing window.  The
+   * path is compared with the paths of the events as it is.
+   */
+  FSW_STATUS fsw_add_priority_path(const FSW_HANDLE handle,
+                                   const char *path);
+
   /**
    * Adds an event type filter to the current session.
    *
@@ -177,6 +305,62 @@ extern "C"
    */
   FSW_STATUS fsw_start_monitor(const FSW_HANDLE handle);
 
+  /**
+   * Starts the monitor in a thread owned by the library and returns
+   * immediately.  The events are not passed to the session callbacks, which
+   * need not be set: they are queued in the session and read with
+   * fsw_read_events().  fsw_get_event_fd() returns a descriptor that can be
+   * added to the event loop of the caller to be notified when events are
+   * queued.
+   *
+   * The session is stopped with fsw_stop_monitor(), which waits for the
+   * monitor thread to terminate.  This function returns
+   * ::FSW_ERR_NOT_SUPPORTED if the library was built without thread support.
+   */
+  FSW_STATUS fsw_start_monitor_async(const FSW_HANDLE handle);
+
+  /**
+   * Sets the capacity of the queue of a session started with
+   * fsw_start_monitor_async().  At most @p size events wait to be read, or an
+   * unlimited number if @p size is @c 0: when the queue is full, @p policy is
+   * applied.  With ::fsw_delivery_block, the monitor thread waits for events
+   * to be read.  With ::fsw_delivery_drop, the new events are dropped and a
+   * single ::Overflow event is queued until events are read again; each
+   * overflow is counted in the @c overflows member of ::fsw_monitor_stats.  ::fsw_delivery_coalesce is not supported.  By
+   * default, at most 65536 events are queued and new events are dropped.  The
+   * setting is applied when the session is started.
+   */
+  FSW_STATUS fsw_set_event_queue(const FSW_HANDLE handle,
+                                 const size_t size,
+                                 const enum fsw_delivery_policy policy);
+
+  /**
+   * Returns a descriptor which is readable while the events of a session
+   * started with fsw_start_monitor_async() are waiting to be read, or when its
+   * monitor has terminated.  The descriptor is owned by the session and must
+   * only be polled: it is closed by fsw_destroy_session().  If the session was
+   * never started with fsw_start_monitor_async(), @c -1 is returned.
+   */
+  int fsw_get_event_fd(const FSW_HANDLE handle);
+
+  /**
+   * Reads the events queued by a session started with
+   * fsw_start_monitor_async() without blocking.  The oldest events that fit in
+   * @p size bytes are removed from the queue and stored in @p buffer, which
+   * must be suitably aligned, as an ::fsw_cevent_batch, whose records and
+   * paths can be accessed with ::FSW_CEVENT_BATCH_RECORD and
+   * ::FSW_CEVENT_BATCH_STRING.
+   *
+   * Returns the number of events stored in @p buffer, which is @c 0 if no
+   * events are queued, or @c -1 on error, in which case the error code is
+   * returned by fsw_last_error():
+   *
+   *   - ::FSW_ERR_BUFFER_TOO_SMALL if @p buffer cannot store the oldest event.
+   *   - The error which terminated the monitor thread, once all the queued
+   *     events have been read.
+   */
+  int fsw_read_events(const FSW_HANDLE handle, void * buffer, const size_t size);
+
   /**
    * Stops a running monitor.
    */
@@ -187,6 +371,14 @@ extern "C"
    */
   bool fsw_is_running(const FSW_HANDLE handle);
 
+  /**
+   * Gets the counters of the monitor of a session.  This function can be
+   * called from another thread while the monitor is running.
+   *
+   * See cmonitor.h for the definition of fsw_monitor_stats.
+   */
+  FSW_STATUS fsw_get_stats(const FSW_HANDLE handle, fsw_monitor_stats * stats);
+
   /**
    * Destroys an existing session and invalidates its handle.
    */
@@ -203,7 +395,8 @@ extern "C"
   bool fsw_is_verbose();
 
   /**
-   * Set the verbose mode.
+   * Set the verbose mode.  In verbose mode, the messages of every level are
+   * logged: see fsw_set_log_level() in libfswatch_log.h.
    */
   void fsw_set_verbose(bool verbose);
 
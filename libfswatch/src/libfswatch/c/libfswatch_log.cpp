@@ -13,56 +13,292 @@
  * You should have received a copy of the GNU General Public License along with
  * this program.  If not, see <http://www.gnu.org/licenses/>.
  */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include "gettext_defs.h"
 #include "libfswatch.h"
 #include "libfswatch_log.h"
 #include "../c++/string/string_utils.hpp"
 #include <cstdarg>
+#include <cstdint>
+#ifdef HAVE_CXX_MUTEX
+#  include <atomic>
+#  include <chrono>
+#  include <mutex>
+#  include <thread>
+#endif
 
 using namespace std;
 using namespace fsw;
 
+int fsw_log_threshold = FSW_LOG_LEVEL_OFF;
+
+#ifdef HAVE_CXX_MUTEX
+static atomic<bool> log_async{false};
+
+namespace
+{
+  const size_t LOG_QUEUE_SIZE = 1024;
+  const size_t LOG_MESSAGE_SIZE = 512;
+
+  struct log_slot
+  {
+    atomic<size_t> sequence;
+    FILE *file;
+    size_t length;
+    char text[LOG_MESSAGE_SIZE];
+  };
+
+  /*
+   * Bounded queue of formatted messages drained by a writer thread.  Producers
+   * claim a slot with a compare-and-swap on the enqueue position and publish it
+   * by updating its sequence number, as in Dmitry Vyukov's bounded MPMC queue;
+   * since there is a single consumer, the dequeue position is not shared.
+   * Messages are dropped when the queue is full.
+   */
+  class async_log_sink
+  {
+  public:
+    async_log_sink()
+    {
+      for (size_t i = 0; i < LOG_QUEUE_SIZE; ++i)
+        slots[i].sequence.store(i, memory_order_relaxed);
+    }
+
+    ~async_log_sink()
+    {
+      log_async.store(false, memory_order_release);
+      stop();
+    }
+
+    void start()
+    {
+      lock_guard<mutex> lock(control_mutex);
+      if (running.load(memory_order_relaxed)) return;
+
+      running.store(true, memory_order_release);
+      writer = thread(&async_log_sink::run, this);
+    }
+
+    void stop()
+    {
+      lock_guard<mutex> lock(control_mutex);
+      if (!running.load(memory_order_relaxed)) return;
+
+      running.store(false, memory_order_release);
+      writer.join();
+    }
+
+    void post(FILE *f, const char *func, const char *format, va_list args)
+    {
+      size_t pos = enqueue_pos.load(memory_order_relaxed);
+      log_slot *slot;
+
+      for (;;)
+      {
+        slot = &slots[pos % LOG_QUEUE_SIZE];
+        const size_t seq = slot->sequence.load(memory_order_acquire);
+        const intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+        if (diff == 0)
+        {
+          if (enqueue_pos.compare_exchange_weak(pos,
+                                                pos + 1,
+                                                memory_order_relaxed))
+            break;
+        }
+        else if (diff < 0)
+        {
+          dropped.fetch_add(1, memory_order_relaxed);
+          return;
+        }
+        else
+        {
+          pos = enqueue_pos.load(memory_order_relaxed);
+        }
+      }
+
+      int prefix = func ? snprintf(slot->text, LOG_MESSAGE_SIZE, "%s: ", func) : 0;
+      if (prefix < 0) prefix = 0;
+      if ((size_t) prefix >= LOG_MESSAGE_SIZE) prefix = LOG_MESSAGE_SIZE - 1;
+
+      int rv = vsnprintf(slot->text + prefix,
+                         LOG_MESSAGE_SIZE - prefix,
+                         format,
+                         args);
+      size_t length = prefix + (rv < 0 ? 0 : rv);
+
+      // Truncated messages keep their line termination.
+      if (length >= LOG_MESSAGE_SIZE)
+      {
+        length = LOG_MESSAGE_SIZE - 1;
+        slot->text[length - 1] = '\n';
+      }
+
+      slot->file = f;
+      slot->length = length;
+      slot->sequence.store(pos + 1, memory_order_release);
+    }
+
+  private:
+    bool write_next()
+    {
+      log_slot& slot = slots[dequeue_pos % LOG_QUEUE_SIZE];
+
+      if (slot.sequence.load(memory_order_acquire) != dequeue_pos + 1)
+        return false;
+
+      fwrite(slot.text, 1, slot.length, slot.file);
+      slot.sequence.store(dequeue_pos + LOG_QUEUE_SIZE, memory_order_release);
+      ++dequeue_pos;
+
+      return true;
+    }
+
+    void run()
+    {
+      for (;;)
+      {
+        const bool stopping = !running.load(memory_order_acquire);
+        bool written = false;
+
+        while (write_next()) written = true;
+
+        const uint64_t lost = dropped.exchange(0, memory_order_relaxed);
+        if (lost)
+          fprintf(stderr, _("%llu log messages dropped.\n"), (unsigned long long) lost);
+
+        if (written) fflush(stdout);
+        if (stopping) return;
+
+        this_thread::sleep_for(chrono::milliseconds(5));
+      }
+    }
+
+    log_slot slots[LOG_QUEUE_SIZE];
+    atomic<size_t> enqueue_pos{0};
+    size_t dequeue_pos = 0;
+    atomic<uint64_t> dropped{0};
+    atomic<bool> running{false};
+    mutex control_mutex;
+    thread writer;
+  };
+}
+
+static async_log_sink& get_log_sink()
+{
+  static async_log_sink sink;
+  return sink;
+}
+#endif
+
+static void write_log(FILE *f, const char *func, const char *format, va_list args)
+{
+#ifdef HAVE_CXX_MUTEX
+  if (log_async.load(memory_order_acquire))
+  {
+    get_log_sink().post(f, func, format, args);
+    return;
+  }
+#endif
+
+  if (func) fprintf(f, "%s: ", func);
+  vfprintf(f, format, args);
+}
+
+static void write_logf(FILE *f, const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+
+  write_log(f, nullptr, format, args);
+
+  va_end(args);
+}
+
+void fsw_set_log_level(enum fsw_log_level level)
+{
+  fsw_log_threshold = level;
+}
+
+enum fsw_log_level fsw_get_log_level()
+{
+  return static_cast<fsw_log_level>(fsw_log_threshold);
+}
+
+FSW_STATUS fsw_set_log_async(bool async)
+{
+#ifdef HAVE_CXX_MUTEX
+  if (async)
+  {
+    get_log_sink().start();
+    log_async.store(true, memory_order_release);
+  }
+  else if (log_async.exchange(false, memory_order_acq_rel))
+  {
+    get_log_sink().stop();
+  }
+
+  return FSW_OK;
+#else
+  return async ? FSW_ERR_NOT_SUPPORTED : FSW_OK;
+#endif
+}
+
 void fsw_log(const char *msg)
 {
-  if (fsw_is_verbose()) printf("%s", msg);
+  if (FSW_LOG_ENABLED(FSW_LOG_LEVEL_INFO)) write_logf(stdout, "%s", msg);
 }
 
 void fsw_flog(FILE *f, const char *msg)
 {
-  if (fsw_is_verbose()) fprintf(f, "%s", msg);
+  if (FSW_LOG_ENABLED(FSW_LOG_LEVEL_INFO)) write_logf(f, "%s", msg);
 }
 
 void fsw_logf(const char *format, ...)
 {
-  if (!fsw_is_verbose()) return;
+  if (!FSW_LOG_ENABLED(FSW_LOG_LEVEL_INFO)) return;
 
   va_list args;
   va_start(args, format);
 
-  vfprintf(stdout, format, args);
+  write_log(stdout, nullptr, format, args);
 
   va_end(args);
 }
 
 void fsw_flogf(FILE *f, const char *format, ...)
 {
-  if (!fsw_is_verbose()) return;
+  if (!FSW_LOG_ENABLED(FSW_LOG_LEVEL_INFO)) return;
 
   va_list args;
   va_start(args, format);
 
-  vfprintf(f, format, args);
+  write_log(f, nullptr, format, args);
+
+  va_end(args);
+}
+
+void fsw_flogf_func(FILE *f, const char *func, const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+
+  write_log(f, func, format, args);
 
   va_end(args);
 }
 
 void fsw_log_perror(const char *msg)
 {
-  if (fsw_is_verbose()) perror(msg);
+  if (FSW_LOG_ENABLED(FSW_LOG_LEVEL_INFO)) perror(msg);
 }
 
 void fsw_logf_perror(const char *format, ...)
 {
-  if (!fsw_is_verbose()) return;
+  if (!FSW_LOG_ENABLED(FSW_LOG_LEVEL_INFO)) return;
 
   va_list args;
   va_start(args, format);
@@ -27,6 +27,57 @@
 #  define LIBFSW_LOG_H
 
 #include <stdio.h>
+#include <stdbool.h>
+#include "libfswatch_types.h"
+#ifdef __cplusplus
+#  include <sstream>
+#endif
+
+/**
+ * @brief Levels of the log messages.
+ *
+ * A message is printed if its level is lower than or equal to the level set
+ * with fsw_set_log_level().  Messages of level ::FSW_LOG_LEVEL_DEBUG are
+ * printed for every event or system call and are removed at compile time if
+ * `FSW_DISABLE_DEBUG_LOG` is defined.
+ */
+enum fsw_log_level
+{
+  FSW_LOG_LEVEL_OFF = 0, /**< No message is printed. */
+  FSW_LOG_LEVEL_INFO,    /**< Messages describing the state of a monitor. */
+  FSW_LOG_LEVEL_DEBUG    /**< Messages describing every event. */
+};
+
+/**
+ * @brief The current log level.
+ *
+ * This variable is exposed so that the log macros can check the level inline,
+ * before their arguments are evaluated.  Use fsw_set_log_level() to change it.
+ */
+extern int fsw_log_threshold;
+
+/**
+ * Sets the log level.  fsw_set_verbose() sets the level to
+ * ::FSW_LOG_LEVEL_DEBUG or ::FSW_LOG_LEVEL_OFF.
+ */
+void fsw_set_log_level(enum fsw_log_level level);
+
+/**
+ * Gets the log level.
+ */
+enum fsw_log_level fsw_get_log_level();
+
+/**
+ * Enables or disables the asynchronous log sink.  When the sink is enabled,
+ * the messages are formatted into a lock-free queue and written by a
+ * dedicated thread, so that logging does not block the threads of a monitor
+ * on the output stream.  Messages are dropped, and the number of dropped
+ * messages is reported, when the queue is full.  Messages printed with
+ * fsw_log_perror() and fsw_logf_perror() are always written synchronously.
+ * Returns FSW_ERR_NOT_SUPPORTED if `libfswatch` was built without thread
+ * support.
+ */
+FSW_STATUS fsw_set_log_async(bool async);
 
 /**
  * Prints the specified message to standard output.
@@ -50,6 +101,13 @@ void fsw_logf(const char * format, ...);
  */
 void fsw_flogf(FILE * f, const char * format, ...);
 
+/**
+ * Formats the specified message and prints it to the specified file, prepended
+ * by the name of the specified function, as a single record.  The message
+ * string format conforms with printf.
+ */
+void fsw_flogf_func(FILE * f, const char * func, const char * format, ...);
+
 /**
  * Prints the specified message using perror.
  */
@@ -61,34 +119,95 @@ void fsw_log_perror(const char * msg);
  */
 void fsw_logf_perror(const char * format, ...);
 
+/**
+ * @brief Checks whether messages of the specified level are printed.
+ */
+#  define FSW_LOG_ENABLED(level) ((level) <= fsw_log_threshold)
+
+/*
+ * The log macros check the level before evaluating their arguments, so that a
+ * disabled message costs a comparison.
+ */
+#  define FSW_LOG_AT(level, f, ...)                    \
+  do                                                   \
+  {                                                    \
+    if (FSW_LOG_ENABLED(level))                        \
+      fsw_flogf_func(f, __func__, __VA_ARGS__);        \
+  } while (0)
+
 /**
  * @brief Log the specified message to the standard output prepended by the
  * source line number.
  */
-#  define FSW_LOG(msg)           fsw_logf("%s: ", __func__);          fsw_log(msg)
+#  define FSW_LOG(msg)           FSW_LOG_AT(FSW_LOG_LEVEL_INFO, stdout, "%s", msg)
 
 /**
  * @brief Log the specified message to the standard error prepended by the
  * source line number.
  */
-#  define FSW_ELOG(msg)          fsw_flogf(stderr, "%s: ", __func__); fsw_flog(stderr, msg)
+#  define FSW_ELOG(msg)          FSW_LOG_AT(FSW_LOG_LEVEL_INFO, stderr, "%s", msg)
 
 /**
  * @brief Log the specified `printf()`-like message to the standard output
  * prepended by the source line number.
  */
-#  define FSW_LOGF(msg, ...)     fsw_logf("%s: ", __func__);          fsw_logf(msg, __VA_ARGS__)
+#  define FSW_LOGF(msg, ...)     FSW_LOG_AT(FSW_LOG_LEVEL_INFO, stdout, msg, __VA_ARGS__)
 
 /**
  * @brief Log the specified `printf()`-like message to the standard error
  * prepended by the source line number.
  */
-#  define FSW_ELOGF(msg, ...)    fsw_flogf(stderr, "%s: ", __func__); fsw_flogf(stderr, msg, __VA_ARGS__)
+#  define FSW_ELOGF(msg, ...)    FSW_LOG_AT(FSW_LOG_LEVEL_INFO, stderr, msg, __VA_ARGS__)
 
 /**
  * @brief Log the specified `printf()`-like message to the specified file
  * descriptor prepended by the source line number.
  */
-#  define FSW_FLOGF(f, msg, ...) fsw_flogf(f, "%s: ", __func__);      fsw_flogf(f, msg, __VA_ARGS__)
+#  define FSW_FLOGF(f, msg, ...) FSW_LOG_AT(FSW_LOG_LEVEL_INFO, f, msg, __VA_ARGS__)
+
+#  ifndef FSW_DISABLE_DEBUG_LOG
+/**
+ * @brief Log the specified debug message to the standard error prepended by
+ * the source line number.
+ */
+#    define FSW_DLOG(msg)        FSW_LOG_AT(FSW_LOG_LEVEL_DEBUG, stderr, "%s", msg)
+
+/**
+ * @brief Log the specified `printf()`-like debug message to the standard error
+ * prepended by the source line number.
+ */
+#    define FSW_DLOGF(msg, ...)  FSW_LOG_AT(FSW_LOG_LEVEL_DEBUG, stderr, msg, __VA_ARGS__)
+#  else
+#    define FSW_DLOG(msg)        do {} while (0)
+#    define FSW_DLOGF(msg, ...)  do {} while (0)
+#  endif
+
+#  ifdef __cplusplus
+#    ifndef FSW_DISABLE_DEBUG_LOG
+/**
+ * @brief Log the debug message built by inserting the specified expression
+ * into a `std::ostream` to the standard error prepended by the source line
+ * number.
+ *
+ * The stream is only built if the message is printed:
+ *
+ * @code
+ * FSW_DLOGS(_("Added: ") << path << "\n");
+ * @endcode
+ */
+#      define FSW_DLOGS(expr)                                           \
+  do                                                                    \
+  {                                                                     \
+    if (FSW_LOG_ENABLED(FSW_LOG_LEVEL_DEBUG))                           \
+    {                                                                   \
+      std::ostringstream fsw_log_stream;                                \
+      fsw_log_stream << expr;                                           \
+      fsw_flogf_func(stderr, __func__, "%s", fsw_log_stream.str().c_str()); \
+    }                                                                   \
+  } while (0)
+#    else
+#      define FSW_DLOGS(expr)    do {} while (0)
+#    endif
+#  endif
 
 #endif  /* LIBFSW_LOG_H */
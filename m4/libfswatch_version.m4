@@ -38,5 +38,5 @@
 # Libtool documentation, 7.3 Updating library version information
 #
 m4_define([LIBFSWATCH_VERSION], [1.14.0])
-m4_define([LIBFSWATCH_API_VERSION], [11:1:0])
+m4_define([LIBFSWATCH_API_VERSION], [12:0:0])
 m4_define([LIBFSWATCH_REVISION], [1])
@@ -0,0 +1,589 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * Microbenchmarks of the event pipeline.
+ *
+ * Every benchmark prints a line made of tab-separated fields:
+ *
+ *   name  items  repetitions  ns_per_item  min_ns_per_item
+ *
+ * where ns_per_item is the median of the repetitions.  Inputs are generated
+ * from a fixed seed, so that the output of two builds can be compared line by
+ * line.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "libfswatch/c++/event.hpp"
+#include "libfswatch/c++/event_batch.hpp"
+#include "libfswatch/c++/filter.hpp"
+#include "libfswatch/c++/monitor.hpp"
+#include "libfswatch/c++/monitor_factory.hpp"
+#include "libfswatch/c/cevent_marshal.hpp"
+#include "printf_event.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace fsw;
+
+static double min_time = 0.2;
+static unsigned int repetitions = 5;
+static string name_filter;
+static vector<size_t> poll_sizes{10000, 100000};
+
+/*
+ * Monitor exposing the event processing of the base class.
+ */
+class bench_monitor : public monitor
+{
+public:
+  bench_monitor(FSW_EVENT_CALLBACK *callback)
+    : monitor(vector<string>(), callback)
+  {
+  }
+
+  using monitor::accept_path;
+  using monitor::notify_events;
+
+  vector<fsw_event_flag> get_flags(const event& evt) const
+  {
+    return filter_flags(evt);
+  }
+
+protected:
+  void run()
+  {
+  }
+};
+
+/*
+ * Stream buffer discarding its output.
+ */
+class null_buffer : public streambuf
+{
+protected:
+  int overflow(int c)
+  {
+    return c;
+  }
+
+  streamsize xsputn(const char *, streamsize n)
+  {
+    return n;
+  }
+};
+
+static null_buffer null_buf;
+static ostream null_stream(&null_buf);
+static atomic<size_t> sink{0};
+
+/*
+ * Runs a benchmark processing the specified number of items per invocation
+ * until min_time seconds have elapsed, repetitions times, and prints the
+ * median and the minimum time per item.
+ */
+static void run_benchmark(const string& name,
+                          size_t items,
+                          const function<void()>& body)
+{
+  if (!name_filter.empty() && name.find(name_filter) == string::npos) return;
+
+  vector<double> results;
+
+  // Warm up caches and allocators.
+  body();
+
+  for (unsigned int r = 0; r < repetitions; ++r)
+  {
+    size_t invocations = 0;
+    const auto start = steady_clock::now();
+    auto now = start;
+
+    do
+    {
+      body();
+      ++invocations;
+      now = steady_clock::now();
+    }
+    while (duration<double>(now - start).count() < min_time);
+
+    const double ns = duration<double, nano>(now - start).count();
+    results.push_back(ns / (invocations * items));
+  }
+
+  sort(results.begin(), results.end());
+
+  cout << name << '\t' << items << '\t' << repetitions << '\t'
+       << results[results.size() / 2] << '\t' << results.front() << endl;
+}
+
+/*
+ * Generates paths resembling a source tree, with version control and build
+ * directories.
+ */
+static vector<string> generate_paths(size_t count)
+{
+  static const char *dirs[] = {"src", "include", "lib", "test", "docs",
+                               "build", "node_modules", ".git", "vendor"};
+  static const char *exts[] = {".c", ".cpp", ".h", ".o", ".js", ".md",
+                               ".txt", ".swp", "~"};
+  mt19937 rng(42);
+  vector<string> paths;
+
+  paths.reserve(count);
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    string path = "/home/user/project";
+    const unsigned int depth = 1 + rng() % 6;
+
+    for (unsigned int d = 0; d < depth; ++d)
+    {
+      path += '/';
+      path += dirs[rng() % (sizeof(dirs) / sizeof(dirs[0]))];
+      path += to_string(rng() % 10);
+    }
+
+    path += "/file" + to_string(i);
+    path += exts[rng() % (sizeof(exts) / sizeof(exts[0]))];
+    paths.push_back(path);
+  }
+
+  return paths;
+}
+
+static vector<event> generate_events(const vector<string>& paths)
+{
+  static const vector<fsw_event_flag> flag_sets[] = {
+    {Created, IsFile},
+    {Updated, IsFile},
+    {Updated, AttributeModified, IsFile},
+    {Removed, IsFile},
+    {Renamed, MovedFrom, IsDir},
+    {PlatformSpecific}
+  };
+  mt19937 rng(43);
+  vector<event> events;
+
+  events.reserve(paths.size());
+
+  for (const auto& path : paths)
+  {
+    events.emplace_back(path,
+                        1500000000 + events.size(),
+                        flag_sets[rng() % (sizeof(flag_sets)
+                                           / sizeof(flag_sets[0]))]);
+  }
+
+  return events;
+}
+
+static vector<monitor_filter> get_filter_set(const string& name)
+{
+  vector<monitor_filter> filters;
+
+  if (name == "exclude")
+  {
+    filters.push_back({"/\\.git/", fsw_filter_type::filter_exclude, true, true,
+                       false});
+    filters.push_back({"/node_modules/", fsw_filter_type::filter_exclude, true,
+                       true, false});
+    filters.push_back({"\\.swp$", fsw_filter_type::filter_exclude, true, true,
+                       false});
+    filters.push_back({"~$", fsw_filter_type::filter_exclude, true, true,
+                       false});
+    filters.push_back({"\\.o$", fsw_filter_type::filter_exclude, true, true,
+                       false});
+  }
+  else if (name == "include")
+  {
+    filters.push_back({".*", fsw_filter_type::filter_exclude, true, true,
+                       false});
+    filters.push_back({"\\.(c|cpp|h)$", fsw_filter_type::filter_include, true,
+                       true, false});
+  }
+  else if (name == "insensitive")
+  {
+    filters.push_back({"/build[0-9]*/", fsw_filter_type::filter_exclude, false,
+                       true, false});
+    filters.push_back({"\\.(TXT|MD)$", fsw_filter_type::filter_exclude, false,
+                       true, false});
+  }
+  else if (name == "glob")
+  {
+    filters.push_back({"**/.git/**", fsw_filter_type::filter_exclude, true,
+                       false, true});
+    filters.push_back({"**/node_modules/**", fsw_filter_type::filter_exclude,
+                       true, false, true});
+    filters.push_back({"*.swp", fsw_filter_type::filter_exclude, true, false,
+                       true});
+  }
+
+  return filters;
+}
+
+static const char *filter_sets[] = {"none", "exclude", "include",
+                                    "insensitive", "glob"};
+
+static void count_events(const vector<event>& events, void *)
+{
+  sink += events.size();
+}
+
+static void count_batch(const event_batch& events, void *)
+{
+  sink += events.size();
+}
+
+static void bench_accept_path(const vector<string>& paths)
+{
+  for (const char *set : filter_sets)
+  {
+    bench_monitor mon(count_events);
+    mon.set_filters(get_filter_set(set));
+
+    run_benchmark(string("accept_path/") + set, paths.size(), [&]()
+    {
+      size_t accepted = 0;
+      for (const auto& path : paths) accepted += mon.accept_path(path);
+      sink += accepted;
+    });
+  }
+}
+
+static void bench_notify_events(const vector<event>& events)
+{
+  vector<fsw_event_type_filter> type_filters{{Created}, {Updated}, {Removed},
+                                             {Renamed}};
+  event_batch batch;
+
+  for (const auto& evt : events) batch.add(evt);
+
+  for (const char *set : filter_sets)
+  {
+    bench_monitor mon(count_events);
+    mon.set_filters(get_filter_set(set));
+    mon.set_event_type_filters(type_filters);
+
+    run_benchmark(string("notify_events/") + set, events.size(), [&]()
+    {
+      mon.notify_events(events);
+    });
+
+    mon.set_batch_callback(count_batch);
+
+    run_benchmark(string("notify_batch/") + set, batch.size(), [&]()
+    {
+      mon.notify_events(batch);
+    });
+  }
+
+  bench_monitor mon(count_events);
+  mon.set_event_type_filters(type_filters);
+
+  run_benchmark("filter_flags", events.size(), [&]()
+  {
+    size_t flags = 0;
+    for (const auto& evt : events) flags += mon.get_flags(evt).size();
+    sink += flags;
+  });
+}
+
+static void bench_callback_proxy(const vector<event>& events)
+{
+  event_batch batch;
+  vector<char> buffer;
+
+  for (const auto& evt : events) batch.add(evt);
+
+  run_benchmark("copy_cevents", events.size(), [&]()
+  {
+    fsw_cevent *cevents = copy_cevents(events);
+    sink += cevents[0].flags_num;
+    free_cevents(cevents, events.size());
+  });
+
+  run_benchmark("pack_cevent_batch", batch.size(), [&]()
+  {
+    sink += pack_cevent_batch(batch, buffer)->event_num;
+  });
+}
+
+static void print_path(const event& evt)
+{
+  null_stream << evt.get_path();
+}
+
+static void print_flags(const event& evt)
+{
+  const vector<fsw_event_flag>& flags = evt.get_flags();
+
+  for (size_t i = 0; i < flags.size(); ++i)
+  {
+    null_stream << flags[i];
+    if (i != flags.size() - 1) null_stream << ' ';
+  }
+}
+
+static void print_time(const event& evt)
+{
+  const time_t evt_time = evt.get_time();
+  char buffer[128];
+
+  struct tm tm_time;
+
+  if (strftime(buffer,
+               sizeof(buffer),
+               "%c",
+               localtime_r(&evt_time, &tm_time)))
+    null_stream << buffer;
+}
+
+static void bench_printf_event(const vector<event>& events)
+{
+  static const struct
+  {
+    const char *name;
+    const char *format;
+  } formats[] = {
+    {"path", "%p"},
+    {"flags", "%p %f"},
+    {"time", "%t %p %f"},
+    {"literal", "[%%] %p%n"}
+  };
+  const printf_event_callbacks callbacks{print_flags, print_path, print_time};
+
+  for (const auto& f : formats)
+  {
+    printf_event_format format;
+    printf_event_compile_format(f.format, format);
+
+    run_benchmark(string("printf_event/") + f.name, events.size(), [&]()
+    {
+      for (const auto& evt : events)
+        printf_event(format, evt, callbacks, null_stream);
+    });
+  }
+}
+
+static bool create_tree(const string& root, size_t entries)
+{
+  // 100 files per directory, 100 directories per parent.
+  for (size_t i = 0; i < entries; ++i)
+  {
+    if (i % 100 == 0)
+    {
+      string dir = root;
+      for (size_t d = i / 100; ; d /= 100)
+      {
+        dir += "/d" + to_string(d % 100);
+        mkdir(dir.c_str(), 0700);
+        if (d < 100) break;
+      }
+    }
+
+    string dir = root;
+    for (size_t d = i / 100; ; d /= 100)
+    {
+      dir += "/d" + to_string(d % 100);
+      if (d < 100) break;
+    }
+
+    const string file = dir + "/f" + to_string(i);
+    const int fd = open(file.c_str(), O_CREAT | O_WRONLY, 0600);
+    if (fd < 0) return false;
+    close(fd);
+  }
+
+  return true;
+}
+
+static void touch_files(const string& root, size_t entries, unsigned int round)
+{
+  // Touch 1% of the files to give each scan something to report.
+  for (size_t i = round % 100; i < entries; i += 100)
+  {
+    string dir = root;
+    for (size_t d = i / 100; ; d /= 100)
+    {
+      dir += "/d" + to_string(d % 100);
+      if (d < 100) break;
+    }
+
+    const string file = dir + "/f" + to_string(i);
+    struct timeval times[2];
+    gettimeofday(&times[0], nullptr);
+    times[0].tv_sec += round + 1;
+    times[1] = times[0];
+    utimes(file.c_str(), times);
+  }
+}
+
+static void remove_tree(const string& root)
+{
+  const string command = "rm -rf '" + root + "'";
+  if (system(command.c_str()) != 0)
+    cerr << "Cannot remove " << root << endl;
+}
+
+/*
+ * The poll monitor scans at most once per second: every repetition measures a
+ * full scan and the comparison with the previous snapshot, as reported by the
+ * monitor statistics.
+ */
+static void bench_poll_monitor(size_t entries)
+{
+  const string name = "poll_scan/" + to_string(entries);
+
+  if (!name_filter.empty() && name.find(name_filter) == string::npos) return;
+
+  char root_template[] = "/tmp/fswatch_benchmark.XXXXXX";
+  if (!mkdtemp(root_template))
+  {
+    cerr << "Cannot create a temporary directory." << endl;
+    return;
+  }
+
+  const string root(root_template);
+
+  if (!create_tree(root, entries))
+  {
+    cerr << "Cannot create the tree: " << root << endl;
+    remove_tree(root);
+    return;
+  }
+
+  monitor *mon =
+    monitor_factory::create_monitor(fsw_monitor_type::poll_monitor_type,
+                                    vector<string>{root},
+                                    count_events);
+  mon->set_recursive(true);
+  mon->set_latency(1);
+
+  thread runner([mon]() { mon->start(); });
+  vector<double> results;
+  uint64_t scans = 0;
+  unsigned int round = 0;
+
+  while (results.size() < repetitions)
+  {
+    this_thread::sleep_for(milliseconds(50));
+
+    const fsw_monitor_stats stats = mon->get_stats();
+    if (stats.scans == scans) continue;
+
+    // The first scan collects the initial data.
+    if (scans) results.push_back(stats.last_scan_time * 1000.0 / entries);
+    scans = stats.scans;
+
+    touch_files(root, entries, round++);
+  }
+
+  mon->stop();
+  runner.join();
+  delete mon;
+  remove_tree(root);
+
+  sort(results.begin(), results.end());
+
+  cout << name << '\t' << entries << '\t' << repetitions << '\t'
+       << results[results.size() / 2] << '\t' << results.front() << endl;
+}
+
+static vector<size_t> parse_sizes(const char *arg)
+{
+  vector<size_t> sizes;
+  stringstream ss(arg);
+  string size;
+
+  while (getline(ss, size, ','))
+    if (!size.empty()) sizes.push_back(strtoull(size.c_str(), nullptr, 10));
+
+  return sizes;
+}
+
+static void usage(ostream& stream)
+{
+  stream << "Usage: fswatch_benchmark [OPTION] ...\n\n";
+  stream << "Options:\n";
+  stream << "  --filter=STRING       Run the benchmarks whose name contains STRING.\n";
+  stream << "  --min-time=SECONDS    Minimum duration of a repetition (default: 0.2).\n";
+  stream << "  --poll-sizes=N[,N...] Sizes of the trees scanned by the poll monitor\n";
+  stream << "                        (default: 10000,100000).\n";
+  stream << "  --repetitions=N       Number of repetitions (default: 5).\n";
+}
+
+int main(int argc, char **argv)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const string arg(argv[i]);
+    const size_t eq = arg.find('=');
+    const string opt = arg.substr(0, eq);
+    const char *value = eq == string::npos ? "" : argv[i] + eq + 1;
+
+    if (opt == "--filter") name_filter = value;
+    else if (opt == "--min-time") min_time = strtod(value, nullptr);
+    else if (opt == "--poll-sizes") poll_sizes = parse_sizes(value);
+    else if (opt == "--repetitions") repetitions = strtoul(value, nullptr, 10);
+    else
+    {
+      usage(opt == "--help" ? cout : cerr);
+      return opt == "--help" ? 0 : 1;
+    }
+  }
+
+  if (repetitions == 0 || min_time <= 0)
+  {
+    usage(cerr);
+    return 1;
+  }
+
+  const vector<string> paths = generate_paths(10000);
+  const vector<event> events = generate_events(paths);
+
+  cout << "# benchmark\titems\trepetitions\tns_per_item\tmin_ns_per_item"
+       << endl;
+
+  bench_accept_path(paths);
+  bench_notify_events(events);
+  bench_callback_proxy(events);
+  bench_printf_event(events);
+
+  for (size_t size : poll_sizes)
+    if (size) bench_poll_monitor(size);
+
+  return 0;
+}
@@ -0,0 +1,546 @@
+/*
+ * Copyright (c) 2014-2016 Enrico M. Crisostomo
+ *
+ * This program is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE.  See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * End-to-end load generator.
+ *
+ * For every monitor, a workload of file system mutations is run against a
+ * temporary directory at increasing rates.  Before a mutation is performed,
+ * its path and time are recorded; the first event received for that path
+ * completes the mutation and its latency is the time elapsed in between.
+ * Once the workload of a rate is over, the mutations which are still pending
+ * after a grace period are lost.  The ladder stops at the first rate at which
+ * mutations are lost or the monitor overflows.
+ *
+ * Every rate prints a line made of tab-separated fields:
+ *
+ *   monitor  rate  mutations  achieved_rate  lost  overflows  p50  p99  p999
+ *   max
+ *
+ * where latencies are in microseconds.
+ */
+#ifdef HAVE_CONFIG_H
+#  include "libfswatch_config.h"
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "libfswatch/c++/event.hpp"
+#include "libfswatch/c++/monitor.hpp"
+#include "libfswatch/c++/monitor_factory.hpp"
+#include "libfswatch/c++/path_utils.hpp"
+#include "libfswatch/c++/libfswatch_exception.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using namespace fsw;
+
+enum mutation_type
+{
+  mutation_create,
+  mutation_write,
+  mutation_rename,
+  mutation_delete,
+  mutation_deep
+};
+
+static const struct
+{
+  const char *name;
+  mutation_type type;
+} mutation_names[] = {
+  {"create", mutation_create},
+  {"write",  mutation_write},
+  {"rename", mutation_rename},
+  {"delete", mutation_delete},
+  {"deep",   mutation_deep}
+};
+
+static vector<string> monitor_names;
+static vector<mutation_type> workload{mutation_create, mutation_write,
+                                      mutation_rename, mutation_delete,
+                                      mutation_deep};
+static vector<double> rates{1000, 2000, 4000, 8000, 16000, 32000, 64000,
+                            128000, 256000};
+static double step_duration = 2.0;
+static double latency = 0.1;
+static unsigned int pool_size = 1000;
+static unsigned int depth = 16;
+
+/*
+ * Mutations waiting for an event, by path.
+ */
+struct load_state
+{
+  mutex state_mutex;
+  unordered_map<string, deque<steady_clock::time_point>> pending;
+  vector<double> latencies;
+  size_t overflows = 0;
+};
+
+static void process_events(const vector<event>& events, void *context)
+{
+  const auto now = steady_clock::now();
+  load_state *state = static_cast<load_state *> (context);
+
+  lock_guard<mutex> lock(state->state_mutex);
+
+  for (const auto& evt : events)
+  {
+    if (evt.get_flag_mask() & Overflow)
+    {
+      ++state->overflows;
+      continue;
+    }
+
+    auto it = state->pending.find(evt.get_path());
+    if (it == state->pending.end()) continue;
+
+    // A single event may report several mutations of the same path.
+    for (const auto& sent : it->second)
+      state->latencies.push_back(duration<double, micro>(now - sent).count());
+
+    state->pending.erase(it);
+  }
+}
+
+static void expect(load_state& state, const string& path)
+{
+  lock_guard<mutex> lock(state.state_mutex);
+  state.pending[path].push_back(steady_clock::now());
+}
+
+static void create_file(const string& path)
+{
+  const int fd = open(path.c_str(), O_CREAT | O_WRONLY, 0600);
+
+  if (fd < 0)
+  {
+    cerr << "Cannot create " << path << ": " << strerror(errno) << endl;
+    exit(1);
+  }
+
+  close(fd);
+}
+
+static void append_file(const string& path)
+{
+  const int fd = open(path.c_str(), O_WRONLY | O_APPEND);
+
+  if (fd < 0 || write(fd, "x", 1) != 1)
+  {
+    cerr << "Cannot write " << path << ": " << strerror(errno) << endl;
+    exit(1);
+  }
+
+  close(fd);
+}
+
+/*
+ * Layout of the temporary directory:
+ *
+ *   create/  files created by the workload
+ *   write/   pool of files written by the workload
+ *   rename/  pool of files renamed by the workload
+ *   delete/  files created before each rate and deleted by the workload
+ *   deep/    directory chain of the specified depth, where files are created
+ */
+struct load_tree
+{
+  string root;
+  string deep_dir;
+  vector<bool> renamed;
+};
+
+static load_tree create_tree()
+{
+  char root_template[] = "/tmp/fswatch_load.XXXXXX";
+
+  if (!mkdtemp(root_template))
+  {
+    cerr << "Cannot create a temporary directory." << endl;
+    exit(1);
+  }
+
+  load_tree tree;
+  tree.root = fsw_realpath(root_template, nullptr);
+
+  for (const char *dir : {"create", "write", "rename", "delete", "deep"})
+    mkdir((tree.root + "/" + dir).c_str(), 0700);
+
+  tree.deep_dir = tree.root + "/deep";
+
+  for (unsigned int i = 0; i < depth; ++i)
+  {
+    tree.deep_dir += "/l" + to_string(i);
+    mkdir(tree.deep_dir.c_str(), 0700);
+  }
+
+  for (unsigned int i = 0; i < pool_size; ++i)
+  {
+    create_file(tree.root + "/write/w" + to_string(i));
+    create_file(tree.root + "/rename/a" + to_string(i));
+  }
+
+  tree.renamed.assign(pool_size, false);
+
+  return tree;
+}
+
+static void remove_tree(const load_tree& tree)
+{
+  const string command = "rm -rf '" + tree.root + "'";
+  if (system(command.c_str()) != 0)
+    cerr << "Cannot remove " << tree.root << endl;
+}
+
+static void mutate(load_tree& tree,
+                   load_state& state,
+                   mutation_type type,
+                   size_t step,
+                   size_t n)
+{
+  const string id = to_string(step) + "_" + to_string(n);
+
+  switch (type)
+  {
+  case mutation_create:
+  {
+    const string path = tree.root + "/create/c" + id;
+    expect(state, path);
+    create_file(path);
+    break;
+  }
+  case mutation_write:
+  {
+    const string path = tree.root + "/write/w" + to_string(n % pool_size);
+    expect(state, path);
+    append_file(path);
+    break;
+  }
+  case mutation_rename:
+  {
+    const size_t k = n % pool_size;
+    const string a = tree.root + "/rename/a" + to_string(k);
+    const string b = tree.root + "/rename/b" + to_string(k);
+    const string& from = tree.renamed[k] ? b : a;
+    const string& to = tree.renamed[k] ? a : b;
+
+    expect(state, to);
+    if (rename(from.c_str(), to.c_str()) != 0)
+    {
+      cerr << "Cannot rename " << from << ": " << strerror(errno) << endl;
+      exit(1);
+    }
+    tree.renamed[k] = !tree.renamed[k];
+    break;
+  }
+  case mutation_delete:
+  {
+    const string path = tree.root + "/delete/d" + id;
+    expect(state, path);
+    unlink(path.c_str());
+    break;
+  }
+  case mutation_deep:
+  {
+    const string path = tree.deep_dir + "/f" + id;
+    expect(state, path);
+    create_file(path);
+    break;
+  }
+  }
+}
+
+/*
+ * Waits until no mutation is pending or the grace period is over, and returns
+ * the number of pending mutations.
+ */
+static size_t drain(load_state& state)
+{
+  const auto deadline =
+    steady_clock::now() + duration<double>(max(2.0, 4 * latency));
+
+  for (;;)
+  {
+    size_t pending = 0;
+
+    {
+      lock_guard<mutex> lock(state.state_mutex);
+      for (const auto& p : state.pending) pending += p.second.size();
+    }
+
+    if (!pending || steady_clock::now() > deadline) return pending;
+
+    this_thread::sleep_for(milliseconds(10));
+  }
+}
+
+/*
+ * Waits for the events of the mutations performed so far to be delivered.  The
+ * poll monitor does not scan more often than once per second.
+ */
+static void settle()
+{
+  this_thread::sleep_for(duration<double>(2 * latency + 1.0));
+}
+
+static double percentile(const vector<double>& sorted, double p)
+{
+  if (sorted.empty()) return 0;
+
+  const size_t i = static_cast<size_t> (p * sorted.size());
+  return sorted[min(i, sorted.size() - 1)];
+}
+
+static void run_monitor(const string& name)
+{
+  load_tree tree = create_tree();
+  load_state state;
+  monitor *mon;
+
+  try
+  {
+    mon = monitor_factory::create_monitor(name,
+                                          vector<string>{tree.root},
+                                          process_events,
+                                          &state);
+  }
+  catch (const libfsw_exception& ex)
+  {
+    cerr << name << ": " << ex.what() << endl;
+    remove_tree(tree);
+    return;
+  }
+
+  mon->set_recursive(true);
+  mon->set_latency(latency);
+  mon->set_allow_overflow(true);
+
+  thread runner([mon, &name]()
+                {
+                  try
+                  {
+                    mon->start();
+                  }
+                  catch (const libfsw_exception& ex)
+                  {
+                    cerr << name << ": " << ex.what() << endl;
+                  }
+                });
+
+  // Let the monitor run its initial scan.
+  while (!mon->is_running()) this_thread::sleep_for(milliseconds(10));
+  settle();
+
+  const size_t types = workload.size();
+  double loss_rate = 0;
+
+  for (size_t step = 0; step < rates.size(); ++step)
+  {
+    const double rate = rates[step];
+    const size_t mutations = static_cast<size_t> (rate * step_duration);
+
+    // Create the files to delete and let their events go by.
+    if (find(workload.begin(), workload.end(), mutation_delete)
+        != workload.end())
+    {
+      for (size_t n = 0; n < mutations; ++n)
+        if (workload[n % types] == mutation_delete)
+          create_file(tree.root + "/delete/d" + to_string(step) + "_"
+                      + to_string(n / types));
+
+      settle();
+    }
+
+    {
+      lock_guard<mutex> lock(state.state_mutex);
+      state.pending.clear();
+      state.latencies.clear();
+      state.overflows = 0;
+    }
+
+    const auto start = steady_clock::now();
+
+    for (size_t n = 0; n < mutations; ++n)
+    {
+      this_thread::sleep_until(start + duration<double>(n / rate));
+      mutate(tree, state, workload[n % types], step, n / types);
+    }
+
+    const double elapsed =
+      duration<double>(steady_clock::now() - start).count();
+    const size_t lost = drain(state);
+
+    lock_guard<mutex> lock(state.state_mutex);
+    vector<double>& samples = state.latencies;
+    sort(samples.begin(), samples.end());
+
+    cout << name << '\t' << rate << '\t' << mutations << '\t'
+         << static_cast<uint64_t> (mutations / elapsed) << '\t' << lost << '\t'
+         << state.overflows << '\t'
+         << static_cast<uint64_t> (percentile(samples, 0.5)) << '\t'
+         << static_cast<uint64_t> (percentile(samples, 0.99)) << '\t'
+         << static_cast<uint64_t> (percentile(samples, 0.999)) << '\t'
+         << static_cast<uint64_t> (samples.empty() ? 0 : samples.back())
+         << endl;
+
+    if (lost || state.overflows)
+    {
+      loss_rate = rate;
+      break;
+    }
+  }
+
+  mon->stop();
+  runner.join();
+  delete mon;
+  remove_tree(tree);
+
+  if (loss_rate)
+    cout << "# " << name << ": loss begins at " << loss_rate
+         << " mutations/s" << endl;
+  else
+    cout << "# " << name << ": no loss up to " << rates.back()
+         << " mutations/s" << endl;
+}
+
+static vector<string> split(const char *arg)
+{
+  vector<string> tokens;
+  stringstream ss(arg);
+  string token;
+
+  while (getline(ss, token, ','))
+    if (!token.empty()) tokens.push_back(token);
+
+  return tokens;
+}
+
+static bool parse_workload(const char *arg)
+{
+  workload.clear();
+
+  for (const auto& token : split(arg))
+  {
+    bool found = false;
+
+    for (const auto& m : mutation_names)
+    {
+      if (token != m.name) continue;
+
+      workload.push_back(m.type);
+      found = true;
+    }
+
+    if (!found) return false;
+  }
+
+  return !workload.empty();
+}
+
+static void usage(ostream& stream)
+{
+  stream << "Usage: fswatch_load [OPTION] ...\n\n";
+  stream << "Options:\n";
+  stream << "  --depth=N             Depth of the deep tree (default: 16).\n";
+  stream << "  --duration=SECONDS    Duration of every rate (default: 2).\n";
+  stream << "  --latency=SECONDS     Latency of the monitors (default: 0.1).\n";
+  stream << "  --monitor=NAME[,...]  Monitors to run (default: all).\n";
+  stream << "  --pool=N              Files written and renamed (default: 1000).\n";
+  stream << "  --rates=N[,N...]      Mutations per second (default: 1000 to\n";
+  stream << "                        256000, doubling).\n";
+  stream << "  --workload=TYPE[,...] Mutations to cycle through, among create,\n";
+  stream << "                        write, rename, delete and deep (default:\n";
+  stream << "                        all).\n";
+}
+
+int main(int argc, char **argv)
+{
+  for (int i = 1; i < argc; ++i)
+  {
+    const string arg(argv[i]);
+    const size_t eq = arg.find('=');
+    const string opt = arg.substr(0, eq);
+    const char *value = eq == string::npos ? "" : argv[i] + eq + 1;
+    bool valid = true;
+
+    if (opt == "--depth") depth = strtoul(value, nullptr, 10);
+    else if (opt == "--duration") valid = (step_duration = strtod(value, nullptr)) > 0;
+    else if (opt == "--latency") valid = (latency = strtod(value, nullptr)) > 0;
+    else if (opt == "--monitor") monitor_names = split(value);
+    else if (opt == "--pool") valid = (pool_size = strtoul(value, nullptr, 10)) > 0;
+    else if (opt == "--rates")
+    {
+      rates.clear();
+      for (const auto& rate : split(value))
+      {
+        rates.push_back(strtod(rate.c_str(), nullptr));
+        if (rates.back() <= 0) valid = false;
+      }
+      valid = valid && !rates.empty();
+    }
+    else if (opt == "--workload") valid = parse_workload(value);
+    else if (opt == "--help")
+    {
+      usage(cout);
+      return 0;
+    }
+    else valid = false;
+
+    if (!valid)
+    {
+      usage(cerr);
+      return 1;
+    }
+  }
+
+  if (monitor_names.empty())
+  {
+    // The subscriber monitor does not watch the file system.
+    for (const auto& name : monitor_factory::get_types())
+      if (name != "subscriber_monitor") monitor_names.push_back(name);
+  }
+
+  cout << "# monitor\trate\tmutations\tachieved_rate\tlost\toverflows"
+       << "\tp50_us\tp99_us\tp999_us\tmax_us" << endl;
+
+  for (const auto& name : monitor_names)
+  {
+    if (!monitor_factory::exists_type(name))
+    {
+      cerr << "Unknown monitor: " << name << endl;
+      continue;
+    }
+
+    run_monitor(name);
+  }
+
+  return 0;
+}